@@ -0,0 +1,1266 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * archive_download.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "archive_download.h"
+#include "common.h"
+#include "repo.h"
+
+#include "apr_strings.h"
+#include "apr_tables.h"
+#include "apr_time.h"
+
+#include "http_log.h"
+#include "http_protocol.h"
+#include "util_script.h"
+
+#include <zlib.h>
+
+
+APLOG_USE_MODULE(davrods);
+
+
+#define TAR_BLOCK_SIZE (512)
+
+
+/*
+ * The offsets and lengths of the fields in a ustar header block.
+ */
+#define TAR_NAME_OFFSET (0)
+#define TAR_NAME_LENGTH (100)
+#define TAR_MODE_OFFSET (100)
+#define TAR_UID_OFFSET (108)
+#define TAR_GID_OFFSET (116)
+#define TAR_ID_LENGTH (8)
+#define TAR_SIZE_OFFSET (124)
+#define TAR_SIZE_LENGTH (12)
+#define TAR_MTIME_OFFSET (136)
+#define TAR_MTIME_LENGTH (12)
+#define TAR_CHECKSUM_OFFSET (148)
+#define TAR_CHECKSUM_LENGTH (8)
+#define TAR_TYPE_OFFSET (156)
+#define TAR_MAGIC_OFFSET (257)
+#define TAR_VERSION_OFFSET (263)
+#define TAR_UNAME_OFFSET (265)
+#define TAR_GNAME_OFFSET (297)
+#define TAR_OWNER_LENGTH (32)
+
+
+#define TAR_FILE_TYPE ('0')
+#define TAR_DIRECTORY_TYPE ('5')
+#define TAR_PAX_TYPE ('x')
+
+
+/** The largest size that fits into the 11 octal digits of a ustar header. */
+static const apr_off_t S_MAX_USTAR_SIZE = 077777777777LL;
+
+/** Zeros for padding each member and for the end of the archive. */
+static const char S_ZEROS_S [TAR_BLOCK_SIZE * 16] = { 0 };
+
+
+/*
+ * The signatures and fixed lengths of the zip records. Members are
+ * stored uncompressed and each data object is followed by a data
+ * descriptor holding the CRC-32 that was calculated as it was sent.
+ */
+#define ZIP_LOCAL_HEADER_SIGNATURE (0x04034b50)
+#define ZIP_DATA_DESCRIPTOR_SIGNATURE (0x08074b50)
+#define ZIP_CENTRAL_HEADER_SIGNATURE (0x02014b50)
+#define ZIP64_END_SIGNATURE (0x06064b50)
+#define ZIP64_LOCATOR_SIGNATURE (0x07064b50)
+#define ZIP_END_SIGNATURE (0x06054b50)
+
+#define ZIP_LOCAL_HEADER_LENGTH (30)
+#define ZIP_CENTRAL_HEADER_LENGTH (46)
+#define ZIP64_END_LENGTH (56)
+#define ZIP64_LOCATOR_LENGTH (20)
+#define ZIP_END_LENGTH (22)
+
+/** The largest zip64 extra field, holding both sizes and the offset. */
+#define ZIP64_MAX_EXTRA_LENGTH (28)
+
+#define ZIP64_EXTRA_ID (0x0001)
+
+/** The sizes are in the data descriptor and the name is UTF-8. */
+#define ZIP_FLAGS_DATA_DESCRIPTOR (0x0008)
+#define ZIP_FLAGS_UTF8 (0x0800)
+
+#define ZIP_VERSION (20)
+#define ZIP64_VERSION (45)
+
+/** Version made by, with the upper byte saying that the attributes are Unix ones. */
+#define ZIP_UNIX_VERSION_MADE_BY ((3 << 8) | ZIP64_VERSION)
+
+/** Anything at least this large needs a zip64 field. */
+static const apr_uint64_t S_ZIP64_LIMIT = 0xFFFFFFFF;
+
+static const unsigned int S_ZIP64_MAX_ENTRIES = 0xFFFF;
+
+
+typedef enum ArchiveFormat
+{
+	AF_NONE,
+	AF_TAR,
+	AF_ZIP
+} ArchiveFormat;
+
+
+/**
+ * What is needed to write a zip member's central directory entry once
+ * all of the members have been sent.
+ */
+typedef struct ZipEntry
+{
+	const char *ze_name_s;
+
+	/** The offset of the member's local header within the archive. */
+	apr_off_t ze_offset;
+
+	apr_off_t ze_size;
+
+	apr_uint32_t ze_crc;
+
+	apr_uint16_t ze_dos_time;
+
+	apr_uint16_t ze_dos_date;
+
+	bool ze_directory_flag;
+} ZipEntry;
+
+
+typedef struct ArchiveDownload
+{
+	const dav_resource *ad_resource_p;
+
+	ap_filter_t *ad_output_p;
+
+	apr_bucket_brigade *ad_brigade_p;
+
+	/** The name of the top-level directory that every member is stored under. */
+	const char *ad_base_s;
+
+	/** The length of the path of the collection being sent. */
+	size_t ad_path_length;
+
+	/** The number of members and bytes of data added so far. */
+	unsigned int ad_num_entries;
+	apr_off_t ad_num_bytes;
+
+	/** The limits on the archive, 0 means unlimited. */
+	unsigned int ad_max_entries;
+	apr_off_t ad_max_bytes;
+
+	ArchiveFormat ad_format;
+
+	/** The number of bytes of the archive written so far. */
+	apr_off_t ad_offset;
+
+	/** For zip archives, the ZipEntries of the members sent so far. */
+	apr_array_header_t *ad_zip_entries_p;
+
+	/** The running CRC-32 of the zip member being sent. */
+	apr_uint32_t ad_crc;
+} ArchiveDownload;
+
+
+static ArchiveFormat GetArchiveFormat (request_rec *req_p, const davrods_dir_conf_t *conf_p);
+
+static dav_error *WalkCollection (ArchiveDownload *download_p, const bool send_flag);
+
+static bool AddToLimits (ArchiveDownload *download_p, const apr_off_t size);
+
+static char *GetMemberName (const ArchiveDownload *download_p, const collEnt_t *entry_p, apr_pool_t *pool_p);
+
+static dav_error *SendCollection (ArchiveDownload *download_p, const collEnt_t *entry_p, const char *name_s, apr_pool_t *pool_p);
+
+static dav_error *SendDataObject (ArchiveDownload *download_p, const collEnt_t *entry_p, const char *name_s, apr_pool_t *pool_p);
+
+static apr_status_t StartMember (ArchiveDownload *download_p, const char *name_s, const char type, const apr_off_t size, const collEnt_t *entry_p, apr_pool_t *pool_p);
+
+static apr_status_t FinishMember (ArchiveDownload *download_p, const apr_off_t size);
+
+static apr_status_t WriteMemberHeader (ArchiveDownload *download_p, const char *name_s, const char type, const apr_off_t size, const collEnt_t *entry_p, apr_pool_t *pool_p);
+
+static apr_status_t WriteZipLocalHeader (ArchiveDownload *download_p, const char *name_s, const char type, const apr_off_t size, const collEnt_t *entry_p);
+
+static apr_status_t WriteZipDataDescriptor (ArchiveDownload *download_p);
+
+static apr_status_t WriteZipCentralDirectory (ArchiveDownload *download_p);
+
+static size_t FillZip64Extra (char *buffer_p, const ZipEntry *entry_p, const bool central_flag);
+
+static void GetDosTime (const collEnt_t *entry_p, apr_uint16_t *dos_time_p, apr_uint16_t *dos_date_p);
+
+static char *PutLittleEndian (char *buffer_p, apr_uint64_t value, size_t num_bytes);
+
+static void AddZerosToChecksum (ArchiveDownload *download_p, apr_off_t length);
+
+static apr_status_t WriteBytes (ArchiveDownload *download_p, const char *data_p, const apr_size_t length);
+
+static void FillHeaderBlock (char *block_p, const char *name_s, const char type, const apr_off_t size, const collEnt_t *entry_p);
+
+static char *GetPaxRecord (const char *key_s, const char *value_s, apr_pool_t *pool_p);
+
+static size_t GetNumDigits (size_t value);
+
+static apr_status_t WriteZeros (ArchiveDownload *download_p, apr_off_t length);
+
+static apr_status_t PassBrigade (ArchiveDownload *download_p);
+
+
+
+bool IsArchiveDownloadRequest (request_rec *req_p, const davrods_dir_conf_t *conf_p)
+{
+	return (GetArchiveFormat (req_p, conf_p) != AF_NONE);
+}
+
+
+void SetArchiveDownloadHeaders (const dav_resource *resource_p)
+{
+	request_rec *req_p = resource_p -> info -> r;
+	const char *name_s = get_basename (resource_p -> info -> rods_path);
+	const bool zip_flag = (GetArchiveFormat (req_p, resource_p -> info -> conf) == AF_ZIP);
+
+	if ((!name_s) || (*name_s == '\0'))
+		{
+			name_s = "collection";
+		}
+
+	ap_set_content_type (req_p, zip_flag ? "application/zip" : "application/x-tar");
+	apr_table_setn (req_p -> headers_out, "Content-Disposition", apr_psprintf (req_p -> pool, "attachment; filename=\"%s.%s\"", name_s, zip_flag ? "zip" : "tar"));
+	apr_table_setn (req_p -> headers_out, "Cache-Control", "no-cache, must-revalidate");
+}
+
+
+dav_error *DeliverCollectionArchive (const dav_resource *resource_p, ap_filter_t *output_p)
+{
+	dav_error *err_p = NULL;
+	const davrods_dir_conf_t *conf_p = resource_p -> info -> conf;
+	ArchiveDownload download;
+
+	memset (&download, 0, sizeof (ArchiveDownload));
+
+	download.ad_resource_p = resource_p;
+	download.ad_output_p = output_p;
+	download.ad_format = GetArchiveFormat (resource_p -> info -> r, conf_p);
+	download.ad_path_length = strlen (resource_p -> info -> rods_path);
+	download.ad_base_s = get_basename (resource_p -> info -> rods_path);
+
+	if ((!download.ad_base_s) || (* (download.ad_base_s) == '\0'))
+		{
+			download.ad_base_s = "collection";
+		}
+
+	if (conf_p -> archive_download_max_entries > 0)
+		{
+			download.ad_max_entries = (unsigned int) conf_p -> archive_download_max_entries;
+		}
+
+	if (conf_p -> archive_download_max_mbs > 0)
+		{
+			download.ad_max_bytes = ((apr_off_t) conf_p -> archive_download_max_mbs) * 1024 * 1024;
+		}
+
+	/*
+	 * Once any of the archive has been sent we can no longer report an
+	 * error to the client, so check the limits before starting.
+	 */
+	if ((download.ad_max_entries > 0) || (download.ad_max_bytes > 0))
+		{
+			err_p = WalkCollection (&download, false);
+
+			download.ad_num_entries = 0;
+			download.ad_num_bytes = 0;
+		}
+
+	if (!err_p)
+		{
+			download.ad_brigade_p = apr_brigade_create (resource_p -> pool, output_p -> c -> bucket_alloc);
+
+			if (download.ad_format == AF_ZIP)
+				{
+					download.ad_zip_entries_p = apr_array_make (resource_p -> pool, 64, sizeof (ZipEntry));
+				}
+
+			err_p = WalkCollection (&download, true);
+
+			if (!err_p)
+				{
+					apr_status_t status;
+
+					if (download.ad_format == AF_ZIP)
+						{
+							status = WriteZipCentralDirectory (&download);
+						}
+					else
+						{
+							/* A tar archive ends with two empty blocks */
+							status = WriteZeros (&download, 2 * TAR_BLOCK_SIZE);
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							APR_BRIGADE_INSERT_TAIL (download.ad_brigade_p, apr_bucket_eos_create (output_p -> c -> bucket_alloc));
+
+							status = PassBrigade (&download);
+						}
+
+					if (status != APR_SUCCESS)
+						{
+							err_p = dav_new_error (resource_p -> pool, HTTP_INTERNAL_SERVER_ERROR, 0, status, "Could not write contents to filter.");
+						}
+				}
+
+			apr_brigade_destroy (download.ad_brigade_p);
+		}
+
+	return err_p;
+}
+
+
+const char *SetArchiveDownloads (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	if (strcasecmp (arg_p, "true") == 0)
+		{
+			conf_p -> archive_downloads = 1;
+		}
+	else if (strcasecmp (arg_p, "false") == 0)
+		{
+			conf_p -> archive_downloads = -1;
+		}
+
+	return NULL;
+}
+
+
+const char *SetArchiveDownloadMaxEntries (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+	apr_int64_t value = apr_atoi64 (arg_p);
+
+	if ((value >= 0) && (value <= INT_MAX))
+		{
+			conf_p -> archive_download_max_entries = (int) value;
+		}
+	else
+		{
+			res_s = apr_psprintf (cmd_p -> pool, "Invalid maximum number of archive entries \"%s\"", arg_p);
+		}
+
+	return res_s;
+}
+
+
+const char *SetArchiveDownloadMaxMbs (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+	apr_int64_t value = apr_atoi64 (arg_p);
+
+	if ((value >= 0) && (value <= INT_MAX))
+		{
+			conf_p -> archive_download_max_mbs = (int) value;
+		}
+	else
+		{
+			res_s = apr_psprintf (cmd_p -> pool, "Invalid maximum archive size \"%s\"", arg_p);
+		}
+
+	return res_s;
+}
+
+
+static ArchiveFormat GetArchiveFormat (request_rec *req_p, const davrods_dir_conf_t *conf_p)
+{
+	ArchiveFormat format = AF_NONE;
+
+	if ((conf_p -> archive_downloads > 0) && (req_p -> args))
+		{
+			apr_table_t *params_p = NULL;
+
+			ap_args_to_table (req_p, &params_p);
+
+			if (params_p)
+				{
+					const char *format_s = GetParameterValue (params_p, "format", req_p -> pool);
+
+					if (format_s)
+						{
+							if (strcasecmp (format_s, "tar") == 0)
+								{
+									format = AF_TAR;
+								}
+							else if (strcasecmp (format_s, "zip") == 0)
+								{
+									format = AF_ZIP;
+								}
+						}
+				}
+		}
+
+	return format;
+}
+
+
+/*
+ * Go through every collection and data object below the collection. If
+ * send_flag is false, this just checks that the archive will be within
+ * its limits, otherwise each entry is added to the archive.
+ */
+static dav_error *WalkCollection (ArchiveDownload *download_p, const bool send_flag)
+{
+	dav_error *err_p = NULL;
+	const dav_resource *resource_p = download_p -> ad_resource_p;
+	request_rec *req_p = resource_p -> info -> r;
+	collHandle_t coll_handle;
+	int status;
+
+	memset (&coll_handle, 0, sizeof (collHandle_t));
+
+	status = rclOpenCollection (resource_p -> info -> rods_conn, resource_p -> info -> rods_path, RECUR_QUERY_FG | LONG_METADATA_FG, &coll_handle);
+
+	if (status >= 0)
+		{
+			apr_pool_t *entry_pool_p = NULL;
+
+			if (apr_pool_create (&entry_pool_p, resource_p -> pool) == APR_SUCCESS)
+				{
+					bool loop_flag = true;
+
+					/* The collection itself is the top-level directory */
+					AddToLimits (download_p, 0);
+
+					if (send_flag)
+						{
+							err_p = SendCollection (download_p, NULL, apr_pstrcat (entry_pool_p, download_p -> ad_base_s, "/", NULL), entry_pool_p);
+
+							loop_flag = (err_p == NULL);
+						}
+
+					while (loop_flag)
+						{
+							collEnt_t entry;
+
+							memset (&entry, 0, sizeof (collEnt_t));
+							status = rclReadCollection (resource_p -> info -> rods_conn, &coll_handle, &entry);
+
+							if (status >= 0)
+								{
+									const apr_off_t size = (entry.objType == DATA_OBJ_T) ? entry.dataSize : 0;
+
+									if (AddToLimits (download_p, size))
+										{
+											if (send_flag)
+												{
+													char *name_s = GetMemberName (download_p, &entry, entry_pool_p);
+
+													if (name_s)
+														{
+															if (entry.objType == DATA_OBJ_T)
+																{
+																	err_p = SendDataObject (download_p, &entry, name_s, entry_pool_p);
+																}
+															else if (entry.objType == COLL_OBJ_T)
+																{
+																	err_p = SendCollection (download_p, &entry, name_s, entry_pool_p);
+																}
+
+															if (err_p)
+																{
+																	loop_flag = false;
+																}
+														}
+												}
+										}
+									else
+										{
+											if (send_flag)
+												{
+													/*
+													 * The collection has grown since its limits were checked, so
+													 * just stop adding to the archive rather than corrupting it.
+													 */
+													ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, req_p, "Archive of \"%s\" truncated at %u entries as it is over its limits", resource_p -> info -> rods_path, download_p -> ad_num_entries);
+												}
+											else
+												{
+													ap_log_rerror (APLOG_MARK, APLOG_INFO, APR_SUCCESS, req_p, "Refusing to send \"%s\" as an archive as it is over its limits", resource_p -> info -> rods_path);
+													err_p = dav_new_error (resource_p -> pool, HTTP_FORBIDDEN, 0, 0, "The collection is too large to download as an archive");
+												}
+
+											loop_flag = false;
+										}
+
+									apr_pool_clear (entry_pool_p);
+								}
+							else
+								{
+									if (status != CAT_NO_ROWS_FOUND)
+										{
+											ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, req_p, "rcReadCollection failed for collection \"%s\" with error \"%s\"", resource_p -> info -> rods_path, get_rods_error_msg (status));
+											err_p = dav_new_error (resource_p -> pool, HTTP_INTERNAL_SERVER_ERROR, 0, 0, "Could not read a collection entry from a collection.");
+										}
+
+									loop_flag = false;
+								}
+
+						}		/* while (loop_flag) */
+
+					apr_pool_destroy (entry_pool_p);
+				}		/* if (apr_pool_create (&entry_pool_p, resource_p -> pool) == APR_SUCCESS) */
+			else
+				{
+					err_p = dav_new_error (resource_p -> pool, HTTP_INTERNAL_SERVER_ERROR, 0, 0, "Could not allocate memory for the archive");
+				}
+
+			rclCloseCollection (&coll_handle);
+		}		/* if (status >= 0) */
+	else
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, req_p, "rcOpenCollection failed for \"%s\": %d = %s", resource_p -> info -> rods_path, status, get_rods_error_msg (status));
+			err_p = dav_new_error (resource_p -> pool, HTTP_INTERNAL_SERVER_ERROR, 0, status, "Could not open a collection");
+		}
+
+	return err_p;
+}
+
+
+/*
+ * Count an entry towards the limits of the archive, returning false
+ * if it would take the archive over them.
+ */
+static bool AddToLimits (ArchiveDownload *download_p, const apr_off_t size)
+{
+	bool within_limits_flag = true;
+
+	if ((download_p -> ad_max_entries > 0) && (download_p -> ad_num_entries >= download_p -> ad_max_entries))
+		{
+			within_limits_flag = false;
+		}
+	else if ((download_p -> ad_max_bytes > 0) && (download_p -> ad_num_bytes + size > download_p -> ad_max_bytes))
+		{
+			within_limits_flag = false;
+		}
+
+	if (within_limits_flag)
+		{
+			++ (download_p -> ad_num_entries);
+			download_p -> ad_num_bytes += size;
+		}
+
+	return within_limits_flag;
+}
+
+
+/*
+ * Get the name of an entry within the archive, which is its path
+ * relative to the parent of the collection being sent.
+ */
+static char *GetMemberName (const ArchiveDownload *download_p, const collEnt_t *entry_p, apr_pool_t *pool_p)
+{
+	char *name_s = NULL;
+	const char *coll_s = entry_p -> collName;
+
+	if ((coll_s) && (strncmp (coll_s, download_p -> ad_resource_p -> info -> rods_path, download_p -> ad_path_length) == 0))
+		{
+			const char *relative_coll_s = coll_s + download_p -> ad_path_length;
+
+			if (entry_p -> objType == DATA_OBJ_T)
+				{
+					name_s = apr_pstrcat (pool_p, download_p -> ad_base_s, relative_coll_s, "/", entry_p -> dataName, NULL);
+				}
+			else
+				{
+					name_s = apr_pstrcat (pool_p, download_p -> ad_base_s, relative_coll_s, "/", NULL);
+				}
+		}
+
+	return name_s;
+}
+
+
+static dav_error *SendCollection (ArchiveDownload *download_p, const collEnt_t *entry_p, const char *name_s, apr_pool_t *pool_p)
+{
+	dav_error *err_p = NULL;
+	apr_status_t status = StartMember (download_p, name_s, TAR_DIRECTORY_TYPE, 0, entry_p, pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			status = PassBrigade (download_p);
+		}
+
+	if (status != APR_SUCCESS)
+		{
+			err_p = dav_new_error (download_p -> ad_resource_p -> pool, HTTP_INTERNAL_SERVER_ERROR, 0, status, "Could not write contents to filter.");
+		}
+
+	return err_p;
+}
+
+
+static dav_error *SendDataObject (ArchiveDownload *download_p, const collEnt_t *entry_p, const char *name_s, apr_pool_t *pool_p)
+{
+	dav_error *err_p = NULL;
+	const dav_resource *resource_p = download_p -> ad_resource_p;
+	rcComm_t *connection_p = resource_p -> info -> rods_conn;
+	request_rec *req_p = resource_p -> info -> r;
+	dataObjInp_t open_params;
+	int fd;
+
+	memset (&open_params, 0, sizeof (dataObjInp_t));
+	open_params.openFlags = O_RDONLY;
+	snprintf (open_params.objPath, MAX_NAME_LEN, "%s/%s", entry_p -> collName, entry_p -> dataName);
+
+	/*
+	 * Open the data object before writing its header so that if it can't
+	 * be read, it can be left out without breaking the archive.
+	 */
+	fd = rcDataObjOpen (connection_p, &open_params);
+
+	if (fd >= 0)
+		{
+			apr_status_t status = StartMember (download_p, name_s, TAR_FILE_TYPE, entry_p -> dataSize, entry_p, pool_p);
+			openedDataObjInp_t close_params;
+
+			if (status == APR_SUCCESS)
+				{
+					const apr_off_t buffer_size = (apr_off_t) resource_p -> info -> conf -> rods_rx_buffer_size;
+					apr_off_t remaining = entry_p -> dataSize;
+					bool loop_flag = (remaining > 0);
+					openedDataObjInp_t read_params;
+
+					memset (&read_params, 0, sizeof (openedDataObjInp_t));
+					read_params.l1descInx = fd;
+
+					while (loop_flag)
+						{
+							bytesBuf_t read_buffer = { 0 };
+							int bytes_read;
+
+							read_params.len = (int) ((remaining < buffer_size) ? remaining : buffer_size);
+							bytes_read = rcDataObjRead (connection_p, &read_params, &read_buffer);
+
+							if (bytes_read > 0)
+								{
+									/* Hand the buffer to the brigade rather than copying it */
+									apr_bucket *bucket_p;
+
+									if (download_p -> ad_format == AF_ZIP)
+										{
+											download_p -> ad_crc = (apr_uint32_t) crc32 (download_p -> ad_crc, (const Bytef *) read_buffer.buf, (uInt) bytes_read);
+										}
+
+									bucket_p = apr_bucket_heap_create (read_buffer.buf, bytes_read, free, download_p -> ad_output_p -> c -> bucket_alloc);
+
+									APR_BRIGADE_INSERT_TAIL (download_p -> ad_brigade_p, bucket_p);
+									remaining -= bytes_read;
+									download_p -> ad_offset += bytes_read;
+
+									status = PassBrigade (download_p);
+
+									if ((status != APR_SUCCESS) || (remaining == 0))
+										{
+											loop_flag = false;
+										}
+								}
+							else
+								{
+									if (read_buffer.buf)
+										{
+											free (read_buffer.buf);
+										}
+
+									if (bytes_read == 0)
+										{
+											/*
+											 * The data object has shrunk since it was listed. Its header has
+											 * already been sent, so fill the rest of it to keep the archive valid.
+											 */
+											ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, req_p, "\"%s\" was shorter than its listed size, padding its archive entry with %" APR_OFF_T_FMT " zero bytes", open_params.objPath, remaining);
+											AddZerosToChecksum (download_p, remaining);
+											status = WriteZeros (download_p, remaining);
+										}
+									else
+										{
+											ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, req_p, "rcDataObjRead failed for \"%s\": %d = %s", open_params.objPath, bytes_read, get_rods_error_msg (bytes_read));
+											status = APR_EGENERAL;
+										}
+
+									loop_flag = false;
+								}
+
+						}		/* while (loop_flag) */
+
+					if (status == APR_SUCCESS)
+						{
+							status = FinishMember (download_p, entry_p -> dataSize);
+
+							if (status == APR_SUCCESS)
+								{
+									status = PassBrigade (download_p);
+								}
+						}
+
+				}		/* if (status == APR_SUCCESS) */
+
+			memset (&close_params, 0, sizeof (openedDataObjInp_t));
+			close_params.l1descInx = fd;
+			rcDataObjClose (connection_p, &close_params);
+
+			if (status != APR_SUCCESS)
+				{
+					err_p = dav_new_error (resource_p -> pool, HTTP_INTERNAL_SERVER_ERROR, 0, status, "Could not write contents to filter.");
+				}
+		}		/* if (fd >= 0) */
+	else
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, req_p, "Leaving \"%s\" out of the archive as rcDataObjOpen failed: %d = %s", open_params.objPath, fd, get_rods_error_msg (fd));
+		}
+
+	return err_p;
+}
+
+
+static apr_status_t StartMember (ArchiveDownload *download_p, const char *name_s, const char type, const apr_off_t size, const collEnt_t *entry_p, apr_pool_t *pool_p)
+{
+	apr_status_t status;
+
+	if (download_p -> ad_format == AF_ZIP)
+		{
+			status = WriteZipLocalHeader (download_p, name_s, type, size, entry_p);
+		}
+	else
+		{
+			status = WriteMemberHeader (download_p, name_s, type, size, entry_p, pool_p);
+		}
+
+	return status;
+}
+
+
+/*
+ * Once a data object's data has been sent, pad a tar member to a
+ * whole block or follow a zip member with its data descriptor.
+ */
+static apr_status_t FinishMember (ArchiveDownload *download_p, const apr_off_t size)
+{
+	apr_status_t status;
+
+	if (download_p -> ad_format == AF_ZIP)
+		{
+			status = WriteZipDataDescriptor (download_p);
+		}
+	else
+		{
+			status = WriteZeros (download_p, (TAR_BLOCK_SIZE - (size % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE);
+		}
+
+	return status;
+}
+
+
+/*
+ * Write the header block for a member. Names longer than the ustar
+ * name field and sizes too large for its size field are stored in
+ * a preceding pax extended header.
+ */
+static apr_status_t WriteMemberHeader (ArchiveDownload *download_p, const char *name_s, const char type, const apr_off_t size, const collEnt_t *entry_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+	char block [TAR_BLOCK_SIZE];
+	char *pax_s = NULL;
+
+	if (strlen (name_s) > TAR_NAME_LENGTH)
+		{
+			pax_s = GetPaxRecord ("path", name_s, pool_p);
+		}
+
+	if (size > S_MAX_USTAR_SIZE)
+		{
+			char *size_record_s = GetPaxRecord ("size", apr_off_t_toa (pool_p, size), pool_p);
+
+			pax_s = pax_s ? apr_pstrcat (pool_p, pax_s, size_record_s, NULL) : size_record_s;
+		}
+
+	if (pax_s)
+		{
+			const apr_off_t pax_length = (apr_off_t) strlen (pax_s);
+
+			FillHeaderBlock (block, "././@PaxHeader", TAR_PAX_TYPE, pax_length, entry_p);
+
+			status = apr_brigade_write (download_p -> ad_brigade_p, NULL, NULL, block, TAR_BLOCK_SIZE);
+
+			if (status == APR_SUCCESS)
+				{
+					status = apr_brigade_write (download_p -> ad_brigade_p, NULL, NULL, pax_s, pax_length);
+
+					if (status == APR_SUCCESS)
+						{
+							status = WriteZeros (download_p, (TAR_BLOCK_SIZE - (pax_length % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE);
+						}
+				}
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			FillHeaderBlock (block, name_s, type, (size > S_MAX_USTAR_SIZE) ? 0 : size, entry_p);
+
+			status = apr_brigade_write (download_p -> ad_brigade_p, NULL, NULL, block, TAR_BLOCK_SIZE);
+		}
+
+	return status;
+}
+
+
+static void FillHeaderBlock (char *block_p, const char *name_s, const char type, const apr_off_t size, const collEnt_t *entry_p)
+{
+	const unsigned int mode = (type == TAR_DIRECTORY_TYPE) ? 0755 : 0644;
+	unsigned long modified_time = 0;
+	unsigned int checksum = 0;
+	size_t i;
+
+	if ((entry_p) && (entry_p -> modifyTime))
+		{
+			modified_time = strtoul (entry_p -> modifyTime, NULL, 10);
+		}
+	else
+		{
+			modified_time = (unsigned long) apr_time_sec (apr_time_now ());
+		}
+
+	memset (block_p, 0, TAR_BLOCK_SIZE);
+
+	/* The name field doesn't need to be terminated if it is full */
+	strncpy (block_p + TAR_NAME_OFFSET, name_s, TAR_NAME_LENGTH);
+
+	snprintf (block_p + TAR_MODE_OFFSET, TAR_ID_LENGTH, "%07o", mode);
+	snprintf (block_p + TAR_UID_OFFSET, TAR_ID_LENGTH, "%07o", 0);
+	snprintf (block_p + TAR_GID_OFFSET, TAR_ID_LENGTH, "%07o", 0);
+	snprintf (block_p + TAR_SIZE_OFFSET, TAR_SIZE_LENGTH, "%011llo", (unsigned long long) size);
+	snprintf (block_p + TAR_MTIME_OFFSET, TAR_MTIME_LENGTH, "%011lo", modified_time);
+
+	* (block_p + TAR_TYPE_OFFSET) = type;
+
+	memcpy (block_p + TAR_MAGIC_OFFSET, "ustar", 6);
+	memcpy (block_p + TAR_VERSION_OFFSET, "00", 2);
+
+	if ((entry_p) && (entry_p -> ownerName))
+		{
+			strncpy (block_p + TAR_UNAME_OFFSET, entry_p -> ownerName, TAR_OWNER_LENGTH - 1);
+			strncpy (block_p + TAR_GNAME_OFFSET, entry_p -> ownerName, TAR_OWNER_LENGTH - 1);
+		}
+
+	/* The checksum is calculated with its own field set to spaces */
+	memset (block_p + TAR_CHECKSUM_OFFSET, ' ', TAR_CHECKSUM_LENGTH);
+
+	for (i = 0; i < TAR_BLOCK_SIZE; ++ i)
+		{
+			checksum += (unsigned char) block_p [i];
+		}
+
+	snprintf (block_p + TAR_CHECKSUM_OFFSET, TAR_CHECKSUM_LENGTH - 1, "%06o", checksum);
+	* (block_p + TAR_CHECKSUM_OFFSET + TAR_CHECKSUM_LENGTH - 1) = ' ';
+}
+
+
+/*
+ * Write a zip member's local header and note what its central directory
+ * entry will need. A data object's CRC-32 isn't known until it has been
+ * sent, so it goes in the data descriptor after the data instead.
+ */
+static apr_status_t WriteZipLocalHeader (ArchiveDownload *download_p, const char *name_s, const char type, const apr_off_t size, const collEnt_t *entry_p)
+{
+	ZipEntry *zip_entry_p = (ZipEntry *) apr_array_push (download_p -> ad_zip_entries_p);
+	const size_t name_length = strlen (name_s);
+	char header [ZIP_LOCAL_HEADER_LENGTH + ZIP64_MAX_EXTRA_LENGTH];
+	char *buffer_p = header;
+	size_t extra_length = 0;
+	apr_uint16_t flags = ZIP_FLAGS_UTF8;
+	bool zip64_flag;
+	apr_status_t status;
+
+	/* The array outlives the pools that the names are in */
+	zip_entry_p -> ze_name_s = apr_pstrdup (download_p -> ad_zip_entries_p -> pool, name_s);
+	zip_entry_p -> ze_offset = download_p -> ad_offset;
+	zip_entry_p -> ze_size = size;
+	zip_entry_p -> ze_crc = 0;
+	zip_entry_p -> ze_directory_flag = (type == TAR_DIRECTORY_TYPE);
+	GetDosTime (entry_p, & (zip_entry_p -> ze_dos_time), & (zip_entry_p -> ze_dos_date));
+
+	zip64_flag = ((apr_uint64_t) size >= S_ZIP64_LIMIT);
+
+	if (! (zip_entry_p -> ze_directory_flag))
+		{
+			flags |= ZIP_FLAGS_DATA_DESCRIPTOR;
+		}
+
+	buffer_p = PutLittleEndian (buffer_p, ZIP_LOCAL_HEADER_SIGNATURE, 4);
+	buffer_p = PutLittleEndian (buffer_p, zip64_flag ? ZIP64_VERSION : ZIP_VERSION, 2);
+	buffer_p = PutLittleEndian (buffer_p, flags, 2);
+	buffer_p = PutLittleEndian (buffer_p, 0, 2);
+	buffer_p = PutLittleEndian (buffer_p, zip_entry_p -> ze_dos_time, 2);
+	buffer_p = PutLittleEndian (buffer_p, zip_entry_p -> ze_dos_date, 2);
+	buffer_p = PutLittleEndian (buffer_p, 0, 4);
+	buffer_p = PutLittleEndian (buffer_p, zip64_flag ? S_ZIP64_LIMIT : (apr_uint64_t) size, 4);
+	buffer_p = PutLittleEndian (buffer_p, zip64_flag ? S_ZIP64_LIMIT : (apr_uint64_t) size, 4);
+	buffer_p = PutLittleEndian (buffer_p, name_length, 2);
+
+	if (zip64_flag)
+		{
+			extra_length = FillZip64Extra (buffer_p + 2, zip_entry_p, false);
+		}
+
+	buffer_p = PutLittleEndian (buffer_p, extra_length, 2);
+
+	download_p -> ad_crc = 0;
+
+	status = WriteBytes (download_p, header, ZIP_LOCAL_HEADER_LENGTH);
+
+	if (status == APR_SUCCESS)
+		{
+			status = WriteBytes (download_p, name_s, name_length);
+
+			if ((status == APR_SUCCESS) && (extra_length > 0))
+				{
+					status = WriteBytes (download_p, header + ZIP_LOCAL_HEADER_LENGTH, extra_length);
+				}
+		}
+
+	return status;
+}
+
+
+/*
+ * Write the CRC-32 and sizes of the data object that has just been sent.
+ */
+static apr_status_t WriteZipDataDescriptor (ArchiveDownload *download_p)
+{
+	ZipEntry *zip_entry_p = & (APR_ARRAY_IDX (download_p -> ad_zip_entries_p, download_p -> ad_zip_entries_p -> nelts - 1, ZipEntry));
+	const size_t size_length = ((apr_uint64_t) (zip_entry_p -> ze_size) >= S_ZIP64_LIMIT) ? 8 : 4;
+	char descriptor [24];
+	char *buffer_p = descriptor;
+
+	zip_entry_p -> ze_crc = download_p -> ad_crc;
+
+	buffer_p = PutLittleEndian (buffer_p, ZIP_DATA_DESCRIPTOR_SIGNATURE, 4);
+	buffer_p = PutLittleEndian (buffer_p, zip_entry_p -> ze_crc, 4);
+	buffer_p = PutLittleEndian (buffer_p, (apr_uint64_t) (zip_entry_p -> ze_size), size_length);
+	buffer_p = PutLittleEndian (buffer_p, (apr_uint64_t) (zip_entry_p -> ze_size), size_length);
+
+	return WriteBytes (download_p, descriptor, buffer_p - descriptor);
+}
+
+
+/*
+ * Write the central directory and the records that end the archive,
+ * adding the zip64 ones if there are too many members or the archive
+ * is too large for the original fields.
+ */
+static apr_status_t WriteZipCentralDirectory (ArchiveDownload *download_p)
+{
+	apr_status_t status = APR_SUCCESS;
+	const apr_off_t directory_offset = download_p -> ad_offset;
+	const unsigned int num_entries = (unsigned int) (download_p -> ad_zip_entries_p -> nelts);
+	apr_uint64_t directory_length;
+	char record [ZIP64_END_LENGTH + ZIP64_LOCATOR_LENGTH + ZIP_END_LENGTH];
+	char *buffer_p = record;
+	bool zip64_flag;
+	unsigned int i;
+
+	for (i = 0; (i < num_entries) && (status == APR_SUCCESS); ++ i)
+		{
+			const ZipEntry *zip_entry_p = & (APR_ARRAY_IDX (download_p -> ad_zip_entries_p, i, ZipEntry));
+			const size_t name_length = strlen (zip_entry_p -> ze_name_s);
+			const bool large_size_flag = ((apr_uint64_t) (zip_entry_p -> ze_size) >= S_ZIP64_LIMIT);
+			const bool large_offset_flag = ((apr_uint64_t) (zip_entry_p -> ze_offset) >= S_ZIP64_LIMIT);
+			char header [ZIP_CENTRAL_HEADER_LENGTH + ZIP64_MAX_EXTRA_LENGTH];
+			const apr_uint64_t attributes = zip_entry_p -> ze_directory_flag ? ((040755U << 16) | 0x10) : (0100644U << 16);
+			apr_uint16_t flags = ZIP_FLAGS_UTF8;
+			size_t extra_length = 0;
+
+			if (! (zip_entry_p -> ze_directory_flag))
+				{
+					flags |= ZIP_FLAGS_DATA_DESCRIPTOR;
+				}
+
+			buffer_p = header;
+			buffer_p = PutLittleEndian (buffer_p, ZIP_CENTRAL_HEADER_SIGNATURE, 4);
+			buffer_p = PutLittleEndian (buffer_p, ZIP_UNIX_VERSION_MADE_BY, 2);
+			buffer_p = PutLittleEndian (buffer_p, (large_size_flag || large_offset_flag) ? ZIP64_VERSION : ZIP_VERSION, 2);
+			buffer_p = PutLittleEndian (buffer_p, flags, 2);
+			buffer_p = PutLittleEndian (buffer_p, 0, 2);
+			buffer_p = PutLittleEndian (buffer_p, zip_entry_p -> ze_dos_time, 2);
+			buffer_p = PutLittleEndian (buffer_p, zip_entry_p -> ze_dos_date, 2);
+			buffer_p = PutLittleEndian (buffer_p, zip_entry_p -> ze_crc, 4);
+			buffer_p = PutLittleEndian (buffer_p, large_size_flag ? S_ZIP64_LIMIT : (apr_uint64_t) (zip_entry_p -> ze_size), 4);
+			buffer_p = PutLittleEndian (buffer_p, large_size_flag ? S_ZIP64_LIMIT : (apr_uint64_t) (zip_entry_p -> ze_size), 4);
+			buffer_p = PutLittleEndian (buffer_p, name_length, 2);
+
+			if (large_size_flag || large_offset_flag)
+				{
+					extra_length = FillZip64Extra (header + ZIP_CENTRAL_HEADER_LENGTH, zip_entry_p, true);
+				}
+
+			buffer_p = PutLittleEndian (buffer_p, extra_length, 2);
+			buffer_p = PutLittleEndian (buffer_p, 0, 2);
+			buffer_p = PutLittleEndian (buffer_p, 0, 2);
+			buffer_p = PutLittleEndian (buffer_p, 0, 2);
+			buffer_p = PutLittleEndian (buffer_p, attributes, 4);
+			buffer_p = PutLittleEndian (buffer_p, large_offset_flag ? S_ZIP64_LIMIT : (apr_uint64_t) (zip_entry_p -> ze_offset), 4);
+
+			status = WriteBytes (download_p, header, ZIP_CENTRAL_HEADER_LENGTH);
+
+			if (status == APR_SUCCESS)
+				{
+					status = WriteBytes (download_p, zip_entry_p -> ze_name_s, name_length);
+
+					if ((status == APR_SUCCESS) && (extra_length > 0))
+						{
+							status = WriteBytes (download_p, header + ZIP_CENTRAL_HEADER_LENGTH, extra_length);
+						}
+				}
+
+			/* Don't let the whole central directory build up in the brigade */
+			if ((status == APR_SUCCESS) && ((i % 1024) == 1023))
+				{
+					status = PassBrigade (download_p);
+				}
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			directory_length = (apr_uint64_t) (download_p -> ad_offset - directory_offset);
+			zip64_flag = ((num_entries >= S_ZIP64_MAX_ENTRIES) || ((apr_uint64_t) directory_offset >= S_ZIP64_LIMIT) || (directory_length >= S_ZIP64_LIMIT));
+
+			buffer_p = record;
+
+			if (zip64_flag)
+				{
+					const apr_off_t end_offset = download_p -> ad_offset;
+
+					buffer_p = PutLittleEndian (buffer_p, ZIP64_END_SIGNATURE, 4);
+					buffer_p = PutLittleEndian (buffer_p, ZIP64_END_LENGTH - 12, 8);
+					buffer_p = PutLittleEndian (buffer_p, ZIP_UNIX_VERSION_MADE_BY, 2);
+					buffer_p = PutLittleEndian (buffer_p, ZIP64_VERSION, 2);
+					buffer_p = PutLittleEndian (buffer_p, 0, 4);
+					buffer_p = PutLittleEndian (buffer_p, 0, 4);
+					buffer_p = PutLittleEndian (buffer_p, num_entries, 8);
+					buffer_p = PutLittleEndian (buffer_p, num_entries, 8);
+					buffer_p = PutLittleEndian (buffer_p, directory_length, 8);
+					buffer_p = PutLittleEndian (buffer_p, (apr_uint64_t) directory_offset, 8);
+
+					buffer_p = PutLittleEndian (buffer_p, ZIP64_LOCATOR_SIGNATURE, 4);
+					buffer_p = PutLittleEndian (buffer_p, 0, 4);
+					buffer_p = PutLittleEndian (buffer_p, (apr_uint64_t) end_offset, 8);
+					buffer_p = PutLittleEndian (buffer_p, 1, 4);
+				}
+
+			buffer_p = PutLittleEndian (buffer_p, ZIP_END_SIGNATURE, 4);
+			buffer_p = PutLittleEndian (buffer_p, 0, 2);
+			buffer_p = PutLittleEndian (buffer_p, 0, 2);
+			buffer_p = PutLittleEndian (buffer_p, zip64_flag ? S_ZIP64_MAX_ENTRIES : num_entries, 2);
+			buffer_p = PutLittleEndian (buffer_p, zip64_flag ? S_ZIP64_MAX_ENTRIES : num_entries, 2);
+			buffer_p = PutLittleEndian (buffer_p, zip64_flag ? S_ZIP64_LIMIT : directory_length, 4);
+			buffer_p = PutLittleEndian (buffer_p, zip64_flag ? S_ZIP64_LIMIT : (apr_uint64_t) directory_offset, 4);
+			buffer_p = PutLittleEndian (buffer_p, 0, 2);
+
+			status = WriteBytes (download_p, record, buffer_p - record);
+		}
+
+	return status;
+}
+
+
+/*
+ * Fill in the zip64 extra field for a member, returning its length. The
+ * local header always has both sizes whereas the central directory only
+ * has the values that don't fit into their original fields.
+ */
+static size_t FillZip64Extra (char *buffer_p, const ZipEntry *entry_p, const bool central_flag)
+{
+	char *data_p = buffer_p + 4;
+	const bool large_size_flag = ((apr_uint64_t) (entry_p -> ze_size) >= S_ZIP64_LIMIT);
+
+	if ((!central_flag) || large_size_flag)
+		{
+			data_p = PutLittleEndian (data_p, (apr_uint64_t) (entry_p -> ze_size), 8);
+			data_p = PutLittleEndian (data_p, (apr_uint64_t) (entry_p -> ze_size), 8);
+		}
+
+	if (central_flag && ((apr_uint64_t) (entry_p -> ze_offset) >= S_ZIP64_LIMIT))
+		{
+			data_p = PutLittleEndian (data_p, (apr_uint64_t) (entry_p -> ze_offset), 8);
+		}
+
+	PutLittleEndian (buffer_p, ZIP64_EXTRA_ID, 2);
+	PutLittleEndian (buffer_p + 2, (apr_uint64_t) (data_p - buffer_p - 4), 2);
+
+	return (size_t) (data_p - buffer_p);
+}
+
+
+/*
+ * Zip stores local times with a two second resolution, starting in 1980.
+ */
+static void GetDosTime (const collEnt_t *entry_p, apr_uint16_t *dos_time_p, apr_uint16_t *dos_date_p)
+{
+	apr_time_t modified_time;
+	apr_time_exp_t exploded_time;
+
+	if ((entry_p) && (entry_p -> modifyTime))
+		{
+			modified_time = apr_time_from_sec (strtoul (entry_p -> modifyTime, NULL, 10));
+		}
+	else
+		{
+			modified_time = apr_time_now ();
+		}
+
+	if ((apr_time_exp_lt (&exploded_time, modified_time) == APR_SUCCESS) && (exploded_time.tm_year >= 80))
+		{
+			*dos_time_p = (apr_uint16_t) ((exploded_time.tm_hour << 11) | (exploded_time.tm_min << 5) | (exploded_time.tm_sec / 2));
+			*dos_date_p = (apr_uint16_t) (((exploded_time.tm_year - 80) << 9) | ((exploded_time.tm_mon + 1) << 5) | exploded_time.tm_mday);
+		}
+	else
+		{
+			*dos_time_p = 0;
+			*dos_date_p = (1 << 5) | 1;
+		}
+}
+
+
+static char *PutLittleEndian (char *buffer_p, apr_uint64_t value, size_t num_bytes)
+{
+	while (num_bytes > 0)
+		{
+			*buffer_p = (char) (value & 0xFF);
+			value >>= 8;
+			++ buffer_p;
+			-- num_bytes;
+		}
+
+	return buffer_p;
+}
+
+
+/*
+ * A zip member that is padded because its data object shrank needs the
+ * padding in its CRC-32 too.
+ */
+static void AddZerosToChecksum (ArchiveDownload *download_p, apr_off_t length)
+{
+	if (download_p -> ad_format == AF_ZIP)
+		{
+			while (length > 0)
+				{
+					const uInt chunk_length = (length < (apr_off_t) sizeof (S_ZEROS_S)) ? (uInt) length : (uInt) sizeof (S_ZEROS_S);
+
+					download_p -> ad_crc = (apr_uint32_t) crc32 (download_p -> ad_crc, (const Bytef *) S_ZEROS_S, chunk_length);
+					length -= chunk_length;
+				}
+		}
+}
+
+
+static apr_status_t WriteBytes (ArchiveDownload *download_p, const char *data_p, const apr_size_t length)
+{
+	apr_status_t status = apr_brigade_write (download_p -> ad_brigade_p, NULL, NULL, data_p, length);
+
+	if (status == APR_SUCCESS)
+		{
+			download_p -> ad_offset += length;
+		}
+
+	return status;
+}
+
+
+/*
+ * Each pax record is "<length> <key>=<value>\n" where the length
+ * includes its own digits.
+ */
+static char *GetPaxRecord (const char *key_s, const char *value_s, apr_pool_t *pool_p)
+{
+	const size_t content_length = strlen (key_s) + strlen (value_s) + 3;
+	size_t num_digits = GetNumDigits (content_length);
+
+	if (GetNumDigits (content_length + num_digits) != num_digits)
+		{
+			++ num_digits;
+		}
+
+	return apr_psprintf (pool_p, "%" APR_SIZE_T_FMT " %s=%s\n", content_length + num_digits, key_s, value_s);
+}
+
+
+static size_t GetNumDigits (size_t value)
+{
+	size_t num_digits = 1;
+
+	while (value >= 10)
+		{
+			value /= 10;
+			++ num_digits;
+		}
+
+	return num_digits;
+}
+
+
+static apr_status_t WriteZeros (ArchiveDownload *download_p, apr_off_t length)
+{
+	apr_status_t status = APR_SUCCESS;
+	apr_bucket_alloc_t *bucket_alloc_p = download_p -> ad_output_p -> c -> bucket_alloc;
+
+	while ((length > 0) && (status == APR_SUCCESS))
+		{
+			const apr_size_t chunk_length = (length < (apr_off_t) sizeof (S_ZEROS_S)) ? (apr_size_t) length : sizeof (S_ZEROS_S);
+
+			APR_BRIGADE_INSERT_TAIL (download_p -> ad_brigade_p, apr_bucket_immortal_create (S_ZEROS_S, chunk_length, bucket_alloc_p));
+			length -= chunk_length;
+			download_p -> ad_offset += chunk_length;
+
+			/* Don't let a long run of padding build up in the brigade */
+			if (length > 0)
+				{
+					status = PassBrigade (download_p);
+				}
+		}
+
+	return status;
+}
+
+
+static apr_status_t PassBrigade (ArchiveDownload *download_p)
+{
+	apr_status_t status = ap_pass_brigade (download_p -> ad_output_p, download_p -> ad_brigade_p);
+
+	apr_brigade_cleanup (download_p -> ad_brigade_p);
+
+	return status;
+}
@@ -0,0 +1,92 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * archive_download.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef ARCHIVE_DOWNLOAD_H_
+#define ARCHIVE_DOWNLOAD_H_
+
+#include <stdbool.h>
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "mod_dav.h"
+
+#include "config.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Check whether a GET request for a collection is asking for the
+ * collection as an archive, i.e. it has a "format=tar" or "format=zip"
+ * parameter and archive downloads are enabled.
+ *
+ * @param req_p The request.
+ * @param conf_p The configuration.
+ * @return <code>true</code> if the collection should be sent as an
+ * archive, <code>false</code> otherwise.
+ */
+bool IsArchiveDownloadRequest (request_rec *req_p, const davrods_dir_conf_t *conf_p);
+
+
+/**
+ * Set the Content-Type and Content-Disposition headers for sending
+ * a collection as an archive.
+ *
+ * @param resource_p The collection.
+ */
+void SetArchiveDownloadHeaders (const dav_resource *resource_p);
+
+
+/**
+ * Send a collection and everything below it as a tar or zip archive.
+ * The archive is built as it is sent so only one read buffer is held
+ * in memory at any time, whatever the size of the collection. Zip
+ * members are stored uncompressed and only their names, offsets, sizes
+ * and CRC-32s are kept until the central directory is written at the end.
+ *
+ * @param resource_p The collection to send.
+ * @param output_p The filter to write the archive to.
+ * @return <code>NULL</code> upon success or a dav_error if the
+ * collection could not be sent.
+ */
+dav_error *DeliverCollectionArchive (const dav_resource *resource_p, ap_filter_t *output_p);
+
+
+const char *SetArchiveDownloads (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+const char *SetArchiveDownloadMaxEntries (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+const char *SetArchiveDownloadMaxMbs (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ARCHIVE_DOWNLOAD_H_ */
@@ -0,0 +1,1056 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * archive_ingest.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "archive_ingest.h"
+#include "common.h"
+#include "negative_cache.h"
+#include "write_placement.h"
+
+#include "apr_strings.h"
+#include "apr_hash.h"
+
+#include "http_log.h"
+#include "http_protocol.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+#define TAR_BLOCK_SIZE (512)
+
+
+/*
+ * The offsets and lengths of the fields in a ustar header block that
+ * we use.
+ */
+#define TAR_NAME_OFFSET (0)
+#define TAR_NAME_LENGTH (100)
+#define TAR_SIZE_OFFSET (124)
+#define TAR_SIZE_LENGTH (12)
+#define TAR_CHECKSUM_OFFSET (148)
+#define TAR_CHECKSUM_LENGTH (8)
+#define TAR_TYPE_OFFSET (156)
+#define TAR_MAGIC_OFFSET (257)
+#define TAR_PREFIX_OFFSET (345)
+#define TAR_PREFIX_LENGTH (155)
+
+
+/** The largest GNU long name or pax header that we will read. */
+static const apr_off_t S_MAX_EXTENDED_HEADER_SIZE = 64 * 1024;
+
+
+typedef struct ArchiveIngest
+{
+	request_rec *ai_req_p;
+
+	rcComm_t *ai_connection_p;
+
+	const davrods_dir_conf_t *ai_config_p;
+
+	const char *ai_collection_s;
+
+	bool ai_overwrite_flag;
+
+	JSONWriter *ai_writer_p;
+
+	/** The collections that are known to exist, so they are only created once. */
+	apr_hash_t *ai_collections_p;
+
+	/**
+	 * The resources set with DavRodsWriteResources in the order to try them
+	 * or NULL if there are none.
+	 */
+	apr_array_header_t *ai_write_resources_p;
+
+	/** The buffer used to send members that are too large for a single put. */
+	char *ai_buffer_p;
+	apr_size_t ai_buffer_size;
+
+	apr_pool_t *ai_pool_p;
+
+	unsigned int ai_num_succeeded;
+	unsigned int ai_num_failed;
+} ArchiveIngest;
+
+
+static apr_status_t ReadFromBody (request_rec *req_p, char *buffer_p, const apr_size_t length);
+
+static apr_status_t SkipBody (ArchiveIngest *ingest_p, apr_off_t length);
+
+static bool IsZeroBlock (const char *block_p);
+
+static bool IsValidHeader (const char *block_p);
+
+static bool GetOctalValue (const char *field_p, const size_t length, apr_off_t *value_p);
+
+static char *GetHeaderName (const char *block_p, apr_pool_t *pool_p);
+
+static char *ReadExtendedHeader (ArchiveIngest *ingest_p, const apr_off_t size, apr_pool_t *pool_p);
+
+static bool ParsePaxHeader (char *data_s, const apr_off_t size, char **name_ss, apr_off_t *size_p, apr_pool_t *pool_p);
+
+static char *GetMemberPath (ArchiveIngest *ingest_p, const char *name_s, apr_pool_t *pool_p);
+
+static int EnsureCollection (ArchiveIngest *ingest_p, const char *collection_s);
+
+static int EnsureParentCollection (ArchiveIngest *ingest_p, const char *path_s, apr_pool_t *pool_p);
+
+static apr_status_t IngestDataObject (ArchiveIngest *ingest_p, const char *path_s, const apr_off_t size, int *rods_status_p, apr_pool_t *pool_p);
+
+static int PutDataObject (ArchiveIngest *ingest_p, const char *path_s, char *data_p, const apr_off_t size, apr_pool_t *pool_p);
+
+static int CreateDataObject (ArchiveIngest *ingest_p, dataObjInp_t *params_p, bytesBuf_t *put_buffer_p, apr_pool_t *pool_p);
+
+static int SendCreateRequest (ArchiveIngest *ingest_p, dataObjInp_t *params_p, bytesBuf_t *put_buffer_p);
+
+static char *GetTemporaryPath (const char *path_s, apr_pool_t *pool_p);
+
+static int ReplaceDataObject (ArchiveIngest *ingest_p, const char *temp_path_s, const char *path_s);
+
+static void DeleteDataObject (ArchiveIngest *ingest_p, const char *path_s);
+
+static apr_status_t WriteMemberResult (ArchiveIngest *ingest_p, const char *path_s, const char *type_s, const apr_off_t size, const int rods_status, const char *error_s);
+
+
+apr_status_t IngestTarArchive (request_rec *req_p, rcComm_t *connection_p, const char *collection_s, const davrods_dir_conf_t *config_p, const bool overwrite_flag, JSONWriter *writer_p)
+{
+	apr_status_t status = APR_EGENERAL;
+	ArchiveIngest ingest;
+
+	memset (&ingest, 0, sizeof (ArchiveIngest));
+
+	ingest.ai_req_p = req_p;
+	ingest.ai_connection_p = connection_p;
+	ingest.ai_config_p = config_p;
+	ingest.ai_collection_s = collection_s;
+	ingest.ai_overwrite_flag = overwrite_flag;
+	ingest.ai_writer_p = writer_p;
+	ingest.ai_pool_p = req_p -> pool;
+	ingest.ai_collections_p = apr_hash_make (req_p -> pool);
+	ingest.ai_write_resources_p = GetWriteResources (config_p, connection_p, req_p -> pool);
+	ingest.ai_buffer_size = config_p -> rods_tx_buffer_size;
+	ingest.ai_buffer_p = apr_palloc (req_p -> pool, ingest.ai_buffer_size);
+
+	if ((ingest.ai_collections_p) && (ingest.ai_buffer_p))
+		{
+			int rods_status = EnsureCollection (&ingest, collection_s);
+
+			if (rods_status >= 0)
+				{
+					if ((status = ap_setup_client_block (req_p, REQUEST_CHUNKED_DECHUNK)) == OK)
+						{
+							apr_pool_t *member_pool_p = NULL;
+
+							status = APR_SUCCESS;
+
+							if (ap_should_client_block (req_p))
+								{
+									status = apr_pool_create (&member_pool_p, req_p -> pool);
+								}
+
+							if ((status == APR_SUCCESS) && (member_pool_p))
+								{
+									char block [TAR_BLOCK_SIZE];
+									char *long_name_s = NULL;
+									apr_off_t pax_size = -1;
+									bool loop_flag = true;
+
+									while (loop_flag)
+										{
+											status = ReadFromBody (req_p, block, TAR_BLOCK_SIZE);
+
+											if (status != APR_SUCCESS)
+												{
+													/* An archive without its end-of-archive blocks is accepted as long as it ends between members */
+													if (status == APR_EOF)
+														{
+															status = APR_SUCCESS;
+														}
+
+													loop_flag = false;
+												}
+											else if (IsZeroBlock (block))
+												{
+													loop_flag = false;
+												}
+											else if (!IsValidHeader (block))
+												{
+													ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, req_p, "Invalid tar header block when unpacking into \"%s\"", collection_s);
+													status = APR_EINVAL;
+													loop_flag = false;
+												}
+											else
+												{
+													const char type = block [TAR_TYPE_OFFSET];
+													apr_off_t size = 0;
+
+													if (!GetOctalValue (block + TAR_SIZE_OFFSET, TAR_SIZE_LENGTH, &size))
+														{
+															status = APR_EINVAL;
+															loop_flag = false;
+														}
+													else if ((type == 'L') || (type == 'x'))
+														{
+															/*
+															 * A GNU long name or pax extended header that applies
+															 * to the next member. The member pool isn't cleared
+															 * until that member has been stored.
+															 */
+															char *data_s = ReadExtendedHeader (&ingest, size, member_pool_p);
+
+															if (data_s)
+																{
+																	if (type == 'L')
+																		{
+																			long_name_s = data_s;
+																		}
+																	else
+																		{
+																			if (!ParsePaxHeader (data_s, size, &long_name_s, &pax_size, member_pool_p))
+																				{
+																					ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, req_p, "Invalid pax header when unpacking into \"%s\"", collection_s);
+																					status = APR_EINVAL;
+																					loop_flag = false;
+																				}
+																		}
+																}
+															else
+																{
+																	status = APR_EINVAL;
+																	loop_flag = false;
+																}
+														}
+													else
+														{
+															char *name_s = long_name_s ? long_name_s : GetHeaderName (block, member_pool_p);
+															char *path_s;
+
+															if (pax_size >= 0)
+																{
+																	size = pax_size;
+																}
+
+															long_name_s = NULL;
+															pax_size = -1;
+
+															path_s = GetMemberPath (&ingest, name_s, member_pool_p);
+
+															if ((type == '0') || (type == '\0') || (type == '7'))
+																{
+																	if (path_s)
+																		{
+																			rods_status = EnsureParentCollection (&ingest, path_s, member_pool_p);
+
+																			if (rods_status >= 0)
+																				{
+																					status = IngestDataObject (&ingest, path_s, size, &rods_status, member_pool_p);
+
+																					if (rods_status >= 0)
+																						{
+																							ForgetKnownAbsent (config_p, path_s);
+																						}
+																				}
+																			else
+																				{
+																					status = SkipBody (&ingest, size);
+																				}
+
+																			if (status == APR_SUCCESS)
+																				{
+																					status = WriteMemberResult (&ingest, path_s, "data_object", size, rods_status, NULL);
+																				}
+																		}
+																	else
+																		{
+																			status = SkipBody (&ingest, size);
+
+																			if (status == APR_SUCCESS)
+																				{
+																					status = WriteMemberResult (&ingest, name_s, "data_object", size, 0, "Invalid member name");
+																				}
+																		}
+																}
+															else if (type == '5')
+																{
+																	if (path_s)
+																		{
+																			rods_status = EnsureCollection (&ingest, path_s);
+																			status = WriteMemberResult (&ingest, path_s, "collection", 0, rods_status, NULL);
+																		}
+																	else
+																		{
+																			status = WriteMemberResult (&ingest, name_s, "collection", 0, 0, "Invalid member name");
+																		}
+
+																	if (status == APR_SUCCESS)
+																		{
+																			status = SkipBody (&ingest, size);
+																		}
+																}
+															else
+																{
+																	/* Links, devices, fifos and global pax headers are not stored */
+																	status = SkipBody (&ingest, size);
+
+																	if ((status == APR_SUCCESS) && (type != 'g'))
+																		{
+																			status = WriteMemberResult (&ingest, path_s ? path_s : name_s, "skipped", size, 0, NULL);
+																		}
+																}
+
+															if (status != APR_SUCCESS)
+																{
+																	loop_flag = false;
+																}
+
+															apr_pool_clear (member_pool_p);
+														}
+
+												}
+
+										}		/* while (loop_flag) */
+
+									apr_pool_destroy (member_pool_p);
+								}
+
+						}		/* if ((status = ap_setup_client_block (req_p, REQUEST_CHUNKED_DECHUNK)) == OK) */
+					else
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, req_p, "Failed to set up reading the archive for \"%s\", %d", collection_s, status);
+							status = APR_EGENERAL;
+						}
+				}
+			else
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, req_p, "Failed to create collection \"%s\": %d = %s", collection_s, rods_status, get_rods_error_msg (rods_status));
+					WriteMemberResult (&ingest, collection_s, "collection", 0, rods_status, NULL);
+				}
+
+			if (BeginJSONObject (writer_p) == APR_SUCCESS)
+				{
+					WriteJSONKey (writer_p, "succeeded");
+					WriteJSONInteger (writer_p, ingest.ai_num_succeeded);
+					WriteJSONKey (writer_p, "failed");
+					WriteJSONInteger (writer_p, ingest.ai_num_failed);
+					WriteJSONKey (writer_p, "complete");
+					WriteJSONBoolean (writer_p, (status == APR_SUCCESS));
+					EndJSONObject (writer_p);
+				}
+
+		}		/* if ((ingest.ai_collections_p) && (ingest.ai_buffer_p)) */
+
+	return status;
+}
+
+
+/*
+ * Read exactly length bytes of the request body. APR_EOF is returned if
+ * the body had already finished and APR_INCOMPLETE if it finished part
+ * of the way through.
+ */
+static apr_status_t ReadFromBody (request_rec *req_p, char *buffer_p, const apr_size_t length)
+{
+	apr_size_t num_read = 0;
+	bool loop_flag = true;
+	apr_status_t status = APR_SUCCESS;
+
+	while (loop_flag && (num_read < length))
+		{
+			long l = ap_get_client_block (req_p, buffer_p + num_read, length - num_read);
+
+			if (l > 0)
+				{
+					num_read += (apr_size_t) l;
+				}
+			else
+				{
+					status = (l == 0) ? ((num_read == 0) ? APR_EOF : APR_INCOMPLETE) : APR_EGENERAL;
+					loop_flag = false;
+				}
+		}
+
+	return status;
+}
+
+
+/*
+ * Read past the data of a member along with the padding up to the next block.
+ */
+static apr_status_t SkipBody (ArchiveIngest *ingest_p, apr_off_t length)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	length = ((length + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE) * TAR_BLOCK_SIZE;
+
+	while ((length > 0) && (status == APR_SUCCESS))
+		{
+			apr_size_t chunk_size = (length > (apr_off_t) (ingest_p -> ai_buffer_size)) ? ingest_p -> ai_buffer_size : (apr_size_t) length;
+
+			status = ReadFromBody (ingest_p -> ai_req_p, ingest_p -> ai_buffer_p, chunk_size);
+			length -= chunk_size;
+		}
+
+	return status;
+}
+
+
+static bool IsZeroBlock (const char *block_p)
+{
+	int i;
+
+	for (i = 0; i < TAR_BLOCK_SIZE; ++ i)
+		{
+			if (block_p [i] != '\0')
+				{
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+/*
+ * The checksum is the sum of the header's bytes with the checksum field
+ * itself taken as spaces.
+ */
+static bool IsValidHeader (const char *block_p)
+{
+	apr_off_t expected;
+	bool valid_flag = false;
+
+	if (GetOctalValue (block_p + TAR_CHECKSUM_OFFSET, TAR_CHECKSUM_LENGTH, &expected))
+		{
+			const unsigned char *byte_p = (const unsigned char *) block_p;
+			apr_off_t sum = 0;
+			int i;
+
+			for (i = 0; i < TAR_BLOCK_SIZE; ++ i, ++ byte_p)
+				{
+					if ((i >= TAR_CHECKSUM_OFFSET) && (i < TAR_CHECKSUM_OFFSET + TAR_CHECKSUM_LENGTH))
+						{
+							sum += ' ';
+						}
+					else
+						{
+							sum += *byte_p;
+						}
+				}
+
+			valid_flag = (sum == expected);
+		}
+
+	return valid_flag;
+}
+
+
+/*
+ * Numeric fields are octal strings ended by a space or NUL, or for large
+ * sizes, GNU tar stores the value in base-256 with the top bit of the
+ * first byte set.
+ */
+static bool GetOctalValue (const char *field_p, const size_t length, apr_off_t *value_p)
+{
+	const unsigned char *byte_p = (const unsigned char *) field_p;
+	apr_off_t value = 0;
+	size_t i = 0;
+
+	if (*byte_p & 0x80)
+		{
+			value = *byte_p & 0x7F;
+
+			for (i = 1; i < length; ++ i)
+				{
+					value = (value << 8) | byte_p [i];
+				}
+		}
+	else
+		{
+			while ((i < length) && (byte_p [i] == ' '))
+				{
+					++ i;
+				}
+
+			while ((i < length) && (byte_p [i] >= '0') && (byte_p [i] <= '7'))
+				{
+					value = (value << 3) | (byte_p [i] - '0');
+					++ i;
+				}
+
+			if ((i < length) && (byte_p [i] != ' ') && (byte_p [i] != '\0'))
+				{
+					return false;
+				}
+		}
+
+	*value_p = value;
+	return (value >= 0);
+}
+
+
+static char *GetHeaderName (const char *block_p, apr_pool_t *pool_p)
+{
+	char *name_s = apr_pstrndup (pool_p, block_p + TAR_NAME_OFFSET, TAR_NAME_LENGTH);
+
+	if ((name_s) && (strncmp (block_p + TAR_MAGIC_OFFSET, "ustar", 5) == 0) && (block_p [TAR_PREFIX_OFFSET] != '\0'))
+		{
+			char *prefix_s = apr_pstrndup (pool_p, block_p + TAR_PREFIX_OFFSET, TAR_PREFIX_LENGTH);
+
+			name_s = prefix_s ? apr_pstrcat (pool_p, prefix_s, "/", name_s, NULL) : NULL;
+		}
+
+	return name_s;
+}
+
+
+static char *ReadExtendedHeader (ArchiveIngest *ingest_p, const apr_off_t size, apr_pool_t *pool_p)
+{
+	char *data_s = NULL;
+
+	if (size <= S_MAX_EXTENDED_HEADER_SIZE)
+		{
+			const apr_size_t padded_size = ((size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE) * TAR_BLOCK_SIZE;
+
+			data_s = apr_palloc (pool_p, padded_size + 1);
+
+			if (data_s)
+				{
+					if (ReadFromBody (ingest_p -> ai_req_p, data_s, padded_size) == APR_SUCCESS)
+						{
+							* (data_s + size) = '\0';
+						}
+					else
+						{
+							data_s = NULL;
+						}
+				}
+		}
+	else
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, ingest_p -> ai_req_p, "Extended tar header of %" APR_OFF_T_FMT " bytes is too large", size);
+		}
+
+	return data_s;
+}
+
+
+/*
+ * A pax header is a series of "<length> <key>=<value>\n" records. A size
+ * that isn't a valid non-negative number makes the header invalid as the
+ * member's data couldn't be found.
+ */
+static bool ParsePaxHeader (char *data_s, const apr_off_t size, char **name_ss, apr_off_t *size_p, apr_pool_t *pool_p)
+{
+	apr_off_t offset = 0;
+	bool loop_flag = true;
+	bool valid_flag = true;
+
+	while (loop_flag && (offset < size))
+		{
+			char *record_s = data_s + offset;
+			char *end_s = NULL;
+			long record_length = strtol (record_s, &end_s, 10);
+
+			if ((record_length > 0) && (offset + record_length <= size) && (*end_s == ' '))
+				{
+					char *key_s = end_s + 1;
+					char *value_s = strchr (key_s, '=');
+					char *record_end_s = record_s + record_length - 1;
+
+					if ((value_s) && (value_s < record_end_s) && (*record_end_s == '\n'))
+						{
+							*value_s = '\0';
+							++ value_s;
+
+							if (strcmp (key_s, "path") == 0)
+								{
+									*name_ss = apr_pstrmemdup (pool_p, value_s, record_end_s - value_s);
+								}
+							else if (strcmp (key_s, "size") == 0)
+								{
+									char *size_end_s = NULL;
+
+									if ((apr_strtoff (size_p, value_s, &size_end_s, 10) != APR_SUCCESS) || (size_end_s != record_end_s) || (*size_p < 0))
+										{
+											valid_flag = false;
+											loop_flag = false;
+										}
+								}
+						}
+
+					offset += record_length;
+				}
+			else
+				{
+					loop_flag = false;
+				}
+		}
+
+	return valid_flag;
+}
+
+
+/*
+ * Get the iRODS path for a member, rejecting any names that would end up
+ * outside of the target collection.
+ */
+static char *GetMemberPath (ArchiveIngest *ingest_p, const char *name_s, apr_pool_t *pool_p)
+{
+	char *path_s = NULL;
+
+	if (name_s)
+		{
+			char *copy_s = apr_pstrdup (pool_p, name_s);
+			char *state_s = NULL;
+			char *component_s = apr_strtok (copy_s, "/", &state_s);
+			bool valid_flag = true;
+
+			path_s = apr_pstrdup (pool_p, ingest_p -> ai_collection_s);
+
+			while (component_s && valid_flag && path_s)
+				{
+					if (strcmp (component_s, "..") == 0)
+						{
+							valid_flag = false;
+						}
+					else if (strcmp (component_s, ".") != 0)
+						{
+							path_s = apr_pstrcat (pool_p, path_s, "/", component_s, NULL);
+						}
+
+					component_s = apr_strtok (NULL, "/", &state_s);
+				}
+
+			if (!valid_flag || !path_s || (strlen (path_s) >= MAX_NAME_LEN))
+				{
+					path_s = NULL;
+				}
+		}
+
+	return path_s;
+}
+
+
+static int EnsureCollection (ArchiveIngest *ingest_p, const char *collection_s)
+{
+	int status = 0;
+
+	if (!apr_hash_get (ingest_p -> ai_collections_p, collection_s, APR_HASH_KEY_STRING))
+		{
+			collInp_t coll_inp;
+
+			memset (&coll_inp, 0, sizeof (collInp_t));
+			rstrcpy (coll_inp.collName, collection_s, MAX_NAME_LEN);
+			addKeyVal (&coll_inp.condInput, RECURSIVE_OPR__KW, "");
+
+			status = rcCollCreate (ingest_p -> ai_connection_p, &coll_inp);
+
+			clearKeyVal (&coll_inp.condInput);
+
+			if (status == CATALOG_ALREADY_HAS_ITEM_BY_THAT_NAME)
+				{
+					status = 0;
+				}
+
+			if (status >= 0)
+				{
+					const char *key_s = apr_pstrdup (ingest_p -> ai_pool_p, collection_s);
+
+					apr_hash_set (ingest_p -> ai_collections_p, key_s, APR_HASH_KEY_STRING, key_s);
+					ForgetKnownAbsent (ingest_p -> ai_config_p, collection_s);
+				}
+		}
+
+	return status;
+}
+
+
+static int EnsureParentCollection (ArchiveIngest *ingest_p, const char *path_s, apr_pool_t *pool_p)
+{
+	const char *last_slash_s = strrchr (path_s, '/');
+	int status = 0;
+
+	if (last_slash_s && (last_slash_s != path_s))
+		{
+			char *parent_s = apr_pstrmemdup (pool_p, path_s, last_slash_s - path_s);
+
+			status = parent_s ? EnsureCollection (ingest_p, parent_s) : SYS_MALLOC_ERR;
+		}
+
+	return status;
+}
+
+
+/*
+ * Store a member's data as a data object. Members that fit are sent
+ * along with a single put request, larger ones are created and then
+ * written in chunks. The member's data is always read from the body, even
+ * if storing it fails, so that the next member can be found.
+ */
+static apr_status_t IngestDataObject (ArchiveIngest *ingest_p, const char *path_s, const apr_off_t size, int *rods_status_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+	const apr_off_t padding = (TAR_BLOCK_SIZE - (size % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE;
+
+	if (size <= MAX_SZ_FOR_SINGLE_BUF)
+		{
+			char *data_p = apr_palloc (pool_p, size + padding + 1);
+
+			if (data_p)
+				{
+					if ((status = ReadFromBody (ingest_p -> ai_req_p, data_p, size + padding)) == APR_SUCCESS)
+						{
+							*rods_status_p = PutDataObject (ingest_p, path_s, data_p, size, pool_p);
+						}
+				}
+			else
+				{
+					status = APR_ENOMEM;
+				}
+		}
+	else
+		{
+			/*
+			 * When overwriting, the member is written to a temporary data object
+			 * that only replaces the existing one once all of it has been stored,
+			 * so a failed write never removes a data object that was already there.
+			 */
+			const char *write_path_s = (ingest_p -> ai_overwrite_flag) ? GetTemporaryPath (path_s, pool_p) : path_s;
+
+			if (write_path_s)
+				{
+					dataObjInp_t create_params;
+					int fd;
+
+					memset (&create_params, 0, sizeof (dataObjInp_t));
+					rstrcpy (create_params.objPath, write_path_s, MAX_NAME_LEN);
+					create_params.dataSize = size;
+					create_params.oprType = PUT_OPR;
+
+					fd = CreateDataObject (ingest_p, &create_params, NULL, pool_p);
+					clearKeyVal (&create_params.condInput);
+
+					if (fd >= 0)
+						{
+							openedDataObjInp_t data_obj;
+							apr_off_t remaining = size;
+							int close_status;
+
+							memset (&data_obj, 0, sizeof (openedDataObjInp_t));
+							data_obj.l1descInx = fd;
+
+							*rods_status_p = 0;
+
+							while ((remaining > 0) && (status == APR_SUCCESS) && (*rods_status_p >= 0))
+								{
+									apr_size_t chunk_size = (remaining > (apr_off_t) (ingest_p -> ai_buffer_size)) ? ingest_p -> ai_buffer_size : (apr_size_t) remaining;
+
+									if ((status = ReadFromBody (ingest_p -> ai_req_p, ingest_p -> ai_buffer_p, chunk_size)) == APR_SUCCESS)
+										{
+											bytesBuf_t write_buffer;
+											int written;
+
+											write_buffer.len = (int) chunk_size;
+											write_buffer.buf = ingest_p -> ai_buffer_p;
+
+											written = rcDataObjWrite (ingest_p -> ai_connection_p, &data_obj, &write_buffer);
+
+											if (written < 0)
+												{
+													*rods_status_p = written;
+												}
+
+											remaining -= chunk_size;
+										}
+								}
+
+							close_status = rcDataObjClose (ingest_p -> ai_connection_p, &data_obj);
+
+							if ((close_status < 0) && (*rods_status_p >= 0))
+								{
+									*rods_status_p = close_status;
+								}
+
+							if (status == APR_SUCCESS)
+								{
+									/* Carry on past the rest of the member if a write failed */
+									status = SkipBody (ingest_p, remaining + padding);
+								}
+
+							if ((*rods_status_p >= 0) && (status == APR_SUCCESS) && (write_path_s != path_s))
+								{
+									*rods_status_p = ReplaceDataObject (ingest_p, write_path_s, path_s);
+								}
+
+							/*
+							 * Don't leave a partial data object behind. This is always one
+							 * that we created as, without overwriting, the create fails for
+							 * an existing data object.
+							 */
+							if ((*rods_status_p < 0) || (status != APR_SUCCESS))
+								{
+									DeleteDataObject (ingest_p, write_path_s);
+								}
+						}
+					else
+						{
+							*rods_status_p = fd;
+							status = SkipBody (ingest_p, size);
+						}
+				}
+			else
+				{
+					*rods_status_p = USER_STRLEN_TOOLONG;
+					status = SkipBody (ingest_p, size);
+				}
+		}
+
+	return status;
+}
+
+
+static int PutDataObject (ArchiveIngest *ingest_p, const char *path_s, char *data_p, const apr_off_t size, apr_pool_t *pool_p)
+{
+	dataObjInp_t put_params;
+	bytesBuf_t put_buffer;
+	int status;
+
+	memset (&put_params, 0, sizeof (dataObjInp_t));
+	rstrcpy (put_params.objPath, path_s, MAX_NAME_LEN);
+	put_params.dataSize = size;
+	put_params.oprType = PUT_OPR;
+
+	addKeyVal (&put_params.condInput, DATA_INCLUDED_KW, "");
+
+	/* The single put either stores the whole data object or leaves it as it was */
+	if (ingest_p -> ai_overwrite_flag)
+		{
+			addKeyVal (&put_params.condInput, FORCE_FLAG_KW, "");
+		}
+
+	put_buffer.len = (int) size;
+	put_buffer.buf = data_p;
+
+	status = CreateDataObject (ingest_p, &put_params, &put_buffer, pool_p);
+
+	clearKeyVal (&put_params.condInput);
+
+	return status;
+}
+
+
+/*
+ * Create a data object, trying the write resources in turn in the same
+ * way as for uploads. If put_buffer_p is set, the data is sent along with
+ * a single put request, otherwise the data object is opened for writing.
+ */
+static int CreateDataObject (ArchiveIngest *ingest_p, dataObjInp_t *params_p, bytesBuf_t *put_buffer_p, apr_pool_t *pool_p)
+{
+	const apr_array_header_t *resources_p = ingest_p -> ai_write_resources_p;
+	int status;
+
+	if (resources_p && (resources_p -> nelts > 0))
+		{
+			bool try_next_flag = true;
+			int i;
+
+			status = SYS_INVALID_INPUT_PARAM;
+
+			for (i = 0; (i < resources_p -> nelts) && try_next_flag; ++ i)
+				{
+					const char *resource_s = APR_ARRAY_IDX (resources_p, i, const char *);
+
+					rmKeyVal (& (params_p -> condInput), DEST_RESC_NAME_KW);
+					addKeyVal (& (params_p -> condInput), DEST_RESC_NAME_KW, resource_s);
+
+					status = SendCreateRequest (ingest_p, params_p, put_buffer_p);
+
+					if (status >= 0)
+						{
+							AddInFlightUpload (resource_s, params_p -> dataSize, pool_p);
+							try_next_flag = false;
+						}
+					else
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, ingest_p -> ai_req_p, "Creating \"%s\" failed on resource %s: %d = %s", params_p -> objPath, resource_s, status, get_rods_error_msg (status));
+
+							/* Only another resource can help if this one was the problem */
+							try_next_flag = IsWriteResourceError (status);
+						}
+				}
+		}
+	else
+		{
+			const char *resource_s = ingest_p -> ai_config_p -> rods_default_resource;
+
+			if (resource_s && (strlen (resource_s) > 0))
+				{
+					addKeyVal (& (params_p -> condInput), DEST_RESC_NAME_KW, resource_s);
+				}
+
+			status = SendCreateRequest (ingest_p, params_p, put_buffer_p);
+		}
+
+	return status;
+}
+
+
+static int SendCreateRequest (ArchiveIngest *ingest_p, dataObjInp_t *params_p, bytesBuf_t *put_buffer_p)
+{
+	int status;
+
+	if (put_buffer_p)
+		{
+			portalOprOut_t *portal_out_p = NULL;
+
+			status = _rcDataObjPut (ingest_p -> ai_connection_p, params_p, put_buffer_p, &portal_out_p);
+
+			if (portal_out_p)
+				{
+					free (portal_out_p);
+				}
+		}
+	else
+		{
+			status = rcDataObjCreate (ingest_p -> ai_connection_p, params_p);
+		}
+
+	return status;
+}
+
+
+/*
+ * Think up a name in the same collection as path_s that's unlikely to
+ * exist, using the same scheme as the temporary files for uploads.
+ */
+static char *GetTemporaryPath (const char *path_s, apr_pool_t *pool_p)
+{
+	char *temp_path_s = NULL;
+	const char *last_slash_s = strrchr (path_s, '/');
+
+	if (last_slash_s)
+		{
+			temp_path_s = apr_psprintf (pool_p, "%.*s/.davrods-tx-%04x-%08lx", (int) (last_slash_s - path_s), path_s, getpid (), (unsigned long) apr_time_now ());
+
+			if (temp_path_s && (strlen (temp_path_s) >= MAX_NAME_LEN))
+				{
+					temp_path_s = NULL;
+				}
+		}
+
+	return temp_path_s;
+}
+
+
+/*
+ * Move a completely written temporary data object over the member's path.
+ */
+static int ReplaceDataObject (ArchiveIngest *ingest_p, const char *temp_path_s, const char *path_s)
+{
+	dataObjInp_t unlink_params;
+	int status;
+
+	memset (&unlink_params, 0, sizeof (dataObjInp_t));
+	rstrcpy (unlink_params.objPath, path_s, MAX_NAME_LEN);
+	addKeyVal (&unlink_params.condInput, FORCE_FLAG_KW, "");
+
+	status = rcDataObjUnlink (ingest_p -> ai_connection_p, &unlink_params);
+	clearKeyVal (&unlink_params.condInput);
+
+	/* There may not have been anything to replace */
+	if ((status >= 0) || (status == CAT_NO_ROWS_FOUND) || (status == OBJ_PATH_DOES_NOT_EXIST))
+		{
+			dataObjCopyInp_t rename_params;
+
+			memset (&rename_params, 0, sizeof (dataObjCopyInp_t));
+			rename_params.srcDataObjInp.oprType = RENAME_DATA_OBJ;
+			rstrcpy (rename_params.srcDataObjInp.objPath, temp_path_s, MAX_NAME_LEN);
+			rstrcpy (rename_params.destDataObjInp.objPath, path_s, MAX_NAME_LEN);
+
+			status = rcDataObjRename (ingest_p -> ai_connection_p, &rename_params);
+		}
+
+	if (status < 0)
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, ingest_p -> ai_req_p, "Failed to replace \"%s\" with \"%s\": %d = %s", path_s, temp_path_s, status, get_rods_error_msg (status));
+		}
+
+	return status;
+}
+
+
+static void DeleteDataObject (ArchiveIngest *ingest_p, const char *path_s)
+{
+	dataObjInp_t unlink_params;
+
+	memset (&unlink_params, 0, sizeof (dataObjInp_t));
+	rstrcpy (unlink_params.objPath, path_s, MAX_NAME_LEN);
+	addKeyVal (&unlink_params.condInput, FORCE_FLAG_KW, "");
+
+	rcDataObjUnlink (ingest_p -> ai_connection_p, &unlink_params);
+	clearKeyVal (&unlink_params.condInput);
+}
+
+
+static apr_status_t WriteMemberResult (ArchiveIngest *ingest_p, const char *path_s, const char *type_s, const apr_off_t size, const int rods_status, const char *error_s)
+{
+	JSONWriter *writer_p = ingest_p -> ai_writer_p;
+	apr_status_t status;
+
+	if ((rods_status < 0) && (!error_s))
+		{
+			error_s = get_rods_error_msg (rods_status);
+		}
+
+	if (error_s)
+		{
+			++ (ingest_p -> ai_num_failed);
+		}
+	else if (strcmp (type_s, "skipped") != 0)
+		{
+			++ (ingest_p -> ai_num_succeeded);
+		}
+
+	status = BeginJSONObject (writer_p);
+
+	if (status == APR_SUCCESS)
+		{
+			WriteJSONStringMember (writer_p, "path", path_s);
+			WriteJSONStringMember (writer_p, "type", type_s);
+			WriteJSONKey (writer_p, "size");
+			WriteJSONInteger (writer_p, size);
+			WriteJSONKey (writer_p, "status");
+			WriteJSONInteger (writer_p, rods_status);
+
+			if (error_s)
+				{
+					WriteJSONStringMember (writer_p, "error", error_s);
+				}
+
+			status = EndJSONObject (writer_p);
+		}
+
+	return status;
+}
@@ -0,0 +1,69 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * archive_ingest.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef ARCHIVE_INGEST_H_
+#define ARCHIVE_INGEST_H_
+
+#include <stdbool.h>
+
+#include "httpd.h"
+
+#include <irods/rodsClient.h>
+
+#include "config.h"
+#include "json_writer.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Unpack a tar archive sent as the body of a request into a collection.
+ * The archive is read as it arrives rather than being stored first and
+ * each member is written to iRODS before the next one is read. The
+ * result for each member is written as an entry of the current JSON
+ * array, followed by an entry with the number of members that succeeded
+ * and failed.
+ *
+ * @param req_p The request with the archive as its body.
+ * @param connection_p The connection to the iRODS server.
+ * @param collection_s The collection to unpack the archive into. This
+ * will be created if it does not exist.
+ * @param config_p The configuration.
+ * @param overwrite_flag If this is <code>true</code>, existing data
+ * objects will be replaced, otherwise they will be reported as failures.
+ * @param writer_p The JSONWriter to write the results with.
+ * @return APR_SUCCESS if all of the archive was read, an error code
+ * otherwise. Failures for individual members are only reported in the
+ * results.
+ */
+apr_status_t IngestTarArchive (request_rec *req_p, rcComm_t *connection_p, const char *collection_s, const davrods_dir_conf_t *config_p, const bool overwrite_flag, JSONWriter *writer_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ARCHIVE_INGEST_H_ */
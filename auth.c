@@ -22,13 +22,21 @@
 #include "auth.h"
 #include "config.h"
 #include "common.h"
+#include "session_token.h"
+#include "auth_cache.h"
+#include "env_cache.h"
+
+#include <limits.h>
+#include <strings.h>
 
 #include <http_request.h>
+#include <http_protocol.h>
 
 #include <irods/rodsClient.h>
 #include <irods/sslSockComm.h>
 
 #include "http_core.h"
+#include "apr_strings.h"
 #include "mod_session.h"
 
 
@@ -38,11 +46,36 @@ APLOG_USE_MODULE(davrods);
 
 static apr_status_t rods_conn_cleanup (void *mem);
 static authn_status GetIRodsConnection2 (request_rec *req_p, apr_pool_t *pool_p,
-		rcComm_t **connection_pp, const char *username_s, const char *password_s);
+		rcComm_t **connection_pp, const char *username_s, const char *password_s,
+		const char *proxy_username_s);
 
 static int do_rods_login_pam (request_rec *r, rcComm_t *rods_conn,
 		const char *password, int ttl, char **tmp_password);
 
+static const char *GetLastUsedKey (void);
+
+static const char *GetNewLoginNoteKey (void);
+
+static const char *GetCatalogConnectionKey (void);
+
+static const char *GetCatalogLastUsedKey (void);
+
+static const char *GetCatalogBrokenKey (void);
+
+static const char *GetLostConnectionKey (void);
+
+static bool IsMarkedBroken (apr_pool_t *pool_p);
+
+static apr_pool_t *FindDavrodsMemoryPool (apr_pool_t *pool_p);
+
+static void MarkConnectionBroken (apr_pool_t *davrods_pool_p, const rcComm_t *connection_p);
+
+static void DropIRodsConnection (apr_pool_t *pool_p);
+
+static bool ProbeIRodsConnection (request_rec *req_p, rcComm_t *connection_p, const apr_time_t last_used, const apr_time_t now);
+
+static rcComm_t *OpenCatalogConnection (request_rec *req_p, davrods_dir_conf_t *conf_p, const char *username_s);
+
 
 
 
@@ -66,6 +99,59 @@ const char *GetConnectionKey (void)
 	return "rods_conn";
 }
 
+const char *GetBrokenKey (void)
+{
+	return "rods_conn_broken";
+}
+
+/*
+ * The connection that was checked out from the public user pool, which
+ * closes it itself rather than it being closed by the davrods pool.
+ */
+const char *GetPublicConnectionKey (void)
+{
+	return "rods_conn_public";
+}
+
+static const char *GetLastUsedKey (void)
+{
+	return "rods_conn_last_used";
+}
+
+/*
+ * The request note that is set when a request has logged in to iRODS
+ * rather than reusing the connection from an earlier request.
+ */
+static const char *GetNewLoginNoteKey (void)
+{
+	return "davrods_new_login";
+}
+
+static const char *GetCatalogConnectionKey (void)
+{
+	return "rods_catalog_conn";
+}
+
+static const char *GetCatalogLastUsedKey (void)
+{
+	return "rods_catalog_conn_last_used";
+}
+
+static const char *GetCatalogBrokenKey (void)
+{
+	return "rods_catalog_conn_broken";
+}
+
+/*
+ * The key that CheckIRodsConnectionStatus uses to note a lost connection
+ * in a pool that is not made from a request, such as the listing
+ * prefetch thread's, until CheckIRodsPoolStatus passes it on.
+ */
+static const char *GetLostConnectionKey (void)
+{
+	return "rods_conn_lost";
+}
+
 /**
  * \brief iRODS connection cleanup function.
  *
@@ -129,9 +215,13 @@ static int do_rods_login_pam (request_rec *r, rcComm_t *rods_conn,
 
 /**
  * \brief Connect to iRODS and attempt to login.
+ *
+ * If proxy_username is set, the connection is made on behalf of username
+ * by the proxy user, which must be a rodsadmin, and password is the proxy
+ * user's password. The proxy user always uses native authentication.
  */
 static authn_status rods_login (request_rec *r, const char *username,
-		const char *password, rcComm_t **rods_conn)
+		const char *password, const char *proxy_username, rcComm_t **rods_conn)
 {
 	authn_status result = AUTH_USER_NOT_FOUND;
 	// Get config.
@@ -140,32 +230,41 @@ static authn_status rods_login (request_rec *r, const char *username,
 
 	if (conf)
 		{
+			RodsAuthScheme auth_scheme = proxy_username ? DAVRODS_AUTH_NATIVE : conf->rods_auth_scheme;
+
 			ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
-					"Connecting to iRODS using address <%s:%d>, username <%s> and zone <%s>",
-					conf->rods_host, conf->rods_port, username, conf->rods_zone);
+					"Connecting to iRODS using address <%s:%d>, username <%s>%s%s and zone <%s>",
+					conf->rods_host, conf->rods_port, username,
+					proxy_username ? " by proxy user " : "", proxy_username ? proxy_username : "",
+					conf->rods_zone);
 
 
-			// Point the iRODS client library to the webserver's iRODS env file.
-			//setenv("IRODS_ENVIRONMENT_FILE", "/dev/null", 1);
-			setenv ("IRODS_ENVIRONMENT_FILE", conf->rods_env_file, 1);
-
-			ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
-					"Using iRODS env file at <%s>", getenv ("IRODS_ENVIRONMENT_FILE"));
+			// IRODS_ENVIRONMENT_FILE is set once in post_config (see ExportEnvFile),
+			// changing it here would not be safe with a threaded MPM.
 
 			rErrMsg_t rods_errmsg;
-			*rods_conn = rcConnect (conf->rods_host, conf->rods_port, username,
-					conf->rods_zone, 0, &rods_errmsg);
+
+			if (proxy_username)
+				{
+					*rods_conn = _rcConnect (conf->rods_host, conf->rods_port, proxy_username,
+							conf->rods_zone, username, conf->rods_zone, &rods_errmsg, 0, 0);
+				}
+			else
+				{
+					*rods_conn = rcConnect (conf->rods_host, conf->rods_port, username,
+							conf->rods_zone, 0, &rods_errmsg);
+				}
 
 			if (*rods_conn)
 				{
 					ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
 							"Succesfully connected to iRODS zone '%s'", conf->rods_zone);
 
-					miscSvrInfo_t *server_info = NULL;
-					rcGetMiscSvrInfo (*rods_conn, &server_info);
+					const char *server_version = GetCachedServerVersion (r, *rods_conn,
+							conf->rods_host, conf->rods_port);
 
 					ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
-							"Server version: %s", server_info->relVersion);
+							"Server version: %s", server_version ? server_version : "unknown");
 
 					// Whether to use SSL for the entire connection.
 					// Note: SSL is always in effect during PAM auth, regardless of negotiation results.
@@ -212,7 +311,7 @@ static authn_status rods_login (request_rec *r, const char *username,
 					// If the negotiation result requires plain TCP, but we are
 					// using the PAM auth scheme, we need to turn on SSL during
 					// auth.
-					if (!useSsl && conf->rods_auth_scheme == DAVRODS_AUTH_PAM)
+					if (!useSsl && auth_scheme == DAVRODS_AUTH_PAM)
 						{
 							if ((*rods_conn)->ssl)
 								{
@@ -258,21 +357,49 @@ static authn_status rods_login (request_rec *r, const char *username,
 
 					int status = 0;
 
-					if (conf->rods_auth_scheme == DAVRODS_AUTH_PAM)
+					if (auth_scheme == DAVRODS_AUTH_PAM)
 						{
-							char *tmp_password = NULL;
-							status = do_rods_login_pam (r, *rods_conn, password_buf,
-									conf->rods_auth_ttl, &tmp_password);
-							if (!status)
+							// The PAM exchange is the slowest part of logging in, so first try
+							// the temporary password from an earlier login with this password.
+							char *tmp_password = GetCachedTemporaryPassword (r, username,
+									password, conf->rods_zone);
+
+							if (tmp_password)
 								{
-									password_buf = apr_pstrdup (r->pool, tmp_password);
+									status = clientLoginWithPassword (*rods_conn, tmp_password);
 
-									// Login using the received temporary password.
-									status = clientLoginWithPassword (*rods_conn, password_buf);
+									if (status)
+										{
+											ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
+													"Cached temporary password was rejected: %d = %s", status,
+													get_rods_error_msg (status));
+
+											ForgetTemporaryPassword (r, username, password, conf->rods_zone);
+											tmp_password = NULL;
+										}
+								}
+
+							if (!tmp_password)
+								{
+									status = do_rods_login_pam (r, *rods_conn, password_buf,
+											conf->rods_auth_ttl, &tmp_password);
+									if (!status)
+										{
+											password_buf = apr_pstrdup (r->pool, tmp_password);
+
+											// Login using the received temporary password.
+											status = clientLoginWithPassword (*rods_conn, password_buf);
+
+											if (!status)
+												{
+													CacheTemporaryPassword (r, username, password,
+															conf->rods_zone, tmp_password, conf->rods_auth_ttl);
+												}
+										}
 								}
 
 						}
-					else if (conf->rods_auth_scheme == DAVRODS_AUTH_NATIVE)
+					else if (auth_scheme == DAVRODS_AUTH_NATIVE)
 						{
 							status = clientLoginWithPassword (*rods_conn, password_buf);
 						}
@@ -306,7 +433,7 @@ static authn_status rods_login (request_rec *r, const char *username,
 									ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
 											"Disabling SSL (was used for PAM only)");
 
-									if (conf->rods_auth_scheme != DAVRODS_AUTH_PAM)
+									if (auth_scheme != DAVRODS_AUTH_PAM)
 										{
 											// This should not happen.
 											ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, r,
@@ -420,6 +547,486 @@ apr_status_t RodsLogout (request_rec *req_p)
 }
 
 
+bool IsIRodsConnectionError (const int status)
+{
+	bool lost_flag = false;
+
+	if (status < 0)
+		{
+			/* Some iRODS error codes have the errno added to them, so remove it. */
+			const int code = (status / 1000) * 1000;
+
+			switch (code)
+				{
+					case SYS_HEADER_READ_LEN_ERR:
+					case SYS_HEADER_WRITE_LEN_ERR:
+					case SYS_HEADER_TYPE_LEN_ERR:
+					case SYS_SOCK_READ_ERR:
+					case SYS_SOCK_READ_TIMEDOUT:
+					case SYS_SOCK_CONNECT_ERR:
+						lost_flag = true;
+						break;
+
+					default:
+						break;
+				}
+		}
+
+	return lost_flag;
+}
+
+
+void CheckIRodsStatus (request_rec *req_p, const int status)
+{
+	if (IsIRodsConnectionError (status))
+		{
+			apr_pool_t *pool_p = GetDavrodsMemoryPool (req_p);
+
+			ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, req_p,
+					"Lost the iRODS connection: %d = %s", status, get_rods_error_msg (status));
+
+			if (pool_p)
+				{
+					apr_pool_userdata_setn (GetBrokenKey (), GetBrokenKey (), apr_pool_cleanup_null, pool_p);
+				}
+		}
+}
+
+
+void CheckIRodsConnectionStatus (rcComm_t *connection_p, const int status, apr_pool_t *pool_p)
+{
+	if (IsIRodsConnectionError (status))
+		{
+			apr_pool_t *davrods_pool_p = FindDavrodsMemoryPool (pool_p);
+
+			ap_log_perror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, pool_p,
+					"Lost the iRODS connection: %d = %s", status, get_rods_error_msg (status));
+
+			if (davrods_pool_p)
+				{
+					MarkConnectionBroken (davrods_pool_p, connection_p);
+				}
+			else
+				{
+					apr_pool_userdata_setn (connection_p, GetLostConnectionKey (), apr_pool_cleanup_null, pool_p);
+				}
+		}
+}
+
+
+void CheckIRodsPoolStatus (request_rec *req_p, apr_pool_t *pool_p)
+{
+	void *ptr = NULL;
+
+	if ((apr_pool_userdata_get (&ptr, GetLostConnectionKey (), pool_p) == APR_SUCCESS) && ptr)
+		{
+			apr_pool_t *davrods_pool_p = GetDavrodsMemoryPool (req_p);
+
+			if (davrods_pool_p)
+				{
+					MarkConnectionBroken (davrods_pool_p, (const rcComm_t *) ptr);
+				}
+
+			apr_pool_userdata_setn (NULL, GetLostConnectionKey (), apr_pool_cleanup_null, pool_p);
+		}
+}
+
+
+bool IsIRodsConnectionBroken (request_rec *req_p)
+{
+	bool broken_flag = false;
+	apr_pool_t *pool_p = GetDavrodsMemoryPool (req_p);
+
+	if (pool_p)
+		{
+			broken_flag = IsMarkedBroken (pool_p);
+		}
+
+	return broken_flag;
+}
+
+
+void ValidateIRodsConnection (request_rec *req_p, apr_pool_t *pool_p)
+{
+	void *ptr = NULL;
+
+	if ((apr_pool_userdata_get (&ptr, GetConnectionKey (), pool_p) == APR_SUCCESS) && ptr)
+		{
+			rcComm_t *connection_p = (rcComm_t *) ptr;
+			apr_time_t *last_used_p = NULL;
+			const apr_time_t now = apr_time_now ();
+			bool healthy_flag = !IsMarkedBroken (pool_p);
+
+			if ((apr_pool_userdata_get (&ptr, GetLastUsedKey (), pool_p) == APR_SUCCESS) && ptr)
+				{
+					last_used_p = (apr_time_t *) ptr;
+				}
+
+			if (healthy_flag && last_used_p)
+				{
+					healthy_flag = ProbeIRodsConnection (req_p, connection_p, *last_used_p, now);
+				}
+
+			if (healthy_flag)
+				{
+					if (!last_used_p)
+						{
+							last_used_p = (apr_time_t *) apr_palloc (pool_p, sizeof (apr_time_t));
+							apr_pool_userdata_set (last_used_p, GetLastUsedKey (), apr_pool_cleanup_null, pool_p);
+						}
+
+					*last_used_p = now;
+				}
+			else
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_INFO, APR_SUCCESS, req_p, "Dropping lost iRODS connection");
+
+					// This runs rods_conn_cleanup, so the next login makes a new connection.
+					apr_pool_clear (pool_p);
+				}
+		}
+}
+
+
+rcComm_t *ReconnectIRodsConnection (request_rec *req_p)
+{
+	rcComm_t *connection_p = NULL;
+	davrods_dir_conf_t *conf_p = ap_get_module_config (req_p -> per_dir_config, &davrods_module);
+	apr_pool_t *pool_p = GetDavrodsMemoryPool (req_p);
+
+	if (pool_p && conf_p)
+		{
+			const char *username_s = NULL;
+			const char *password_s = NULL;
+
+			ap_log_rerror (APLOG_MARK, APLOG_INFO, APR_SUCCESS, req_p, "Reconnecting to iRODS");
+
+			// Clearing the pool would free the rodsEnv and anything else that
+			// this request is still using, so just drop the connection itself.
+			DropIRodsConnection (pool_p);
+
+			if (IsSessionTokenRequest (req_p))
+				{
+					GetIRodsConnectionForTokenUser (req_p, &connection_p, req_p -> user);
+				}
+			else if ((ap_auth_type (req_p) && (strcasecmp (ap_auth_type (req_p), "Basic") == 0) && (ap_get_basic_auth_pw (req_p, &password_s) == OK)))
+				{
+					GetIRodsConnection (req_p, &connection_p, req_p -> user, password_s);
+				}
+			else if ((GetSessionAuth (req_p, &username_s, &password_s, NULL) == APR_SUCCESS) && username_s && password_s)
+				{
+					GetIRodsConnection (req_p, &connection_p, username_s, password_s);
+				}
+			else
+				{
+					connection_p = GetIRODSConnectionForPublicUser (req_p, pool_p, conf_p);
+				}
+
+			if (!connection_p)
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, req_p, "Failed to reconnect to iRODS");
+				}
+		}
+
+	return connection_p;
+}
+
+
+rcComm_t *GetIRodsCatalogConnection (request_rec *req_p, rcComm_t *data_connection_p)
+{
+	rcComm_t *connection_p = NULL;
+	davrods_dir_conf_t *conf_p = ap_get_module_config (req_p -> per_dir_config, &davrods_module);
+
+	if (conf_p && (conf_p -> catalog_connection > 0) && data_connection_p)
+		{
+			apr_pool_t *pool_p = GetDavrodsMemoryPool (req_p);
+
+			if (pool_p)
+				{
+					void *ptr = NULL;
+					apr_time_t *last_used_p = NULL;
+					const apr_time_t now = apr_time_now ();
+					const char *username_s = data_connection_p -> clientUser.userName;
+
+					if ((apr_pool_userdata_get (&ptr, GetCatalogConnectionKey (), pool_p) == APR_SUCCESS) && ptr)
+						{
+							connection_p = (rcComm_t *) ptr;
+						}
+
+					if ((apr_pool_userdata_get (&ptr, GetCatalogLastUsedKey (), pool_p) == APR_SUCCESS) && ptr)
+						{
+							last_used_p = (apr_time_t *) ptr;
+						}
+
+					/*
+					 * The davrods pool is cleared whenever the data connection changes
+					 * user, but a pooled public user connection can be swapped in without
+					 * that happening, so check that both connections are for the same user.
+					 */
+					if (connection_p)
+						{
+							bool broken_flag = ((apr_pool_userdata_get (&ptr, GetCatalogBrokenKey (), pool_p) == APR_SUCCESS) && ptr);
+
+							if (broken_flag
+									|| (strcmp (connection_p -> clientUser.userName, username_s) != 0)
+									|| (strcmp (connection_p -> clientUser.rodsZone, data_connection_p -> clientUser.rodsZone) != 0)
+									|| (last_used_p && !ProbeIRodsConnection (req_p, connection_p, *last_used_p, now)))
+								{
+									ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, req_p, "Closing iRODS catalog connection for user '%s'", connection_p -> clientUser.userName);
+
+									apr_pool_cleanup_run (pool_p, connection_p, rods_conn_cleanup);
+									apr_pool_userdata_set (NULL, GetCatalogConnectionKey (), apr_pool_cleanup_null, pool_p);
+									apr_pool_userdata_set (NULL, GetCatalogBrokenKey (), apr_pool_cleanup_null, pool_p);
+									connection_p = NULL;
+								}
+						}
+
+					if (!connection_p)
+						{
+							connection_p = OpenCatalogConnection (req_p, conf_p, username_s);
+
+							if (connection_p)
+								{
+									apr_pool_userdata_set (connection_p, GetCatalogConnectionKey (), rods_conn_cleanup, pool_p);
+								}
+						}
+
+					if (connection_p)
+						{
+							if (!last_used_p)
+								{
+									last_used_p = (apr_time_t *) apr_palloc (pool_p, sizeof (apr_time_t));
+									apr_pool_userdata_set (last_used_p, GetCatalogLastUsedKey (), apr_pool_cleanup_null, pool_p);
+								}
+
+							*last_used_p = now;
+						}
+
+				}		/* if (pool_p) */
+
+		}		/* if (conf_p && (conf_p -> catalog_connection > 0) && data_connection_p) */
+
+	return connection_p;
+}
+
+
+const char *SetCatalogConnection (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	if (strcasecmp (arg_p, "true") == 0)
+		{
+			conf_p -> catalog_connection = 1;
+		}
+	else if (strcasecmp (arg_p, "false") == 0)
+		{
+			conf_p -> catalog_connection = -1;
+		}
+
+	return NULL;
+}
+
+
+const char *SetConnectionProbeIdle (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+	apr_int64_t idle = apr_atoi64 (arg_p);
+
+	if ((idle >= 0) && (idle <= INT_MAX))
+		{
+			conf_p -> connection_probe_idle = (int) idle;
+		}
+	else
+		{
+			res_s = apr_psprintf (cmd_p -> pool, "Invalid connection probe idle time \"%s\"", arg_p);
+		}
+
+	return res_s;
+}
+
+
+static bool IsMarkedBroken (apr_pool_t *pool_p)
+{
+	void *ptr = NULL;
+
+	return ((apr_pool_userdata_get (&ptr, GetBrokenKey (), pool_p) == APR_SUCCESS) && ptr);
+}
+
+
+/*
+ * Mark whichever of the cached data and catalog connections is
+ * connection_p so that it is replaced rather than reused.
+ */
+static void MarkConnectionBroken (apr_pool_t *davrods_pool_p, const rcComm_t *connection_p)
+{
+	void *ptr = NULL;
+
+	if ((apr_pool_userdata_get (&ptr, GetConnectionKey (), davrods_pool_p) == APR_SUCCESS) && (ptr == connection_p))
+		{
+			apr_pool_userdata_setn (GetBrokenKey (), GetBrokenKey (), apr_pool_cleanup_null, davrods_pool_p);
+		}
+	else if ((apr_pool_userdata_get (&ptr, GetCatalogConnectionKey (), davrods_pool_p) == APR_SUCCESS) && (ptr == connection_p))
+		{
+			apr_pool_userdata_setn (GetCatalogBrokenKey (), GetCatalogBrokenKey (), apr_pool_cleanup_null, davrods_pool_p);
+		}
+}
+
+
+/*
+ * The request pool and anything made from it are descendants of the
+ * connection pool that GetDavrodsMemoryPool () stores the davrods pool in.
+ * Pools that are not, such as the listing prefetch thread's, give NULL.
+ */
+static apr_pool_t *FindDavrodsMemoryPool (apr_pool_t *pool_p)
+{
+	apr_pool_t *davrods_pool_p = NULL;
+
+	while (pool_p && !davrods_pool_p)
+		{
+			void *ptr = NULL;
+
+			if ((apr_pool_userdata_get (&ptr, GetDavrodsMemoryPoolKey (), pool_p) == APR_SUCCESS) && ptr)
+				{
+					davrods_pool_p = (apr_pool_t *) ptr;
+				}
+			else
+				{
+					pool_p = apr_pool_parent_get (pool_p);
+				}
+		}
+
+	return davrods_pool_p;
+}
+
+
+static void DropIRodsConnection (apr_pool_t *pool_p)
+{
+	void *ptr = NULL;
+
+	if ((apr_pool_userdata_get (&ptr, GetConnectionKey (), pool_p) == APR_SUCCESS) && ptr)
+		{
+			void *public_ptr = NULL;
+
+			apr_pool_userdata_get (&public_ptr, GetPublicConnectionKey (), pool_p);
+
+			/*
+			 * A connection from the public user pool is closed by that pool
+			 * once it sees that the davrods pool no longer holds it.
+			 */
+			if (ptr != public_ptr)
+				{
+					apr_pool_cleanup_run (pool_p, ptr, rods_conn_cleanup);
+				}
+
+			apr_pool_userdata_set (NULL, GetConnectionKey (), apr_pool_cleanup_null, pool_p);
+		}
+
+	apr_pool_userdata_set (NULL, GetBrokenKey (), apr_pool_cleanup_null, pool_p);
+	apr_pool_userdata_set (NULL, GetLastUsedKey (), apr_pool_cleanup_null, pool_p);
+}
+
+
+/*
+ * If DavRodsConnectionProbeIdle is set and the connection has not been used
+ * for longer than that, check that its iRODS agent is still there.
+ */
+static bool ProbeIRodsConnection (request_rec *req_p, rcComm_t *connection_p, const apr_time_t last_used, const apr_time_t now)
+{
+	bool healthy_flag = true;
+	davrods_dir_conf_t *conf_p = ap_get_module_config (req_p -> per_dir_config, &davrods_module);
+
+	if (conf_p && (conf_p -> connection_probe_idle > 0) && (now - last_used > apr_time_from_sec (conf_p -> connection_probe_idle)))
+		{
+			/* This is about the cheapest call there is that needs a round trip to the agent. */
+			miscSvrInfo_t *server_info_p = NULL;
+			int status = rcGetMiscSvrInfo (connection_p, &server_info_p);
+
+			if (server_info_p)
+				{
+					free (server_info_p);
+				}
+
+			if (status < 0)
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, req_p,
+							"iRODS connection failed its liveness probe after %" APR_TIME_T_FMT " seconds idle: %d = %s",
+							apr_time_sec (now - last_used), status, get_rods_error_msg (status));
+
+					healthy_flag = false;
+				}
+		}
+
+	return healthy_flag;
+}
+
+
+/*
+ * Log in a second connection for the user of the data connection, using the
+ * same credentials that ReconnectIRodsConnection would use.
+ */
+static rcComm_t *OpenCatalogConnection (request_rec *req_p, davrods_dir_conf_t *conf_p, const char *username_s)
+{
+	rcComm_t *connection_p = NULL;
+	const char *password_s = NULL;
+	const char *session_username_s = NULL;
+	const char *proxy_username_s = NULL;
+
+	if (IsSessionTokenRequest (req_p))
+		{
+			if (conf_p -> session_token_proxy_username_s)
+				{
+					proxy_username_s = conf_p -> session_token_proxy_username_s;
+					password_s = conf_p -> session_token_proxy_password_s ? conf_p -> session_token_proxy_password_s : "";
+				}
+		}
+	else if ((ap_auth_type (req_p) && (strcasecmp (ap_auth_type (req_p), "Basic") == 0) && (ap_get_basic_auth_pw (req_p, &password_s) == OK)))
+		{
+			if (! (req_p -> user && (strcmp (req_p -> user, username_s) == 0)))
+				{
+					password_s = NULL;
+				}
+		}
+	else if ((GetSessionAuth (req_p, &session_username_s, &password_s, NULL) == APR_SUCCESS) && session_username_s && password_s)
+		{
+			if (strcmp (session_username_s, username_s) != 0)
+				{
+					password_s = NULL;
+				}
+		}
+	else if (conf_p -> davrods_public_username_s && (strcmp (conf_p -> davrods_public_username_s, username_s) == 0))
+		{
+			password_s = conf_p -> davrods_public_password_s ? conf_p -> davrods_public_password_s : "";
+		}
+
+	if (password_s)
+		{
+			authn_status result = rods_login (req_p, username_s, password_s, proxy_username_s, &connection_p);
+
+			if (result == AUTH_GRANTED)
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, req_p, "Opened iRODS catalog connection for user '%s'", username_s);
+				}
+			else
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, req_p, "Failed to open iRODS catalog connection for user '%s': %d", username_s, result);
+
+					if (connection_p)
+						{
+							rcDisconnect (connection_p);
+							connection_p = NULL;
+						}
+				}
+		}
+	else
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, req_p, "No credentials to open an iRODS catalog connection for user '%s'", username_s);
+		}
+
+	return connection_p;
+}
+
+
 /**
  * Get the auth username and password from the main request
  * notes table, if present. This is based upon get_session_auth taken
@@ -483,18 +1090,44 @@ authn_status GetIRodsConnection (request_rec *req_p, rcComm_t **connection_pp,
 
 	if (pool_p)
 		{
-			result = GetIRodsConnection2 (req_p, pool_p, connection_pp, username_s, password_s);
+			result = GetIRodsConnection2 (req_p, pool_p, connection_pp, username_s, password_s, NULL);
+		}
+
+	return result;
+}
+
+
+authn_status GetIRodsConnectionForTokenUser (request_rec *req_p, rcComm_t **connection_pp,
+		const char *username_s)
+{
+	authn_status result = AUTH_USER_NOT_FOUND;
+	davrods_dir_conf_t *conf_p = ap_get_module_config (req_p -> per_dir_config, &davrods_module);
+
+	if ((conf_p) && (conf_p -> session_token_proxy_username_s))
+		{
+			apr_pool_t *pool_p = GetDavrodsMemoryPool (req_p);
+
+			if (pool_p)
+				{
+					const char *password_s = conf_p -> session_token_proxy_password_s ? conf_p -> session_token_proxy_password_s : "";
+
+					result = GetIRodsConnection2 (req_p, pool_p, connection_pp, username_s, password_s, conf_p -> session_token_proxy_username_s);
+				}
 		}
 
 	return result;
 }
 
 static authn_status GetIRodsConnection2 (request_rec *req_p, apr_pool_t *pool_p,
-		rcComm_t **connection_pp, const char *username_s, const char *password_s)
+		rcComm_t **connection_pp, const char *username_s, const char *password_s,
+		const char *proxy_username_s)
 {
 	authn_status result = AUTH_USER_NOT_FOUND;
+	davrods_dir_conf_t *conf_p = ap_get_module_config (req_p -> per_dir_config, &davrods_module);
+	rcComm_t *connection_p = NULL;
 
-	rcComm_t *connection_p = GetIRODSConnectionFromPool (pool_p);
+	ValidateIRodsConnection (req_p, pool_p);
+	connection_p = GetIRODSConnectionFromPool (pool_p);
 
 
 	if (connection_p)
@@ -534,10 +1167,29 @@ static authn_status GetIRodsConnection2 (request_rec *req_p, apr_pool_t *pool_p,
 				}
 		}
 
-	if (result == AUTH_USER_NOT_FOUND)
+	if ((result == AUTH_USER_NOT_FOUND) && (!proxy_username_s)
+			&& IsLoginThrottled (req_p, username_s, password_s, conf_p -> rods_zone))
+		{
+			// Refuse repeated failures without bothering iRODS and its PAM stack.
+			result = AUTH_DENIED;
+		}
+	else if (result == AUTH_USER_NOT_FOUND)
 		{
 			// User is not yet authenticated.
-			result = rods_login (req_p, username_s, password_s, &connection_p);
+			result = rods_login (req_p, username_s, password_s, proxy_username_s, &connection_p);
+
+			if (!proxy_username_s)
+				{
+					if (result == AUTH_DENIED)
+						{
+							RecordFailedLogin (req_p, username_s, password_s, conf_p -> rods_zone,
+									conf_p -> failed_login_backoff, conf_p -> failed_login_max_backoff);
+						}
+					else if (result == AUTH_GRANTED)
+						{
+							RecordSuccessfulLogin (req_p, username_s, password_s, conf_p -> rods_zone);
+						}
+				}
 
 			if (result == AUTH_GRANTED)
 				{
@@ -566,18 +1218,17 @@ static authn_status GetIRodsConnection2 (request_rec *req_p, apr_pool_t *pool_p,
 									// Get iRODS env and store it.
 									rodsEnv *env_p = apr_palloc (pool_p, sizeof(rodsEnv));
 
-									int status = getRodsEnv (env_p);
-
-									if (status == 0)
+									if (GetCachedRodsEnv (req_p, conf_p -> rods_env_file, env_p))
 										{
 											apr_pool_userdata_set (env_p, GetRodsEnvKey (),
 													apr_pool_cleanup_null, pool_p);
+											apr_table_setn (req_p -> notes, GetNewLoginNoteKey (), "true");
 										}
 									else
 										{
 											ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS,
-													req_p, "Failed to get the iRODS environment, %d",
-													status);
+													req_p, "Failed to get the iRODS environment from %s",
+													conf_p -> rods_env_file);
 											result = AUTH_GENERAL_ERROR;
 
 											rods_conn_cleanup (connection_p);
@@ -630,6 +1281,13 @@ static authn_status check_rods (request_rec *req_p, const char *username,
 
 			result = GetIRodsConnection (req_p, &rods_connection_p, username,	password);
 
+			// Only hand out a new token when the password was actually checked by
+			// iRODS, not on every request that reuses the connection.
+			if ((result == AUTH_GRANTED) && apr_table_get (req_p -> notes, GetNewLoginNoteKey ()))
+				{
+					IssueSessionToken (req_p, username);
+				}
+
 		}
 	else
 		{
@@ -40,6 +40,12 @@ const char *GetRodsEnvKey (void);
 const char *GetConnectionKey (void);
 
 
+const char *GetBrokenKey (void);
+
+
+const char *GetPublicConnectionKey (void);
+
+
 void davrods_auth_register(apr_pool_t *p);
 
 
@@ -49,9 +55,97 @@ apr_pool_t *GetDavrodsMemoryPool (request_rec *req_p);
 authn_status GetIRodsConnection (request_rec *req_p, rcComm_t **connection_pp, const char *username_s, const char *password_s);
 
 
+/**
+ * Get a connection for a user that was authenticated by a session token.
+ * If there is no cached connection for the user, a new one is made by the
+ * session token proxy user so the user's password is not needed.
+ */
+authn_status GetIRodsConnectionForTokenUser (request_rec *req_p, rcComm_t **connection_pp, const char *username_s);
+
+
 apr_status_t RodsLogout (request_rec *req_p);
 
 
+/**
+ * Check whether an iRODS status code means that the connection to the
+ * iRODS agent has been lost, e.g. because the server was restarted or
+ * the connection was reaped while idle.
+ */
+bool IsIRodsConnectionError (const int status);
+
+
+/**
+ * Check the status code from an iRODS call and, if the connection has
+ * been lost, mark the cached connection so that it is replaced rather
+ * than reused.
+ */
+void CheckIRodsStatus (request_rec *req_p, const int status);
+
+
+/**
+ * Like CheckIRodsStatus but for code that only has a pool, such as the
+ * catalog queries. Whichever of the cached data and catalog connections
+ * is connection_p is marked. If pool_p is not made from the request pool,
+ * the lost connection is noted in pool_p for CheckIRodsPoolStatus.
+ */
+void CheckIRodsConnectionStatus (rcComm_t *connection_p, const int status, apr_pool_t *pool_p);
+
+
+/**
+ * Mark any connection that CheckIRodsConnectionStatus noted as lost in
+ * a pool that is not made from the request pool, such as one used by
+ * another thread, once that pool is no longer in use elsewhere.
+ */
+void CheckIRodsPoolStatus (request_rec *req_p, apr_pool_t *pool_p);
+
+
+/**
+ * Check whether the cached connection has been marked as lost by
+ * CheckIRodsStatus.
+ */
+bool IsIRodsConnectionBroken (request_rec *req_p);
+
+
+/**
+ * Drop the cached connection in the davrods pool if it has been marked
+ * as lost or, if DavRodsConnectionProbeIdle is set and the connection
+ * has been idle for longer than that, if it fails a liveness probe.
+ */
+void ValidateIRodsConnection (request_rec *req_p, apr_pool_t *pool_p);
+
+
+/**
+ * Replace a lost connection with a new one for the same user, logging
+ * in again with the credentials sent with the current request. Only the
+ * connection is dropped from the davrods pool, so anything else that
+ * the request has taken from it, such as the rodsEnv, stays valid.
+ *
+ * @return The new connection or NULL if it could not be made.
+ */
+rcComm_t *ReconnectIRodsConnection (request_rec *req_p);
+
+
+/**
+ * Get a second connection for the user of the data connection that can be
+ * used for catalog queries, such as metadata and checksum lookups, at the
+ * same time as the data connection is paging through a listing or moving
+ * data. It is kept in the davrods pool alongside the data connection.
+ *
+ * @param req_p The request.
+ * @param data_connection_p The request's data connection.
+ * @return The catalog connection or NULL if DavRodsCatalogConnection is
+ * not turned on or the connection could not be made, in which case
+ * everything should stay on the data connection.
+ */
+rcComm_t *GetIRodsCatalogConnection (request_rec *req_p, rcComm_t *data_connection_p);
+
+
+const char *SetCatalogConnection (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+const char *SetConnectionProbeIdle (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
 apr_status_t GetSessionAuth (request_rec *req_p, const char **user_ss, const char **password_ss, const char **hash_ss);
 
 
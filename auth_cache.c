@@ -0,0 +1,736 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * auth_cache.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdbool.h>
+#include <limits.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include "auth_cache.h"
+#include "config.h"
+
+#include "apr_atomic.h"
+#include "apr_global_mutex.h"
+#include "apr_shm.h"
+#include "apr_strings.h"
+
+#include "ap_provider.h"
+#include "ap_socache.h"
+#include "http_log.h"
+#include "http_protocol.h"
+#include "mod_status.h"
+#include "util_mutex.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+#define AUTH_CACHE_SALT_LENGTH (32)
+
+
+/*
+ * The temporary passwords are stored XORed with a key derived from the
+ * user's own password, so they are limited to the length of that key.
+ */
+#define AUTH_CACHE_MAX_VALUE_LENGTH (SHA512_DIGEST_LENGTH)
+
+
+/** The longest that any failed login is remembered for, as a number of doublings of its backoff. */
+#define AUTH_CACHE_MAX_BACKOFF_SHIFT (20)
+
+
+/** The number of failed logins for a credential, user or address and when they can next log in. */
+typedef struct FailedLogins
+{
+	apr_uint32_t fl_count;
+	apr_time_t fl_until;
+} FailedLogins;
+
+
+/** The counters shown on the server-status page. */
+typedef struct AuthCacheStats
+{
+	apr_uint32_t acs_num_cached_logins;
+	apr_uint32_t acs_num_stored;
+	apr_uint32_t acs_num_failed_logins;
+	apr_uint32_t acs_num_throttled_logins;
+} AuthCacheStats;
+
+
+static const char * const S_MUTEX_TYPE_S = "davrods-auth-cache";
+
+/** The default longest time in seconds to refuse logins for after failures. */
+static const apr_int64_t S_DEFAULT_MAX_BACKOFF = 300;
+
+/** Stop using a temporary password this long before iRODS expires it. */
+static const apr_interval_time_t S_EXPIRY_MARGIN = apr_time_from_sec (60);
+
+/**
+ * How many failures for the exact credential, for a user and from an
+ * address are allowed before their logins are refused. Other users'
+ * mistakes count towards the user and address limits, so these are
+ * higher, especially for addresses which can be shared by everyone
+ * behind a NAT gateway or proxy.
+ */
+static const apr_uint32_t S_CREDENTIAL_FAILURE_THRESHOLD = 1;
+static const apr_uint32_t S_USER_FAILURE_THRESHOLD = 5;
+static const apr_uint32_t S_ADDRESS_FAILURE_THRESHOLD = 20;
+
+
+static const ap_socache_provider_t *s_provider_p = NULL;
+
+static ap_socache_instance_t *s_instance_p = NULL;
+
+static apr_global_mutex_t *s_mutex_p = NULL;
+
+static bool s_ready_flag = false;
+
+static apr_shm_t *s_shm_p = NULL;
+
+static AuthCacheStats *s_stats_p = NULL;
+
+/** Random data added to every hash so they can't be compared across restarts. */
+static unsigned char s_salt [AUTH_CACHE_SALT_LENGTH];
+
+
+static bool GetDigest (const EVP_MD *md_p, const char *purpose_s, const char *username_s, const char *password_s, const char *zone_s, unsigned char *digest_p);
+
+static void GetFailedLoginIds (const char *username_s, const char *password_s, const char *zone_s, const char *address_s, unsigned char ids [3][SHA256_DIGEST_LENGTH]);
+
+static bool GetFailedLogins (request_rec *req_p, const unsigned char *id_p, FailedLogins *failures_p);
+
+static void AddFailedLogin (request_rec *req_p, const unsigned char *id_p, const apr_uint32_t threshold, const int initial_backoff, const int max_backoff);
+
+static bool IsCredentialCached (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s);
+
+static void CreateAuthCacheStats (apr_pool_t *pool_p, server_rec *server_p);
+
+static apr_status_t LockAuthCache (void);
+
+static void UnlockAuthCache (void);
+
+static apr_status_t DestroyAuthCache (void *data_p);
+
+
+
+apr_status_t RegisterAuthCacheMutex (apr_pool_t *pool_p)
+{
+	/* Forget any cache from the previous configuration as its pool has gone */
+	s_provider_p = NULL;
+	s_instance_p = NULL;
+	s_mutex_p = NULL;
+	s_ready_flag = false;
+
+	return ap_mutex_register (pool_p, S_MUTEX_TYPE_S, NULL, APR_LOCK_DEFAULT, 0);
+}
+
+
+apr_status_t InitAuthCache (apr_pool_t *pool_p, server_rec *server_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	s_ready_flag = false;
+
+	CreateAuthCacheStats (pool_p, server_p);
+
+	if (s_provider_p)
+		{
+			status = apr_generate_random_bytes (s_salt, sizeof (s_salt));
+
+			if (status == APR_SUCCESS)
+				{
+					if (s_provider_p -> flags & AP_SOCACHE_FLAG_NOTMPSAFE)
+						{
+							status = ap_global_mutex_create (&s_mutex_p, NULL, S_MUTEX_TYPE_S, NULL, server_p, pool_p, 0);
+						}
+					else
+						{
+							s_mutex_p = NULL;
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							struct ap_socache_hints hints;
+
+							memset (&hints, 0, sizeof (struct ap_socache_hints));
+							hints.avg_id_len = SHA256_DIGEST_LENGTH;
+							hints.avg_obj_len = 32;
+							hints.expiry_interval = apr_time_from_sec (60);
+
+							status = s_provider_p -> init (s_instance_p, S_MUTEX_TYPE_S, &hints, server_p, pool_p);
+
+							if (status == APR_SUCCESS)
+								{
+									apr_pool_cleanup_register (pool_p, server_p, DestroyAuthCache, apr_pool_cleanup_null);
+									s_ready_flag = true;
+								}
+							else
+								{
+									ap_log_error (APLOG_MARK, APLOG_ERR, status, server_p, "Failed to initialise the %s authentication cache", s_provider_p -> name);
+								}
+						}
+					else
+						{
+							ap_log_error (APLOG_MARK, APLOG_ERR, status, server_p, "Failed to create the authentication cache mutex");
+						}
+				}
+			else
+				{
+					ap_log_error (APLOG_MARK, APLOG_ERR, status, server_p, "Failed to generate the authentication cache salt");
+				}
+		}
+
+	return status;
+}
+
+
+void InitAuthCacheChild (apr_pool_t *pool_p, server_rec *server_p)
+{
+	if (s_ready_flag && s_mutex_p)
+		{
+			apr_status_t status = apr_global_mutex_child_init (&s_mutex_p, apr_global_mutex_lockfile (s_mutex_p), pool_p);
+
+			if (status != APR_SUCCESS)
+				{
+					ap_log_error (APLOG_MARK, APLOG_ERR, status, server_p, "Failed to attach to the authentication cache mutex, the cache is disabled");
+					s_ready_flag = false;
+				}
+		}
+}
+
+
+char *GetCachedTemporaryPassword (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s)
+{
+	char *temporary_password_s = NULL;
+
+	if (s_ready_flag)
+		{
+			unsigned char id [SHA256_DIGEST_LENGTH];
+
+			if (GetDigest (EVP_sha256 (), "id", username_s, password_s, zone_s, id))
+				{
+					unsigned char value [AUTH_CACHE_MAX_VALUE_LENGTH];
+					unsigned int value_length = sizeof (value);
+					apr_status_t status = LockAuthCache ();
+
+					if (status == APR_SUCCESS)
+						{
+							status = s_provider_p -> retrieve (s_instance_p, req_p -> server, id, sizeof (id), value, &value_length, req_p -> pool);
+							UnlockAuthCache ();
+
+							if (status == APR_SUCCESS)
+								{
+									unsigned char key [SHA512_DIGEST_LENGTH];
+
+									if (GetDigest (EVP_sha512 (), "value", username_s, password_s, zone_s, key))
+										{
+											temporary_password_s = (char *) apr_palloc (req_p -> pool, value_length + 1);
+
+											if (temporary_password_s)
+												{
+													unsigned int i;
+
+													for (i = 0; i < value_length; ++ i)
+														{
+															temporary_password_s [i] = (char) (value [i] ^ key [i]);
+														}
+
+													temporary_password_s [value_length] = '\0';
+
+													if (s_stats_p)
+														{
+															apr_atomic_inc32 (& (s_stats_p -> acs_num_cached_logins));
+														}
+
+													ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, req_p, "Using cached PAM temporary password for \"%s\"", username_s);
+												}
+										}
+
+									OPENSSL_cleanse (key, sizeof (key));
+								}
+							else if (status != APR_NOTFOUND)
+								{
+									ap_log_rerror (APLOG_MARK, APLOG_WARNING, status, req_p, "Failed to read from the authentication cache");
+								}
+
+							OPENSSL_cleanse (value, sizeof (value));
+						}
+					else
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_WARNING, status, req_p, "Failed to lock the authentication cache");
+						}
+				}
+		}
+
+	return temporary_password_s;
+}
+
+
+void CacheTemporaryPassword (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s, const char *temporary_password_s, const int ttl_hours)
+{
+	const size_t length = strlen (temporary_password_s);
+
+	if (s_ready_flag && (ttl_hours > 0) && (length > 0) && (length <= AUTH_CACHE_MAX_VALUE_LENGTH))
+		{
+			unsigned char id [SHA256_DIGEST_LENGTH];
+			unsigned char key [SHA512_DIGEST_LENGTH];
+
+			if (GetDigest (EVP_sha256 (), "id", username_s, password_s, zone_s, id) && GetDigest (EVP_sha512 (), "value", username_s, password_s, zone_s, key))
+				{
+					unsigned char value [AUTH_CACHE_MAX_VALUE_LENGTH];
+					const apr_time_t expiry = apr_time_now () + apr_time_from_sec ((apr_time_t) ttl_hours * 60 * 60) - S_EXPIRY_MARGIN;
+					apr_status_t status;
+					size_t i;
+
+					for (i = 0; i < length; ++ i)
+						{
+							value [i] = ((unsigned char) temporary_password_s [i]) ^ key [i];
+						}
+
+					status = LockAuthCache ();
+
+					if (status == APR_SUCCESS)
+						{
+							status = s_provider_p -> store (s_instance_p, req_p -> server, id, sizeof (id), expiry, value, (unsigned int) length, req_p -> pool);
+							UnlockAuthCache ();
+						}
+
+					if ((status == APR_SUCCESS) && (s_stats_p))
+						{
+							apr_atomic_inc32 (& (s_stats_p -> acs_num_stored));
+						}
+
+					if (status != APR_SUCCESS)
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_WARNING, status, req_p, "Failed to cache PAM temporary password for \"%s\"", username_s);
+						}
+
+					OPENSSL_cleanse (value, sizeof (value));
+				}
+
+			OPENSSL_cleanse (key, sizeof (key));
+		}
+}
+
+
+void ForgetTemporaryPassword (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s)
+{
+	if (s_ready_flag)
+		{
+			unsigned char id [SHA256_DIGEST_LENGTH];
+
+			if (GetDigest (EVP_sha256 (), "id", username_s, password_s, zone_s, id))
+				{
+					if (LockAuthCache () == APR_SUCCESS)
+						{
+							s_provider_p -> remove (s_instance_p, req_p -> server, id, sizeof (id), req_p -> pool);
+							UnlockAuthCache ();
+						}
+				}
+		}
+}
+
+
+bool IsLoginThrottled (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s)
+{
+	bool throttled_flag = false;
+
+	/* A credential that has already been accepted by iRODS is never refused */
+	if (s_ready_flag && (!IsCredentialCached (req_p, username_s, password_s, zone_s)))
+		{
+			unsigned char ids [3][SHA256_DIGEST_LENGTH];
+			apr_time_t until = 0;
+			int i;
+
+			GetFailedLoginIds (username_s, password_s, zone_s, req_p -> useragent_ip, ids);
+
+			for (i = 0; i < 3; ++ i)
+				{
+					FailedLogins failures;
+
+					if (GetFailedLogins (req_p, ids [i], &failures))
+						{
+							if (failures.fl_until > until)
+								{
+									until = failures.fl_until;
+								}
+						}
+				}
+
+			if (until > apr_time_now ())
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_INFO, APR_SUCCESS, req_p, "Refusing login for \"%s\" from %s for another %" APR_TIME_T_FMT " seconds after failed logins", username_s, req_p -> useragent_ip, apr_time_sec (until - apr_time_now ()) + 1);
+
+					if (s_stats_p)
+						{
+							apr_atomic_inc32 (& (s_stats_p -> acs_num_throttled_logins));
+						}
+
+					throttled_flag = true;
+				}
+		}
+
+	return throttled_flag;
+}
+
+
+void RecordFailedLogin (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s, const int initial_backoff, const int max_backoff)
+{
+	if (s_stats_p)
+		{
+			apr_atomic_inc32 (& (s_stats_p -> acs_num_failed_logins));
+		}
+
+	if (s_ready_flag && (initial_backoff > 0))
+		{
+			unsigned char ids [3][SHA256_DIGEST_LENGTH];
+
+			GetFailedLoginIds (username_s, password_s, zone_s, req_p -> useragent_ip, ids);
+
+			AddFailedLogin (req_p, ids [0], S_CREDENTIAL_FAILURE_THRESHOLD, initial_backoff, max_backoff);
+			AddFailedLogin (req_p, ids [1], S_USER_FAILURE_THRESHOLD, initial_backoff, max_backoff);
+			AddFailedLogin (req_p, ids [2], S_ADDRESS_FAILURE_THRESHOLD, initial_backoff, max_backoff);
+		}
+}
+
+
+void RecordSuccessfulLogin (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s)
+{
+	if (s_ready_flag)
+		{
+			unsigned char ids [3][SHA256_DIGEST_LENGTH];
+
+			GetFailedLoginIds (username_s, password_s, zone_s, req_p -> useragent_ip, ids);
+
+			/*
+			 * Only the credential and the user are forgotten, other clients at the
+			 * same address may still be failing.
+			 */
+			if (LockAuthCache () == APR_SUCCESS)
+				{
+					s_provider_p -> remove (s_instance_p, req_p -> server, ids [0], SHA256_DIGEST_LENGTH, req_p -> pool);
+					s_provider_p -> remove (s_instance_p, req_p -> server, ids [1], SHA256_DIGEST_LENGTH, req_p -> pool);
+					UnlockAuthCache ();
+				}
+		}
+}
+
+
+int PrintAuthCacheStats (request_rec *req_p, int flags)
+{
+	if (s_stats_p)
+		{
+			const apr_uint32_t num_cached_logins = apr_atomic_read32 (& (s_stats_p -> acs_num_cached_logins));
+			const apr_uint32_t num_stored = apr_atomic_read32 (& (s_stats_p -> acs_num_stored));
+			const apr_uint32_t num_failed_logins = apr_atomic_read32 (& (s_stats_p -> acs_num_failed_logins));
+			const apr_uint32_t num_throttled_logins = apr_atomic_read32 (& (s_stats_p -> acs_num_throttled_logins));
+
+			if (flags & AP_STATUS_SHORT)
+				{
+					ap_rprintf (req_p, "DavrodsAuth: cached_logins=%u cached_passwords=%u failed_logins=%u throttled_logins=%u\n",
+						num_cached_logins, num_stored, num_failed_logins, num_throttled_logins);
+				}
+			else
+				{
+					ap_rputs ("<hr />\n<h2>Davrods authentication</h2>\n", req_p);
+					ap_rputs ("<table border=\"0\">\n<tr><th>Logins using cached passwords</th><th>Passwords cached</th><th>Failed logins</th><th>Throttled logins</th></tr>\n", req_p);
+					ap_rprintf (req_p, "<tr><td>%u</td><td>%u</td><td>%u</td><td>%u</td></tr>\n</table>\n",
+						num_cached_logins, num_stored, num_failed_logins, num_throttled_logins);
+				}
+		}
+
+	return OK;
+}
+
+
+const char *SetAuthCache (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = ap_check_cmd_context (cmd_p, GLOBAL_ONLY);
+
+	if (!res_s)
+		{
+			if (strcasecmp (arg_p, "none") == 0)
+				{
+					s_provider_p = NULL;
+					s_instance_p = NULL;
+				}
+			else
+				{
+					/* The value is "provider" or "provider:arguments" as for SSLSessionCache */
+					const char *separator_s = ap_strchr_c (arg_p, ':');
+					const char *name_s = separator_s ? apr_pstrmemdup (cmd_p -> pool, arg_p, separator_s - arg_p) : arg_p;
+					const char *args_s = separator_s ? separator_s + 1 : NULL;
+					const ap_socache_provider_t *provider_p = ap_lookup_provider (AP_SOCACHE_PROVIDER_GROUP, name_s, AP_SOCACHE_PROVIDER_VERSION);
+
+					if (provider_p)
+						{
+							ap_socache_instance_t *instance_p = NULL;
+							const char *error_s = provider_p -> create (&instance_p, args_s, cmd_p -> temp_pool, cmd_p -> pool);
+
+							if (!error_s)
+								{
+									s_provider_p = provider_p;
+									s_instance_p = instance_p;
+								}
+							else
+								{
+									res_s = apr_psprintf (cmd_p -> pool, "Failed to create the authentication cache: %s", error_s);
+								}
+						}
+					else
+						{
+							res_s = apr_psprintf (cmd_p -> pool, "Unknown authentication cache type \"%s\", is mod_socache_%s loaded?", name_s, name_s);
+						}
+				}
+		}
+
+	return res_s;
+}
+
+
+const char *SetFailedLoginBackoff (cmd_parms *cmd_p, void *config_p, const char *initial_s, const char *max_s)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+	apr_int64_t initial_backoff = apr_atoi64 (initial_s);
+	apr_int64_t max_backoff = max_s ? apr_atoi64 (max_s) : S_DEFAULT_MAX_BACKOFF;
+
+	if ((initial_backoff >= 0) && (initial_backoff <= INT_MAX) && (max_backoff >= initial_backoff) && (max_backoff <= INT_MAX))
+		{
+			conf_p -> failed_login_backoff = (int) initial_backoff;
+			conf_p -> failed_login_max_backoff = (int) max_backoff;
+		}
+	else
+		{
+			res_s = apr_psprintf (cmd_p -> pool, "Invalid failed login backoff \"%s\" \"%s\"", initial_s, max_s ? max_s : "");
+		}
+
+	return res_s;
+}
+
+
+/*
+ * Hash the salt and the user's details along with what the hash is used
+ * for, so the cache id and the key for the value are unrelated.
+ */
+static bool GetDigest (const EVP_MD *md_p, const char *purpose_s, const char *username_s, const char *password_s, const char *zone_s, unsigned char *digest_p)
+{
+	bool success_flag = false;
+	EVP_MD_CTX *context_p = EVP_MD_CTX_new ();
+
+	if (context_p)
+		{
+			unsigned int length = 0;
+
+			/* Include the terminating '\0's so that the fields can't run into each other */
+			if ((EVP_DigestInit_ex (context_p, md_p, NULL) == 1)
+				&& (EVP_DigestUpdate (context_p, s_salt, sizeof (s_salt)) == 1)
+				&& (EVP_DigestUpdate (context_p, purpose_s, strlen (purpose_s) + 1) == 1)
+				&& (EVP_DigestUpdate (context_p, username_s, strlen (username_s) + 1) == 1)
+				&& (EVP_DigestUpdate (context_p, zone_s, strlen (zone_s) + 1) == 1)
+				&& (EVP_DigestUpdate (context_p, password_s, strlen (password_s) + 1) == 1)
+				&& (EVP_DigestFinal_ex (context_p, digest_p, &length) == 1))
+				{
+					success_flag = true;
+				}
+
+			EVP_MD_CTX_free (context_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * The failed logins are tracked for the exact credential, for the user
+ * and for the client's address.
+ */
+static void GetFailedLoginIds (const char *username_s, const char *password_s, const char *zone_s, const char *address_s, unsigned char ids [3][SHA256_DIGEST_LENGTH])
+{
+	GetDigest (EVP_sha256 (), "failed-credential", username_s, password_s, zone_s, ids [0]);
+	GetDigest (EVP_sha256 (), "failed-user", username_s, "", zone_s, ids [1]);
+	GetDigest (EVP_sha256 (), "failed-address", address_s ? address_s : "", "", "", ids [2]);
+}
+
+
+static bool GetFailedLogins (request_rec *req_p, const unsigned char *id_p, FailedLogins *failures_p)
+{
+	bool found_flag = false;
+
+	if (LockAuthCache () == APR_SUCCESS)
+		{
+			unsigned int length = sizeof (FailedLogins);
+
+			if (s_provider_p -> retrieve (s_instance_p, req_p -> server, id_p, SHA256_DIGEST_LENGTH, (unsigned char *) failures_p, &length, req_p -> pool) == APR_SUCCESS)
+				{
+					found_flag = (length == sizeof (FailedLogins));
+				}
+
+			UnlockAuthCache ();
+		}
+
+	return found_flag;
+}
+
+
+/*
+ * Once there have been threshold failures, each further failure doubles
+ * the time before the next attempt is allowed, up to max_backoff seconds.
+ */
+static void AddFailedLogin (request_rec *req_p, const unsigned char *id_p, const apr_uint32_t threshold, const int initial_backoff, const int max_backoff)
+{
+	if (LockAuthCache () == APR_SUCCESS)
+		{
+			FailedLogins failures;
+			unsigned int length = sizeof (FailedLogins);
+			apr_time_t backoff = 0;
+			apr_time_t max_backoff_time = apr_time_from_sec (max_backoff > initial_backoff ? max_backoff : initial_backoff);
+			apr_uint32_t shift;
+
+			if ((s_provider_p -> retrieve (s_instance_p, req_p -> server, id_p, SHA256_DIGEST_LENGTH, (unsigned char *) &failures, &length, req_p -> pool) != APR_SUCCESS) || (length != sizeof (FailedLogins)))
+				{
+					memset (&failures, 0, sizeof (FailedLogins));
+				}
+
+			++ (failures.fl_count);
+
+			if (failures.fl_count >= threshold)
+				{
+					shift = failures.fl_count - threshold;
+
+					if (shift > AUTH_CACHE_MAX_BACKOFF_SHIFT)
+						{
+							shift = AUTH_CACHE_MAX_BACKOFF_SHIFT;
+						}
+
+					backoff = apr_time_from_sec ((apr_time_t) initial_backoff) << shift;
+
+					if (backoff > max_backoff_time)
+						{
+							backoff = max_backoff_time;
+						}
+
+					failures.fl_until = apr_time_now () + backoff;
+				}
+			else
+				{
+					failures.fl_until = 0;
+				}
+
+			/* Keep the count for a while after the backoff so that repeated failures keep growing it */
+			s_provider_p -> store (s_instance_p, req_p -> server, id_p, SHA256_DIGEST_LENGTH, apr_time_now () + backoff + max_backoff_time, (unsigned char *) &failures, sizeof (FailedLogins), req_p -> pool);
+
+			UnlockAuthCache ();
+		}
+}
+
+
+/*
+ * Check whether a credential has a cached PAM temporary password, which
+ * means that iRODS has already accepted it.
+ */
+static bool IsCredentialCached (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s)
+{
+	bool cached_flag = false;
+	unsigned char id [SHA256_DIGEST_LENGTH];
+
+	if (GetDigest (EVP_sha256 (), "id", username_s, password_s, zone_s, id))
+		{
+			if (LockAuthCache () == APR_SUCCESS)
+				{
+					unsigned char value [AUTH_CACHE_MAX_VALUE_LENGTH];
+					unsigned int value_length = sizeof (value);
+
+					cached_flag = (s_provider_p -> retrieve (s_instance_p, req_p -> server, id, sizeof (id), value, &value_length, req_p -> pool) == APR_SUCCESS);
+					UnlockAuthCache ();
+
+					OPENSSL_cleanse (value, sizeof (value));
+				}
+		}
+
+	return cached_flag;
+}
+
+
+static void CreateAuthCacheStats (apr_pool_t *pool_p, server_rec *server_p)
+{
+	apr_status_t status = apr_shm_create (&s_shm_p, sizeof (AuthCacheStats), NULL, pool_p);
+
+	if (status == APR_ENOTIMPL)
+		{
+			/* Anonymous shared memory isn't available so use a named segment instead */
+			const char *filename_s = ap_runtime_dir_relative (pool_p, "davrods-auth-stats");
+
+			apr_shm_remove (filename_s, pool_p);
+			status = apr_shm_create (&s_shm_p, sizeof (AuthCacheStats), filename_s, pool_p);
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			s_stats_p = (AuthCacheStats *) apr_shm_baseaddr_get (s_shm_p);
+			memset (s_stats_p, 0, sizeof (AuthCacheStats));
+		}
+	else
+		{
+			ap_log_error (APLOG_MARK, APLOG_ERR, status, server_p, "Failed to create the shared memory for the authentication statistics");
+			s_stats_p = NULL;
+		}
+}
+
+
+static apr_status_t LockAuthCache (void)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	if (s_mutex_p)
+		{
+			status = apr_global_mutex_lock (s_mutex_p);
+		}
+
+	return status;
+}
+
+
+static void UnlockAuthCache (void)
+{
+	if (s_mutex_p)
+		{
+			apr_global_mutex_unlock (s_mutex_p);
+		}
+}
+
+
+static apr_status_t DestroyAuthCache (void *data_p)
+{
+	server_rec *server_p = (server_rec *) data_p;
+
+	if (s_provider_p && s_instance_p)
+		{
+			s_provider_p -> destroy (s_instance_p, server_p);
+		}
+
+	s_ready_flag = false;
+
+	return APR_SUCCESS;
+}
@@ -0,0 +1,177 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * auth_cache.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef AUTH_CACHE_H_
+#define AUTH_CACHE_H_
+
+#include <stdbool.h>
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "apr_pools.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Register the mutex used by the authentication cache. This is called
+ * from the pre_config hook so that it can be configured with the
+ * Mutex directive.
+ *
+ * @param pool_p The configuration pool.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t RegisterAuthCacheMutex (apr_pool_t *pool_p);
+
+
+/**
+ * Set up the shared cache of PAM temporary passwords, if one has been
+ * configured. This is called from the post_config hook so that every
+ * child process shares the same cache.
+ *
+ * @param pool_p The configuration pool.
+ * @param server_p The server.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t InitAuthCache (apr_pool_t *pool_p, server_rec *server_p);
+
+
+/**
+ * Reattach to the authentication cache's mutex in a new child process.
+ *
+ * @param pool_p The child pool.
+ * @param server_p The server.
+ */
+void InitAuthCacheChild (apr_pool_t *pool_p, server_rec *server_p);
+
+
+/**
+ * Get the PAM temporary password that was issued the last time that
+ * a user logged in with the same password.
+ *
+ * @param req_p The request that is logging in.
+ * @param username_s The username.
+ * @param password_s The password that the user sent.
+ * @param zone_s The iRODS zone.
+ * @return The temporary password or <code>NULL</code> if there isn't
+ * an unexpired one in the cache.
+ */
+char *GetCachedTemporaryPassword (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s);
+
+
+/**
+ * Store a PAM temporary password so that later logins with the same
+ * password can use it instead of going through PAM again.
+ *
+ * @param req_p The request that logged in.
+ * @param username_s The username.
+ * @param password_s The password that the user sent.
+ * @param zone_s The iRODS zone.
+ * @param temporary_password_s The temporary password issued by iRODS.
+ * @param ttl_hours The number of hours that the temporary password is
+ * valid for.
+ */
+void CacheTemporaryPassword (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s, const char *temporary_password_s, const int ttl_hours);
+
+
+/**
+ * Remove a cached PAM temporary password after iRODS has rejected it.
+ *
+ * @param req_p The request that tried to log in.
+ * @param username_s The username.
+ * @param password_s The password that the user sent.
+ * @param zone_s The iRODS zone.
+ */
+void ForgetTemporaryPassword (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s);
+
+
+/**
+ * Check whether a login should be refused straight away because of
+ * recent failed logins with the same credential, for the same user or
+ * from the same address. A credential with a cached PAM temporary
+ * password is never refused.
+ *
+ * @param req_p The request that is logging in.
+ * @param username_s The username.
+ * @param password_s The password that the user sent.
+ * @param zone_s The iRODS zone.
+ * @return <code>true</code> if the login should be refused without
+ * contacting iRODS, <code>false</code> otherwise.
+ */
+bool IsLoginThrottled (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s);
+
+
+/**
+ * Record that iRODS rejected a login, so that further logins with
+ * the same credential are refused for a time that doubles with each
+ * failure. Logins for the same user or from the same address are
+ * refused in the same way once they have had several failures.
+ *
+ * @param req_p The request that tried to log in.
+ * @param username_s The username.
+ * @param password_s The password that the user sent.
+ * @param zone_s The iRODS zone.
+ * @param initial_backoff The number of seconds to refuse logins for
+ * after the first failure. If this is 0 only the failure is counted.
+ * @param max_backoff The most seconds to refuse logins for.
+ */
+void RecordFailedLogin (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s, const int initial_backoff, const int max_backoff);
+
+
+/**
+ * Forget the failed logins for a user after they have logged in.
+ *
+ * @param req_p The request that logged in.
+ * @param username_s The username.
+ * @param password_s The password that the user sent.
+ * @param zone_s The iRODS zone.
+ */
+void RecordSuccessfulLogin (request_rec *req_p, const char *username_s, const char *password_s, const char *zone_s);
+
+
+/**
+ * Print the authentication counters as part of the mod_status
+ * server-status page.
+ *
+ * @param req_p The request for the status page.
+ * @param flags The mod_status flags.
+ * @return OK.
+ */
+int PrintAuthCacheStats (request_rec *req_p, int flags);
+
+
+const char *SetAuthCache (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+const char *SetFailedLoginBackoff (cmd_parms *cmd_p, void *config_p, const char *initial_s, const char *max_s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUTH_CACHE_H_ */
@@ -0,0 +1,1072 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * collection_listing.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "collection_listing.h"
+#include "common.h"
+#include "auth.h"
+
+#include "apr_strings.h"
+
+#include "irods/rodsErrorTable.h"
+#include "irods/rcMisc.h"
+
+
+static const char * const S_SORT_KEYS_SS [LSK_NUM_KEYS] = { "name", "size", "date", "owner" };
+
+
+/*
+ * The columns to get for each data object and collection. The column
+ * used for sorting, if any, is moved to the front of these when the
+ * query is built so that it is the primary ORDER BY term.
+ */
+static const int S_DATA_OBJECT_COLUMNS_P [] = { COL_D_DATA_ID, COL_DATA_NAME, COL_COLL_NAME, COL_DATA_REPL_NUM, COL_DATA_SIZE, COL_D_OWNER_NAME, COL_D_RESC_NAME, COL_D_CREATE_TIME, COL_D_MODIFY_TIME, COL_D_DATA_CHECKSUM, -1 };
+
+/*
+ * The number of data object ids to put into each of the queries used
+ * to find the preferred replicas.
+ */
+static const int S_REPLICA_BATCH_SIZE = 64;
+
+/*
+ * A replica's rank is its resource's preference index multiplied by this
+ * plus its replica number, so replicas on the same resource are ordered
+ * by their replica numbers.
+ */
+static const int S_RESOURCE_RANK_STEP = 65536;
+
+static const int S_COLLECTION_COLUMNS_P [] = { COL_COLL_ID, COL_COLL_NAME, COL_COLL_OWNER_NAME, COL_COLL_CREATE_TIME, COL_COLL_MODIFY_TIME, -1 };
+
+
+/********************************/
+
+static bool IsSafeQueryValue (const char *value_s);
+
+static char *EscapeLikeValue (const char *value_s, apr_pool_t *pool_p);
+
+static int GetSortColumn (const ListingSortKey key, const ListingPhase phase);
+
+static int AddSelectColumns (genQueryInp_t *query_p, const int *columns_p, const int sort_column, const bool ascending_flag, const int name_column);
+
+static int AddConditions (genQueryInp_t *query_p, const CollectionListing *listing_p, const ListingPhase phase);
+
+static char *GetConditionValue (const char *current_condition_s, const char *op_s, const char *value_s, apr_pool_t *pool_p);
+
+static int CountDataObjects (CollectionListing *listing_p, apr_size_t *num_data_objects_p, apr_size_t *num_replicas_p);
+
+static int StartListingPhase (CollectionListing *listing_p, ListingPhase phase);
+
+static int RunListingQuery (CollectionListing *listing_p);
+
+static void FinishListingQuery (CollectionListing *listing_p);
+
+static void SetCollEntryFromResults (collEnt_t *entry_p, const genQueryOut_t *results_p, const int row, const ListingPhase phase);
+
+static int SetUpResourceFiltering (CollectionListing *listing_p);
+
+static int GetResourceRank (const CollectionListing *listing_p, const char *resource_s);
+
+static int GetReplicaRank (const CollectionListing *listing_p, const char *resource_s, const char *repl_num_s);
+
+static void UpdateReplicaRank (CollectionListing *listing_p, const char *id_s, const int rank);
+
+static int SetReplicaRanksForPage (CollectionListing *listing_p);
+
+static bool IsPreferredReplica (const CollectionListing *listing_p, const int row);
+
+/********************************/
+
+
+void InitListingOptions (ListingOptions *options_p)
+{
+	options_p -> lo_sort_key = LSK_NAME;
+	options_p -> lo_ascending_flag = true;
+	options_p -> lo_name_filter_s = NULL;
+	options_p -> lo_extension_filter_s = NULL;
+	options_p -> lo_offset = 0;
+	options_p -> lo_limit = 0;
+	options_p -> lo_resources_ss = NULL;
+	options_p -> lo_watched_name_s = NULL;
+}
+
+
+bool IsFullListing (const ListingOptions *options_p)
+{
+	return ((options_p -> lo_name_filter_s == NULL) && (options_p -> lo_extension_filter_s == NULL) && (options_p -> lo_offset == 0) && (options_p -> lo_limit == 0));
+}
+
+
+apr_status_t SetListingOptionsFromParameters (ListingOptions *options_p, apr_table_t *params_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	if (params_p)
+		{
+			const char *value_s = GetParameterValue (params_p, "sort", pool_p);
+
+			if (value_s)
+				{
+					ListingSortKey key = LSK_NAME;
+
+					while ((key < LSK_NUM_KEYS) && (strcmp (value_s, S_SORT_KEYS_SS [key]) != 0))
+						{
+							++ key;
+						}
+
+					if (key < LSK_NUM_KEYS)
+						{
+							options_p -> lo_sort_key = key;
+						}
+					else
+						{
+							ap_log_perror (APLOG_MARK, APLOG_ERR, APR_BADARG, pool_p, "Unknown listing sort key \"%s\"", value_s);
+							status = APR_BADARG;
+						}
+				}
+
+			value_s = GetParameterValue (params_p, "order", pool_p);
+			if (value_s)
+				{
+					if (strcmp (value_s, "asc") == 0)
+						{
+							options_p -> lo_ascending_flag = true;
+						}
+					else if (strcmp (value_s, "desc") == 0)
+						{
+							options_p -> lo_ascending_flag = false;
+						}
+					else
+						{
+							ap_log_perror (APLOG_MARK, APLOG_ERR, APR_BADARG, pool_p, "Unknown listing sort order \"%s\"", value_s);
+							status = APR_BADARG;
+						}
+				}
+
+			value_s = GetParameterValue (params_p, "name", pool_p);
+			if (value_s && (*value_s != '\0'))
+				{
+					options_p -> lo_name_filter_s = value_s;
+				}
+
+			value_s = GetParameterValue (params_p, "ext", pool_p);
+			if (value_s)
+				{
+					/* Allow the extension to be given as either ".csv" or "csv" */
+					if (*value_s == '.')
+						{
+							++ value_s;
+						}
+
+					if (*value_s != '\0')
+						{
+							options_p -> lo_extension_filter_s = value_s;
+						}
+				}
+
+			value_s = GetParameterValue (params_p, "offset", pool_p);
+			if (value_s)
+				{
+					apr_int64_t i;
+
+					errno = 0;
+					i = apr_strtoi64 (value_s, NULL, 10);
+
+					if ((errno == 0) && (i >= 0))
+						{
+							options_p -> lo_offset = (apr_size_t) i;
+						}
+					else
+						{
+							ap_log_perror (APLOG_MARK, APLOG_ERR, APR_BADARG, pool_p, "Invalid listing offset \"%s\"", value_s);
+							status = APR_BADARG;
+						}
+				}
+
+			value_s = GetParameterValue (params_p, "limit", pool_p);
+			if (value_s)
+				{
+					apr_int64_t i;
+
+					errno = 0;
+					i = apr_strtoi64 (value_s, NULL, 10);
+
+					if ((errno == 0) && (i >= 0))
+						{
+							options_p -> lo_limit = (apr_size_t) i;
+						}
+					else
+						{
+							ap_log_perror (APLOG_MARK, APLOG_ERR, APR_BADARG, pool_p, "Invalid listing limit \"%s\"", value_s);
+							status = APR_BADARG;
+						}
+				}
+
+		}		/* if (params_p) */
+
+	return status;
+}
+
+
+int OpenCollectionListing (CollectionListing *listing_p, const char *collection_s, const ListingOptions *options_p, rcComm_t *connection_p, apr_pool_t *pool_p)
+{
+	int status = 0;
+
+	memset (listing_p, 0, sizeof (CollectionListing));
+
+	listing_p -> cl_connection_p = connection_p;
+	listing_p -> cl_collection_s = collection_s;
+	listing_p -> cl_options_p = options_p;
+	listing_p -> cl_phase = LP_DONE;
+	listing_p -> cl_remaining = options_p -> lo_limit;
+	listing_p -> cl_pool_p = pool_p;
+	listing_p -> cl_watched_name_found_flag = false;
+
+	/*
+	 * GenQuery has no way of escaping a quote within a condition
+	 * value so we can't safely build the query for these.
+	 */
+	if (IsSafeQueryValue (collection_s) && IsSafeQueryValue (options_p -> lo_name_filter_s) && IsSafeQueryValue (options_p -> lo_extension_filter_s))
+		{
+			if (apr_pool_create (& (listing_p -> cl_page_pool_p), pool_p) != APR_SUCCESS)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to create the page pool for listing \"%s\"", collection_s);
+					listing_p -> cl_page_pool_p = NULL;
+					status = SYS_MALLOC_ERR;
+				}
+			else if (options_p -> lo_resources_ss)
+				{
+					status = SetUpResourceFiltering (listing_p);
+				}
+
+			if (status == 0)
+				{
+					ListingPhase start_phase = LP_DATA_OBJECTS;
+
+					/*
+					 * Since the data objects are listed first, we need to know how
+					 * many of them there are to know where the requested window
+					 * starts.
+					 */
+					if (options_p -> lo_offset > 0)
+						{
+							apr_size_t num_data_objects = 0;
+							apr_size_t num_replicas = 0;
+
+							status = CountDataObjects (listing_p, &num_data_objects, &num_replicas);
+
+							if (status == 0)
+								{
+									if (options_p -> lo_offset >= num_data_objects)
+										{
+											start_phase = LP_COLLECTIONS;
+											listing_p -> cl_collection_offset = options_p -> lo_offset - num_data_objects;
+										}
+									else if (num_replicas == num_data_objects)
+										{
+											/* Each row is a distinct data object so the server can skip them */
+											listing_p -> cl_data_offset = options_p -> lo_offset;
+										}
+									else
+										{
+											listing_p -> cl_data_skip = options_p -> lo_offset;
+										}
+								}
+						}
+
+					if (status == 0)
+						{
+							status = StartListingPhase (listing_p, start_phase);
+
+							/* An empty listing is not an error */
+							if (status == CAT_NO_ROWS_FOUND)
+								{
+									status = 0;
+								}
+							else if (status < 0)
+								{
+									FinishListingQuery (listing_p);
+								}
+						}
+
+				}		/* if (status == 0) */
+
+		}
+	else
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_BADARG, pool_p, "Cannot list \"%s\" as it or its filters contain a quote", collection_s);
+			status = SYS_INVALID_INPUT_PARAM;
+		}
+
+	return status;
+}
+
+
+int ReadCollectionListing (CollectionListing *listing_p, collEnt_t *entry_p)
+{
+	int status = CAT_NO_ROWS_FOUND;
+	bool loop_flag = true;
+
+	while (loop_flag)
+		{
+			if ((listing_p -> cl_phase == LP_DONE) || ((listing_p -> cl_options_p -> lo_limit > 0) && (listing_p -> cl_remaining == 0)))
+				{
+					status = CAT_NO_ROWS_FOUND;
+					loop_flag = false;
+				}
+			else if ((listing_p -> cl_results_p) && (listing_p -> cl_current_row < listing_p -> cl_results_p -> rowCnt))
+				{
+					/* Skip over any replicas that aren't the preferred one for their data object */
+					if ((listing_p -> cl_phase == LP_DATA_OBJECTS) && (!IsPreferredReplica (listing_p, listing_p -> cl_current_row)))
+						{
+							++ (listing_p -> cl_current_row);
+						}
+					else if ((listing_p -> cl_phase == LP_DATA_OBJECTS) && (listing_p -> cl_data_skip > 0))
+						{
+							/* This data object is before the start of the requested window */
+							-- (listing_p -> cl_data_skip);
+							++ (listing_p -> cl_current_row);
+						}
+					else
+						{
+							SetCollEntryFromResults (entry_p, listing_p -> cl_results_p, listing_p -> cl_current_row, listing_p -> cl_phase);
+							++ (listing_p -> cl_current_row);
+
+							if ((listing_p -> cl_phase == LP_DATA_OBJECTS) && (listing_p -> cl_options_p -> lo_watched_name_s) && (entry_p -> dataName))
+								{
+									if ((entry_p -> dataSize > 0) && (strcmp (entry_p -> dataName, listing_p -> cl_options_p -> lo_watched_name_s) == 0))
+										{
+											listing_p -> cl_watched_name_found_flag = true;
+										}
+								}
+
+							if (listing_p -> cl_options_p -> lo_limit > 0)
+								{
+									-- (listing_p -> cl_remaining);
+								}
+
+							status = 0;
+							loop_flag = false;
+						}
+				}
+			else if ((listing_p -> cl_results_p) && (listing_p -> cl_results_p -> continueInx > 0))
+				{
+					/* Get the next page of results for the current phase */
+					listing_p -> cl_query.continueInx = listing_p -> cl_results_p -> continueInx;
+					freeGenQueryOut (& (listing_p -> cl_results_p));
+
+					status = RunListingQuery (listing_p);
+
+					if (status == CAT_NO_ROWS_FOUND)
+						{
+							status = StartListingPhase (listing_p, listing_p -> cl_phase + 1);
+						}
+
+					if ((status != 0) && (status != CAT_NO_ROWS_FOUND))
+						{
+							loop_flag = false;
+						}
+				}
+			else
+				{
+					status = StartListingPhase (listing_p, listing_p -> cl_phase + 1);
+
+					if ((status != 0) && (status != CAT_NO_ROWS_FOUND))
+						{
+							loop_flag = false;
+						}
+				}
+
+		}		/* while (loop_flag) */
+
+	return status;
+}
+
+
+void CloseCollectionListing (CollectionListing *listing_p)
+{
+	FinishListingQuery (listing_p);
+	listing_p -> cl_phase = LP_DONE;
+
+	if (listing_p -> cl_page_pool_p)
+		{
+			apr_pool_destroy (listing_p -> cl_page_pool_p);
+			listing_p -> cl_page_pool_p = NULL;
+		}
+}
+
+
+/********************************/
+
+
+static bool IsSafeQueryValue (const char *value_s)
+{
+	return ((value_s == NULL) || (strchr (value_s, '\'') == NULL));
+}
+
+
+/*
+ * Escape the characters that are wildcards in a like condition so that
+ * the value only matches itself.
+ */
+static char *EscapeLikeValue (const char *value_s, apr_pool_t *pool_p)
+{
+	char *escaped_s = (char *) apr_palloc (pool_p, (2 * strlen (value_s)) + 1);
+	char *dest_p = escaped_s;
+
+	while (*value_s != '\0')
+		{
+			if ((*value_s == '%') || (*value_s == '_') || (*value_s == '\\'))
+				{
+					*dest_p = '\\';
+					++ dest_p;
+				}
+
+			*dest_p = *value_s;
+			++ dest_p;
+			++ value_s;
+		}
+
+	*dest_p = '\0';
+
+	return escaped_s;
+}
+
+
+static int GetSortColumn (const ListingSortKey key, const ListingPhase phase)
+{
+	int column = -1;
+
+	switch (key)
+		{
+			case LSK_NAME:
+				column = (phase == LP_DATA_OBJECTS) ? COL_DATA_NAME : COL_COLL_NAME;
+				break;
+
+			case LSK_SIZE:
+				/* Collections have no size so fall back to their names */
+				column = (phase == LP_DATA_OBJECTS) ? COL_DATA_SIZE : COL_COLL_NAME;
+				break;
+
+			case LSK_MODIFIED_TIME:
+				column = (phase == LP_DATA_OBJECTS) ? COL_D_MODIFY_TIME : COL_COLL_MODIFY_TIME;
+				break;
+
+			case LSK_OWNER:
+				column = (phase == LP_DATA_OBJECTS) ? COL_D_OWNER_NAME : COL_COLL_OWNER_NAME;
+				break;
+
+			default:
+				break;
+		}
+
+	return column;
+}
+
+
+/*
+ * GenQuery builds its ORDER BY clause from the flagged select columns in
+ * the order that they were added, so the sort column goes first followed
+ * by the name as the tie-breaker.
+ */
+static int AddSelectColumns (genQueryInp_t *query_p, const int *columns_p, const int sort_column, const bool ascending_flag, const int name_column)
+{
+	int success_code = addInxIval (& (query_p -> selectInp), sort_column, ascending_flag ? ORDER_BY : ORDER_BY_DESC);
+
+	if ((success_code == 0) && (sort_column != name_column))
+		{
+			success_code = addInxIval (& (query_p -> selectInp), name_column, ORDER_BY);
+		}
+
+	while ((*columns_p != -1) && (success_code == 0))
+		{
+			if ((*columns_p != sort_column) && (*columns_p != name_column))
+				{
+					success_code = addInxIval (& (query_p -> selectInp), *columns_p, 1);
+				}
+
+			++ columns_p;
+		}
+
+	return success_code;
+}
+
+
+static char *GetConditionValue (const char *current_condition_s, const char *op_s, const char *value_s, apr_pool_t *pool_p)
+{
+	char *condition_s = NULL;
+
+	if (current_condition_s)
+		{
+			condition_s = apr_psprintf (pool_p, "%s && %s '%s'", current_condition_s, op_s, value_s);
+		}
+	else
+		{
+			condition_s = apr_psprintf (pool_p, "%s '%s'", op_s, value_s);
+		}
+
+	return condition_s;
+}
+
+
+static int AddConditions (genQueryInp_t *query_p, const CollectionListing *listing_p, const ListingPhase phase)
+{
+	int success_code = -1;
+	apr_pool_t *pool_p = listing_p -> cl_pool_p;
+	const ListingOptions *options_p = listing_p -> cl_options_p;
+	const char *collection_s = listing_p -> cl_collection_s;
+	char *value_s = GetConditionValue (NULL, "=", collection_s, pool_p);
+
+	if (phase == LP_DATA_OBJECTS)
+		{
+			success_code = addInxVal (& (query_p -> sqlCondInp), COL_COLL_NAME, value_s);
+
+			if (success_code == 0)
+				{
+					char *name_condition_s = NULL;
+
+					if (options_p -> lo_name_filter_s)
+						{
+							char *pattern_s = apr_pstrcat (pool_p, "%", EscapeLikeValue (options_p -> lo_name_filter_s, pool_p), "%", NULL);
+							name_condition_s = GetConditionValue (name_condition_s, "like", pattern_s, pool_p);
+						}
+
+					if (options_p -> lo_extension_filter_s)
+						{
+							char *pattern_s = apr_pstrcat (pool_p, "%.", EscapeLikeValue (options_p -> lo_extension_filter_s, pool_p), NULL);
+							name_condition_s = GetConditionValue (name_condition_s, "like", pattern_s, pool_p);
+						}
+
+					if (name_condition_s)
+						{
+							success_code = addInxVal (& (query_p -> sqlCondInp), COL_DATA_NAME, name_condition_s);
+						}
+
+					if ((success_code == 0) && (listing_p -> cl_resources_condition_s))
+						{
+							success_code = addInxVal (& (query_p -> sqlCondInp), COL_D_RESC_NAME, listing_p -> cl_resources_condition_s);
+						}
+				}
+		}
+	else
+		{
+			success_code = addInxVal (& (query_p -> sqlCondInp), COL_COLL_PARENT_NAME, value_s);
+
+			if (success_code == 0)
+				{
+					const bool root_flag = (strcmp (collection_s, "/") == 0);
+					char *name_condition_s = NULL;
+
+					/* The root collection is its own parent */
+					if (root_flag)
+						{
+							name_condition_s = GetConditionValue (name_condition_s, "<>", "/", pool_p);
+						}
+
+					if (options_p -> lo_name_filter_s)
+						{
+							char *pattern_s = apr_pstrcat (pool_p, EscapeLikeValue (collection_s, pool_p), root_flag ? "" : "/", "%", EscapeLikeValue (options_p -> lo_name_filter_s, pool_p), "%", NULL);
+							name_condition_s = GetConditionValue (name_condition_s, "like", pattern_s, pool_p);
+						}
+
+					if (name_condition_s)
+						{
+							success_code = addInxVal (& (query_p -> sqlCondInp), COL_COLL_NAME, name_condition_s);
+						}
+				}
+		}
+
+	return success_code;
+}
+
+
+/*
+ * Count both the distinct data objects and the replica rows that the data
+ * objects phase will return for them. Counting the data id column would
+ * only give us the latter, so we go through the (id, replica number) rows
+ * ordered by id and count each id once.
+ */
+static int CountDataObjects (CollectionListing *listing_p, apr_size_t *num_data_objects_p, apr_size_t *num_replicas_p)
+{
+	genQueryInp_t query;
+	genQueryOut_t *results_p = NULL;
+	apr_int64_t last_id = -1;
+	int status;
+
+	*num_data_objects_p = 0;
+	*num_replicas_p = 0;
+
+	memset (&query, 0, sizeof (genQueryInp_t));
+	query.maxRows = MAX_SQL_ROWS;
+
+	if ((status = addInxIval (& (query.selectInp), COL_D_DATA_ID, ORDER_BY)) == 0)
+		{
+			if ((status = addInxIval (& (query.selectInp), COL_DATA_REPL_NUM, 1)) == 0)
+				{
+					status = AddConditions (&query, listing_p, LP_DATA_OBJECTS);
+				}
+		}
+
+	if (status == 0)
+		{
+			do
+				{
+					status = rcGenQuery (listing_p -> cl_connection_p, &query, &results_p);
+					CheckIRodsConnectionStatus (listing_p -> cl_connection_p, status, listing_p -> cl_pool_p);
+
+					if (status == 0)
+						{
+							int i;
+
+							for (i = 0; i < results_p -> rowCnt; ++ i)
+								{
+									const char *id_s = GetGenQueryResultValue (results_p, COL_D_DATA_ID, i);
+
+									if (id_s)
+										{
+											const apr_int64_t id = apr_atoi64 (id_s);
+
+											if (id != last_id)
+												{
+													++ (*num_data_objects_p);
+													last_id = id;
+												}
+										}
+
+									++ (*num_replicas_p);
+								}
+
+							query.continueInx = results_p -> continueInx;
+							freeGenQueryOut (&results_p);
+						}
+				}
+			while ((status == 0) && (query.continueInx > 0));
+		}
+
+	if (status == CAT_NO_ROWS_FOUND)
+		{
+			status = 0;
+		}
+	else if (status != 0)
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, listing_p -> cl_pool_p, "Failed to count the data objects in \"%s\", %s", listing_p -> cl_collection_s, get_rods_error_msg (status));
+		}
+
+	freeGenQueryOut (&results_p);
+	clearGenQueryInp (&query);
+
+	return status;
+}
+
+
+/*
+ * Move the listing on to the given phase, skipping over any phases that
+ * are not needed or that have no matching entries.
+ */
+static int StartListingPhase (CollectionListing *listing_p, ListingPhase phase)
+{
+	int status = CAT_NO_ROWS_FOUND;
+	const ListingOptions *options_p = listing_p -> cl_options_p;
+
+	FinishListingQuery (listing_p);
+
+	while ((status == CAT_NO_ROWS_FOUND) && (phase != LP_DONE))
+		{
+			/* Collections don't have extensions */
+			if ((phase == LP_COLLECTIONS) && (options_p -> lo_extension_filter_s))
+				{
+					phase = LP_DONE;
+				}
+			else
+				{
+					genQueryInp_t *query_p = & (listing_p -> cl_query);
+					const int name_column = (phase == LP_DATA_OBJECTS) ? COL_DATA_NAME : COL_COLL_NAME;
+					const int *columns_p = (phase == LP_DATA_OBJECTS) ? S_DATA_OBJECT_COLUMNS_P : S_COLLECTION_COLUMNS_P;
+
+					listing_p -> cl_phase = phase;
+					query_p -> rowOffset = (phase == LP_DATA_OBJECTS) ? listing_p -> cl_data_offset : listing_p -> cl_collection_offset;
+
+					status = AddSelectColumns (query_p, columns_p, GetSortColumn (options_p -> lo_sort_key, phase), options_p -> lo_ascending_flag, name_column);
+
+					if (status == 0)
+						{
+							status = AddConditions (query_p, listing_p, phase);
+
+							if (status == 0)
+								{
+									status = RunListingQuery (listing_p);
+								}
+						}
+
+					if (status == CAT_NO_ROWS_FOUND)
+						{
+							FinishListingQuery (listing_p);
+							++ phase;
+						}
+				}
+
+		}		/* while ((status == CAT_NO_ROWS_FOUND) && (phase != LP_DONE)) */
+
+	listing_p -> cl_phase = phase;
+
+	return status;
+}
+
+
+static int RunListingQuery (CollectionListing *listing_p)
+{
+	int status;
+	genQueryInp_t *query_p = & (listing_p -> cl_query);
+
+	/* Only ask for as many rows as are still needed */
+	if ((listing_p -> cl_options_p -> lo_limit > 0) && (listing_p -> cl_remaining < MAX_SQL_ROWS) && (listing_p -> cl_data_skip == 0))
+		{
+			query_p -> maxRows = (int) (listing_p -> cl_remaining);
+		}
+	else
+		{
+			query_p -> maxRows = MAX_SQL_ROWS;
+		}
+
+	status = rcGenQuery (listing_p -> cl_connection_p, query_p, & (listing_p -> cl_results_p));
+	CheckIRodsConnectionStatus (listing_p -> cl_connection_p, status, listing_p -> cl_pool_p);
+
+	/* The row offset only applies to the first page of results */
+	query_p -> rowOffset = 0;
+	listing_p -> cl_current_row = 0;
+
+	if (status == 0)
+		{
+			if (listing_p -> cl_phase == LP_DATA_OBJECTS)
+				{
+					status = SetReplicaRanksForPage (listing_p);
+				}
+		}
+	else if (status != CAT_NO_ROWS_FOUND)
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, listing_p -> cl_pool_p, "Listing query failed for \"%s\", %s", listing_p -> cl_collection_s, get_rods_error_msg (status));
+		}
+
+	return status;
+}
+
+
+static void FinishListingQuery (CollectionListing *listing_p)
+{
+	genQueryInp_t *query_p = & (listing_p -> cl_query);
+
+	/*
+	 * If we've stopped before the end of the results, tell the
+	 * server that it can close the statement.
+	 */
+	if ((listing_p -> cl_results_p) && (listing_p -> cl_results_p -> continueInx > 0))
+		{
+			query_p -> continueInx = listing_p -> cl_results_p -> continueInx;
+			query_p -> maxRows = 0;
+
+			freeGenQueryOut (& (listing_p -> cl_results_p));
+			rcGenQuery (listing_p -> cl_connection_p, query_p, & (listing_p -> cl_results_p));
+		}
+
+	freeGenQueryOut (& (listing_p -> cl_results_p));
+	clearGenQueryInp (query_p);
+	memset (query_p, 0, sizeof (genQueryInp_t));
+
+	listing_p -> cl_current_row = 0;
+}
+
+
+static void SetCollEntryFromResults (collEnt_t *entry_p, const genQueryOut_t *results_p, const int row, const ListingPhase phase)
+{
+	memset (entry_p, 0, sizeof (collEnt_t));
+
+	if (phase == LP_DATA_OBJECTS)
+		{
+			const char *value_s = GetGenQueryResultValue (results_p, COL_DATA_SIZE, row);
+
+			entry_p -> objType = DATA_OBJ_T;
+			entry_p -> dataId = GetGenQueryResultValue (results_p, COL_D_DATA_ID, row);
+			entry_p -> dataName = GetGenQueryResultValue (results_p, COL_DATA_NAME, row);
+			entry_p -> collName = GetGenQueryResultValue (results_p, COL_COLL_NAME, row);
+			entry_p -> ownerName = GetGenQueryResultValue (results_p, COL_D_OWNER_NAME, row);
+			entry_p -> resource = GetGenQueryResultValue (results_p, COL_D_RESC_NAME, row);
+			entry_p -> createTime = GetGenQueryResultValue (results_p, COL_D_CREATE_TIME, row);
+			entry_p -> modifyTime = GetGenQueryResultValue (results_p, COL_D_MODIFY_TIME, row);
+			entry_p -> chksum = GetGenQueryResultValue (results_p, COL_D_DATA_CHECKSUM, row);
+
+			if (value_s)
+				{
+					entry_p -> dataSize = (rodsLong_t) apr_atoi64 (value_s);
+				}
+
+			value_s = GetGenQueryResultValue (results_p, COL_DATA_REPL_NUM, row);
+			if (value_s)
+				{
+					entry_p -> replNum = atoi (value_s);
+				}
+		}
+	else
+		{
+			/*
+			 * Unlike rclReadCollection (), we have the collection id to hand
+			 * so store it to save having to look it up again later.
+			 */
+			entry_p -> objType = COLL_OBJ_T;
+			entry_p -> dataId = GetGenQueryResultValue (results_p, COL_COLL_ID, row);
+			entry_p -> collName = GetGenQueryResultValue (results_p, COL_COLL_NAME, row);
+			entry_p -> ownerName = GetGenQueryResultValue (results_p, COL_COLL_OWNER_NAME, row);
+			entry_p -> createTime = GetGenQueryResultValue (results_p, COL_COLL_CREATE_TIME, row);
+			entry_p -> modifyTime = GetGenQueryResultValue (results_p, COL_COLL_MODIFY_TIME, row);
+		}
+}
+
+
+static int SetUpResourceFiltering (CollectionListing *listing_p)
+{
+	int status = SYS_INVALID_INPUT_PARAM;
+	apr_pool_t *pool_p = listing_p -> cl_pool_p;
+	char **resource_ss = listing_p -> cl_options_p -> lo_resources_ss;
+	size_t num_resources = 0;
+
+	while ((*resource_ss) && IsSafeQueryValue (*resource_ss))
+		{
+			++ resource_ss;
+			++ num_resources;
+		}
+
+	if (*resource_ss == NULL)
+		{
+			status = SYS_MALLOC_ERR;
+
+			listing_p -> cl_resources_condition_s = GetGenQueryInCondition (listing_p -> cl_options_p -> lo_resources_ss, num_resources, pool_p);
+
+			if (listing_p -> cl_resources_condition_s)
+				{
+					status = 0;
+				}
+
+			if (status != 0)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to set up the resource filtering for \"%s\"", listing_p -> cl_collection_s);
+				}
+		}
+	else
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_BADARG, pool_p, "Cannot filter by resource \"%s\" as it contains a quote", *resource_ss);
+		}
+
+	return status;
+}
+
+
+static int GetResourceRank (const CollectionListing *listing_p, const char *resource_s)
+{
+	char **resource_ss = listing_p -> cl_options_p -> lo_resources_ss;
+	int rank = 0;
+
+	if (resource_s)
+		{
+			while (*resource_ss)
+				{
+					if (strcmp (*resource_ss, resource_s) == 0)
+						{
+							return rank;
+						}
+
+					++ resource_ss;
+					++ rank;
+				}
+		}
+
+	return -1;
+}
+
+
+static int GetReplicaRank (const CollectionListing *listing_p, const char *resource_s, const char *repl_num_s)
+{
+	int rank = 0;
+
+	if (listing_p -> cl_resources_condition_s)
+		{
+			rank = GetResourceRank (listing_p, resource_s);
+		}
+
+	if (rank >= 0)
+		{
+			rank = (rank * S_RESOURCE_RANK_STEP) + (repl_num_s ? atoi (repl_num_s) : 0);
+		}
+
+	return rank;
+}
+
+
+static void UpdateReplicaRank (CollectionListing *listing_p, const char *id_s, const int rank)
+{
+	if (rank >= 0)
+		{
+			int *best_rank_p = (int *) apr_hash_get (listing_p -> cl_replica_ranks_p, id_s, APR_HASH_KEY_STRING);
+
+			if (best_rank_p)
+				{
+					if (rank < *best_rank_p)
+						{
+							*best_rank_p = rank;
+						}
+				}
+			else
+				{
+					best_rank_p = (int *) apr_palloc (listing_p -> cl_page_pool_p, sizeof (int));
+
+					if (best_rank_p)
+						{
+							*best_rank_p = rank;
+							apr_hash_set (listing_p -> cl_replica_ranks_p, apr_pstrdup (listing_p -> cl_page_pool_p, id_s), APR_HASH_KEY_STRING, best_rank_p);
+						}
+				}
+		}
+}
+
+
+/*
+ * Work out which replica to list for each of the data objects in the current
+ * page of results. Any data object whose replica in this page doesn't have the
+ * best possible rank might have a better replica elsewhere in the listing, so
+ * we get all of the matching replicas for these with a single query per batch
+ * of ids rather than having to read the whole collection first. As exactly one
+ * replica of each data object has its best rank, this also stops any data
+ * object being listed twice without having to remember everything listed so
+ * far.
+ */
+static int SetReplicaRanksForPage (CollectionListing *listing_p)
+{
+	int status = 0;
+	const genQueryOut_t *results_p = listing_p -> cl_results_p;
+	apr_pool_t *page_pool_p = listing_p -> cl_page_pool_p;
+	apr_array_header_t *ids_p;
+	int i;
+
+	apr_pool_clear (page_pool_p);
+	listing_p -> cl_replica_ranks_p = apr_hash_make (page_pool_p);
+	ids_p = apr_array_make (page_pool_p, results_p -> rowCnt, sizeof (char *));
+
+	for (i = 0; i < results_p -> rowCnt; ++ i)
+		{
+			const char *id_s = GetGenQueryResultValue (results_p, COL_D_DATA_ID, i);
+			const int rank = GetReplicaRank (listing_p, GetGenQueryResultValue (results_p, COL_D_RESC_NAME, i), GetGenQueryResultValue (results_p, COL_DATA_REPL_NUM, i));
+
+			if (rank > 0)
+				{
+					APR_ARRAY_PUSH (ids_p, const char *) = id_s;
+				}
+
+			UpdateReplicaRank (listing_p, id_s, rank);
+		}
+
+	/*
+	 * Keep each batch of ids small enough to fit within the
+	 * maximum size of a GenQuery condition.
+	 */
+	for (i = 0; (i < ids_p -> nelts) && (status == 0); i += S_REPLICA_BATCH_SIZE)
+		{
+			genQueryInp_t query;
+			genQueryOut_t *replicas_p = NULL;
+			const int num_ids = ((ids_p -> nelts) - i < S_REPLICA_BATCH_SIZE) ? (ids_p -> nelts) - i : S_REPLICA_BATCH_SIZE;
+			char *ids_condition_s = GetGenQueryInCondition (((char **) ids_p -> elts) + i, (size_t) num_ids, page_pool_p);
+
+			memset (&query, 0, sizeof (genQueryInp_t));
+			query.maxRows = MAX_SQL_ROWS;
+
+			if ((status = addInxIval (& (query.selectInp), COL_D_DATA_ID, 1)) == 0)
+				{
+					if ((status = addInxIval (& (query.selectInp), COL_D_RESC_NAME, 1)) == 0)
+						{
+							if ((status = addInxIval (& (query.selectInp), COL_DATA_REPL_NUM, 1)) == 0)
+								{
+									if (((status = addInxVal (& (query.sqlCondInp), COL_D_DATA_ID, ids_condition_s)) == 0) && (listing_p -> cl_resources_condition_s))
+										{
+											status = addInxVal (& (query.sqlCondInp), COL_D_RESC_NAME, listing_p -> cl_resources_condition_s);
+										}
+								}
+						}
+				}
+
+			if (status == 0)
+				{
+					do
+						{
+							status = rcGenQuery (listing_p -> cl_connection_p, &query, &replicas_p);
+							CheckIRodsConnectionStatus (listing_p -> cl_connection_p, status, listing_p -> cl_pool_p);
+
+							if (status == 0)
+								{
+									int j;
+
+									for (j = 0; j < replicas_p -> rowCnt; ++ j)
+										{
+											UpdateReplicaRank (listing_p, GetGenQueryResultValue (replicas_p, COL_D_DATA_ID, j), GetReplicaRank (listing_p, GetGenQueryResultValue (replicas_p, COL_D_RESC_NAME, j), GetGenQueryResultValue (replicas_p, COL_DATA_REPL_NUM, j)));
+										}
+
+									query.continueInx = replicas_p -> continueInx;
+									freeGenQueryOut (&replicas_p);
+								}
+						}
+					while ((status == 0) && (query.continueInx > 0));
+				}
+
+			if (status == CAT_NO_ROWS_FOUND)
+				{
+					status = 0;
+				}
+			else if (status != 0)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, listing_p -> cl_pool_p, "Failed to get the replicas for the listing of \"%s\", %s", listing_p -> cl_collection_s, get_rods_error_msg (status));
+				}
+
+			freeGenQueryOut (&replicas_p);
+			clearGenQueryInp (&query);
+		}
+
+	return status;
+}
+
+
+static bool IsPreferredReplica (const CollectionListing *listing_p, const int row)
+{
+	bool preferred_flag = false;
+	const char *id_s = GetGenQueryResultValue (listing_p -> cl_results_p, COL_D_DATA_ID, row);
+
+	if (id_s)
+		{
+			const int *best_rank_p = (const int *) apr_hash_get (listing_p -> cl_replica_ranks_p, id_s, APR_HASH_KEY_STRING);
+
+			if (best_rank_p)
+				{
+					const int rank = GetReplicaRank (listing_p, GetGenQueryResultValue (listing_p -> cl_results_p, COL_D_RESC_NAME, row), GetGenQueryResultValue (listing_p -> cl_results_p, COL_DATA_REPL_NUM, row));
+
+					preferred_flag = (rank == *best_rank_p);
+				}
+		}
+
+	return preferred_flag;
+}
@@ -0,0 +1,247 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * collection_listing.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef COLLECTION_LISTING_H_
+#define COLLECTION_LISTING_H_
+
+#include <stdbool.h>
+
+#include "irods/rcConnect.h"
+#include "irods/rodsGenQuery.h"
+#include "irods/miscUtil.h"
+
+#include "apr_pools.h"
+#include "apr_tables.h"
+#include "apr_hash.h"
+
+
+/**
+ * The attributes that a collection listing can be sorted by.
+ */
+typedef enum ListingSortKey
+{
+	LSK_NAME,
+	LSK_SIZE,
+	LSK_MODIFIED_TIME,
+	LSK_OWNER,
+	LSK_NUM_KEYS
+} ListingSortKey;
+
+
+/**
+ * The phases that a collection listing goes through. As with
+ * rclOpenCollection () called with DATA_QUERY_FIRST_FG, the
+ * data objects are listed before the child collections.
+ */
+typedef enum ListingPhase
+{
+	LP_DATA_OBJECTS,
+	LP_COLLECTIONS,
+	LP_DONE
+} ListingPhase;
+
+
+/**
+ * The sorting, filtering and paging options for a collection listing.
+ * All of these are compiled into the underlying GenQuery so only the
+ * requested window of the listing is transferred from the iCAT.
+ */
+typedef struct ListingOptions
+{
+	ListingSortKey lo_sort_key;
+
+	bool lo_ascending_flag;
+
+	/** If set, only list entries whose names contain this value. */
+	const char *lo_name_filter_s;
+
+	/**
+	 * If set, only list data objects whose names end with this
+	 * extension. Collections are not listed when this is set.
+	 */
+	const char *lo_extension_filter_s;
+
+	/** The number of entries to skip before the listing begins. */
+	apr_size_t lo_offset;
+
+	/** The maximum number of entries to list, or 0 for no limit. */
+	apr_size_t lo_limit;
+
+	/**
+	 * If set, a NULL-terminated array of the resources to list data
+	 * objects from in order of preference. Only one replica of each
+	 * data object will be listed, from the most preferred resource
+	 * that holds it.
+	 */
+	char **lo_resources_ss;
+
+	/**
+	 * If set, the listing notes whether it includes a non-empty data
+	 * object with this name in cl_watched_name_found_flag.
+	 */
+	const char *lo_watched_name_s;
+} ListingOptions;
+
+
+/**
+ * A GenQuery-based replacement for the collHandle_t used by
+ * rclOpenCollection () and rclReadCollection ().
+ */
+typedef struct CollectionListing
+{
+	rcComm_t *cl_connection_p;
+
+	const char *cl_collection_s;
+
+	const ListingOptions *cl_options_p;
+
+	ListingPhase cl_phase;
+
+	genQueryInp_t cl_query;
+
+	genQueryOut_t *cl_results_p;
+
+	int cl_current_row;
+
+	/** The row offset to use for the first query of the data objects phase. */
+	apr_size_t cl_data_offset;
+
+	/**
+	 * The number of data objects still to be skipped before the requested
+	 * window starts. This is used instead of cl_data_offset when some of
+	 * the data objects have more than one matching replica, as the row
+	 * offset would then count replicas rather than data objects.
+	 */
+	apr_size_t cl_data_skip;
+
+	/** The row offset to use for the first query of the collections phase. */
+	apr_size_t cl_collection_offset;
+
+	/** The number of entries still to be returned if a limit was set. */
+	apr_size_t cl_remaining;
+
+	/** The "in (...)" condition for the selected resources, if any. */
+	const char *cl_resources_condition_s;
+
+	/**
+	 * For each data object in the current page of results, the rank of
+	 * the replica to list for it. A replica's rank comes from the
+	 * preference index of its resource, if resources were selected,
+	 * and then its replica number so exactly one replica of each data
+	 * object has the best rank. This is cleared with cl_page_pool_p for
+	 * each new page.
+	 */
+	apr_hash_t *cl_replica_ranks_p;
+
+	/**
+	 * Whether a non-empty data object named lo_watched_name_s has been
+	 * listed so far. Once the listing is finished, this tells whether the
+	 * collection holds such an object as long as IsFullListing () is true
+	 * for the ListingOptions.
+	 */
+	bool cl_watched_name_found_flag;
+
+	apr_pool_t *cl_page_pool_p;
+
+	apr_pool_t *cl_pool_p;
+} CollectionListing;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a ListingOptions to list everything in name order.
+ *
+ * @param options_p The ListingOptions to initialise.
+ */
+void InitListingOptions (ListingOptions *options_p);
+
+
+/**
+ * Set the ListingOptions from the "sort", "order", "name", "ext",
+ * "offset" and "limit" request parameters. Any parameters that are
+ * missing keep their current values.
+ *
+ * @param options_p The ListingOptions to set.
+ * @param params_p The request parameters.
+ * @param pool_p The pool to use for any allocations.
+ * @return APR_SUCCESS upon success, APR_BADARG if any of the parameters
+ * had an invalid value.
+ */
+apr_status_t SetListingOptionsFromParameters (ListingOptions *options_p, apr_table_t *params_p, apr_pool_t *pool_p);
+
+
+/**
+ * Check whether a listing with the given options will include every
+ * data object within the collection, i.e. it is not filtered by name or
+ * extension nor paged.
+ *
+ * @param options_p The ListingOptions to check.
+ * @return <code>true</code> if all of the data objects will be listed,
+ * <code>false</code> otherwise.
+ */
+bool IsFullListing (const ListingOptions *options_p);
+
+
+/**
+ * Open a collection for listing.
+ *
+ * @param listing_p The CollectionListing to open.
+ * @param collection_s The iRODS path of the collection to list.
+ * @param options_p The ListingOptions to use. This must remain valid
+ * until CloseCollectionListing () is called.
+ * @param connection_p The connection to the iRODS server.
+ * @param pool_p The pool to use for any allocations.
+ * @return A negative iRODS error code upon failure.
+ */
+int OpenCollectionListing (CollectionListing *listing_p, const char *collection_s, const ListingOptions *options_p, rcComm_t *connection_p, apr_pool_t *pool_p);
+
+
+/**
+ * Get the next entry in a CollectionListing. The string values in
+ * the entry are only valid until the next call to this function.
+ *
+ * @param listing_p The CollectionListing to read from.
+ * @param entry_p The collEnt_t to store the values in.
+ * @return 0 upon success, CAT_NO_ROWS_FOUND when the listing is
+ * finished or a negative iRODS error code upon failure.
+ */
+int ReadCollectionListing (CollectionListing *listing_p, collEnt_t *entry_p);
+
+
+/**
+ * Free any resources used by a CollectionListing.
+ *
+ * @param listing_p The CollectionListing to close.
+ */
+void CloseCollectionListing (CollectionListing *listing_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COLLECTION_LISTING_H_ */
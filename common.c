@@ -25,8 +25,10 @@
 #include "propdb.h"
 #include "repo.h"
 #include "auth.h"
+#include "public_pool.h"
 #include "curl_util.h"
 #include "meta.h"
+#include "session_token.h"
 
 
 #ifdef DAVRODS_ENABLE_PROVIDER_LOCALLOCK
@@ -365,11 +367,32 @@ rcComm_t *GetIRODSConnectionFromRequest (request_rec *req_p)
 					const char *username_s = NULL;
 					const char *password_s = NULL;
 					const char *hash_s = NULL;
-					apr_status_t status = GetSessionAuth (req_p, &username_s, &password_s, &hash_s);
+					apr_status_t status = APR_SUCCESS;
 
-					if (status == APR_SUCCESS)
+					if (IsSessionTokenRequest (req_p))
 						{
-							rcComm_t *pool_connection_p = GetIRODSConnectionFromPool (pool_p);
+							/*
+							 * The user has already been authenticated by their session token, so
+							 * there is no session to load and no password to log in with.
+							 */
+							if (GetIRodsConnectionForTokenUser (req_p, &connection_p, req_p -> user) != AUTH_GRANTED)
+								{
+									ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, req_p, "Failed to connect to iRODS for session token user \"%s\"", req_p -> user);
+								}
+
+							status = APR_EGENERAL;
+						}
+					else
+						{
+							status = GetSessionAuth (req_p, &username_s, &password_s, &hash_s);
+						}
+
+					if ((status == APR_SUCCESS) && (!connection_p))
+						{
+							rcComm_t *pool_connection_p = NULL;
+
+							ValidateIRodsConnection (req_p, pool_p);
+							pool_connection_p = GetIRODSConnectionFromPool (pool_p);
 
 							if (pool_connection_p)
 								{
@@ -411,16 +434,16 @@ rcComm_t *GetIRODSConnectionFromRequest (request_rec *req_p)
 										{
 											status = GetIRodsConnection (req_p, &connection_p, username_s, password_s);
 
-											if (status != APR_SUCCESS)
+											if (status == AUTH_GRANTED)
 												{
-
+													IssueSessionToken (req_p, username_s);
 												}
 										}
 								}
 
 
-						}		/* if (status == APR_SUCCESS) */
-					else
+						}		/* if ((status == APR_SUCCESS) && (!connection_p)) */
+					else if (!connection_p)
 						{
 							ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_EGENERAL, req_p, "Failed to get session variables");
 
@@ -448,7 +471,12 @@ rcComm_t *GetIRODSConnectionForPublicUser (request_rec *req_p, apr_pool_t *davro
    * For publicly-accessible iRODS instances, check_rods will never have been called, so we'll need
    * to get the memory pool and iRODS connection for the public user.
    */
-	if (conf_p -> davrods_public_username_s)
+	if (conf_p -> davrods_public_username_s && (conf_p -> public_connections > 0))
+		{
+			connection_p = GetPooledPublicConnection (req_p, davrods_pool_p, conf_p);
+		}
+
+	if (conf_p -> davrods_public_username_s && !connection_p)
 		{
 			authn_status status = GetIRodsConnection (req_p, &connection_p, conf_p -> davrods_public_username_s, conf_p -> davrods_public_password_s ? conf_p -> davrods_public_password_s : "");
 
@@ -605,9 +633,51 @@ char *GetChecksum (collEnt_t *coll_entry_p, rcComm_t *connection_p, apr_pool_t *
 		}
 	else
 		{
+			CheckIRodsConnectionStatus (connection_p, status, pool_p);
 			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to rcDataObjChksum for \"%s\"", full_path_s);
 		}
 
 	return checksum_s;
 }
 
+
+char *GetGenQueryResultValue (const genQueryOut_t *results_p, const int column, const int row)
+{
+	int i;
+
+	for (i = 0; i < results_p -> attriCnt; ++ i)
+		{
+			const sqlResult_t *sql_p = & (results_p -> sqlResult [i]);
+
+			if (sql_p -> attriInx == column)
+				{
+					return (sql_p -> value + (row * sql_p -> len));
+				}
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Build a condition of the form "in ('a', 'b', 'c')"
+ */
+char *GetGenQueryInCondition (char **values_ss, const size_t num_values, apr_pool_t *pool_p)
+{
+	char *condition_s = NULL;
+	apr_array_header_t *parts_p = apr_array_make (pool_p, (int) num_values, sizeof (char *));
+
+	if (parts_p)
+		{
+			size_t i;
+
+			for (i = 0; i < num_values; ++ i)
+				{
+					APR_ARRAY_PUSH (parts_p, char *) = apr_pstrcat (pool_p, "'", * (values_ss + i), "'", NULL);
+				}
+
+			condition_s = apr_pstrcat (pool_p, "in (", apr_array_pstrcat (pool_p, parts_p, ','), ")", NULL);
+		}
+
+	return condition_s;
+}
@@ -29,6 +29,7 @@
 
 #include "irods/rcConnect.h"
 #include "irods/miscUtil.h"
+#include "irods/rodsGenQuery.h"
 
 #include "apr_tables.h"
 
@@ -84,4 +85,27 @@ const char *GetParameterValue (apr_table_t *params_p, const char * const param_s
 char *GetChecksum (collEnt_t *coll_entry_p, rcComm_t *connection_p, apr_pool_t *pool_p);
 
 
+/**
+ * Get a value from the results of a GenQuery.
+ *
+ * @param results_p The results to get the value from.
+ * @param column The column to get the value for, e.g. COL_DATA_NAME.
+ * @param row The row to get the value from.
+ * @return The value or <code>NULL</code> if the column was not
+ * part of the query.
+ */
+char *GetGenQueryResultValue (const genQueryOut_t *results_p, const int column, const int row);
+
+
+/**
+ * Create a GenQuery condition that matches any of the given values.
+ *
+ * @param values_ss The values to match. None of these must contain a quote.
+ * @param num_values The number of values.
+ * @param pool_p The pool to allocate the condition from.
+ * @return The condition or <code>NULL</code> upon error.
+ */
+char *GetGenQueryInCondition (char **values_ss, const size_t num_values, apr_pool_t *pool_p);
+
+
 #endif /* _DAVRODS_COMMON_H_ */
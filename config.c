@@ -22,6 +22,18 @@
 #include "config.h"
 #include "theme.h"
 #include "common.h"
+#include "negative_cache.h"
+#include "vault_read.h"
+#include "replica_selector.h"
+#include "write_placement.h"
+#include "upload_checksum.h"
+#include "archive_download.h"
+#include "session_token.h"
+#include "auth_cache.h"
+#include "env_cache.h"
+#include "auth.h"
+#include "public_pool.h"
+#include "resumable_upload.h"
 
 #include <apr_strings.h>
 
@@ -39,6 +51,7 @@ static const RodsExposedRootType S_DEFAULT_EXPOSED_ROOT_TYPE = DAVRODS_ROOT_USER
 
 static const size_t S_DEFAULT_TX_BUFFER_SIZE = 4 * 1024 * 1024;
 static const size_t S_DEFAULT_RX_BUFFER_SIZE = 4 * 1024 * 1024;
+static const size_t S_DEFAULT_SMALL_PUT_SIZE = 0;
 
 static const TmpFileBehaviour S_DEFAULT_TMPFILE_ROLLBACK = DAVRODS_TMPFILE_ROLLBACK_NO;
 static const char * const S_DEFAULT_LOCK_DBPATH_S = "/var/lib/davrods/lockdb_locallock";
@@ -49,6 +62,20 @@ static const char * const S_DEFAULT_SEARCH_PATH_S = "/search";
 static const char * const S_DEFAULT_PUBLIC_USERNAME_S = NULL;
 static const char * const S_DEFAULT_PUBLIC_PASSWORD_S = NULL;
 static const int S_DEFAULT_THEMED_LISTINGS = 0;
+static const int S_DEFAULT_NEGATIVE_CACHE_TIMEOUT = 0;
+static const int S_DEFAULT_DIRECT_VAULT_READS = 0;
+static const int S_DEFAULT_REPLICA_ROUTING = 0;
+static const WritePlacementPolicy S_DEFAULT_WRITE_PLACEMENT_POLICY = DAVRODS_WRITE_ROUND_ROBIN;
+static const UploadChecksumAlgorithm S_DEFAULT_UPLOAD_CHECKSUM = DAVRODS_CHECKSUM_NONE;
+static const int S_DEFAULT_ARCHIVE_DOWNLOADS = 0;
+static const int S_DEFAULT_ARCHIVE_DOWNLOAD_MAX_ENTRIES = 0;
+static const int S_DEFAULT_ARCHIVE_DOWNLOAD_MAX_MBS = 0;
+static const int S_DEFAULT_SESSION_TOKEN_LIFETIME = 8 * 60 * 60;
+static const int S_DEFAULT_FAILED_LOGIN_BACKOFF = 0;
+static const int S_DEFAULT_FAILED_LOGIN_MAX_BACKOFF = 0;
+static const int S_DEFAULT_CONNECTION_PROBE_IDLE = 0;
+static const int S_DEFAULT_PUBLIC_CONNECTIONS = 0;
+static const int S_DEFAULT_CATALOG_CONNECTION = 0;
 
 
 static const char *MergeConfigStrings (const char *parent_s, const char *child_s, const char *default_s);
@@ -93,6 +120,7 @@ void *davrods_create_dir_config(apr_pool_t *p, char *dir) {
 
         conf->rods_tx_buffer_size    = S_DEFAULT_TX_BUFFER_SIZE;
         conf->rods_rx_buffer_size    = S_DEFAULT_RX_BUFFER_SIZE;
+        conf->rods_small_put_size    = S_DEFAULT_SMALL_PUT_SIZE;
 
         conf->tmpfile_rollback       = S_DEFAULT_TMPFILE_ROLLBACK;
         conf->locallock_lockdb_path  = S_DEFAULT_LOCK_DBPATH_S;
@@ -112,6 +140,21 @@ void *davrods_create_dir_config(apr_pool_t *p, char *dir) {
 
     		conf -> exposed_roots_per_user_p = apr_table_make (p, 16);
 
+    		conf -> negative_cache_timeout = S_DEFAULT_NEGATIVE_CACHE_TIMEOUT;
+    		conf -> direct_vault_reads = S_DEFAULT_DIRECT_VAULT_READS;
+    		conf -> replica_routing = S_DEFAULT_REPLICA_ROUTING;
+    		conf -> write_placement_policy = S_DEFAULT_WRITE_PLACEMENT_POLICY;
+    		conf -> upload_checksum = S_DEFAULT_UPLOAD_CHECKSUM;
+    		conf -> archive_downloads = S_DEFAULT_ARCHIVE_DOWNLOADS;
+    		conf -> archive_download_max_entries = S_DEFAULT_ARCHIVE_DOWNLOAD_MAX_ENTRIES;
+    		conf -> archive_download_max_mbs = S_DEFAULT_ARCHIVE_DOWNLOAD_MAX_MBS;
+    		conf -> session_token_lifetime = S_DEFAULT_SESSION_TOKEN_LIFETIME;
+    		conf -> failed_login_backoff = S_DEFAULT_FAILED_LOGIN_BACKOFF;
+    		conf -> failed_login_max_backoff = S_DEFAULT_FAILED_LOGIN_MAX_BACKOFF;
+    		conf -> connection_probe_idle = S_DEFAULT_CONNECTION_PROBE_IDLE;
+    		conf -> public_connections = S_DEFAULT_PUBLIC_CONNECTIONS;
+    		conf -> catalog_connection = S_DEFAULT_CATALOG_CONNECTION;
+
     }
     return conf;
 }
@@ -131,6 +174,7 @@ void *davrods_merge_dir_config(apr_pool_t *p, void *_parent, void *_child) {
 
     conf_p -> rods_tx_buffer_size = MergeConfigInts (parent_p -> rods_tx_buffer_size, child_p -> rods_tx_buffer_size, S_DEFAULT_TX_BUFFER_SIZE);
     conf_p -> rods_rx_buffer_size = MergeConfigInts (parent_p -> rods_rx_buffer_size, child_p -> rods_rx_buffer_size, S_DEFAULT_RX_BUFFER_SIZE);
+    conf_p -> rods_small_put_size = MergeConfigInts (parent_p -> rods_small_put_size, child_p -> rods_small_put_size, S_DEFAULT_SMALL_PUT_SIZE);
     conf_p -> tmpfile_rollback = MergeConfigInts (parent_p -> tmpfile_rollback, child_p -> tmpfile_rollback, S_DEFAULT_TMPFILE_ROLLBACK);
     conf_p -> locallock_lockdb_path = MergeConfigStrings (parent_p -> locallock_lockdb_path, child_p -> locallock_lockdb_path, S_DEFAULT_LOCK_DBPATH_S);
     conf_p -> davrods_api_path_s = MergeConfigStrings (parent_p -> davrods_api_path_s, child_p -> davrods_api_path_s, S_DEFAULT_API_PATH_S);
@@ -147,6 +191,46 @@ void *davrods_merge_dir_config(apr_pool_t *p, void *_parent, void *_child) {
 
   	conf_p -> exposed_roots_per_user_p = MergeAPRTables (parent_p -> exposed_roots_per_user_p, child_p -> exposed_roots_per_user_p, p);
 
+    conf_p -> negative_cache_timeout = MergeConfigInts (parent_p -> negative_cache_timeout, child_p -> negative_cache_timeout, S_DEFAULT_NEGATIVE_CACHE_TIMEOUT);
+    DAVRODS_PROP_MERGE (negative_cache_names_ss);
+    DAVRODS_PROP_MERGE (denied_names_ss);
+
+    conf_p -> direct_vault_reads = MergeConfigInts (parent_p -> direct_vault_reads, child_p -> direct_vault_reads, S_DEFAULT_DIRECT_VAULT_READS);
+    DAVRODS_PROP_MERGE (local_vault_hosts_ss);
+
+    conf_p -> replica_routing = MergeConfigInts (parent_p -> replica_routing, child_p -> replica_routing, S_DEFAULT_REPLICA_ROUTING);
+
+    DAVRODS_PROP_MERGE (write_resources_p);
+    conf_p -> write_placement_policy = MergeConfigInts (parent_p -> write_placement_policy, child_p -> write_placement_policy, S_DEFAULT_WRITE_PLACEMENT_POLICY);
+
+    conf_p -> upload_checksum = MergeConfigInts (parent_p -> upload_checksum, child_p -> upload_checksum, S_DEFAULT_UPLOAD_CHECKSUM);
+    DAVRODS_PROP_MERGE (resumable_uploads_dir_s);
+
+    conf_p -> archive_downloads = MergeConfigInts (parent_p -> archive_downloads, child_p -> archive_downloads, S_DEFAULT_ARCHIVE_DOWNLOADS);
+    conf_p -> archive_download_max_entries = MergeConfigInts (parent_p -> archive_download_max_entries, child_p -> archive_download_max_entries, S_DEFAULT_ARCHIVE_DOWNLOAD_MAX_ENTRIES);
+    conf_p -> archive_download_max_mbs = MergeConfigInts (parent_p -> archive_download_max_mbs, child_p -> archive_download_max_mbs, S_DEFAULT_ARCHIVE_DOWNLOAD_MAX_MBS);
+
+    if (child_p -> session_token_key_p)
+    	{
+    		conf_p -> session_token_key_p = child_p -> session_token_key_p;
+    		conf_p -> session_token_key_length = child_p -> session_token_key_length;
+    	}
+    else
+    	{
+    		conf_p -> session_token_key_p = parent_p -> session_token_key_p;
+    		conf_p -> session_token_key_length = parent_p -> session_token_key_length;
+    	}
+
+    conf_p -> session_token_lifetime = MergeConfigInts (parent_p -> session_token_lifetime, child_p -> session_token_lifetime, S_DEFAULT_SESSION_TOKEN_LIFETIME);
+    DAVRODS_PROP_MERGE (session_token_proxy_username_s);
+    DAVRODS_PROP_MERGE (session_token_proxy_password_s);
+
+    conf_p -> failed_login_backoff = MergeConfigInts (parent_p -> failed_login_backoff, child_p -> failed_login_backoff, S_DEFAULT_FAILED_LOGIN_BACKOFF);
+    conf_p -> failed_login_max_backoff = MergeConfigInts (parent_p -> failed_login_max_backoff, child_p -> failed_login_max_backoff, S_DEFAULT_FAILED_LOGIN_MAX_BACKOFF);
+    conf_p -> connection_probe_idle = MergeConfigInts (parent_p -> connection_probe_idle, child_p -> connection_probe_idle, S_DEFAULT_CONNECTION_PROBE_IDLE);
+    conf_p -> public_connections = MergeConfigInts (parent_p -> public_connections, child_p -> public_connections, S_DEFAULT_PUBLIC_CONNECTIONS);
+    conf_p -> catalog_connection = MergeConfigInts (parent_p -> catalog_connection, child_p -> catalog_connection, S_DEFAULT_CATALOG_CONNECTION);
+
 
     MergeThemeConfigs (conf_p, parent_p, child_p, p);
 
@@ -244,6 +328,7 @@ static const char *cmd_davrodsenvfile(
 ) {
     davrods_dir_conf_t *conf = (davrods_dir_conf_t*)config;
     conf->rods_env_file = arg1;
+    NoteEnvFile(cmd->pool, arg1);
     return NULL;
 }
 
@@ -299,6 +384,23 @@ static const char *cmd_davrodsrxbufferkbs(
     return NULL;
 }
 
+static const char *cmd_davrodssmallputkbs(
+    cmd_parms *cmd, void *config,
+    const char *arg1
+) {
+    davrods_dir_conf_t *conf = (davrods_dir_conf_t*)config;
+    size_t kb = apr_atoi64(arg1);
+    conf->rods_small_put_size = kb * 1024;
+
+    // iRODS only accepts data sent along with the put request up to this size.
+    if (errno == ERANGE || conf->rods_small_put_size < kb
+            || conf->rods_small_put_size > MAX_SZ_FOR_SINGLE_BUF) {
+        return "Please check if your small put size is sane, it can be at most 32768 KiBs";
+    }
+
+    return NULL;
+}
+
 static const char *cmd_davrodstmpfilerollback(
     cmd_parms *cmd, void *config,
     const char *arg1
@@ -408,6 +510,10 @@ const command_rec davrods_directives[] = {
         DAVRODS_CONFIG_PREFIX "RxBufferKbs", cmd_davrodsrxbufferkbs,
         NULL, ACCESS_CONF, "Amount of file KiBs to download from iRODS at a time on GETs"
     ),
+    AP_INIT_TAKE1(
+        DAVRODS_CONFIG_PREFIX "SmallPutKbs", cmd_davrodssmallputkbs,
+        NULL, ACCESS_CONF, "Maximum size in KiBs of PUTs to buffer in memory and send to iRODS in a single request (defaults to 0, which disables this)"
+    ),
     AP_INIT_TAKE1(
         DAVRODS_CONFIG_PREFIX "TmpfileRollback", cmd_davrodstmpfilerollback,
         NULL, ACCESS_CONF, "Support PUT rollback through the use of temporary files on the target iRODS resource"
@@ -682,5 +788,120 @@ const command_rec davrods_directives[] = {
 				NULL, ACCESS_CONF, "Image for the Frictionless Data Packages"
 		),
 
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "FDCacheDirectory", SetFDCacheDirectory,
+				NULL, ACCESS_CONF, "Local directory to cache generated Frictionless Data Packages in"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "FDSniffTabularHeaders", SetFDSniffTabularHeaders,
+				NULL, ACCESS_CONF, "Read the column headings of CSV and TSV files without any column_headings metadata from the files themselves, default is false"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "NegativeCacheTimeout", SetNegativeCacheTimeout,
+				NULL, ACCESS_CONF, "Number of seconds to remember that probed-for names such as .DS_Store do not exist, default is 0 which disables this"
+		),
+
+		AP_INIT_RAW_ARGS(
+				DAVRODS_CONFIG_PREFIX "NegativeCacheNames", SetNegativeCacheNames,
+				NULL, ACCESS_CONF, "List of name patterns to remember as not existing with each entry separated by spaces"
+		),
+
+		AP_INIT_RAW_ARGS(
+				DAVRODS_CONFIG_PREFIX "DeniedNames", SetDeniedNames,
+				NULL, ACCESS_CONF, "List of name patterns that are always treated as not existing with each entry separated by spaces"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "DirectVaultReads", SetDirectVaultReads,
+				NULL, ACCESS_CONF, "Read data objects directly from resource vaults on this host, default is false"
+		),
+
+		AP_INIT_RAW_ARGS(
+				DAVRODS_CONFIG_PREFIX "LocalVaultHosts", SetLocalVaultHosts,
+				NULL, ACCESS_CONF, "List of resource host names that refer to this host with each entry separated by spaces"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ReplicaRouting", SetReplicaRouting,
+				NULL, ACCESS_CONF, "Read from the replica on the resource that has been quickest to read from recently, default is false"
+		),
+
+		AP_INIT_RAW_ARGS(
+				DAVRODS_CONFIG_PREFIX "WriteResources", SetWriteResources,
+				NULL, ACCESS_CONF, "List of resources to create new data objects on, each with an optional weight e.g. resc1:2, separated by spaces"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "WritePlacement", SetWritePlacementPolicy,
+				NULL, ACCESS_CONF, "How to choose between the write resources: round-robin, least-in-flight or free-space, default is round-robin"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "UploadChecksum", SetUploadChecksum,
+				NULL, ACCESS_CONF, "The checksum to calculate while uploading and register for new data objects: none, md5 or sha256, default is none"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ResumableUploadsDirectory", SetResumableUploadsDirectory,
+				NULL, ACCESS_CONF, "Local directory to store the progress of resumable Content-Range uploads in, resumable uploads are disabled if this is not set"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ArchiveDownloads", SetArchiveDownloads,
+				NULL, ACCESS_CONF, "Allow collections to be downloaded as tar archives by adding format=tar to their urls, default is false"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ArchiveDownloadMaxEntries", SetArchiveDownloadMaxEntries,
+				NULL, ACCESS_CONF, "The maximum number of collections and data objects in an archive download, default is 0 for no limit"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ArchiveDownloadMaxMbs", SetArchiveDownloadMaxMbs,
+				NULL, ACCESS_CONF, "The maximum size in megabytes of the data in an archive download, default is 0 for no limit"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "SessionTokenKeyFile", SetSessionTokenKeyFile,
+				NULL, ACCESS_CONF, "File containing the secret key, of at least 32 bytes, used to sign session tokens. Session tokens are disabled if this is not set"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "SessionTokenLifetime", SetSessionTokenLifetime,
+				NULL, ACCESS_CONF, "The number of seconds that a session token is valid for, default is 28800"
+		),
+
+		AP_INIT_TAKE2(
+				DAVRODS_CONFIG_PREFIX "SessionTokenProxyUser", SetSessionTokenProxyUser,
+				NULL, ACCESS_CONF, "The username and password of the rodsadmin account used to connect to iRODS on behalf of users with a session token"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "AuthCache", SetAuthCache,
+				NULL, RSRC_CONF, "The mod_socache provider, e.g. shmcb:/run/httpd/davrods_auth(512000), used to share PAM temporary passwords between processes, default is none"
+		),
+
+		AP_INIT_TAKE12(
+				DAVRODS_CONFIG_PREFIX "FailedLoginBackoff", SetFailedLoginBackoff,
+				NULL, ACCESS_CONF, "The seconds to refuse logins for after a failed login, doubling with each further failure up to the optional maximum which defaults to 300. This needs DavRodsAuthCache, default is 0 which disables this"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ConnectionProbeIdle", SetConnectionProbeIdle,
+				NULL, ACCESS_CONF, "The seconds that a cached iRODS connection can be idle before it is checked before being reused, default is 0 which disables this"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "PublicConnections", SetPublicConnections,
+				NULL, ACCESS_CONF, "The number of logged in connections for DavRodsDefaultUsername that each child process keeps ready for anonymous requests, default is 0 which disables this"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "CatalogConnection", SetCatalogConnection,
+				NULL, ACCESS_CONF, "Use a second iRODS connection for catalog queries so that they can overlap with paging through listings, default is false"
+		),
+
 		{ NULL }
 };
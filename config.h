@@ -50,6 +50,19 @@ typedef enum {
     DAVRODS_ROOT_USER_DIR,       //             User             => /<zone>/home/<user>
 } RodsExposedRootType;
 
+typedef enum {
+    DAVRODS_WRITE_ROUND_ROBIN = 1,
+    DAVRODS_WRITE_LEAST_IN_FLIGHT,
+    DAVRODS_WRITE_FREE_SPACE,
+} WritePlacementPolicy;
+
+typedef enum {
+    DAVRODS_CHECKSUM_NONE = 1,
+    DAVRODS_CHECKSUM_MD5,
+    DAVRODS_CHECKSUM_SHA256,
+} UploadChecksumAlgorithm;
+
+
 /**
  * \brief Davrods per-directory config structure.
  */
@@ -62,6 +75,7 @@ typedef struct davrods_dir_conf {
     const char *rods_exposed_root; // Note: This is not necessarily a path, see below.
     size_t      rods_tx_buffer_size;
     size_t      rods_rx_buffer_size;
+    size_t      rods_small_put_size; // Bodies up to this size are sent in a single put, 0 disables this.
 
     TmpFileBehaviour tmpfile_rollback;
 
@@ -83,6 +97,66 @@ typedef struct davrods_dir_conf {
 
     const char *eirods_dav_views_path_s;
 
+    /* The number of seconds to remember missing probe names for, 0 disables the negative cache. */
+    int negative_cache_timeout;
+
+    /* The name patterns to remember as missing, or NULL for the built-in list. */
+    char **negative_cache_names_ss;
+
+    /* The name patterns that are always treated as missing. */
+    char **denied_names_ss;
+
+    /* Whether to read data objects straight from resource vaults on this host. */
+    int direct_vault_reads;
+
+    /* The resource host names that refer to this host, or NULL to use its hostname. */
+    char **local_vault_hosts_ss;
+
+    /* Whether to choose which replica to read from using the measured resource performance. */
+    int replica_routing;
+
+    /* The candidate resources for new data objects, as WriteResources, or NULL to use rods_default_resource. */
+    apr_array_header_t *write_resources_p;
+
+    WritePlacementPolicy write_placement_policy;
+
+    /* The checksum to calculate while uploading and register for new data objects. */
+    UploadChecksumAlgorithm upload_checksum;
+
+    /* The local directory for the upload session files, or NULL to disable resumable uploads. */
+    const char *resumable_uploads_dir_s;
+
+    /* Whether collections can be downloaded as tar archives using ?format=tar. */
+    int archive_downloads;
+
+    /* The most entries and megabytes of data that an archive download can have, 0 for no limit. */
+    int archive_download_max_entries;
+    int archive_download_max_mbs;
+
+    /* The key used to sign session tokens, or NULL to disable them. */
+    const unsigned char *session_token_key_p;
+    apr_size_t session_token_key_length;
+
+    /* The number of seconds that a session token is valid for. */
+    int session_token_lifetime;
+
+    /* The rodsadmin account used to connect on behalf of users with a session token. */
+    const char *session_token_proxy_username_s;
+    const char *session_token_proxy_password_s;
+
+    /* The seconds to refuse logins for after the first failure, doubling up to the maximum, 0 disables this. */
+    int failed_login_backoff;
+    int failed_login_max_backoff;
+
+    /* The seconds that a cached iRODS connection can be idle before it is probed prior to reuse, 0 disables this. */
+    int connection_probe_idle;
+
+    /* The number of logged in public user connections that each child keeps ready, 0 disables this. */
+    int public_connections;
+
+    /* Whether to open a second connection per client for catalog queries that can run alongside paging and transfers. */
+    int catalog_connection;
+
 } davrods_dir_conf_t;
 
 extern const command_rec davrods_directives[];
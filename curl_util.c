@@ -55,6 +55,10 @@
 
 #include "apr_strings.h"
 
+#if APR_HAS_THREADS
+#include "apr_thread_proc.h"
+#endif
+
 #include "common.h"
 
 
@@ -74,6 +78,31 @@ typedef struct CURLParam
 } CURLParam;
 
 
+/**
+ * The CURL handle that is kept for each thread so that its connection
+ * and DNS caches are reused between requests. Only one CurlUtil at a
+ * time can use it, any others get their own handle.
+ */
+typedef struct ThreadCurl
+{
+	CURL *tc_curl_p;
+
+	bool tc_in_use_flag;
+} ThreadCurl;
+
+
+#if APR_HAS_THREADS
+static apr_threadkey_t *s_thread_curl_key_p = NULL;
+#else
+static ThreadCurl *s_thread_curl_p = NULL;
+#endif
+
+
+static ThreadCurl *GetThreadCurl (void);
+
+static void FreeThreadCurl (void *data_p);
+
+
 
 
 
@@ -189,6 +218,24 @@ static size_t WriteToMemoryCallback (char *response_data_p, size_t block_size, s
 
 
 
+apr_status_t InitCurlUtil (apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	#if APR_HAS_THREADS
+	status = apr_threadkey_private_create (&s_thread_curl_key_p, FreeThreadCurl, pool_p);
+
+	if (status != APR_SUCCESS)
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to create the per-thread CURL key");
+			s_thread_curl_key_p = NULL;
+		}
+	#endif
+
+	return status;
+}
+
+
 CurlUtil *AllocateCurlUtil (request_rec *req_p, apr_pool_t *pool_p)
 {
 	apr_bucket_brigade *buffer_p = apr_brigade_create (pool_p, req_p -> connection -> bucket_alloc);
@@ -238,7 +285,19 @@ bool ResetCurlUtil (CurlUtil *tool_p)
 
 void FreeCurlUtil (CurlUtil *curl_tool_p)
 {
-	FreeCurl (curl_tool_p -> ct_curl_p);
+	if (curl_tool_p -> ct_thread_handle_flag)
+		{
+			ThreadCurl *thread_curl_p = GetThreadCurl ();
+
+			if (thread_curl_p)
+				{
+					thread_curl_p -> tc_in_use_flag = false;
+				}
+		}
+	else
+		{
+			FreeCurl (curl_tool_p -> ct_curl_p);
+		}
 
 	if (curl_tool_p -> ct_headers_list_p)
 		{
@@ -251,7 +310,25 @@ void FreeCurlUtil (CurlUtil *curl_tool_p)
 
 static bool SetupCurl (CurlUtil *tool_p, apr_pool_t *pool_p)
 {
-	tool_p -> ct_curl_p = curl_easy_init ();
+	ThreadCurl *thread_curl_p = GetThreadCurl ();
+
+	if (thread_curl_p && !thread_curl_p -> tc_in_use_flag)
+		{
+			/*
+			 * Clear the options from the last use but keep the open
+			 * connections, DNS cache and TLS sessions.
+			 */
+			curl_easy_reset (thread_curl_p -> tc_curl_p);
+
+			thread_curl_p -> tc_in_use_flag = true;
+			tool_p -> ct_curl_p = thread_curl_p -> tc_curl_p;
+			tool_p -> ct_thread_handle_flag = true;
+		}
+	else
+		{
+			tool_p -> ct_curl_p = curl_easy_init ();
+			tool_p -> ct_thread_handle_flag = false;
+		}
 
 	if (tool_p -> ct_curl_p)
 		{
@@ -271,7 +348,15 @@ static bool SetupCurl (CurlUtil *tool_p, apr_pool_t *pool_p)
 						}
 				}
 
-			FreeCurl (tool_p -> ct_curl_p);
+			if (tool_p -> ct_thread_handle_flag)
+				{
+					thread_curl_p -> tc_in_use_flag = false;
+				}
+			else
+				{
+					FreeCurl (tool_p -> ct_curl_p);
+				}
+
 			tool_p -> ct_curl_p = NULL;
 		}
 	else
@@ -289,6 +374,81 @@ static void FreeCurl (CURL *curl_p)
 }
 
 
+static ThreadCurl *GetThreadCurl (void)
+{
+	ThreadCurl *thread_curl_p = NULL;
+
+	#if APR_HAS_THREADS
+	if (s_thread_curl_key_p)
+		{
+			void *data_p = NULL;
+
+			if (apr_threadkey_private_get (&data_p, s_thread_curl_key_p) == APR_SUCCESS)
+				{
+					thread_curl_p = (ThreadCurl *) data_p;
+				}
+
+			if (!thread_curl_p)
+				{
+					thread_curl_p = (ThreadCurl *) malloc (sizeof (ThreadCurl));
+
+					if (thread_curl_p)
+						{
+							thread_curl_p -> tc_in_use_flag = false;
+							thread_curl_p -> tc_curl_p = curl_easy_init ();
+
+							if (! ((thread_curl_p -> tc_curl_p) && (apr_threadkey_private_set (thread_curl_p, s_thread_curl_key_p) == APR_SUCCESS)))
+								{
+									FreeThreadCurl (thread_curl_p);
+									thread_curl_p = NULL;
+								}
+						}
+				}
+		}
+	#else
+	if (!s_thread_curl_p)
+		{
+			s_thread_curl_p = (ThreadCurl *) malloc (sizeof (ThreadCurl));
+
+			if (s_thread_curl_p)
+				{
+					s_thread_curl_p -> tc_in_use_flag = false;
+					s_thread_curl_p -> tc_curl_p = curl_easy_init ();
+
+					if (! (s_thread_curl_p -> tc_curl_p))
+						{
+							FreeThreadCurl (s_thread_curl_p);
+							s_thread_curl_p = NULL;
+						}
+				}
+		}
+
+	thread_curl_p = s_thread_curl_p;
+	#endif
+
+	return thread_curl_p;
+}
+
+
+/*
+ * This is called by APR when a thread that has used a CurlUtil exits.
+ */
+static void FreeThreadCurl (void *data_p)
+{
+	ThreadCurl *thread_curl_p = (ThreadCurl *) data_p;
+
+	if (thread_curl_p)
+		{
+			if (thread_curl_p -> tc_curl_p)
+				{
+					FreeCurl (thread_curl_p -> tc_curl_p);
+				}
+
+			free (thread_curl_p);
+		}
+}
+
+
 char *SimpleCallGetRequest (request_rec *req_p, apr_pool_t *pool_p, const char *uri_s)
 {
 	char *result_s = NULL;
@@ -413,6 +573,9 @@ static bool AddCurlCallback (CurlUtil *curl_tool_p, apr_pool_t *pool_p)
 	    /* set maximum allowed redirects */
 	    { CURLOPT_MAXREDIRS, (const char *) 1 },
 
+	    /* don't use signals for DNS timeouts, they aren't safe in a threaded MPM */
+	    { CURLOPT_NOSIGNAL, (const char *) 1 },
+
 			{ CURLOPT_LASTENTRY, (const char *) NULL }
 		};
 
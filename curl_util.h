@@ -57,6 +57,13 @@ typedef struct CurlUtil
 	/** @private */
 	CURL *ct_curl_p;
 
+	/**
+	 * @private
+	 * <code>true</code> if ct_curl_p is the calling thread's reusable
+	 * handle rather than one that was created for this CurlUtil.
+	 */
+	bool ct_thread_handle_flag;
+
 	/** @private */
 	apr_pool_t *ct_pool_p;
 
@@ -86,6 +93,17 @@ typedef struct CurlUtil
 #endif
 
 
+/**
+ * Set up the per-thread CURL handles that are reused by each CurlUtil,
+ * so that connections and DNS lookups are cached between requests. This
+ * is called once for each child process, after curl_global_init().
+ *
+ * @param pool_p The pool of the child process.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t InitCurlUtil (apr_pool_t *pool_p);
+
+
 /**
  * Allocate a CurlUtil.
  *
@@ -0,0 +1,431 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * env_cache.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "env_cache.h"
+#include "config.h"
+
+#include "apr_strings.h"
+#include "apr_hash.h"
+#include "apr_file_info.h"
+
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
+
+#include "http_config.h"
+#include "http_log.h"
+
+#include "jansson.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+static const char * const S_ENV_FILE_VARIABLE_S = "IRODS_ENVIRONMENT_FILE";
+
+
+typedef struct EnvCacheEntry
+{
+	/** The modification time of the file when it was parsed. */
+	apr_time_t ece_mtime;
+
+	/** The parsed environment. */
+	rodsEnv ece_env;
+} EnvCacheEntry;
+
+
+/*
+ * The first environment file set with DavRodsEnvFile. This lives in the
+ * configuration pool so it is reset before the configuration is read
+ * again on a restart.
+ */
+static const char *s_env_file_s = NULL;
+
+
+/*
+ * The caches are per child process. s_envs_p maps each environment file
+ * path to an EnvCacheEntry and s_versions_p maps each "<host>:<port>"
+ * to the release version of that iRODS server.
+ */
+static apr_pool_t *s_cache_pool_p = NULL;
+
+static apr_hash_t *s_envs_p = NULL;
+
+static apr_hash_t *s_versions_p = NULL;
+
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *s_mutex_p = NULL;
+#endif
+
+
+static bool LoadRodsEnv (apr_pool_t *pool_p, const char *env_file_s, rodsEnv *env_p);
+
+static bool OverlayRodsEnv (apr_pool_t *pool_p, const char *env_file_s, rodsEnv *env_p);
+
+static bool CopyEnvString (const json_t *env_json_p, const char *key_s, char *value_s, const size_t size);
+
+static void PrimeEnvCache (apr_pool_t *pool_p);
+
+/*
+ * Read the exported environment file while the child process still only
+ * has one thread. As well as filling the cache, this means that the iRODS
+ * client library sets up its own copy of the environment before any
+ * requests can race to do so.
+ */
+static void PrimeEnvCache (apr_pool_t *pool_p)
+{
+	const char *env_file_s = getenv (S_ENV_FILE_VARIABLE_S);
+
+	if (env_file_s)
+		{
+			apr_finfo_t info;
+
+			if (apr_stat (&info, env_file_s, APR_FINFO_MTIME, pool_p) == APR_SUCCESS)
+				{
+					EnvCacheEntry *entry_p = (EnvCacheEntry *) apr_palloc (s_cache_pool_p, sizeof (EnvCacheEntry));
+
+					if (LoadRodsEnv (pool_p, env_file_s, & (entry_p -> ece_env)))
+						{
+							entry_p -> ece_mtime = info.mtime;
+							apr_hash_set (s_envs_p, apr_pstrdup (s_cache_pool_p, env_file_s), APR_HASH_KEY_STRING, entry_p);
+						}
+				}
+		}
+}
+
+
+static void LockEnvCache (void);
+
+static void UnlockEnvCache (void);
+
+
+void ResetEnvFile (void)
+{
+	s_env_file_s = NULL;
+}
+
+
+void NoteEnvFile (apr_pool_t *pool_p, const char *env_file_s)
+{
+	if (!s_env_file_s)
+		{
+			s_env_file_s = apr_pstrdup (pool_p, env_file_s);
+		}
+	else if (strcmp (s_env_file_s, env_file_s) != 0)
+		{
+			ap_log_perror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, pool_p,
+				"More than one iRODS environment file is configured, the client library will read its connection settings such as SSL from \"%s\" rather than \"%s\"",
+				s_env_file_s, env_file_s);
+		}
+}
+
+
+void ExportEnvFile (server_rec *server_p)
+{
+	const char *env_file_s = s_env_file_s;
+
+	if (!env_file_s)
+		{
+			davrods_dir_conf_t *conf_p = ap_get_module_config (server_p -> lookup_defaults, &davrods_module);
+
+			if (conf_p)
+				{
+					env_file_s = conf_p -> rods_env_file;
+				}
+		}
+
+	if (env_file_s)
+		{
+			setenv (S_ENV_FILE_VARIABLE_S, env_file_s, 1);
+
+			ap_log_error (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, server_p, "Using iRODS env file at <%s>", env_file_s);
+		}
+}
+
+
+apr_status_t InitEnvCache (apr_pool_t *pool_p)
+{
+	apr_status_t status = apr_pool_create (&s_cache_pool_p, pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			s_envs_p = apr_hash_make (s_cache_pool_p);
+			s_versions_p = apr_hash_make (s_cache_pool_p);
+
+			#if APR_HAS_THREADS
+			status = apr_thread_mutex_create (&s_mutex_p, APR_THREAD_MUTEX_DEFAULT, pool_p);
+
+			if (status != APR_SUCCESS)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to create the iRODS environment cache mutex");
+					s_envs_p = NULL;
+					s_versions_p = NULL;
+				}
+			#endif
+
+			if (s_envs_p)
+				{
+					PrimeEnvCache (pool_p);
+				}
+		}
+	else
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to create the iRODS environment cache pool");
+		}
+
+	return status;
+}
+
+
+bool GetCachedRodsEnv (request_rec *req_p, const char *env_file_s, rodsEnv *env_p)
+{
+	bool success_flag = false;
+
+	if (s_envs_p)
+		{
+			apr_finfo_t info;
+			const bool stat_flag = (apr_stat (&info, env_file_s, APR_FINFO_MTIME, req_p -> pool) == APR_SUCCESS);
+			EnvCacheEntry *entry_p;
+
+			LockEnvCache ();
+
+			entry_p = (EnvCacheEntry *) apr_hash_get (s_envs_p, env_file_s, APR_HASH_KEY_STRING);
+
+			if (entry_p && stat_flag && (entry_p -> ece_mtime == info.mtime))
+				{
+					memcpy (env_p, & (entry_p -> ece_env), sizeof (rodsEnv));
+					success_flag = true;
+				}
+			else
+				{
+					if (!entry_p)
+						{
+							entry_p = (EnvCacheEntry *) apr_palloc (s_cache_pool_p, sizeof (EnvCacheEntry));
+						}
+
+					if (LoadRodsEnv (req_p -> pool, env_file_s, & (entry_p -> ece_env)))
+						{
+							memcpy (env_p, & (entry_p -> ece_env), sizeof (rodsEnv));
+							success_flag = true;
+
+							/*
+							 * If the file can't be stat'ed, don't keep the entry so that
+							 * it is read again next time.
+							 */
+							if (stat_flag)
+								{
+									entry_p -> ece_mtime = info.mtime;
+									apr_hash_set (s_envs_p, apr_pstrdup (s_cache_pool_p, env_file_s), APR_HASH_KEY_STRING, entry_p);
+								}
+						}
+					else
+						{
+							apr_hash_set (s_envs_p, env_file_s, APR_HASH_KEY_STRING, NULL);
+						}
+				}
+
+			UnlockEnvCache ();
+		}
+	else
+		{
+			success_flag = LoadRodsEnv (req_p -> pool, env_file_s, env_p);
+		}
+
+	return success_flag;
+}
+
+
+const char *GetCachedServerVersion (request_rec *req_p, rcComm_t *connection_p, const char *host_s, const int port)
+{
+	const char *version_s = NULL;
+	char *key_s = apr_psprintf (req_p -> pool, "%s:%d", host_s, port);
+
+	if (s_versions_p)
+		{
+			LockEnvCache ();
+			version_s = (const char *) apr_hash_get (s_versions_p, key_s, APR_HASH_KEY_STRING);
+			UnlockEnvCache ();
+		}
+
+	if (!version_s)
+		{
+			miscSvrInfo_t *server_info_p = NULL;
+			int status = rcGetMiscSvrInfo (connection_p, &server_info_p);
+
+			if ((status >= 0) && server_info_p)
+				{
+					if (s_versions_p)
+						{
+							LockEnvCache ();
+
+							version_s = apr_pstrdup (s_cache_pool_p, server_info_p -> relVersion);
+							apr_hash_set (s_versions_p, apr_pstrdup (s_cache_pool_p, key_s), APR_HASH_KEY_STRING, version_s);
+
+							UnlockEnvCache ();
+						}
+					else
+						{
+							version_s = apr_pstrdup (req_p -> pool, server_info_p -> relVersion);
+						}
+				}
+			else
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, req_p, "rcGetMiscSvrInfo failed for %s: %d", key_s, status);
+				}
+
+			if (server_info_p)
+				{
+					free (server_info_p);
+				}
+		}
+
+	return version_s;
+}
+
+
+static bool LoadRodsEnv (apr_pool_t *pool_p, const char *env_file_s, rodsEnv *env_p)
+{
+	bool success_flag = false;
+	const char *exported_env_file_s = getenv (S_ENV_FILE_VARIABLE_S);
+	int status;
+
+	/*
+	 * getRodsEnv () only reads the file named by IRODS_ENVIRONMENT_FILE. That
+	 * was set by ExportEnvFile before any threads were started and is never
+	 * changed afterwards, so any other environment file is read on top of it.
+	 */
+	memset (env_p, 0, sizeof (rodsEnv));
+	status = getRodsEnv (env_p);
+
+	if (status == 0)
+		{
+			if (exported_env_file_s && (strcmp (exported_env_file_s, env_file_s) == 0))
+				{
+					ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool_p, "Read iRODS env file at <%s>", env_file_s);
+					success_flag = true;
+				}
+			else
+				{
+					success_flag = OverlayRodsEnv (pool_p, env_file_s, env_p);
+				}
+		}
+	else
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, pool_p, "Failed to read iRODS env file at <%s>: %d", exported_env_file_s ? exported_env_file_s : env_file_s, status);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Copy the settings that davrods itself uses from an environment file
+ * other than the exported one. The rest of the settings, such as those
+ * for SSL, are read by the iRODS client library itself so they always
+ * come from the exported file.
+ */
+static bool OverlayRodsEnv (apr_pool_t *pool_p, const char *env_file_s, rodsEnv *env_p)
+{
+	bool success_flag = false;
+	json_error_t error;
+	json_t *env_json_p = json_load_file (env_file_s, 0, &error);
+
+	if (env_json_p)
+		{
+			if (json_is_object (env_json_p))
+				{
+					const json_t *port_p = json_object_get (env_json_p, "irods_port");
+					const bool user_flag = CopyEnvString (env_json_p, "irods_user_name", env_p -> rodsUserName, sizeof (env_p -> rodsUserName));
+					const bool zone_flag = CopyEnvString (env_json_p, "irods_zone_name", env_p -> rodsZone, sizeof (env_p -> rodsZone));
+					const bool home_flag = CopyEnvString (env_json_p, "irods_home", env_p -> rodsHome, sizeof (env_p -> rodsHome));
+					const bool cwd_flag = CopyEnvString (env_json_p, "irods_cwd", env_p -> rodsCwd, sizeof (env_p -> rodsCwd));
+
+					CopyEnvString (env_json_p, "irods_host", env_p -> rodsHost, sizeof (env_p -> rodsHost));
+					CopyEnvString (env_json_p, "irods_default_resource", env_p -> rodsDefResource, sizeof (env_p -> rodsDefResource));
+
+					if (json_is_integer (port_p))
+						{
+							env_p -> rodsPort = (int) json_integer_value (port_p);
+						}
+
+					/* Fill in the home and current collections for another user or zone as getRodsEnv () does */
+					if ((user_flag || zone_flag) && (!home_flag))
+						{
+							apr_snprintf (env_p -> rodsHome, sizeof (env_p -> rodsHome), "/%s/home/%s", env_p -> rodsZone, env_p -> rodsUserName);
+						}
+
+					if ((user_flag || zone_flag || home_flag) && (!cwd_flag))
+						{
+							apr_cpystrn (env_p -> rodsCwd, env_p -> rodsHome, sizeof (env_p -> rodsCwd));
+						}
+
+					ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool_p, "Read iRODS env file at <%s>", env_file_s);
+					success_flag = true;
+				}
+			else
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, pool_p, "iRODS env file at <%s> is not a JSON object", env_file_s);
+				}
+
+			json_decref (env_json_p);
+		}
+	else
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, pool_p, "Failed to read iRODS env file at <%s>: %s", env_file_s, error.text);
+		}
+
+	return success_flag;
+}
+
+
+static bool CopyEnvString (const json_t *env_json_p, const char *key_s, char *value_s, const size_t size)
+{
+	bool copied_flag = false;
+	const json_t *value_p = json_object_get (env_json_p, key_s);
+
+	if (json_is_string (value_p))
+		{
+			apr_cpystrn (value_s, json_string_value (value_p), size);
+			copied_flag = true;
+		}
+
+	return copied_flag;
+}
+
+
+static void LockEnvCache (void)
+{
+	#if APR_HAS_THREADS
+	apr_thread_mutex_lock (s_mutex_p);
+	#endif
+}
+
+
+static void UnlockEnvCache (void)
+{
+	#if APR_HAS_THREADS
+	apr_thread_mutex_unlock (s_mutex_p);
+	#endif
+}
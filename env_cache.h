@@ -0,0 +1,115 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * env_cache.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef ENV_CACHE_H_
+#define ENV_CACHE_H_
+
+#include <stdbool.h>
+
+#include "httpd.h"
+
+#include "apr_pools.h"
+
+#include "irods/rodsClient.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Forget the iRODS environment file that was noted during the previous
+ * reading of the configuration. This is called from the pre_config hook.
+ */
+void ResetEnvFile (void);
+
+
+/**
+ * Note an iRODS environment file that has been set with DavRodsEnvFile.
+ * The first one that is noted is the one that is exported to the child
+ * processes by ExportEnvFile.
+ *
+ * @param pool_p The configuration pool.
+ * @param env_file_s The path to the iRODS environment file.
+ */
+void NoteEnvFile (apr_pool_t *pool_p, const char *env_file_s);
+
+
+/**
+ * Point the iRODS client library at the configured environment file by
+ * setting IRODS_ENVIRONMENT_FILE. This is called from the post_config
+ * hook, before any child processes or threads exist, so that the process
+ * environment does not need to be changed while requests are served.
+ *
+ * @param server_p The server.
+ */
+void ExportEnvFile (server_rec *server_p);
+
+
+/**
+ * Set up the cache of parsed iRODS environments and server details and
+ * read the exported environment file into it. This is called once for
+ * each child process, before it starts any threads.
+ *
+ * @param pool_p The pool of the child process.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t InitEnvCache (apr_pool_t *pool_p);
+
+
+/**
+ * Get the parsed iRODS environment for an environment file. The file is
+ * only read again when its modification time changes. For any file other
+ * than the exported one, its user, zone, home and current collections,
+ * host, port and default resource are read on top of the exported
+ * environment, so the process environment is never changed.
+ *
+ * @param req_p The request that needs the environment.
+ * @param env_file_s The path to the iRODS environment file.
+ * @param env_p The rodsEnv to copy the environment into.
+ * @return <code>true</code> if the environment was copied into env_p,
+ * <code>false</code> if the file could not be read.
+ */
+bool GetCachedRodsEnv (request_rec *req_p, const char *env_file_s, rodsEnv *env_p);
+
+
+/**
+ * Get the release version of an iRODS server. This is only asked of the
+ * server the first time that each child process connects to it.
+ *
+ * @param req_p The request that made the connection.
+ * @param connection_p The connection to the server.
+ * @param host_s The host name of the server.
+ * @param port The port of the server.
+ * @return The release version or <code>NULL</code> if it could not be
+ * retrieved.
+ */
+const char *GetCachedServerVersion (request_rec *req_p, rcComm_t *connection_p, const char *host_s, const int port);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ENV_CACHE_H_ */
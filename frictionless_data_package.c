@@ -20,15 +20,23 @@
  *      Author: billy
  */
 
+#include <ctype.h>
+#include <strings.h>
+
 #include "apr_strings.h"
+#include "apr_file_io.h"
+#include "apr_file_info.h"
+#include "apr_hash.h"
 
 #include "frictionless_data_package.h"
+#include "json_writer.h"
 #include "meta.h"
 #include "repo.h"
 #include "theme.h"
 
 #include "httpd.h"
 #include "http_protocol.h"
+#include "util_md5.h"
 
 #include "irods/rcConnect.h"
 
@@ -42,6 +50,83 @@
 static const char * const S_DATA_PACKAGE_S = "datapackage.json";
 
 
+/*
+ * The columns used to get the resource details for each data object
+ * within a data package.
+ */
+static const int S_RESOURCE_COLUMNS_P [] =
+{
+	COL_D_DATA_ID,
+	COL_COLL_NAME,
+	COL_DATA_NAME,
+	COL_DATA_SIZE,
+	COL_D_MODIFY_TIME,
+	COL_D_DATA_CHECKSUM,
+	-1
+};
+
+
+/*
+ * The cache files and previous resource entries used while a data
+ * package is being generated.
+ */
+typedef struct DataPackageCache
+{
+	/** The path of the cached datapackage.json or NULL if it isn't kept. */
+	const char *dpc_package_path_s;
+
+	/** The path of the index of the resource entries in the cached datapackage.json */
+	const char *dpc_index_path_s;
+
+	char *dpc_package_temp_path_s;
+
+	apr_file_t *dpc_package_file_p;
+
+	char *dpc_index_temp_path_s;
+
+	apr_file_t *dpc_index_file_p;
+
+	/** The filename of the previously cached datapackage.json, if any. */
+	const char *dpc_previous_package_s;
+
+	/**
+	 * The index lines for the resources in the previously cached
+	 * datapackage.json keyed by their data object ids.
+	 */
+	apr_hash_t *dpc_previous_entries_p;
+
+	apr_size_t dpc_num_reused;
+
+	apr_size_t dpc_num_generated;
+} DataPackageCache;
+
+
+/*
+ * The amount of a tabular data object to read when looking for its
+ * column headings.
+ */
+static const int S_HEADER_SNIFF_SIZE = 4096;
+
+
+/*
+ * The column metadata for all of the tabular data objects within a data
+ * package. Rather than querying the metadata for each tabular data object
+ * separately, it is all fetched by a single paged GenQuery the first time
+ * that it is needed.
+ */
+typedef struct TabularMetadata
+{
+	const char *tm_subtree_condition_s;
+
+	/** The apr_table_t of IrodsMetadata for each data object keyed by its id. */
+	apr_hash_t *tm_tables_p;
+
+	bool tm_loaded_flag;
+
+	apr_pool_t *tm_pool_p;
+} TabularMetadata;
+
+
 static const char *S_TYPES_SS [] =
 {
 	"string",
@@ -60,15 +145,41 @@ static const char *GetJSONString (const json_t *json_p, const char * const key_s
 
 static bool SetJSONString (json_t *json_p, const char * const key_s, const char * const value_s, apr_pool_t *pool_p);
 
-static json_t *GetResources (const dav_resource *resource_p);
+static apr_status_t WriteDataPackage (const json_t *data_package_p, const char *collection_s, DataPackageCache *cache_p, struct dav_resource_private *davrods_resource_p, apr_bucket_brigade *bb_p, ap_filter_t *output_p, bool *aborted_flag_p, apr_pool_t *pool_p);
+
+static int WriteResources (JSONWriter *writer_p, const char *collection_s, DataPackageCache *cache_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p);
+
+static json_t *GetResource (collEnt_t * const entry_p, const char *stamp_s, DataPackageCache *cache_p, TabularMetadata *tabular_metadata_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p);
+
+static json_t *PopulateResourceFromDataObject (collEnt_t * const entry_p, TabularMetadata *tabular_metadata_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p);
+
+static apr_table_t *GetTabularMetadata (TabularMetadata *tabular_metadata_p, const char *id_s, rcComm_t *connection_p);
+
+static int LoadTabularMetadata (TabularMetadata *tabular_metadata_p, rcComm_t *connection_p);
+
+static apr_array_header_t *SniffColumnHeaders (rcComm_t *connection_p, const collEnt_t *entry_p, apr_pool_t *pool_p);
 
-static bool AddResources (json_t *fd_p, const dav_resource *resource_p);
+static char *GetDataPackageStamp (rcComm_t *connection_p, const char *collection_s, apr_pool_t *pool_p);
 
-static bool AddResource (collEnt_t * const entry_p, json_t *resources_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p);
+static char *GetDataPackageCacheKey (const char *collection_id_s, const rcComm_t *connection_p, apr_pool_t *pool_p);
 
-static json_t *PopulateResourceFromDataObject (collEnt_t * const entry_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p);
+static int GetAggregateValues (rcComm_t *connection_p, const int *columns_p, const int *functions_p, const int num_columns, const char *condition_s, char **values_ss, apr_pool_t *pool_p);
 
-static json_t *PopulateResourceFromCollection (collEnt_t * const entry_p,  rcComm_t *connection_p, const char *data_package_root_path_s, apr_pool_t *pool_p);
+static apr_hash_t *GetMetadataStamps (rcComm_t *connection_p, const char *subtree_condition_s, apr_pool_t *pool_p);
+
+static char *GetSubtreeCondition (const char *collection_s, apr_pool_t *pool_p);
+
+static bool IsInSubtree (const char *collection_s, const char *entry_collection_s);
+
+static apr_status_t SendCachedDataPackage (const char *package_path_s, apr_bucket_brigade *bb_p, ap_filter_t *output_p, apr_pool_t *pool_p);
+
+static apr_status_t OpenDataPackageCache (DataPackageCache *cache_p, const char *directory_s, const char *cache_key_s, const char *package_path_s, apr_pool_t *pool_p);
+
+static void LoadDataPackageIndex (DataPackageCache *cache_p, apr_pool_t *pool_p);
+
+static void CloseDataPackageCache (DataPackageCache *cache_p, const bool success_flag, const char *collection_s, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p);
+
+static char *ReadFileContents (const char *path_s, apr_size_t *length_p, apr_pool_t *pool_p);
 
 static bool AddLicense (json_t *resource_p, const char *name_s, const char *url_s, apr_pool_t *pool_p);
 
@@ -82,13 +193,11 @@ static const char *GetRelativePath (const char *data_package_root_path_s, const
 
 static char *GetMetadataValue (const char *full_key_s, const apr_table_t *metadata_table_p, apr_pool_t *pool_p);
 
-static bool CacheDataPackageToDisk (const char *collection_s, const char *package_data_s, const char *output_path_s, apr_pool_t *pool_p);
-
 static bool CacheDataPackageToIRODS (const char *collection_s, char *package_data_s, rcComm_t *rods_conn_p, apr_pool_t *pool_p);
 
 static bool IsTabularPackage (const char *name_s);
 
-static json_t *GetTabularSchema (struct dav_resource_private *davrods_resource_p, apr_table_t *metadata_p, apr_pool_t *pool_p);
+static json_t *GetTabularSchema (struct dav_resource_private *davrods_resource_p, const collEnt_t *entry_p, apr_table_t *metadata_p, apr_pool_t *pool_p);
 
 static struct	apr_array_header_t *GetColumnHeaders (struct dav_resource_private *davrods_resource_p, apr_table_t *metadata_p, apr_pool_t *pool_p);
 
@@ -173,6 +282,7 @@ bool DoesFDDataPackageExist (const dav_resource *resource_p)
 dav_error *DeliverFDDataPackage (const dav_resource *resource_p, ap_filter_t *output_p)
 {
 	bool success_flag = false;
+	bool aborted_flag = false;
 	dav_error *res_p = NULL;
 	struct dav_resource_private *davrods_resource_p = (struct dav_resource_private *) resource_p -> info;
 	apr_pool_t *pool_p = resource_p -> pool;
@@ -184,86 +294,121 @@ dav_error *DeliverFDDataPackage (const dav_resource *resource_p, ap_filter_t *ou
 
 	if (bb_p)
 		{
-			json_t *dp_p = json_object ();
+			char *collection_id_s = GetCollectionId (davrods_resource_p -> rods_path, davrods_resource_p -> rods_conn, pool_p);
 
-			if (dp_p)
+			if (collection_id_s)
 				{
-					char *collection_id_s = GetCollectionId (davrods_resource_p -> rods_path, davrods_resource_p -> rods_conn, pool_p);
+					const struct HtmlTheme *theme_p = davrods_resource_p -> conf -> theme_p;
+					char *collection_path_s = apr_pstrdup (pool_p, davrods_resource_p -> rods_path);
+					const char *cache_key_s = GetDataPackageCacheKey (collection_id_s, davrods_resource_p -> rods_conn, pool_p);
+					const char *package_path_s = NULL;
+					size_t path_length = strlen (collection_path_s);
+
+					/* Remove any trailing slash so we can match the paths of its child collections */
+					if ((path_length > 1) && (collection_path_s [path_length - 1] == '/'))
+						{
+							collection_path_s [path_length - 1] = '\0';
+						}
+
+					/*
+					 * If we have a cache directory, the cached datapackage.json
+					 * is named after the collection, the user, since what they can
+					 * see depends upon their permissions, and a stamp that changes
+					 * whenever anything within the collection's subtree does.
+					 */
+					if (theme_p -> ht_fd_cache_dir_s)
+						{
+							const char *stamp_s = GetDataPackageStamp (davrods_resource_p -> rods_conn, collection_path_s, pool_p);
+
+							if (stamp_s)
+								{
+									package_path_s = apr_pstrcat (pool_p, theme_p -> ht_fd_cache_dir_s, "/", cache_key_s, "-", stamp_s, ".json", NULL);
 
-					if (collection_id_s)
+									if (SendCachedDataPackage (package_path_s, bb_p, output_p, pool_p) == APR_SUCCESS)
+										{
+											success_flag = true;
+										}
+								}
+						}
+
+					if (!success_flag)
 						{
 							apr_table_t *metadata_p = GetMetadataAsTable (davrods_resource_p -> rods_conn, COLL_OBJ_T, collection_id_s, NULL, davrods_resource_p -> rods_env -> rodsZone, pool_p);
 
 							if (metadata_p)
 								{
-									const struct HtmlTheme *theme_p = davrods_resource_p -> conf -> theme_p;
-									apr_status_t status;
-
-									/* the local collection name */
-									const char *collection_s = strrchr (davrods_resource_p -> rods_path, '/');
+									json_t *dp_p = json_object ();
 
-									if (collection_s)
+									if (dp_p)
 										{
-											/* move past the last slash */
-											++ collection_s;
+											apr_status_t status;
 
-											/*
-											 * Are we at the end of the string?
-											 */
-											if (*collection_s == '\0')
+											/* the local collection name */
+											const char *collection_s = strrchr (davrods_resource_p -> rods_path, '/');
+
+											if (collection_s)
 												{
-													collection_s = NULL;
+													/* move past the last slash */
+													++ collection_s;
+
+													/*
+													 * Are we at the end of the string?
+													 */
+													if (*collection_s == '\0')
+														{
+															collection_s = NULL;
+														}
 												}
-										}
 
-									status = BuildDataPackage (dp_p, metadata_p, collection_s, theme_p, pool_p);
+											status = BuildDataPackage (dp_p, metadata_p, collection_s, theme_p, pool_p);
 
-									if (status == APR_SUCCESS)
-										{
-											if (AddResources (dp_p, resource_p))
+											if (status == APR_SUCCESS)
 												{
-													apr_status_t apr_status;
-													char *dp_s = json_dumps (dp_p, JSON_INDENT (2));
+													DataPackageCache cache;
+													const char *cache_dir_s = package_path_s ? theme_p -> ht_fd_cache_dir_s : NULL;
 
-													if (dp_s)
+													/*
+													 * Saving the package to iRODS needs a complete copy of it, so
+													 * if we aren't caching it we still need a temporary file.
+													 */
+													if ((!cache_dir_s) && (theme_p -> ht_fd_save_datapackages_flag > 0))
 														{
-															if ( (apr_status = apr_brigade_puts (bb_p, NULL, NULL, dp_s)) == APR_SUCCESS)
-																{
-																	if ( (apr_status = ap_pass_brigade (output_p, bb_p)) == APR_SUCCESS)
-																		{
-																			success_flag = true;
-																		}
-																	else
-																		{
-																			ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "ap_pass_brigade failed for \"%s\" at brigade \"%s\"", dp_s, davrods_resource_p -> rods_path);
-																		}
-																}
-															else
-																{
-																	ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "Failed to write \"%s\" to brigade \"%s\"", dp_s, davrods_resource_p -> rods_path);
-																}
+															cache_dir_s = theme_p -> ht_fd_cache_dir_s;
 
-															if (theme_p -> ht_fd_save_datapackages_flag > 0)
+															if ((!cache_dir_s) && (apr_temp_dir_get (&cache_dir_s, pool_p) != APR_SUCCESS))
 																{
-																	CacheDataPackageToIRODS (davrods_resource_p -> rods_path, dp_s, davrods_resource_p -> rods_conn, pool_p);
+																	cache_dir_s = NULL;
 																}
+														}
+
+													OpenDataPackageCache (&cache, cache_dir_s, cache_key_s, package_path_s, pool_p);
+
+													status = WriteDataPackage (dp_p, collection_path_s, &cache, davrods_resource_p, bb_p, output_p, &aborted_flag, pool_p);
 
-															free (dp_s);
+													if (status == APR_SUCCESS)
+														{
+															success_flag = true;
+
+															ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, req_p, "Generated datapackage for \"%s\" reusing " APR_SIZE_T_FMT " resources and regenerating " APR_SIZE_T_FMT,
+															               davrods_resource_p -> rods_path, cache.dpc_num_reused, cache.dpc_num_generated);
 														}
 													else
 														{
-															ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "Failed to dump JSON for \"%s\"", davrods_resource_p -> rods_path);
+															ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, status, req_p, "Failed to write datapackage for \"%s\"", davrods_resource_p -> rods_path);
 														}
 
-												}		/* if (AddResources (dp_p, resource_p)) */
+													CloseDataPackageCache (&cache, success_flag, collection_path_s, davrods_resource_p, pool_p);
+												}
 											else
 												{
-													ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "AddResources failed for \"%s\"", davrods_resource_p -> rods_path);
+													ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "BuildDataPackage failed for \"%s\"", davrods_resource_p -> rods_path);
 												}
-										}
+
+											json_decref (dp_p);
+										}		/* if (dp_p) */
 									else
 										{
-											ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "BuildDataPackage failed for \"%s\"", davrods_resource_p -> rods_path);
+											ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "Failed to create output json for \"%s\"", davrods_resource_p -> rods_path);
 										}
 
 								}		/* if (metadata_p) */
@@ -272,17 +417,12 @@ dav_error *DeliverFDDataPackage (const dav_resource *resource_p, ap_filter_t *ou
 									ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "GetMetadataAsTable failed for \"%s\"", davrods_resource_p -> rods_path);
 								}
 
-						}		/* if (collection_id_s) */
-					else
-						{
-							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "GetCollectionId failed for \"%s\"", davrods_resource_p -> rods_path);
-						}
+						}		/* if (!success_flag) */
 
-					json_decref (dp_p);
-				}		/* if (dp_p) */
+				}		/* if (collection_id_s) */
 			else
 				{
-					ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "Failed to create output json for \"%s\"", davrods_resource_p -> rods_path);
+					ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "GetCollectionId failed for \"%s\"", davrods_resource_p -> rods_path);
 				}
 
 			apr_brigade_destroy (bb_p);
@@ -292,7 +432,11 @@ dav_error *DeliverFDDataPackage (const dav_resource *resource_p, ap_filter_t *ou
 			ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "Failed to create output bucket brigade for \"%s\"", davrods_resource_p -> rods_path);
 		}
 
-	if (!success_flag)
+	/*
+	 * Once some of the package has been sent, it's too late to send
+	 * an error and WriteDataPackage () will have closed the connection.
+	 */
+	if ((!success_flag) && (!aborted_flag))
 		{
 			res_p = dav_new_error (pool_p, HTTP_NOT_FOUND, 0, 0, "Failed to get file.");
 		}
@@ -301,11 +445,818 @@ dav_error *DeliverFDDataPackage (const dav_resource *resource_p, ap_filter_t *ou
 }
 
 
-static bool CacheDataPackageToDisk (const char *collection_s, const char *package_data_s, const char *output_path_s, apr_pool_t *pool_p)
+/*
+ * Stream the data package to the client, copying it to the cache file
+ * if there is one. The top-level values are written first and then the
+ * resources are written one at a time as they are read from iRODS. If
+ * this fails after some of the package has been sent, the response is
+ * cut short and aborted_flag_p is set.
+ */
+static apr_status_t WriteDataPackage (const json_t *data_package_p, const char *collection_s, DataPackageCache *cache_p, struct dav_resource_private *davrods_resource_p, apr_bucket_brigade *bb_p, ap_filter_t *output_p, bool *aborted_flag_p, apr_pool_t *pool_p)
 {
-	bool success_flag = false;
+	JSONWriter writer;
+	const char *key_s;
+	json_t *value_p;
+	apr_status_t status;
+
+	InitJSONWriter (&writer, bb_p, output_p, false);
+
+	if (cache_p -> dpc_package_file_p)
+		{
+			SetJSONWriterCopyFile (&writer, cache_p -> dpc_package_file_p);
+		}
+
+	BeginJSONObject (&writer);
+
+	json_object_foreach ((json_t *) data_package_p, key_s, value_p)
+		{
+			if (WriteJSONKey (&writer, key_s) == APR_SUCCESS)
+				{
+					WriteJSONValue (&writer, value_p);
+				}
+		}
+
+	if (WriteJSONKey (&writer, "resources") == APR_SUCCESS)
+		{
+			if (BeginJSONArray (&writer) == APR_SUCCESS)
+				{
+					if (WriteResources (&writer, collection_s, cache_p, davrods_resource_p, pool_p) == 0)
+						{
+							EndJSONArray (&writer);
+						}
+					else if (writer.jw_status == APR_SUCCESS)
+						{
+							writer.jw_status = APR_EGENERAL;
+						}
+				}
+		}
+
+	EndJSONObject (&writer);
+
+	status = FinishJSONWriter (&writer);
+
+	if (status != APR_SUCCESS)
+		{
+			if (HasJSONWriterSentData (&writer))
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed part way through sending the datapackage for \"%s\", closing the connection", collection_s);
+					*aborted_flag_p = true;
+				}
+
+			AbortJSONWriter (&writer);
+		}
+	else if (writer.jw_copy_status != APR_SUCCESS)
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, writer.jw_copy_status, pool_p, "Failed to write the cached datapackage for \"%s\"", collection_s);
+
+			if (cache_p -> dpc_package_file_p)
+				{
+					apr_file_close (cache_p -> dpc_package_file_p);
+					cache_p -> dpc_package_file_p = NULL;
+				}
+		}
+
+	return status;
+}
+
+
+/*
+ * Rather than walking the collection recursively and getting each
+ * checksum separately, get all of the data objects within the subtree
+ * from a single paged GenQuery. Any resource whose data object and
+ * metadata are unchanged since the package was last cached is copied
+ * from the previous index rather than being regenerated.
+ */
+static int WriteResources (JSONWriter *writer_p, const char *collection_s, DataPackageCache *cache_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p)
+{
+	int status = SYS_INVALID_INPUT_PARAM;
+	rcComm_t *connection_p = davrods_resource_p -> rods_conn;
+	char *subtree_condition_s = GetSubtreeCondition (collection_s, pool_p);
+
+	if (subtree_condition_s)
+		{
+			apr_hash_t *metadata_stamps_p = GetMetadataStamps (connection_p, subtree_condition_s, pool_p);
+			apr_hash_t *listed_ids_p = apr_hash_make (pool_p);
+			apr_pool_t *row_pool_p = NULL;
+			TabularMetadata tabular_metadata;
+
+			memset (&tabular_metadata, 0, sizeof (TabularMetadata));
+			tabular_metadata.tm_subtree_condition_s = subtree_condition_s;
+			tabular_metadata.tm_pool_p = pool_p;
+
+			if ((metadata_stamps_p) && (listed_ids_p) && (apr_pool_create (&row_pool_p, pool_p) == APR_SUCCESS))
+				{
+					genQueryInp_t query;
+					genQueryOut_t *results_p = NULL;
+					const int *column_p = S_RESOURCE_COLUMNS_P;
+
+					memset (&query, 0, sizeof (genQueryInp_t));
+					query.maxRows = MAX_SQL_ROWS;
+					status = 0;
+
+					while ((*column_p != -1) && (status == 0))
+						{
+							const int options = ((*column_p == COL_COLL_NAME) || (*column_p == COL_DATA_NAME)) ? ORDER_BY : 1;
+
+							status = addInxIval (& (query.selectInp), *column_p, options);
+							++ column_p;
+						}
+
+					if (status == 0)
+						{
+							status = addInxVal (& (query.sqlCondInp), COL_COLL_NAME, subtree_condition_s);
+						}
+
+					if (status == 0)
+						{
+							do
+								{
+									status = rcGenQuery (connection_p, &query, &results_p);
+
+									if (status == 0)
+										{
+											int i;
+
+											for (i = 0; (i < results_p -> rowCnt) && (writer_p -> jw_status == APR_SUCCESS); ++ i)
+												{
+													const char *id_s = GetGenQueryResultValue (results_p, COL_D_DATA_ID, i);
+													char *entry_collection_s = GetGenQueryResultValue (results_p, COL_COLL_NAME, i);
+
+													/*
+													 * Only use one replica of each data object and skip any
+													 * collections that only matched the "like" wildcards.
+													 */
+													if ((id_s) && (entry_collection_s) && (IsInSubtree (collection_s, entry_collection_s)) && (!apr_hash_get (listed_ids_p, id_s, APR_HASH_KEY_STRING)))
+														{
+															collEnt_t entry;
+															const char *size_s = GetGenQueryResultValue (results_p, COL_DATA_SIZE, i);
+															const char *modify_time_s = GetGenQueryResultValue (results_p, COL_D_MODIFY_TIME, i);
+															const char *metadata_stamp_s = (const char *) apr_hash_get (metadata_stamps_p, id_s, APR_HASH_KEY_STRING);
+															const char *stamp_s = apr_pstrcat (row_pool_p, modify_time_s ? modify_time_s : "0", "-", metadata_stamp_s ? metadata_stamp_s : "0", NULL);
+															json_t *resource_p;
+
+															memset (&entry, 0, sizeof (collEnt_t));
+															entry.objType = DATA_OBJ_T;
+															entry.dataId = (char *) id_s;
+															entry.collName = entry_collection_s;
+															entry.dataName = GetGenQueryResultValue (results_p, COL_DATA_NAME, i);
+															entry.dataSize = size_s ? (rodsLong_t) apr_atoi64 (size_s) : 0;
+															entry.modifyTime = (char *) modify_time_s;
+															entry.chksum = GetGenQueryResultValue (results_p, COL_D_DATA_CHECKSUM, i);
+
+															apr_hash_set (listed_ids_p, apr_pstrdup (pool_p, id_s), APR_HASH_KEY_STRING, "");
+
+															resource_p = GetResource (&entry, stamp_s, cache_p, &tabular_metadata, davrods_resource_p, row_pool_p);
+
+															if (resource_p)
+																{
+																	WriteJSONValue (writer_p, resource_p);
+																	json_decref (resource_p);
+																}
+															else
+																{
+																	ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get datapackage resource for \"%s/%s\"", entry_collection_s, entry.dataName);
+																}
+
+															apr_pool_clear (row_pool_p);
+														}
+
+												}		/* for (i = 0; i < results_p -> rowCnt; ++ i) */
+
+											query.continueInx = results_p -> continueInx;
+											freeGenQueryOut (&results_p);
+										}		/* if (status == 0) */
+
+								}
+							while ((status == 0) && (query.continueInx > 0) && (writer_p -> jw_status == APR_SUCCESS));
+
+							if (status == CAT_NO_ROWS_FOUND)
+								{
+									status = 0;
+								}
+							else if (status != 0)
+								{
+									ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get the resources for the datapackage of \"%s\", %s", collection_s, get_rods_error_msg (status));
+								}
+
+							/* Close the query if we stopped early */
+							if (query.continueInx > 0)
+								{
+									query.maxRows = 0;
+									rcGenQuery (connection_p, &query, &results_p);
+								}
+						}		/* if (status == 0) */
+
+					freeGenQueryOut (&results_p);
+					clearGenQueryInp (&query);
+					apr_pool_destroy (row_pool_p);
+				}
+
+		}		/* if (subtree_condition_s) */
+
+	return status;
+}
+
+
+/*
+ * Get the JSON for a resource, copying it from the previously cached
+ * package if it is unchanged. If there is a cache index being written,
+ * the resource is added to it.
+ */
+static json_t *GetResource (collEnt_t * const entry_p, const char *stamp_s, DataPackageCache *cache_p, TabularMetadata *tabular_metadata_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p)
+{
+	json_t *resource_p = NULL;
+	const char *path_s = apr_pstrcat (pool_p, entry_p -> collName, "/", entry_p -> dataName, NULL);
+
+	if (cache_p -> dpc_previous_entries_p)
+		{
+			const char *line_s = (const char *) apr_hash_get (cache_p -> dpc_previous_entries_p, entry_p -> dataId, APR_HASH_KEY_STRING);
+
+			if (line_s)
+				{
+					json_t *previous_p = json_loads (line_s, 0, NULL);
+
+					if (previous_p)
+						{
+							const char *previous_path_s = GetJSONString (previous_p, "path");
+							const char *previous_stamp_s = GetJSONString (previous_p, "stamp");
+
+							if ((previous_path_s) && (previous_stamp_s) && (strcmp (previous_path_s, path_s) == 0) && (strcmp (previous_stamp_s, stamp_s) == 0))
+								{
+									resource_p = json_object_get (previous_p, "resource");
+
+									if (resource_p)
+										{
+											json_incref (resource_p);
+											++ (cache_p -> dpc_num_reused);
+										}
+								}
+
+							json_decref (previous_p);
+						}
+				}
+		}
+
+	if (!resource_p)
+		{
+			resource_p = PopulateResourceFromDataObject (entry_p, tabular_metadata_p, davrods_resource_p, pool_p);
+
+			if (resource_p)
+				{
+					++ (cache_p -> dpc_num_generated);
+				}
+		}
+
+	if ((resource_p) && (cache_p -> dpc_index_file_p))
+		{
+			json_t *index_entry_p = json_pack ("{s:s,s:s,s:O}", "path", path_s, "stamp", stamp_s, "resource", resource_p);
+			bool written_flag = false;
+
+			if (index_entry_p)
+				{
+					char *index_entry_s = json_dumps (index_entry_p, JSON_COMPACT);
+
+					if (index_entry_s)
+						{
+							if (apr_file_printf (cache_p -> dpc_index_file_p, "%s\t%s\n", entry_p -> dataId, index_entry_s) > 0)
+								{
+									written_flag = true;
+								}
+
+							free (index_entry_s);
+						}
+
+					json_decref (index_entry_p);
+				}
+
+			/* Without a complete index, the package must not be cached */
+			if (!written_flag)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to add \"%s\" to datapackage index \"%s\"", path_s, cache_p -> dpc_index_temp_path_s);
+					apr_file_close (cache_p -> dpc_index_file_p);
+					cache_p -> dpc_index_file_p = NULL;
+				}
+		}
+
+	return resource_p;
+}
+
+
+/*
+ * Get a value that changes whenever anything that goes into the
+ * datapackage.json for a collection does. This is made up of the latest
+ * modification time of the data objects, collections and metadata within
+ * the collection's subtree along with the numbers of data objects,
+ * collections and metadata AVUs so that deletions are spotted too.
+ */
+static char *GetDataPackageStamp (rcComm_t *connection_p, const char *collection_s, apr_pool_t *pool_p)
+{
+	char *stamp_s = NULL;
+	char *subtree_condition_s = GetSubtreeCondition (collection_s, pool_p);
+
+	if (subtree_condition_s)
+		{
+			const int data_columns_p [] = { COL_D_MODIFY_TIME, COL_D_DATA_ID };
+			const int collection_columns_p [] = { COL_COLL_MODIFY_TIME, COL_COLL_ID };
+			const int counted_functions_p [] = { SELECT_MAX, SELECT_COUNT };
+			const int data_metadata_columns_p [] = { COL_META_DATA_MODIFY_TIME, COL_META_DATA_ATTR_ID };
+			const int collection_metadata_columns_p [] = { COL_META_COLL_MODIFY_TIME, COL_META_COLL_ATTR_ID };
+			char *data_values_ss [2];
+			char *collection_values_ss [2];
+			char *data_metadata_values_ss [2];
+			char *collection_metadata_values_ss [2];
+			char *collection_condition_s = apr_psprintf (pool_p, "= '%s'", collection_s);
+
+			if ((GetAggregateValues (connection_p, data_columns_p, counted_functions_p, 2, subtree_condition_s, data_values_ss, pool_p) == 0) &&
+					(GetAggregateValues (connection_p, collection_columns_p, counted_functions_p, 2, subtree_condition_s, collection_values_ss, pool_p) == 0) &&
+					(GetAggregateValues (connection_p, data_metadata_columns_p, counted_functions_p, 2, subtree_condition_s, data_metadata_values_ss, pool_p) == 0) &&
+					(GetAggregateValues (connection_p, collection_metadata_columns_p, counted_functions_p, 2, collection_condition_s, collection_metadata_values_ss, pool_p) == 0))
+				{
+					const char *times_ss [] = { data_values_ss [0], collection_values_ss [0], data_metadata_values_ss [0], collection_metadata_values_ss [0] };
+					apr_int64_t latest_time = 0;
+					size_t i;
+
+					for (i = 0; i < sizeof (times_ss) / sizeof (times_ss [0]); ++ i)
+						{
+							const apr_int64_t t = apr_atoi64 (times_ss [i]);
+
+							if (t > latest_time)
+								{
+									latest_time = t;
+								}
+						}
+
+					stamp_s = apr_psprintf (pool_p, "%" APR_INT64_T_FMT "-%" APR_INT64_T_FMT "-%" APR_INT64_T_FMT "-%" APR_INT64_T_FMT "-%" APR_INT64_T_FMT, latest_time,
+					                        apr_atoi64 (data_values_ss [1]), apr_atoi64 (collection_values_ss [1]), apr_atoi64 (data_metadata_values_ss [1]), apr_atoi64 (collection_metadata_values_ss [1]));
+				}
+		}
+
+	return stamp_s;
+}
+
+
+/*
+ * Get the prefix used for the names of a collection's cached files. What
+ * goes into a datapackage.json depends upon the permissions of the user
+ * that it was generated for, so each user gets their own copy. The user's
+ * name is hashed to keep the filenames safe.
+ */
+static char *GetDataPackageCacheKey (const char *collection_id_s, const rcComm_t *connection_p, apr_pool_t *pool_p)
+{
+	const char *user_s = apr_pstrcat (pool_p, connection_p -> clientUser.userName, "#", connection_p -> clientUser.rodsZone, NULL);
+
+	return apr_pstrcat (pool_p, collection_id_s, "-", ap_md5 (pool_p, (const unsigned char *) user_s), NULL);
+}
+
+
+/*
+ * Run a GenQuery for aggregate values of the given columns for the
+ * collections matching the given condition. Any values that can't be
+ * found are set to "0".
+ */
+static int GetAggregateValues (rcComm_t *connection_p, const int *columns_p, const int *functions_p, const int num_columns, const char *condition_s, char **values_ss, apr_pool_t *pool_p)
+{
+	genQueryInp_t query;
+	genQueryOut_t *results_p = NULL;
+	int status = 0;
+	int i;
+
+	memset (&query, 0, sizeof (genQueryInp_t));
+	query.maxRows = 1;
+
+	for (i = 0; (i < num_columns) && (status == 0); ++ i)
+		{
+			values_ss [i] = "0";
+			status = addInxIval (& (query.selectInp), columns_p [i], functions_p [i]);
+		}
+
+	if (status == 0)
+		{
+			status = addInxVal (& (query.sqlCondInp), COL_COLL_NAME, condition_s);
+
+			if (status == 0)
+				{
+					status = rcGenQuery (connection_p, &query, &results_p);
+
+					if (status == 0)
+						{
+							for (i = 0; i < num_columns; ++ i)
+								{
+									const char *value_s = GetGenQueryResultValue (results_p, columns_p [i], 0);
+
+									if ((value_s) && (*value_s != '\0'))
+										{
+											values_ss [i] = apr_pstrdup (pool_p, value_s);
+										}
+								}
+						}
+					else if (status == CAT_NO_ROWS_FOUND)
+						{
+							status = 0;
+						}
+					else
+						{
+							ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get the datapackage stamp values for %s, %s", condition_s, get_rods_error_msg (status));
+						}
+
+					freeGenQueryOut (&results_p);
+				}
+		}
+
+	clearGenQueryInp (&query);
+
+	return status;
+}
+
+
+/*
+ * Get the latest metadata modification time and the number of AVUs for
+ * each data object within a subtree keyed by the data object ids. The
+ * count means that removing an AVU changes the stamp too.
+ */
+static apr_hash_t *GetMetadataStamps (rcComm_t *connection_p, const char *subtree_condition_s, apr_pool_t *pool_p)
+{
+	apr_hash_t *stamps_p = apr_hash_make (pool_p);
+
+	if (stamps_p)
+		{
+			genQueryInp_t query;
+			genQueryOut_t *results_p = NULL;
+			int status;
+
+			memset (&query, 0, sizeof (genQueryInp_t));
+			query.maxRows = MAX_SQL_ROWS;
+
+			if ((status = addInxIval (& (query.selectInp), COL_D_DATA_ID, 1)) == 0)
+				{
+					if ((status = addInxIval (& (query.selectInp), COL_META_DATA_MODIFY_TIME, SELECT_MAX)) == 0)
+						{
+							if ((status = addInxIval (& (query.selectInp), COL_META_DATA_ATTR_ID, SELECT_COUNT)) == 0)
+								{
+									status = addInxVal (& (query.sqlCondInp), COL_COLL_NAME, subtree_condition_s);
+								}
+						}
+				}
+
+			if (status == 0)
+				{
+					do
+						{
+							status = rcGenQuery (connection_p, &query, &results_p);
+
+							if (status == 0)
+								{
+									int i;
+
+									for (i = 0; i < results_p -> rowCnt; ++ i)
+										{
+											const char *id_s = GetGenQueryResultValue (results_p, COL_D_DATA_ID, i);
+											const char *time_s = GetGenQueryResultValue (results_p, COL_META_DATA_MODIFY_TIME, i);
+											const char *count_s = GetGenQueryResultValue (results_p, COL_META_DATA_ATTR_ID, i);
+
+											if (id_s && time_s)
+												{
+													apr_hash_set (stamps_p, apr_pstrdup (pool_p, id_s), APR_HASH_KEY_STRING, apr_pstrcat (pool_p, time_s, "-", count_s ? count_s : "0", NULL));
+												}
+										}
+
+									query.continueInx = results_p -> continueInx;
+									freeGenQueryOut (&results_p);
+								}
+						}
+					while ((status == 0) && (query.continueInx > 0));
+				}
+
+			if ((status != 0) && (status != CAT_NO_ROWS_FOUND))
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get the metadata stamps for %s, %s", subtree_condition_s, get_rods_error_msg (status));
+					stamps_p = NULL;
+				}
+
+			freeGenQueryOut (&results_p);
+			clearGenQueryInp (&query);
+		}
+
+	return stamps_p;
+}
+
+
+/*
+ * Build a condition matching a collection and all of its descendants.
+ */
+static char *GetSubtreeCondition (const char *collection_s, apr_pool_t *pool_p)
+{
+	char *condition_s = NULL;
+
+	if (!strchr (collection_s, '\''))
+		{
+			if (strcmp (collection_s, "/") == 0)
+				{
+					condition_s = apr_pstrdup (pool_p, "like '/%'");
+				}
+			else
+				{
+					condition_s = apr_psprintf (pool_p, "= '%s' || like '%s/%%'", collection_s, collection_s);
+				}
+		}
+	else
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Cannot query collection names containing quotes, \"%s\"", collection_s);
+		}
+
+	return condition_s;
+}
+
+
+/*
+ * "like" treats any '_' and '%' in the collection name as wildcards,
+ * so check that each collection really is within the subtree.
+ */
+static bool IsInSubtree (const char *collection_s, const char *entry_collection_s)
+{
+	bool in_subtree_flag = false;
+	const size_t length = strlen (collection_s);
+
+	if (strncmp (collection_s, entry_collection_s, length) == 0)
+		{
+			const char c = entry_collection_s [length];
+
+			if ((c == '\0') || (c == '/') || ((length > 0) && (collection_s [length - 1] == '/')))
+				{
+					in_subtree_flag = true;
+				}
+		}
+
+	return in_subtree_flag;
+}
+
+
+static apr_status_t SendCachedDataPackage (const char *package_path_s, apr_bucket_brigade *bb_p, ap_filter_t *output_p, apr_pool_t *pool_p)
+{
+	apr_file_t *file_p = NULL;
+	apr_status_t status = apr_file_open (&file_p, package_path_s, APR_FOPEN_READ | APR_FOPEN_BINARY | APR_FOPEN_SENDFILE_ENABLED, APR_FPROT_OS_DEFAULT, pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			apr_finfo_t info;
+
+			status = apr_file_info_get (&info, APR_FINFO_SIZE, file_p);
+
+			if (status == APR_SUCCESS)
+				{
+					/* The file is closed by the pool cleanup once the bucket has been sent */
+					apr_brigade_insert_file (bb_p, file_p, 0, info.size, pool_p);
+
+					status = ap_pass_brigade (output_p, bb_p);
+					apr_brigade_cleanup (bb_p);
+				}
+			else
+				{
+					apr_file_close (file_p);
+				}
+		}
+
+	return status;
+}
+
+
+/*
+ * Open the temporary files that the package and its index are written to
+ * and load the index of the previously cached package for the collection.
+ * If package_path_s is NULL then no index is written and the package will
+ * not be kept.
+ */
+static apr_status_t OpenDataPackageCache (DataPackageCache *cache_p, const char *directory_s, const char *cache_key_s, const char *package_path_s, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	memset (cache_p, 0, sizeof (DataPackageCache));
+
+	if (directory_s)
+		{
+			const apr_int32_t flags = APR_FOPEN_CREATE | APR_FOPEN_WRITE | APR_FOPEN_EXCL | APR_FOPEN_BUFFERED;
+
+			cache_p -> dpc_package_path_s = package_path_s;
+			cache_p -> dpc_package_temp_path_s = apr_pstrcat (pool_p, directory_s, "/", cache_key_s, "-XXXXXX", NULL);
+
+			status = apr_file_mktemp (& (cache_p -> dpc_package_file_p), cache_p -> dpc_package_temp_path_s, flags, pool_p);
+
+			if (status == APR_SUCCESS)
+				{
+					if (package_path_s)
+						{
+							cache_p -> dpc_index_path_s = apr_pstrcat (pool_p, directory_s, "/", cache_key_s, ".index", NULL);
+							cache_p -> dpc_index_temp_path_s = apr_pstrcat (pool_p, directory_s, "/", cache_key_s, ".index-XXXXXX", NULL);
+
+							status = apr_file_mktemp (& (cache_p -> dpc_index_file_p), cache_p -> dpc_index_temp_path_s, flags, pool_p);
+
+							if (status == APR_SUCCESS)
+								{
+									const char *package_s = strrchr (package_path_s, '/');
+
+									/* The index begins with the filename of the package that it belongs to */
+									if (apr_file_printf (cache_p -> dpc_index_file_p, "%s\n", package_s ? package_s + 1 : package_path_s) > 0)
+										{
+											LoadDataPackageIndex (cache_p, pool_p);
+										}
+									else
+										{
+											apr_file_close (cache_p -> dpc_index_file_p);
+											cache_p -> dpc_index_file_p = NULL;
+										}
+								}
+							else
+								{
+									ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to create temporary datapackage index \"%s\"", cache_p -> dpc_index_temp_path_s);
+									cache_p -> dpc_index_file_p = NULL;
+								}
+						}
+				}
+			else
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to create temporary datapackage \"%s\"", cache_p -> dpc_package_temp_path_s);
+					cache_p -> dpc_package_file_p = NULL;
+				}
+		}
+
+	return status;
+}
+
+
+/*
+ * The index starts with a line holding the filename of the package that
+ * it belongs to. This is followed by a line for each resource in the
+ * package with the data object id and a tab before the resource's JSON.
+ */
+static void LoadDataPackageIndex (DataPackageCache *cache_p, apr_pool_t *pool_p)
+{
+	apr_size_t length = 0;
+	char *index_s = ReadFileContents (cache_p -> dpc_index_path_s, &length, pool_p);
+
+	if (index_s)
+		{
+			apr_hash_t *entries_p = apr_hash_make (pool_p);
+
+			if (entries_p)
+				{
+					char *line_s = index_s;
+					char *end_s = strchr (line_s, '\n');
+
+					if (end_s)
+						{
+							*end_s = '\0';
+							cache_p -> dpc_previous_package_s = line_s;
+							line_s = end_s + 1;
+
+							while (*line_s != '\0')
+								{
+									char *tab_s = strchr (line_s, '\t');
+
+									end_s = strchr (line_s, '\n');
+
+									if (end_s)
+										{
+											*end_s = '\0';
+										}
+
+									if (tab_s && ((!end_s) || (tab_s < end_s)))
+										{
+											*tab_s = '\0';
+											apr_hash_set (entries_p, line_s, APR_HASH_KEY_STRING, tab_s + 1);
+										}
+
+									line_s = end_s ? end_s + 1 : line_s + strlen (line_s);
+								}
+
+							cache_p -> dpc_previous_entries_p = entries_p;
+						}
+				}
+		}
+}
+
+
+/*
+ * Move the finished package and its index into place, removing the previously
+ * cached package, and save the package to iRODS if needed. If the package
+ * wasn't written successfully, the temporary files are just removed.
+ */
+static void CloseDataPackageCache (DataPackageCache *cache_p, const bool success_flag, const char *collection_s, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p)
+{
+	bool package_flag = false;
+	bool index_flag = false;
+
+	if (cache_p -> dpc_package_file_p)
+		{
+			package_flag = (apr_file_close (cache_p -> dpc_package_file_p) == APR_SUCCESS) && success_flag;
+			cache_p -> dpc_package_file_p = NULL;
+		}
+
+	if (cache_p -> dpc_index_file_p)
+		{
+			index_flag = (apr_file_close (cache_p -> dpc_index_file_p) == APR_SUCCESS);
+			cache_p -> dpc_index_file_p = NULL;
+		}
+
+	if (package_flag)
+		{
+			const struct HtmlTheme *theme_p = davrods_resource_p -> conf -> theme_p;
+
+			if (theme_p -> ht_fd_save_datapackages_flag > 0)
+				{
+					apr_size_t length = 0;
+					char *package_data_s = ReadFileContents (cache_p -> dpc_package_temp_path_s, &length, pool_p);
+
+					if (package_data_s)
+						{
+							CacheDataPackageToIRODS (collection_s, package_data_s, davrods_resource_p -> rods_conn, pool_p);
+						}
+				}
+
+			if ((cache_p -> dpc_package_path_s) && (index_flag))
+				{
+					apr_status_t status = apr_file_rename (cache_p -> dpc_package_temp_path_s, cache_p -> dpc_package_path_s, pool_p);
+
+					if (status == APR_SUCCESS)
+						{
+							status = apr_file_rename (cache_p -> dpc_index_temp_path_s, cache_p -> dpc_index_path_s, pool_p);
+
+							if (status == APR_SUCCESS)
+								{
+									const char *package_s = strrchr (cache_p -> dpc_package_path_s, '/') + 1;
+
+									if ((cache_p -> dpc_previous_package_s) && (strcmp (cache_p -> dpc_previous_package_s, package_s) != 0) && (!strchr (cache_p -> dpc_previous_package_s, '/')))
+										{
+											const char *previous_path_s = apr_pstrndup (pool_p, cache_p -> dpc_package_path_s, package_s - (cache_p -> dpc_package_path_s));
+
+											apr_file_remove (apr_pstrcat (pool_p, previous_path_s, cache_p -> dpc_previous_package_s, NULL), pool_p);
+										}
+								}
+							else
+								{
+									ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to rename \"%s\" to \"%s\"", cache_p -> dpc_index_temp_path_s, cache_p -> dpc_index_path_s);
+									apr_file_remove (cache_p -> dpc_index_temp_path_s, pool_p);
+								}
+						}
+					else
+						{
+							ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to rename \"%s\" to \"%s\"", cache_p -> dpc_package_temp_path_s, cache_p -> dpc_package_path_s);
+							package_flag = false;
+						}
+				}
+			else
+				{
+					package_flag = false;
+				}
+		}
+
+	if (!package_flag)
+		{
+			if (cache_p -> dpc_package_temp_path_s)
+				{
+					apr_file_remove (cache_p -> dpc_package_temp_path_s, pool_p);
+				}
+
+			if (cache_p -> dpc_index_temp_path_s)
+				{
+					apr_file_remove (cache_p -> dpc_index_temp_path_s, pool_p);
+				}
+		}
+}
+
+
+/*
+ * Read a file into a NUL-terminated buffer allocated from the given pool.
+ */
+static char *ReadFileContents (const char *path_s, apr_size_t *length_p, apr_pool_t *pool_p)
+{
+	char *contents_s = NULL;
+	apr_file_t *file_p = NULL;
+
+	if (apr_file_open (&file_p, path_s, APR_FOPEN_READ | APR_FOPEN_BINARY, APR_FPROT_OS_DEFAULT, pool_p) == APR_SUCCESS)
+		{
+			apr_finfo_t info;
+
+			if (apr_file_info_get (&info, APR_FINFO_SIZE, file_p) == APR_SUCCESS)
+				{
+					char *buffer_s = (char *) apr_palloc (pool_p, (apr_size_t) (info.size) + 1);
+
+					if (buffer_s)
+						{
+							apr_size_t length = 0;
+
+							if ((info.size == 0) || (apr_file_read_full (file_p, buffer_s, (apr_size_t) (info.size), &length) == APR_SUCCESS))
+								{
+									* (buffer_s + length) = '\0';
+									*length_p = length;
+									contents_s = buffer_s;
+								}
+						}
+				}
 
-	return success_flag;
+			apr_file_close (file_p);
+		}
+
+	return contents_s;
 }
 
 
@@ -701,139 +1652,7 @@ static bool SetJSONString (json_t *json_p, const char * const key_s, const char
 }
 
 
-static bool AddResources (json_t *fd_p, const dav_resource *resource_p)
-{
-	json_t *resources_json_p = GetResources (resource_p);
-
-	if (resources_json_p)
-		{
-			if (json_object_set_new (fd_p, "resources", resources_json_p) == 0)
-				{
-					return true;
-				}
-
-			json_decref (resources_json_p);
-		}
-
-	return false;
-}
-
-
-
-static json_t *GetResources (const dav_resource *resource_p)
-{
-	json_t *resources_json_p = NULL;
-	struct dav_resource_private *davrods_resource_p = (struct dav_resource_private *) resource_p -> info;
-	request_rec *req_p = davrods_resource_p -> r;
-	IRodsConfig irods_config;
-
-	if (InitIRodsConfig (&irods_config, resource_p) == APR_SUCCESS)
-		{
-			resources_json_p = json_array ();
-
-			if (resources_json_p)
-				{
-					collHandle_t collection_handle;
-					int status;
-
-					memset (&collection_handle, 0, sizeof (collHandle_t));
-
-					// Open the collection
-					status = rclOpenCollection (davrods_resource_p -> rods_conn, davrods_resource_p -> rods_path, RECUR_QUERY_FG, &collection_handle);
-
-					if (status >= 0)
-						{
-							collEnt_t coll_entry;
-
-							memset (&coll_entry, 0, sizeof (collEnt_t));
-
-							// Actually print the directory listing, one table row at a time.
-							do
-								{
-									status = rclReadCollection (davrods_resource_p -> rods_conn, &collection_handle, &coll_entry);
-
-									if (status >= 0)
-										{
-											/*
-											 * FD Data Packages don't appear to add the directory entries to the resources part.
-											 */
-											if (coll_entry.objType != COLL_OBJ_T) // || (strcmp (davrods_resource_p -> rods_path, coll_entry.collName) != 0))
-												{
-													/*
-													 * Add resource
-													 */
-
-													if (!AddResource (&coll_entry, resources_json_p, davrods_resource_p, resource_p -> pool))
-														{
-															status = -1;
-														}
-
-												}		/* if (strcmp (davrods_resource_p -> rods_path, coll_entry.collName) != 0) */
-
-										}		/* if (status >= 0) */
-									else if (status == CAT_NO_ROWS_FOUND)
-										{
-											// End of collection.
-										}
-									else
-										{
-											ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_EGENERAL,
-											               req_p,
-											               "rcReadCollection failed for collection <%s> with error <%s>",
-											               davrods_resource_p->rods_path, get_rods_error_msg (status));
-										}
-								}
-							while (status >= 0);
-
-
-							rclCloseCollection (&collection_handle);
-						}		/* if (collection_handle >= 0) */
-					else
-						{
-							ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, req_p, "rcOpenCollection failed: %d = %s", status, get_rods_error_msg (status));
-						}
-
-				}		/* if (resources_json_p) */
-
-		}		/* if (SetIRodsConfig (&irods_config, exposed_root_s, davrods_root_path_s, metadata_link_s) == APR_SUCCESS) */
-
-
-
-	return resources_json_p;
-}
-
-
-static bool AddResource (collEnt_t * const entry_p, json_t *resources_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p)
-{
-	json_t *resource_p = NULL;
-
-	if (entry_p -> objType == DATA_OBJ_T)
-		{
-			resource_p = PopulateResourceFromDataObject (entry_p, davrods_resource_p, pool_p);
-		}
-	else if (entry_p -> objType == COLL_OBJ_T)
-		{
-			resource_p = PopulateResourceFromCollection (entry_p, davrods_resource_p -> rods_conn, davrods_resource_p -> rods_root, pool_p);
-		}
-
-	if (resource_p)
-		{
-			if (json_array_append_new (resources_p, resource_p) == 0)
-				{
-					return true;
-				}
-			else
-				{
-					json_decref (resource_p);
-				}
-		}
-
-
-	return false;
-}
-
-
-static json_t *PopulateResourceFromDataObject (collEnt_t * const entry_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p)
+static json_t *PopulateResourceFromDataObject (collEnt_t * const entry_p, TabularMetadata *tabular_metadata_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p)
 {
 	json_t *resource_p = json_object ();
 
@@ -878,7 +1697,8 @@ static json_t *PopulateResourceFromDataObject (collEnt_t * const entry_p, struct
 
 							if (set_name_flag)
 								{
-									char *checksum_s = GetChecksum (entry_p, davrods_resource_p -> rods_conn, pool_p);
+									/* Only ask the server for the checksum if the catalogue doesn't have it */
+									char *checksum_s = ((entry_p -> chksum) && (* (entry_p -> chksum) != '\0')) ? entry_p -> chksum : GetChecksum (entry_p, davrods_resource_p -> rods_conn, pool_p);
 
 									if (checksum_s)
 										{
@@ -890,11 +1710,11 @@ static json_t *PopulateResourceFromDataObject (collEnt_t * const entry_p, struct
 									 */
 									if (IsTabularPackage (name_s))
 										{
-											apr_table_t *metadata_p = GetMetadataAsTable (davrods_resource_p -> rods_conn, DATA_OBJ_T, entry_p -> dataId, entry_p -> dataName, davrods_resource_p -> rods_env -> rodsZone, pool_p);
+											apr_table_t *metadata_p = GetTabularMetadata (tabular_metadata_p, entry_p -> dataId, davrods_resource_p -> rods_conn);
 
 											if (metadata_p)
 												{
-													json_t *schema_p = GetTabularSchema (davrods_resource_p, metadata_p, pool_p);
+													json_t *schema_p = GetTabularSchema (davrods_resource_p, entry_p, metadata_p, pool_p);
 
 													if (schema_p)
 														{
@@ -973,46 +1793,6 @@ static const char *GetRelativePath (const char *data_package_root_path_s, const
 }
 
 
-static json_t *PopulateResourceFromCollection (collEnt_t * const entry_p, rcComm_t *connection_p, const char *data_package_root_path_s, apr_pool_t *pool_p)
-{
-	json_t *resource_p = json_object ();
-
-	if (resource_p)
-		{
-			//char *name_s = entry_p -> collName;
-			const char *name_s = GetRelativePath (data_package_root_path_s, entry_p -> collName, pool_p);
-
-			if (name_s)
-				{
-					if (*name_s == '/')
-						{
-							++ name_s;
-
-							if (*name_s == '\0')
-								{
-									name_s = NULL;
-								}
-						}
-				}
-
-			if (!name_s)
-				{
-					name_s = entry_p -> collName;
-				}
-
-			if (SetJSONString (resource_p, "name", name_s, pool_p))
-				{
-					return resource_p;
-				}
-
-			json_decref (resource_p);
-		}		/* if (resource_p) */
-
-	return NULL;
-}
-
-
-
 static bool AddLicense (json_t *resource_p, const char *name_s, const char *url_s, apr_pool_t *pool_p)
 {
 	json_t *licenses_array_p = json_array ();
@@ -1072,7 +1852,7 @@ static bool AddAuthors (json_t *resource_p, const char *authors_s, apr_pool_t *p
 			while (author_s)
 				{
 					/* Scroll past any initial whitespace */
-					while (isspace (*author_s))
+					while (isspace ((unsigned char) *author_s))
 						{
 							++ author_s;
 						}
@@ -1157,11 +1937,11 @@ static bool IsTabularPackage (const char *name_s)
 		{
 			const char *name_suffix_s = name_s + name_length - suffix_length;
 			
-			if (apr_strnatcasecmp (name_suffix_s, ".csv") == 0)
+			if (strcasecmp (name_suffix_s, ".csv") == 0)
 				{
 					tabular_flag = true;
 				}
-			else if (apr_strnatcasecmp (name_suffix_s, ".tsv") == 0)
+			else if (strcasecmp (name_suffix_s, ".tsv") == 0)
 				{
 					tabular_flag = true;
 				}
@@ -1225,7 +2005,7 @@ static struct	apr_array_header_t *GetColumnHeaders (struct dav_resource_private
 
 
 
-static json_t *GetTabularSchema (struct dav_resource_private *davrods_resource_p, apr_table_t *metadata_p, apr_pool_t *pool_p)
+static json_t *GetTabularSchema (struct dav_resource_private *davrods_resource_p, const collEnt_t *entry_p, apr_table_t *metadata_p, apr_pool_t *pool_p)
 {
 	json_t *schema_p = json_object ();
 
@@ -1238,6 +2018,17 @@ static json_t *GetTabularSchema (struct dav_resource_private *davrods_resource_p
 					if (json_object_set_new (schema_p, "fields", fields_p) == 0)
 						{
 							struct apr_array_header_t *columns_p = GetColumnHeaders (davrods_resource_p, metadata_p, pool_p);
+							bool sniffed_flag = false;
+
+							/*
+							 * If there aren't any column headings in the metadata, try reading
+							 * them from the start of the data object itself.
+							 */
+							if ((!columns_p) && (davrods_resource_p -> conf -> theme_p -> ht_fd_sniff_headers_flag > 0))
+								{
+									columns_p = SniffColumnHeaders (davrods_resource_p -> rods_conn, entry_p, pool_p);
+									sniffed_flag = (columns_p != NULL);
+								}
 
 							/*
 							 * Iterate over the column headings and see if their types are specified in the metadata
@@ -1256,9 +2047,10 @@ static json_t *GetTabularSchema (struct dav_resource_private *davrods_resource_p
 							        	{
 							        		IrodsMetadata *value_p = (IrodsMetadata *) apr_table_get (metadata_p, key_s);
 
-							        		if (value_p)
+							        		/* Sniffed columns without a type in the metadata use the default type */
+							        		if ((value_p) || (sniffed_flag))
 							        			{
-									        		const char *type_s = value_p -> im_value_s;
+									        		const char *type_s = value_p ? value_p -> im_value_s : "string";
 
 									        		if (IsValidType (type_s))
 							        					{
@@ -1295,6 +2087,255 @@ static json_t *GetTabularSchema (struct dav_resource_private *davrods_resource_p
 
 
 
+/*
+ * Get the column metadata for a tabular data object. If the data object
+ * doesn't have any, an empty table is returned.
+ */
+static apr_table_t *GetTabularMetadata (TabularMetadata *tabular_metadata_p, const char *id_s, rcComm_t *connection_p)
+{
+	apr_table_t *metadata_p = NULL;
+
+	if (!tabular_metadata_p -> tm_loaded_flag)
+		{
+			tabular_metadata_p -> tm_loaded_flag = true;
+
+			if (LoadTabularMetadata (tabular_metadata_p, connection_p) != 0)
+				{
+					tabular_metadata_p -> tm_tables_p = NULL;
+				}
+		}
+
+	if (tabular_metadata_p -> tm_tables_p)
+		{
+			metadata_p = (apr_table_t *) apr_hash_get (tabular_metadata_p -> tm_tables_p, id_s, APR_HASH_KEY_STRING);
+
+			if (!metadata_p)
+				{
+					metadata_p = apr_table_make (tabular_metadata_p -> tm_pool_p, 1);
+				}
+		}
+
+	return metadata_p;
+}
+
+
+/*
+ * Get the "column_headings" and "<column>_type" metadata for every
+ * tabular data object within the subtree and group it by data object.
+ */
+static int LoadTabularMetadata (TabularMetadata *tabular_metadata_p, rcComm_t *connection_p)
+{
+	int status = SYS_MALLOC_ERR;
+	apr_pool_t *pool_p = tabular_metadata_p -> tm_pool_p;
+
+	tabular_metadata_p -> tm_tables_p = apr_hash_make (pool_p);
+
+	if (tabular_metadata_p -> tm_tables_p)
+		{
+			genQueryInp_t query;
+			genQueryOut_t *results_p = NULL;
+
+			memset (&query, 0, sizeof (genQueryInp_t));
+			query.maxRows = MAX_SQL_ROWS;
+
+			if ((status = addInxIval (& (query.selectInp), COL_D_DATA_ID, 1)) == 0)
+				{
+					if ((status = addInxIval (& (query.selectInp), COL_DATA_NAME, 1)) == 0)
+						{
+							if ((status = addInxIval (& (query.selectInp), COL_META_DATA_ATTR_NAME, 1)) == 0)
+								{
+									if ((status = addInxIval (& (query.selectInp), COL_META_DATA_ATTR_VALUE, 1)) == 0)
+										{
+											if ((status = addInxIval (& (query.selectInp), COL_META_DATA_ATTR_UNITS, 1)) == 0)
+												{
+													if ((status = addInxVal (& (query.sqlCondInp), COL_COLL_NAME, tabular_metadata_p -> tm_subtree_condition_s)) == 0)
+														{
+															status = addInxVal (& (query.sqlCondInp), COL_META_DATA_ATTR_NAME, "= 'column_headings' || like '%\\_type'");
+														}
+												}
+										}
+								}
+						}
+				}
+
+			if (status == 0)
+				{
+					do
+						{
+							status = rcGenQuery (connection_p, &query, &results_p);
+
+							if (status == 0)
+								{
+									int i;
+
+									for (i = 0; i < results_p -> rowCnt; ++ i)
+										{
+											const char *id_s = GetGenQueryResultValue (results_p, COL_D_DATA_ID, i);
+											const char *name_s = GetGenQueryResultValue (results_p, COL_DATA_NAME, i);
+											const char *key_s = GetGenQueryResultValue (results_p, COL_META_DATA_ATTR_NAME, i);
+											const char *value_s = GetGenQueryResultValue (results_p, COL_META_DATA_ATTR_VALUE, i);
+
+											if (id_s && name_s && key_s && value_s && (IsTabularPackage (name_s)))
+												{
+													apr_table_t *table_p = (apr_table_t *) apr_hash_get (tabular_metadata_p -> tm_tables_p, id_s, APR_HASH_KEY_STRING);
+
+													if (!table_p)
+														{
+															table_p = apr_table_make (pool_p, 8);
+															apr_hash_set (tabular_metadata_p -> tm_tables_p, apr_pstrdup (pool_p, id_s), APR_HASH_KEY_STRING, table_p);
+														}
+
+													if (table_p)
+														{
+															IrodsMetadata *metadata_p = AllocateIrodsMetadata (key_s, value_s, GetGenQueryResultValue (results_p, COL_META_DATA_ATTR_UNITS, i), pool_p);
+
+															if (metadata_p)
+																{
+																	apr_table_setn (table_p, metadata_p -> im_key_s, (const char *) metadata_p);
+																}
+														}
+												}
+										}
+
+									query.continueInx = results_p -> continueInx;
+									freeGenQueryOut (&results_p);
+								}
+						}
+					while ((status == 0) && (query.continueInx > 0));
+
+					if (status == CAT_NO_ROWS_FOUND)
+						{
+							status = 0;
+						}
+				}
+
+			if (status != 0)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get the tabular metadata for %s, %s", tabular_metadata_p -> tm_subtree_condition_s, get_rods_error_msg (status));
+				}
+
+			freeGenQueryOut (&results_p);
+			clearGenQueryInp (&query);
+		}
+
+	return status;
+}
+
+
+/*
+ * Read the column headings from the first line of a CSV or TSV data
+ * object, only reading the first few KB of it.
+ */
+static apr_array_header_t *SniffColumnHeaders (rcComm_t *connection_p, const collEnt_t *entry_p, apr_pool_t *pool_p)
+{
+	apr_array_header_t *columns_p = NULL;
+	dataObjInp_t input;
+	const char *path_s = apr_pstrcat (pool_p, entry_p -> collName, "/", entry_p -> dataName, NULL);
+	int status;
+
+	memset (&input, 0, sizeof (dataObjInp_t));
+	rstrcpy (input.objPath, path_s, MAX_NAME_LEN);
+	input.openFlags = O_RDONLY;
+
+	status = rcDataObjOpen (connection_p, &input);
+
+	if (status >= 0)
+		{
+			openedDataObjInp_t handle;
+			bytesBuf_t buffer;
+			const size_t name_length = strlen (entry_p -> dataName);
+			const char sep = ((name_length > 4) && (strcasecmp (entry_p -> dataName + name_length - 4, ".tsv") == 0)) ? '\t' : ',';
+
+			memset (&handle, 0, sizeof (openedDataObjInp_t));
+			memset (&buffer, 0, sizeof (bytesBuf_t));
+
+			handle.l1descInx = status;
+			handle.len = S_HEADER_SNIFF_SIZE;
+
+			status = rcDataObjRead (connection_p, &handle, &buffer);
+
+			if ((status > 0) && (buffer.buf))
+				{
+					char *line_s = apr_pstrndup (pool_p, (const char *) buffer.buf, (apr_size_t) status);
+					char *end_s = strpbrk (line_s, "\r\n");
+
+					/*
+					 * Only use the first line, and if it doesn't end within the data
+					 * that we've read, we can't be sure that we have all of it.
+					 */
+					if (end_s)
+						{
+							char *heading_s = line_s;
+
+							*end_s = '\0';
+							columns_p = apr_array_make (pool_p, 16, sizeof (char *));
+
+							while (heading_s && columns_p)
+								{
+									char *next_s = strchr (heading_s, sep);
+									char *heading_end_s;
+
+									if (next_s)
+										{
+											*next_s = '\0';
+											++ next_s;
+										}
+
+									/* Trim any whitespace and quotes */
+									while ((*heading_s != '\0') && ((isspace ((unsigned char) *heading_s)) || (*heading_s == '"')))
+										{
+											++ heading_s;
+										}
+
+									heading_end_s = heading_s + strlen (heading_s);
+
+									while ((heading_end_s > heading_s) && ((isspace ((unsigned char) * (heading_end_s - 1))) || (* (heading_end_s - 1) == '"')))
+										{
+											-- heading_end_s;
+										}
+
+									*heading_end_s = '\0';
+
+									if (*heading_s != '\0')
+										{
+											* (char **) apr_array_push (columns_p) = heading_s;
+										}
+
+									heading_s = next_s;
+								}
+
+							if ((columns_p) && (columns_p -> nelts == 0))
+								{
+									columns_p = NULL;
+								}
+						}
+				}
+			else if (status < 0)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to read the column headings from \"%s\", %s", path_s, get_rods_error_msg (status));
+				}
+
+			if (buffer.buf)
+				{
+					free (buffer.buf);
+				}
+
+			status = rcDataObjClose (connection_p, &handle);
+
+			if (status < 0)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to close \"%s\", %s", path_s, get_rods_error_msg (status));
+				}
+		}
+	else
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to open \"%s\" to read its column headings, %s", path_s, get_rods_error_msg (status));
+		}
+
+	return columns_p;
+}
+
+
 static bool IsValidType (const char *value_s)
 {
 	const char **type_ss = S_TYPES_SS;
@@ -0,0 +1,529 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * json_writer.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_writer.h"
+
+#include "apr_strings.h"
+
+#include "http_protocol.h"
+
+
+/*
+ * Send a flush to the client after this much data has built up.
+ */
+static const apr_size_t S_DEFAULT_FLUSH_SIZE = 64 * 1024;
+
+
+/********************************/
+
+static apr_status_t WriteRaw (JSONWriter *writer_p, const char *data_s, const apr_size_t length);
+
+static apr_status_t BeginValue (JSONWriter *writer_p);
+
+static apr_status_t EndValue (JSONWriter *writer_p);
+
+static apr_status_t WriteEscapedString (JSONWriter *writer_p, const char *value_s);
+
+static apr_status_t BeginContainer (JSONWriter *writer_p, const char *open_s);
+
+static apr_status_t EndContainer (JSONWriter *writer_p, const char *close_s);
+
+static apr_status_t PassToOutput (apr_bucket_brigade *bb_p, void *data_p);
+
+/********************************/
+
+
+void InitJSONWriter (JSONWriter *writer_p, apr_bucket_brigade *bucket_brigade_p, ap_filter_t *output_p, const bool ndjson_flag)
+{
+	memset (writer_p, 0, sizeof (JSONWriter));
+
+	writer_p -> jw_bucket_brigade_p = bucket_brigade_p;
+	writer_p -> jw_output_p = output_p;
+	writer_p -> jw_ndjson_flag = ndjson_flag;
+	writer_p -> jw_depth = 0;
+	writer_p -> jw_first_value_flags [0] = true;
+	writer_p -> jw_pending_key_flag = false;
+	writer_p -> jw_flush_size = S_DEFAULT_FLUSH_SIZE;
+	writer_p -> jw_unflushed_size = 0;
+	writer_p -> jw_status = APR_SUCCESS;
+	writer_p -> jw_sent_flag = false;
+	writer_p -> jw_copy_file_p = NULL;
+	writer_p -> jw_copy_status = APR_SUCCESS;
+}
+
+
+void SetJSONWriterCopyFile (JSONWriter *writer_p, apr_file_t *copy_file_p)
+{
+	writer_p -> jw_copy_file_p = copy_file_p;
+	writer_p -> jw_copy_status = APR_SUCCESS;
+}
+
+
+apr_status_t BeginJSONArray (JSONWriter *writer_p)
+{
+	return BeginContainer (writer_p, "[");
+}
+
+
+apr_status_t EndJSONArray (JSONWriter *writer_p)
+{
+	return EndContainer (writer_p, "]");
+}
+
+
+apr_status_t BeginJSONObject (JSONWriter *writer_p)
+{
+	return BeginContainer (writer_p, "{");
+}
+
+
+apr_status_t EndJSONObject (JSONWriter *writer_p)
+{
+	return EndContainer (writer_p, "}");
+}
+
+
+apr_status_t WriteJSONKey (JSONWriter *writer_p, const char *key_s)
+{
+	if (BeginValue (writer_p) == APR_SUCCESS)
+		{
+			if (WriteEscapedString (writer_p, key_s) == APR_SUCCESS)
+				{
+					if (WriteRaw (writer_p, ": ", 2) == APR_SUCCESS)
+						{
+							writer_p -> jw_pending_key_flag = true;
+						}
+				}
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+apr_status_t WriteJSONString (JSONWriter *writer_p, const char *value_s)
+{
+	if (BeginValue (writer_p) == APR_SUCCESS)
+		{
+			apr_status_t status;
+
+			if (value_s)
+				{
+					status = WriteEscapedString (writer_p, value_s);
+				}
+			else
+				{
+					status = WriteRaw (writer_p, "null", 4);
+				}
+
+			if (status == APR_SUCCESS)
+				{
+					EndValue (writer_p);
+				}
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+apr_status_t WriteJSONInteger (JSONWriter *writer_p, const apr_int64_t value)
+{
+	if (BeginValue (writer_p) == APR_SUCCESS)
+		{
+			char buffer_s [32];
+			const int length = apr_snprintf (buffer_s, sizeof (buffer_s), "%" APR_INT64_T_FMT, value);
+
+			if (WriteRaw (writer_p, buffer_s, (apr_size_t) length) == APR_SUCCESS)
+				{
+					EndValue (writer_p);
+				}
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+apr_status_t WriteJSONBoolean (JSONWriter *writer_p, const bool value)
+{
+	if (BeginValue (writer_p) == APR_SUCCESS)
+		{
+			apr_status_t status = value ? WriteRaw (writer_p, "true", 4) : WriteRaw (writer_p, "false", 5);
+
+			if (status == APR_SUCCESS)
+				{
+					EndValue (writer_p);
+				}
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+apr_status_t WriteJSONValue (JSONWriter *writer_p, const json_t *value_p)
+{
+	if (BeginValue (writer_p) == APR_SUCCESS)
+		{
+			/* JSON_COMPACT keeps each value on a single line for NDJSON */
+			char *value_s = json_dumps (value_p, JSON_ENCODE_ANY | JSON_COMPACT);
+
+			if (value_s)
+				{
+					if (WriteRaw (writer_p, value_s, strlen (value_s)) == APR_SUCCESS)
+						{
+							EndValue (writer_p);
+						}
+
+					free (value_s);
+				}
+			else
+				{
+					writer_p -> jw_status = APR_ENOMEM;
+				}
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+apr_status_t WriteJSONStringMember (JSONWriter *writer_p, const char *key_s, const char *value_s)
+{
+	if (WriteJSONKey (writer_p, key_s) == APR_SUCCESS)
+		{
+			WriteJSONString (writer_p, value_s);
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+apr_status_t FlushJSONWriter (JSONWriter *writer_p)
+{
+	if ((writer_p -> jw_status == APR_SUCCESS) && (writer_p -> jw_output_p))
+		{
+			apr_bucket_brigade *bb_p = writer_p -> jw_bucket_brigade_p;
+
+			APR_BRIGADE_INSERT_TAIL (bb_p, apr_bucket_flush_create (bb_p -> bucket_alloc));
+
+			writer_p -> jw_status = PassToOutput (bb_p, writer_p);
+			apr_brigade_cleanup (bb_p);
+
+			writer_p -> jw_unflushed_size = 0;
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+apr_status_t FinishJSONWriter (JSONWriter *writer_p)
+{
+	if ((writer_p -> jw_status == APR_SUCCESS) && (writer_p -> jw_output_p))
+		{
+			apr_bucket_brigade *bb_p = writer_p -> jw_bucket_brigade_p;
+
+			writer_p -> jw_status = PassToOutput (bb_p, writer_p);
+			apr_brigade_cleanup (bb_p);
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+bool HasJSONWriterSentData (const JSONWriter *writer_p)
+{
+	return writer_p -> jw_sent_flag;
+}
+
+
+void AbortJSONWriter (JSONWriter *writer_p)
+{
+	apr_bucket_brigade *bb_p = writer_p -> jw_bucket_brigade_p;
+
+	apr_brigade_cleanup (bb_p);
+
+	if ((writer_p -> jw_output_p) && (writer_p -> jw_sent_flag))
+		{
+			ap_filter_t *output_p = writer_p -> jw_output_p;
+
+			/*
+			 * As with a failed proxied response, an error bucket stops the
+			 * chunked encoding from being finished and makes httpd close the
+			 * connection once the response is done.
+			 */
+			APR_BRIGADE_INSERT_TAIL (bb_p, ap_bucket_error_create (HTTP_BAD_GATEWAY, NULL, bb_p -> p, bb_p -> bucket_alloc));
+			APR_BRIGADE_INSERT_TAIL (bb_p, apr_bucket_eos_create (bb_p -> bucket_alloc));
+
+			ap_pass_brigade (output_p, bb_p);
+			apr_brigade_cleanup (bb_p);
+
+			output_p -> c -> keepalive = AP_CONN_CLOSE;
+			output_p -> c -> aborted = 1;
+		}
+
+	if (writer_p -> jw_status == APR_SUCCESS)
+		{
+			writer_p -> jw_status = APR_ECONNABORTED;
+		}
+}
+
+
+/********************************/
+
+
+static apr_status_t WriteRaw (JSONWriter *writer_p, const char *data_s, const apr_size_t length)
+{
+	if (writer_p -> jw_status == APR_SUCCESS)
+		{
+			/*
+			 * If we have an output filter, apr_brigade_write () will pass
+			 * the brigade on to it rather than letting it grow too large.
+			 */
+			if (writer_p -> jw_output_p)
+				{
+					writer_p -> jw_status = apr_brigade_write (writer_p -> jw_bucket_brigade_p, PassToOutput, writer_p, data_s, length);
+				}
+			else
+				{
+					writer_p -> jw_status = apr_brigade_write (writer_p -> jw_bucket_brigade_p, NULL, NULL, data_s, length);
+				}
+
+			writer_p -> jw_unflushed_size += length;
+
+			if ((writer_p -> jw_copy_file_p) && (writer_p -> jw_copy_status == APR_SUCCESS))
+				{
+					writer_p -> jw_copy_status = apr_file_write_full (writer_p -> jw_copy_file_p, data_s, length, NULL);
+				}
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+/*
+ * Write any separator that is needed before the next value.
+ */
+static apr_status_t BeginValue (JSONWriter *writer_p)
+{
+	if (writer_p -> jw_status == APR_SUCCESS)
+		{
+			if (writer_p -> jw_pending_key_flag)
+				{
+					/* The key and ": " have already been written */
+					writer_p -> jw_pending_key_flag = false;
+				}
+			else
+				{
+					bool *first_value_flag_p = & (writer_p -> jw_first_value_flags [writer_p -> jw_depth]);
+
+					if (*first_value_flag_p)
+						{
+							*first_value_flag_p = false;
+
+							/* Put each entry of the outermost array on its own line */
+							if ((writer_p -> jw_depth == 1) && (!writer_p -> jw_ndjson_flag))
+								{
+									WriteRaw (writer_p, "\n", 1);
+								}
+						}
+					else if (! ((writer_p -> jw_ndjson_flag) && (writer_p -> jw_depth == 1)))
+						{
+							if (writer_p -> jw_depth == 1)
+								{
+									WriteRaw (writer_p, ",\n", 2);
+								}
+							else
+								{
+									WriteRaw (writer_p, ", ", 2);
+								}
+						}
+				}
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+static apr_status_t EndValue (JSONWriter *writer_p)
+{
+	if (writer_p -> jw_depth <= 1)
+		{
+			if ((writer_p -> jw_ndjson_flag) && (writer_p -> jw_depth == 1))
+				{
+					WriteRaw (writer_p, "\n", 1);
+				}
+
+			if (writer_p -> jw_unflushed_size >= writer_p -> jw_flush_size)
+				{
+					FlushJSONWriter (writer_p);
+				}
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+static apr_status_t BeginContainer (JSONWriter *writer_p, const char *open_s)
+{
+	if (BeginValue (writer_p) == APR_SUCCESS)
+		{
+			if (writer_p -> jw_depth < JW_MAX_DEPTH - 1)
+				{
+					/* The outermost array isn't written for NDJSON */
+					if (! ((writer_p -> jw_ndjson_flag) && (writer_p -> jw_depth == 0)))
+						{
+							WriteRaw (writer_p, open_s, 1);
+						}
+
+					++ (writer_p -> jw_depth);
+					writer_p -> jw_first_value_flags [writer_p -> jw_depth] = true;
+				}
+			else
+				{
+					writer_p -> jw_status = APR_EGENERAL;
+				}
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+static apr_status_t EndContainer (JSONWriter *writer_p, const char *close_s)
+{
+	if (writer_p -> jw_status == APR_SUCCESS)
+		{
+			if (writer_p -> jw_depth > 0)
+				{
+					const bool empty_flag = writer_p -> jw_first_value_flags [writer_p -> jw_depth];
+
+					-- (writer_p -> jw_depth);
+
+					if (! ((writer_p -> jw_ndjson_flag) && (writer_p -> jw_depth == 0)))
+						{
+							if ((writer_p -> jw_depth == 0) && (!empty_flag))
+								{
+									WriteRaw (writer_p, "\n", 1);
+								}
+
+							WriteRaw (writer_p, close_s, 1);
+						}
+
+					EndValue (writer_p);
+				}
+			else
+				{
+					writer_p -> jw_status = APR_EGENERAL;
+				}
+		}
+
+	return writer_p -> jw_status;
+}
+
+
+static apr_status_t WriteEscapedString (JSONWriter *writer_p, const char *value_s)
+{
+	const char *start_s = value_s;
+	const char *current_s = value_s;
+
+	WriteRaw (writer_p, "\"", 1);
+
+	while ((*current_s != '\0') && (writer_p -> jw_status == APR_SUCCESS))
+		{
+			const unsigned char c = (unsigned char) *current_s;
+			const char *escape_s = NULL;
+			char buffer_s [8];
+
+			switch (c)
+				{
+					case '"':
+						escape_s = "\\\"";
+						break;
+
+					case '\\':
+						escape_s = "\\\\";
+						break;
+
+					case '\b':
+						escape_s = "\\b";
+						break;
+
+					case '\f':
+						escape_s = "\\f";
+						break;
+
+					case '\n':
+						escape_s = "\\n";
+						break;
+
+					case '\r':
+						escape_s = "\\r";
+						break;
+
+					case '\t':
+						escape_s = "\\t";
+						break;
+
+					default:
+						if (c < 0x20)
+							{
+								apr_snprintf (buffer_s, sizeof (buffer_s), "\\u%04x", c);
+								escape_s = buffer_s;
+							}
+						break;
+				}
+
+			if (escape_s)
+				{
+					/* Write out everything before this character that didn't need escaping */
+					if (current_s > start_s)
+						{
+							WriteRaw (writer_p, start_s, current_s - start_s);
+						}
+
+					WriteRaw (writer_p, escape_s, strlen (escape_s));
+					start_s = current_s + 1;
+				}
+
+			++ current_s;
+		}
+
+	if (current_s > start_s)
+		{
+			WriteRaw (writer_p, start_s, current_s - start_s);
+		}
+
+	return WriteRaw (writer_p, "\"", 1);
+}
+
+
+/*
+ * The flush function for apr_brigade_write (), which is ap_filter_flush ()
+ * that also notes that some of the output has been sent.
+ */
+static apr_status_t PassToOutput (apr_bucket_brigade *bb_p, void *data_p)
+{
+	JSONWriter *writer_p = (JSONWriter *) data_p;
+
+	writer_p -> jw_sent_flag = true;
+
+	return ap_pass_brigade (writer_p -> jw_output_p, bb_p);
+}
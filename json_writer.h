@@ -0,0 +1,230 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * json_writer.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef JSON_WRITER_H_
+#define JSON_WRITER_H_
+
+#include <stdbool.h>
+
+#include "httpd.h"
+#include "util_filter.h"
+#include "apr_buckets.h"
+#include "apr_file_io.h"
+
+#include "jansson.h"
+
+
+/**
+ * The maximum nesting depth of arrays and objects that a JSONWriter
+ * can write.
+ */
+#define JW_MAX_DEPTH (32)
+
+
+/**
+ * A JSONWriter writes JSON values directly into a bucket brigade as they
+ * are generated rather than building up a complete document in memory
+ * first.
+ *
+ * If it has an output filter, the brigade is passed on to it whenever it
+ * gets too large and the client is sent a flush after each top-level array
+ * entry once enough data has built up. Without an output filter, all of
+ * the output stays in the brigade for the caller to use.
+ *
+ * In NDJSON mode, the outermost array is not written and each of its
+ * entries is written on a separate line instead.
+ */
+typedef struct JSONWriter
+{
+	apr_bucket_brigade *jw_bucket_brigade_p;
+
+	ap_filter_t *jw_output_p;
+
+	bool jw_ndjson_flag;
+
+	int jw_depth;
+
+	/** For each depth, whether the next value will be the first one at that depth. */
+	bool jw_first_value_flags [JW_MAX_DEPTH];
+
+	/** Whether a key has been written and its value is still to come. */
+	bool jw_pending_key_flag;
+
+	/** The amount of data, in bytes, to build up before sending a flush to the client. */
+	apr_size_t jw_flush_size;
+
+	/** The amount of data, in bytes, written since the last flush. */
+	apr_size_t jw_unflushed_size;
+
+	/** The first error that occurred, after which nothing more will be written. */
+	apr_status_t jw_status;
+
+	/** Whether any of the output has been passed on to jw_output_p yet. */
+	bool jw_sent_flag;
+
+	/** If set, a file that gets a copy of everything that is written. */
+	apr_file_t *jw_copy_file_p;
+
+	/**
+	 * The first error that occurred while writing to jw_copy_file_p. This
+	 * does not stop the output to the brigade.
+	 */
+	apr_status_t jw_copy_status;
+} JSONWriter;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a JSONWriter.
+ *
+ * @param writer_p The JSONWriter to initialise.
+ * @param bucket_brigade_p The brigade to write the JSON into.
+ * @param output_p The filter to send the brigade on to as it fills
+ * up. If this is <code>NULL</code> then all of the output will be
+ * left in the brigade.
+ * @param ndjson_flag If this is <code>true</code> then write the
+ * entries of the outermost array as newline-delimited JSON.
+ */
+void InitJSONWriter (JSONWriter *writer_p, apr_bucket_brigade *bucket_brigade_p, ap_filter_t *output_p, const bool ndjson_flag);
+
+
+/**
+ * Set a file to write a copy of the output to, e.g. to fill a cache
+ * while the same data is streamed to the client.
+ *
+ * @param writer_p The JSONWriter to use.
+ * @param copy_file_p The file to write to or <code>NULL</code> to stop
+ * copying the output.
+ */
+void SetJSONWriterCopyFile (JSONWriter *writer_p, apr_file_t *copy_file_p);
+
+
+apr_status_t BeginJSONArray (JSONWriter *writer_p);
+
+apr_status_t EndJSONArray (JSONWriter *writer_p);
+
+apr_status_t BeginJSONObject (JSONWriter *writer_p);
+
+apr_status_t EndJSONObject (JSONWriter *writer_p);
+
+
+/**
+ * Write the key for the next value within an object.
+ *
+ * @param writer_p The JSONWriter to use.
+ * @param key_s The key which will be escaped as needed.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t WriteJSONKey (JSONWriter *writer_p, const char *key_s);
+
+
+/**
+ * Write a string value.
+ *
+ * @param writer_p The JSONWriter to use.
+ * @param value_s The value which will be escaped as needed. If
+ * this is <code>NULL</code> then a JSON null is written.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t WriteJSONString (JSONWriter *writer_p, const char *value_s);
+
+
+apr_status_t WriteJSONInteger (JSONWriter *writer_p, const apr_int64_t value);
+
+
+apr_status_t WriteJSONBoolean (JSONWriter *writer_p, const bool value);
+
+
+/**
+ * Write an existing jansson value.
+ *
+ * @param writer_p The JSONWriter to use.
+ * @param value_p The value to write.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t WriteJSONValue (JSONWriter *writer_p, const json_t *value_p);
+
+
+/**
+ * Write a key and string value pair within an object.
+ *
+ * @param writer_p The JSONWriter to use.
+ * @param key_s The key.
+ * @param value_s The value.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t WriteJSONStringMember (JSONWriter *writer_p, const char *key_s, const char *value_s);
+
+
+/**
+ * Send everything that has been written so far to the client.
+ *
+ * @param writer_p The JSONWriter to flush.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t FlushJSONWriter (JSONWriter *writer_p);
+
+
+/**
+ * Finish writing. If the JSONWriter has an output filter, then any
+ * remaining data is passed on to it.
+ *
+ * @param writer_p The JSONWriter to finish.
+ * @return The first error that occurred while writing or APR_SUCCESS.
+ */
+apr_status_t FinishJSONWriter (JSONWriter *writer_p);
+
+
+/**
+ * Check whether any of the output has been passed on to the output
+ * filter. Until it has, the caller can still send an error response
+ * instead.
+ *
+ * @param writer_p The JSONWriter to check.
+ * @return <code>true</code> if some of the output has been sent,
+ * <code>false</code> otherwise.
+ */
+bool HasJSONWriterSentData (const JSONWriter *writer_p);
+
+
+/**
+ * Stop writing after an error. Anything that has not been sent yet is
+ * discarded and, if some of the output has already gone to the client,
+ * the response is cut short and the connection closed so that the client
+ * can tell the document is incomplete rather than getting truncated JSON
+ * with a successful status.
+ *
+ * @param writer_p The JSONWriter to abort.
+ */
+void AbortJSONWriter (JSONWriter *writer_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JSON_WRITER_H_ */
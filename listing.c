@@ -34,14 +34,11 @@
 #include "http_protocol.h"
 #include "util_script.h"
 
-#include "jansson.h"
-
 
 #define S_LISTING_DEBUG (0)
 
 static void PrintCollEntry (const collEnt_t *coll_entry_p, apr_pool_t *pool_p);
 
-static json_t *GetIRodsObjectAsJSON (const IRodsObject *irods_obj_p, const IRodsConfig *config_p, apr_pool_t *pool_p);
 
 static bool SetStringValue (const char *src_s, char **dest_ss, apr_pool_t *pool_p);
 
@@ -327,117 +324,73 @@ void FreeIRodsObjectNodeList (IRodsObjectNode *root_node_p)
 
 
 
-apr_status_t PrintIRodsObjectNodesToJSON (IRodsObjectNode *node_p, const IRodsConfig *config_p, request_rec *req_p)
+apr_status_t PrintIRodsObjectNodesToJSON (IRodsObjectNode *node_p, const IRodsConfig *config_p, request_rec *req_p, const bool ndjson_flag)
 {
-	apr_status_t status = APR_EGENERAL;
-	apr_pool_t *pool_p = req_p -> pool;
-
-	json_t *values_p = json_array ();
+	apr_status_t status = APR_ENOMEM;
+	apr_bucket_brigade *bb_p = apr_brigade_create (req_p -> pool, req_p -> connection -> bucket_alloc);
 
-	if (values_p)
+	if (bb_p)
 		{
-			bool success_flag = true;
+			JSONWriter writer;
 
-			while (node_p && success_flag)
-				{
-					json_t *obj_json_p = GetIRodsObjectAsJSON (node_p -> ion_object_p, config_p, pool_p);
+			InitJSONWriter (&writer, bb_p, req_p -> output_filters, ndjson_flag);
 
-					if (obj_json_p)
-						{
-							if (json_array_append_new (values_p, obj_json_p) == 0)
-								{
-									node_p = node_p -> ion_next_p;
-								}
-							else
-								{
-									success_flag = false;
-								}
-						}
-					else
-						{
-							success_flag = false;
-						}
-				}
+			BeginJSONArray (&writer);
 
-			if (success_flag)
+			while (node_p && (writer.jw_status == APR_SUCCESS))
 				{
-					char *data_s = json_dumps (values_p, JSON_INDENT (2));
+					WriteIRodsObjectAsJSON (&writer, node_p -> ion_object_p, config_p, req_p -> pool);
+					node_p = node_p -> ion_next_p;
+				}
 
-					if (data_s)
-						{
-							ap_rputs (data_s, req_p);
-							free (data_s);
-						}
+			EndJSONArray (&writer);
+
+			status = FinishJSONWriter (&writer);
+
+			if (status != APR_SUCCESS)
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, status, req_p, "Failed to write objects as JSON");
 				}
 
-			json_decref (values_p);
+			apr_brigade_destroy (bb_p);
 		}
 	else
 		{
-
+			ap_log_rerror (APLOG_MARK, APLOG_ERR, status, req_p, "Failed to create brigade for JSON output");
 		}
 
 	return status;
 }
 
 
-static json_t *GetIRodsObjectAsJSON (const IRodsObject *irods_obj_p, const IRodsConfig *config_p, apr_pool_t *pool_p)
+apr_status_t WriteIRodsObjectAsJSON (JSONWriter *writer_p, const IRodsObject *irods_obj_p, const IRodsConfig *config_p, apr_pool_t *pool_p)
 {
-	json_t *irods_json_p = json_object ();
+	char *relative_link_s = GetIRodsObjectRelativeLink (irods_obj_p, config_p, pool_p);
 
-	if (irods_json_p)
+	if (relative_link_s)
 		{
-			char *relative_link_s = GetIRodsObjectRelativeLink (irods_obj_p, config_p, pool_p);
+			char *id_s = apr_psprintf (pool_p, "%d.%s", irods_obj_p -> io_obj_type, irods_obj_p -> io_id_s);
 
-			if (relative_link_s)
+			if (id_s)
 				{
-					if (json_object_set_new (irods_json_p, "path", json_string (relative_link_s)) == 0)
-						{
-							char *major_s = apr_itoa (pool_p, irods_obj_p -> io_obj_type);
-
-							if (major_s)
-								{
-									char *id_s = apr_pstrcat (pool_p, major_s, ".", irods_obj_p -> io_id_s, NULL);
-
-									if (id_s)
-										{
-											if (json_object_set_new (irods_json_p, "id", json_string (id_s)) == 0)
-												{
-													return irods_json_p;
-												}
-											else
-												{
-													ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to set \"id\": \"%s\"", id_s);
-												}
-										}
-									else
-										{
-											ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to concatenate \"s\", \".\" & \"%s\"", major_s, irods_obj_p -> io_id_s);
-										}
-								}
-							else
-								{
-
-								}
-						}
-					else
-						{
-							ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to set \"path\": \"%s\"", relative_link_s);
-						}
+					BeginJSONObject (writer_p);
+					WriteJSONStringMember (writer_p, "path", relative_link_s);
+					WriteJSONStringMember (writer_p, "id", id_s);
+					EndJSONObject (writer_p);
 				}
 			else
 				{
-					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to create relative link for \"%s\"", irods_obj_p -> io_data_s);
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to create id for \"%s\"", irods_obj_p -> io_id_s);
+					writer_p -> jw_status = APR_ENOMEM;
 				}
-
-			json_decref (irods_json_p);
 		}
 	else
 		{
-			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to create JSON object");
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to create relative link for \"%s\"", irods_obj_p -> io_data_s);
+			writer_p -> jw_status = APR_ENOMEM;
 		}
 
-	return NULL;
+	return writer_p -> jw_status;
 }
 
 
@@ -522,7 +475,16 @@ apr_status_t SetIRodsObjectFromCollEntry (IRodsObject *obj_p, const collEnt_t *c
 
 	if (coll_entry_p -> objType == COLL_OBJ_T)
 		{
-			const char *id_s = GetCollectionId (coll_entry_p -> collName, connection_p, pool_p);
+			const char *id_s = coll_entry_p -> dataId;
+
+			/*
+			 * rclReadCollection () doesn't fill in the id for collections
+			 * so we need to look it up.
+			 */
+			if ((!id_s) || (*id_s == '\0'))
+				{
+					id_s = GetCollectionId (coll_entry_p -> collName, connection_p, pool_p);
+				}
 
 			status = SetIRodsObject (obj_p, coll_entry_p -> objType, id_s, coll_entry_p -> dataName, coll_entry_p -> collName, coll_entry_p -> ownerName, coll_entry_p -> resource, coll_entry_p -> modifyTime, coll_entry_p -> dataSize, coll_entry_p -> chksum, pool_p);
 		}
@@ -897,9 +859,16 @@ char *GetIRodsObjectLastModifiedTime (const  IRodsObject *irods_obj_p, apr_pool_
 
 apr_status_t GetAndPrintMetadataForIRodsObject (const IRodsObject *irods_obj_p, const char * const api_root_url_s, const char *zone_s, const struct HtmlTheme * const theme_p, apr_bucket_brigade *bb_p, rcComm_t *connection_p, request_rec *req_p, apr_pool_t *pool_p)
 {
-	apr_status_t status = APR_SUCCESS;
 	apr_array_header_t *metadata_array_p = GetMetadataAsArray (connection_p, irods_obj_p -> io_obj_type, irods_obj_p -> io_id_s, irods_obj_p -> io_collection_s, zone_s, pool_p);
 
+	return PrintMetadataForIRodsObject (irods_obj_p, metadata_array_p, api_root_url_s, theme_p, bb_p, req_p, pool_p);
+}
+
+
+apr_status_t PrintMetadataForIRodsObject (const IRodsObject *irods_obj_p, const apr_array_header_t *metadata_array_p, const char * const api_root_url_s, const struct HtmlTheme * const theme_p, apr_bucket_brigade *bb_p, request_rec *req_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
 	apr_brigade_puts (bb_p, NULL, NULL, "<td class=\"metatable\"><div class=\"metadata_toolbar\"\n");
 
 	if (metadata_array_p)
@@ -32,6 +32,7 @@ typedef unsigned int uint;
 #include "apr_buckets.h"
 
 #include "config.h"
+#include "json_writer.h"
 
 /* Forward declaration */
 struct HtmlTheme;
@@ -193,6 +194,9 @@ const char *GetIRodsObjectChecksum (const IRodsObject *irods_obj_p);
 apr_status_t GetAndPrintMetadataForIRodsObject (const IRodsObject *irods_obj_p, const char * const link_s, const char *zone_s, const struct HtmlTheme * const theme_p, apr_bucket_brigade *bb_p, rcComm_t *connection_p, request_rec *req_p, apr_pool_t *pool_p);
 
 
+apr_status_t PrintMetadataForIRodsObject (const IRodsObject *irods_obj_p, const apr_array_header_t *metadata_array_p, const char * const link_s, const struct HtmlTheme * const theme_p, apr_bucket_brigade *bb_p, request_rec *req_p, apr_pool_t *pool_p);
+
+
 apr_status_t GetAndPrintMetadataRestLinkForIRodsObject (const IRodsObject *irods_obj_p, const char * const apt_root_link_s, const char *zone_s, const struct HtmlTheme * const theme_p, apr_bucket_brigade *bb_p, rcComm_t *connection_p, apr_pool_t *pool_p);
 
 
@@ -205,7 +209,30 @@ rodsObjStat_t *GetObjectStat (const char * const path_s, rcComm_t *connection_p,
 char *GetIRodsObjectFullPath (const IRodsObject *obj_p, apr_pool_t *pool_p);
 
 
-apr_status_t PrintIRodsObjectNodesToJSON (IRodsObjectNode *node_p, const IRodsConfig *config_p, request_rec *req_p);
+/**
+ * Stream a list of IRodsObjects to the client as a JSON array of objects
+ * with "path" and "id" keys.
+ *
+ * @param node_p The first node of the list to print.
+ * @param config_p The IRodsConfig used to create the relative links.
+ * @param req_p The request to send the JSON to.
+ * @param ndjson_flag If this is <code>true</code> then the objects will be
+ * sent as newline-delimited JSON rather than as an array.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t PrintIRodsObjectNodesToJSON (IRodsObjectNode *node_p, const IRodsConfig *config_p, request_rec *req_p, const bool ndjson_flag);
+
+
+/**
+ * Write an IRodsObject as a JSON object with "path" and "id" keys.
+ *
+ * @param writer_p The JSONWriter to use.
+ * @param irods_obj_p The IRodsObject to write.
+ * @param config_p The IRodsConfig used to create the relative link.
+ * @param pool_p The pool to use for any temporary allocations.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t WriteIRodsObjectAsJSON (JSONWriter *writer_p, const IRodsObject *irods_obj_p, const IRodsConfig *config_p, apr_pool_t *pool_p);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,374 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * listing_prefetch.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <string.h>
+
+#include "listing_prefetch.h"
+#include "meta.h"
+#include "common.h"
+#include "auth.h"
+
+#include "apr_thread_proc.h"
+#include "apr_queue.h"
+
+#include "http_log.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+#if APR_HAS_THREADS
+
+/**
+ * How many entries can be waiting for the thread before
+ * AddToListingPrefetch blocks.
+ */
+static const unsigned int S_QUEUE_SIZE = 256;
+
+
+typedef struct PrefetchItem
+{
+	IRodsObject pi_object;
+
+	/** Whether to look up the checksum for pi_object. */
+	bool pi_checksum_flag;
+
+	/** Whether pi_object was given to the thread. */
+	bool pi_queued_flag;
+
+	/** The metadata for pi_object, set by the thread. */
+	apr_array_header_t *pi_metadata_p;
+} PrefetchItem;
+
+
+struct ListingPrefetch
+{
+	rcComm_t *lp_connection_p;
+
+	bool lp_metadata_flag;
+
+	bool lp_checksums_flag;
+
+	/** The pool that the PrefetchItems are allocated from, only used by the calling thread. */
+	apr_pool_t *lp_pool_p;
+
+	/** The PrefetchItems in the order they were added, only used by the calling thread. */
+	apr_array_header_t *lp_items_p;
+
+	/** The PrefetchItems waiting to be looked up. */
+	apr_queue_t *lp_queue_p;
+
+	/**
+	 * Apache's pools are not thread-safe so the thread allocates everything
+	 * from this pool, which has its own allocator.
+	 */
+	apr_pool_t *lp_thread_pool_p;
+
+	/** The thread or NULL once it has been joined. */
+	apr_thread_t *lp_thread_p;
+};
+
+
+static void * APR_THREAD_FUNC RunListingPrefetch (apr_thread_t *thread_p, void *data_p);
+
+static apr_status_t StopListingPrefetch (ListingPrefetch *prefetch_p);
+
+static apr_status_t CleanUpListingPrefetch (void *data_p);
+
+
+ListingPrefetch *StartListingPrefetch (rcComm_t *connection_p, const bool metadata_flag, const bool checksums_flag, apr_pool_t *pool_p)
+{
+	ListingPrefetch *prefetch_p = NULL;
+	apr_pool_t *thread_pool_p = NULL;
+	apr_status_t status = apr_pool_create_unmanaged_ex (&thread_pool_p, NULL, NULL);
+
+	if (status == APR_SUCCESS)
+		{
+			apr_queue_t *queue_p = NULL;
+
+			status = apr_queue_create (&queue_p, S_QUEUE_SIZE, thread_pool_p);
+
+			if (status == APR_SUCCESS)
+				{
+					prefetch_p = (ListingPrefetch *) apr_palloc (pool_p, sizeof (ListingPrefetch));
+
+					prefetch_p -> lp_connection_p = connection_p;
+					prefetch_p -> lp_metadata_flag = metadata_flag;
+					prefetch_p -> lp_checksums_flag = checksums_flag;
+					prefetch_p -> lp_pool_p = pool_p;
+					prefetch_p -> lp_items_p = apr_array_make (pool_p, S_QUEUE_SIZE, sizeof (PrefetchItem *));
+					prefetch_p -> lp_queue_p = queue_p;
+					prefetch_p -> lp_thread_pool_p = thread_pool_p;
+					prefetch_p -> lp_thread_p = NULL;
+
+					status = apr_thread_create (& (prefetch_p -> lp_thread_p), NULL, RunListingPrefetch, prefetch_p, thread_pool_p);
+
+					if (status == APR_SUCCESS)
+						{
+							apr_pool_cleanup_register (pool_p, prefetch_p, CleanUpListingPrefetch, apr_pool_cleanup_null);
+						}
+					else
+						{
+							ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to start the listing prefetch thread");
+							prefetch_p = NULL;
+						}
+				}
+			else
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to create the listing prefetch queue");
+				}
+
+			if (!prefetch_p)
+				{
+					apr_pool_destroy (thread_pool_p);
+				}
+		}
+	else
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to create the listing prefetch pool");
+		}
+
+	return prefetch_p;
+}
+
+
+apr_status_t AddToListingPrefetch (ListingPrefetch *prefetch_p, const IRodsObject *irods_obj_p)
+{
+	apr_status_t status = APR_EGENERAL;
+	PrefetchItem *item_p = (PrefetchItem *) apr_palloc (prefetch_p -> lp_pool_p, sizeof (PrefetchItem));
+
+	memcpy (& (item_p -> pi_object), irods_obj_p, sizeof (IRodsObject));
+	item_p -> pi_metadata_p = NULL;
+	item_p -> pi_queued_flag = false;
+	item_p -> pi_checksum_flag = (prefetch_p -> lp_checksums_flag) && (irods_obj_p -> io_obj_type == DATA_OBJ_T)
+			&& ((! (irods_obj_p -> io_checksum_s)) || (* (irods_obj_p -> io_checksum_s) == '\0'));
+
+	APR_ARRAY_PUSH (prefetch_p -> lp_items_p, PrefetchItem *) = item_p;
+
+	if (prefetch_p -> lp_thread_p)
+		{
+			do
+				{
+					status = apr_queue_push (prefetch_p -> lp_queue_p, item_p);
+				}
+			while (status == APR_EINTR);
+
+			item_p -> pi_queued_flag = (status == APR_SUCCESS);
+		}
+
+	return status;
+}
+
+
+apr_status_t FinishListingPrefetch (ListingPrefetch *prefetch_p, request_rec *req_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	if (prefetch_p -> lp_thread_p)
+		{
+			status = StopListingPrefetch (prefetch_p);
+		}
+
+	/* The thread has finished with its pool so pass on any lost connection */
+	CheckIRodsPoolStatus (req_p, prefetch_p -> lp_thread_pool_p);
+
+	return status;
+}
+
+
+size_t GetListingPrefetchSize (const ListingPrefetch *prefetch_p)
+{
+	return (size_t) (prefetch_p -> lp_items_p -> nelts);
+}
+
+
+const IRodsObject *GetListingPrefetchObject (const ListingPrefetch *prefetch_p, const size_t i)
+{
+	const PrefetchItem *item_p = APR_ARRAY_IDX (prefetch_p -> lp_items_p, i, PrefetchItem *);
+
+	return & (item_p -> pi_object);
+}
+
+
+const apr_array_header_t *GetListingPrefetchMetadata (const ListingPrefetch *prefetch_p, const size_t i)
+{
+	const PrefetchItem *item_p = APR_ARRAY_IDX (prefetch_p -> lp_items_p, i, PrefetchItem *);
+
+	return item_p -> pi_metadata_p;
+}
+
+
+bool WasListingPrefetchQueued (const ListingPrefetch *prefetch_p, const size_t i)
+{
+	const PrefetchItem *item_p = APR_ARRAY_IDX (prefetch_p -> lp_items_p, i, PrefetchItem *);
+
+	return item_p -> pi_queued_flag;
+}
+
+
+static void * APR_THREAD_FUNC RunListingPrefetch (apr_thread_t *thread_p, void *data_p)
+{
+	ListingPrefetch *prefetch_p = (ListingPrefetch *) data_p;
+	bool loop_flag = true;
+
+	while (loop_flag)
+		{
+			void *ptr = NULL;
+			apr_status_t status = apr_queue_pop (prefetch_p -> lp_queue_p, &ptr);
+
+			if (status == APR_SUCCESS)
+				{
+					if (ptr)
+						{
+							PrefetchItem *item_p = (PrefetchItem *) ptr;
+							IRodsObject *obj_p = & (item_p -> pi_object);
+
+							if (item_p -> pi_checksum_flag)
+								{
+									collEnt_t coll_entry;
+									char *checksum_s;
+
+									memset (&coll_entry, 0, sizeof (collEnt_t));
+									coll_entry.collName = obj_p -> io_collection_s;
+									coll_entry.dataName = obj_p -> io_data_s;
+
+									checksum_s = GetChecksum (&coll_entry, prefetch_p -> lp_connection_p, prefetch_p -> lp_thread_pool_p);
+
+									if (checksum_s)
+										{
+											obj_p -> io_checksum_s = checksum_s;
+										}
+								}
+
+							if (prefetch_p -> lp_metadata_flag)
+								{
+									item_p -> pi_metadata_p = GetMetadataAsArray (prefetch_p -> lp_connection_p, obj_p -> io_obj_type, obj_p -> io_id_s, obj_p -> io_collection_s, NULL, prefetch_p -> lp_thread_pool_p);
+								}
+						}
+					else
+						{
+							/* FinishListingPrefetch has been called */
+							loop_flag = false;
+						}
+				}
+			else if (status != APR_EINTR)
+				{
+					/* The queue has been terminated */
+					loop_flag = false;
+				}
+		}
+
+	apr_thread_exit (thread_p, APR_SUCCESS);
+
+	return NULL;
+}
+
+
+static apr_status_t StopListingPrefetch (ListingPrefetch *prefetch_p)
+{
+	apr_status_t thread_status = APR_SUCCESS;
+	apr_status_t status;
+
+	/*
+	 * A NULL entry tells the thread that there is nothing more to come
+	 * once it has done the entries ahead of it.
+	 */
+	do
+		{
+			status = apr_queue_push (prefetch_p -> lp_queue_p, NULL);
+		}
+	while (status == APR_EINTR);
+
+	if (status != APR_SUCCESS)
+		{
+			apr_queue_term (prefetch_p -> lp_queue_p);
+		}
+
+	status = apr_thread_join (&thread_status, prefetch_p -> lp_thread_p);
+	prefetch_p -> lp_thread_p = NULL;
+
+	return status;
+}
+
+
+static apr_status_t CleanUpListingPrefetch (void *data_p)
+{
+	ListingPrefetch *prefetch_p = (ListingPrefetch *) data_p;
+
+	if (prefetch_p -> lp_thread_p)
+		{
+			apr_queue_term (prefetch_p -> lp_queue_p);
+			StopListingPrefetch (prefetch_p);
+		}
+
+	apr_pool_destroy (prefetch_p -> lp_thread_pool_p);
+
+	return APR_SUCCESS;
+}
+
+
+#else
+
+
+ListingPrefetch *StartListingPrefetch (rcComm_t *connection_p, const bool metadata_flag, const bool checksums_flag, apr_pool_t *pool_p)
+{
+	return NULL;
+}
+
+
+apr_status_t AddToListingPrefetch (ListingPrefetch *prefetch_p, const IRodsObject *irods_obj_p)
+{
+	return APR_ENOTIMPL;
+}
+
+
+apr_status_t FinishListingPrefetch (ListingPrefetch *prefetch_p, request_rec *req_p)
+{
+	return APR_ENOTIMPL;
+}
+
+
+size_t GetListingPrefetchSize (const ListingPrefetch *prefetch_p)
+{
+	return 0;
+}
+
+
+const IRodsObject *GetListingPrefetchObject (const ListingPrefetch *prefetch_p, const size_t i)
+{
+	return NULL;
+}
+
+
+const apr_array_header_t *GetListingPrefetchMetadata (const ListingPrefetch *prefetch_p, const size_t i)
+{
+	return NULL;
+}
+
+
+bool WasListingPrefetchQueued (const ListingPrefetch *prefetch_p, const size_t i)
+{
+	return false;
+}
+
+
+#endif		/* #if APR_HAS_THREADS */
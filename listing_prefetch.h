@@ -0,0 +1,141 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * listing_prefetch.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef LISTING_PREFETCH_H_
+#define LISTING_PREFETCH_H_
+
+#include <stdbool.h>
+
+#include "apr_pools.h"
+#include "apr_tables.h"
+
+#include "httpd.h"
+
+#include "irods/rcConnect.h"
+
+#include "listing.h"
+
+
+/**
+ * The catalog lookups for the entries of a listing, done on a separate
+ * thread and iRODS connection while the listing itself is being read.
+ */
+typedef struct ListingPrefetch ListingPrefetch;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Start a thread that does the catalog lookups for the entries that are
+ * added with AddToListingPrefetch.
+ *
+ * @param connection_p The catalog connection to use. This must not be
+ * used by anything else until FinishListingPrefetch is called.
+ * @param metadata_flag Whether to get the metadata for each entry.
+ * @param checksums_flag Whether to get the checksums for data objects
+ * that don't have one in the listing.
+ * @param pool_p The pool to use. The prefetched values are kept until
+ * this is cleared.
+ * @return The ListingPrefetch or <code>NULL</code> if threads are not
+ * available or the thread could not be started, in which case the
+ * lookups need to be done as each entry is printed.
+ */
+ListingPrefetch *StartListingPrefetch (rcComm_t *connection_p, const bool metadata_flag, const bool checksums_flag, apr_pool_t *pool_p);
+
+
+/**
+ * Add an entry of the listing to be looked up. This returns straight
+ * away unless the thread has fallen a long way behind.
+ *
+ * @param prefetch_p The ListingPrefetch.
+ * @param irods_obj_p The entry. This is copied so it can be reused.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t AddToListingPrefetch (ListingPrefetch *prefetch_p, const IRodsObject *irods_obj_p);
+
+
+/**
+ * Wait for the lookups of all of the added entries to finish. If the
+ * catalog connection was lost during them, it is marked so that it is
+ * replaced rather than reused.
+ *
+ * @param prefetch_p The ListingPrefetch.
+ * @param req_p The request that the catalog connection belongs to.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t FinishListingPrefetch (ListingPrefetch *prefetch_p, request_rec *req_p);
+
+
+/**
+ * Get the number of entries that have been added.
+ *
+ * @param prefetch_p The ListingPrefetch.
+ * @return The number of entries.
+ */
+size_t GetListingPrefetchSize (const ListingPrefetch *prefetch_p);
+
+
+/**
+ * Get an entry along with any checksum that was looked up for it.
+ * This must only be called after FinishListingPrefetch.
+ *
+ * @param prefetch_p The ListingPrefetch.
+ * @param i The index of the entry in the order that they were added.
+ * @return The entry.
+ */
+const IRodsObject *GetListingPrefetchObject (const ListingPrefetch *prefetch_p, const size_t i);
+
+
+/**
+ * Get the metadata of an entry. This must only be called after
+ * FinishListingPrefetch.
+ *
+ * @param prefetch_p The ListingPrefetch.
+ * @param i The index of the entry in the order that they were added.
+ * @return The metadata as an array of IrodsMetadata pointers or
+ * <code>NULL</code> if it was not looked up.
+ */
+const apr_array_header_t *GetListingPrefetchMetadata (const ListingPrefetch *prefetch_p, const size_t i);
+
+
+/**
+ * Check whether an entry was given to the thread. If AddToListingPrefetch
+ * failed for it, nothing was looked up and it needs to be done when the
+ * entry is printed.
+ *
+ * @param prefetch_p The ListingPrefetch.
+ * @param i The index of the entry in the order that they were added.
+ * @return <code>true</code> if the entry was looked up,
+ * <code>false</code> otherwise.
+ */
+bool WasListingPrefetchQueued (const ListingPrefetch *prefetch_p, const size_t i);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LISTING_PREFETCH_H_ */
@@ -24,6 +24,7 @@
 #include <string.h>
 
 #include "apr_strings.h"
+#include "apr_hash.h"
 
 #include "http_protocol.h"
 
@@ -37,6 +38,7 @@
 #include "rest.h"
 #include "auth.h"
 #include "theme.h"
+#include "json_writer.h"
 
 /*************************************/
 
@@ -46,8 +48,30 @@ static const char * const S_SEARCH_OPERATOR_EQUALS_S = "=";
 
 static const char * const S_SEARCH_OPERATOR_LIKE_S = "like";
 
+/*
+ * The maximum number of ids that GetIRodsObjectNodesForIds ()
+ * will put into a single query.
+ */
+static const int S_IDS_PAGE_SIZE = 256;
+
+static const int S_ID_DATA_OBJECT_COLUMNS_P [] = { COL_D_DATA_ID, COL_DATA_NAME, COL_COLL_NAME, COL_D_OWNER_NAME, COL_D_RESC_HIER, COL_D_MODIFY_TIME, COL_DATA_SIZE, COL_D_DATA_CHECKSUM, -1 };
+
+static const int S_ID_COLLECTION_COLUMNS_P [] = { COL_COLL_ID, COL_COLL_NAME, COL_COLL_OWNER_NAME, COL_COLL_MODIFY_TIME, -1 };
+
 static int s_debug_flag = 0;
 
+
+/*
+ * The list that GetMatchingMetadataHits () builds up
+ * from the hits passed to AddHitToList ().
+ */
+typedef struct HitsList
+{
+	IRodsObjectNode *hl_root_node_p;
+	IRodsObjectNode *hl_current_node_p;
+	apr_pool_t *hl_pool_p;
+} HitsList;
+
 /**************************************/
 
 static int InitGenQuery (genQueryInp_t *query_p, const int options, const char * const zone_s);
@@ -90,7 +114,7 @@ static apr_status_t PrintDownloadMetadataObject (const struct HtmlTheme *theme_p
 
 static apr_status_t GetMetadataArrayAsColumnData (apr_array_header_t *metadata_array_p, apr_bucket_brigade *bucket_brigade_p, const char * const sep_s);
 
-static apr_status_t GetMetadataArrayAsJSON (apr_array_header_t *metadata_array_p, apr_bucket_brigade *bucket_brigade_p);
+static apr_status_t GetMetadataArrayAsJSON (apr_array_header_t *metadata_array_p, apr_bucket_brigade *bucket_brigade_p, const bool ndjson_flag);
 
 static apr_status_t PrintDownloadMetadataObjectLink (const IRodsObject *irods_obj_p, const char *icon_s, const char *label_s, const char *type_s, const char *api_root_url_s, apr_bucket_brigade *bb_p);
 
@@ -102,6 +126,14 @@ static bool AddToTable (IrodsMetadata *metadata_p, void *data_p, apr_pool_t *poo
 
 static bool AddToArray (IrodsMetadata *metadata_p, void *data_p, apr_pool_t *pool_p);
 
+static apr_status_t ProcessMetadataHit (const objType_t obj_type, const char *id_s, const char *data_name_s, const char *collection_s, const rodsObjStat_t *stat_p, apr_status_t (*process_hit_fn) (const IRodsObject *hit_p, void *data_p), void *data_p, apr_pool_t *pool_p);
+
+static apr_status_t AddHitToList (const IRodsObject *hit_p, void *data_p);
+
+static objType_t GetIdParts (const char *id_s, const char **minor_id_ss);
+
+static int AddObjectsForIds (const objType_t obj_type, apr_array_header_t *ids_p, apr_hash_t *objects_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
 /*************************************/
 
 
@@ -862,7 +894,113 @@ IRodsObjectNode *GetIRodsObjectNodeForId (const char *id_s, rcComm_t *rods_conne
 }
 
 
-IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char * const value_s, SearchOperator op, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+
+IRodsObjectNode *GetIRodsObjectNodesForIds (const char **ids_ss, const int num_ids, rcComm_t *rods_connection_p, apr_array_header_t *unknown_ids_p, apr_pool_t *pool_p)
+{
+	IRodsObjectNode *root_node_p = NULL;
+	IRodsObjectNode *current_node_p = NULL;
+	apr_hash_t *objects_p = apr_hash_make (pool_p);
+	int page_start;
+	int i;
+
+	/*
+	 * Resolve the ids a page at a time, with one query for all of the
+	 * data objects and one for all of the collections on each page.
+	 */
+	for (page_start = 0; page_start < num_ids; page_start += S_IDS_PAGE_SIZE)
+		{
+			const int page_size = (num_ids - page_start < S_IDS_PAGE_SIZE) ? num_ids - page_start : S_IDS_PAGE_SIZE;
+			apr_array_header_t *data_ids_p = apr_array_make (pool_p, page_size, sizeof (char *));
+			apr_array_header_t *collection_ids_p = apr_array_make (pool_p, page_size, sizeof (char *));
+
+			for (i = page_start; i < page_start + page_size; ++ i)
+				{
+					const char *minor_id_s = NULL;
+					objType_t obj_type = GetIdParts (* (ids_ss + i), &minor_id_s);
+
+					if (minor_id_s && ((obj_type == DATA_OBJ_T) || (obj_type == UNKNOWN_OBJ_T)))
+						{
+							APR_ARRAY_PUSH (data_ids_p, const char *) = minor_id_s;
+						}
+				}
+
+			if (data_ids_p -> nelts > 0)
+				{
+					AddObjectsForIds (DATA_OBJ_T, data_ids_p, objects_p, rods_connection_p, pool_p);
+				}
+
+			/*
+			 * Only look for the collections once we know which
+			 * of the untyped ids were not for data objects.
+			 */
+			for (i = page_start; i < page_start + page_size; ++ i)
+				{
+					const char *minor_id_s = NULL;
+					objType_t obj_type = GetIdParts (* (ids_ss + i), &minor_id_s);
+
+					if (minor_id_s && ((obj_type == COLL_OBJ_T) || ((obj_type == UNKNOWN_OBJ_T) && (!apr_hash_get (objects_p, minor_id_s, APR_HASH_KEY_STRING)))))
+						{
+							APR_ARRAY_PUSH (collection_ids_p, const char *) = minor_id_s;
+						}
+				}
+
+			if (collection_ids_p -> nelts > 0)
+				{
+					AddObjectsForIds (COLL_OBJ_T, collection_ids_p, objects_p, rods_connection_p, pool_p);
+				}
+
+		}		/* for (page_start = 0; page_start < num_ids; page_start += S_IDS_PAGE_SIZE) */
+
+
+	/* Build the list in the order that the ids were requested */
+	for (i = 0; i < num_ids; ++ i)
+		{
+			const char *id_s = * (ids_ss + i);
+			const char *minor_id_s = NULL;
+			objType_t obj_type = GetIdParts (id_s, &minor_id_s);
+			const IRodsObject *obj_p = NULL;
+
+			if (minor_id_s)
+				{
+					obj_p = (const IRodsObject *) apr_hash_get (objects_p, minor_id_s, APR_HASH_KEY_STRING);
+
+					/* Check that a typed id was for the right kind of object */
+					if (obj_p && (obj_type != UNKNOWN_OBJ_T) && (obj_type != obj_p -> io_obj_type))
+						{
+							obj_p = NULL;
+						}
+				}
+
+			if (obj_p)
+				{
+					IRodsObjectNode *node_p = AllocateIRodsObjectNode (obj_p -> io_obj_type, obj_p -> io_id_s, obj_p -> io_data_s, obj_p -> io_collection_s, obj_p -> io_owner_name_s, obj_p -> io_resource_s, obj_p -> io_last_modified_time_s, obj_p -> io_size, obj_p -> io_checksum_s, pool_p);
+
+					if (node_p)
+						{
+							if (current_node_p)
+								{
+									current_node_p -> ion_next_p = node_p;
+								}
+							else
+								{
+									root_node_p = node_p;
+								}
+
+							current_node_p = node_p;
+						}
+				}
+			else if (unknown_ids_p)
+				{
+					APR_ARRAY_PUSH (unknown_ids_p, const char *) = id_s;
+				}
+
+		}		/* for (i = 0; i < num_ids; ++ i) */
+
+	return root_node_p;
+}
+
+
+apr_status_t ProcessMatchingMetadataHits (const char * const key_s, const char * const value_s, SearchOperator op, rcComm_t *rods_connection_p, apr_status_t (*process_hit_fn) (const IRodsObject *hit_p, void *data_p), void *data_p, apr_pool_t *pool_p)
 {
 	/*
 	 * SELECT meta_id FROM r_meta_main WHERE meta_attr_name = ' ' AND meta_attr_value = ' ';
@@ -883,8 +1021,7 @@ IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char *
 	SearchOperator ops_p [] = { SO_EQUALS, op };
 	int select_columns_p [] =  { COL_META_DATA_ATTR_ID, -1, -1};
 	genQueryOut_t *meta_id_results_p = NULL;
-	IRodsObjectNode *root_node_p = NULL;
-	IRodsObjectNode *current_node_p = NULL;
+	apr_status_t status = APR_SUCCESS;
 
 	/*
 	 * SELECT meta_id FROM r_meta_main WHERE meta_attr_name = ' ' AND meta_attr_value = ' ';
@@ -904,7 +1041,7 @@ IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char *
 					 * SELECT object_id FROM r_objt_metamap WHERE meta_id = ' ';
 					 */
 
-					for (i = 0; i < meta_id_results_p -> rowCnt; ++ i, meta_id_s += meta_results_inc)
+					for (i = 0; (i < meta_id_results_p -> rowCnt) && (status == APR_SUCCESS); ++ i, meta_id_s += meta_results_inc)
 						{
 							/*
 							 * Get all of the matching collections first
@@ -939,7 +1076,7 @@ IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char *
 											where_columns_p [0] = COL_COLL_ID;
 											num_where_columns = 1;
 
-											for (j = 0; j < id_results_p -> rowCnt; ++ j, id_s += inc)
+											for (j = 0; (j < id_results_p -> rowCnt) && (status == APR_SUCCESS); ++ j, id_s += inc)
 												{
 													/*
 													 *
@@ -971,21 +1108,7 @@ IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char *
 
 																			if (stat_p)
 																				{
-																					IRodsObjectNode *node_p = AllocateIRodsObjectNode (COLL_OBJ_T, id_s, NULL, collection_s, stat_p -> ownerName, NULL, stat_p -> modifyTime, stat_p -> objSize, stat_p -> chksum, pool_p);
-
-																					if (node_p)
-																						{
-																							if (current_node_p)
-																								{
-																									current_node_p -> ion_next_p = node_p;
-																								}
-																							else
-																								{
-																									root_node_p = node_p;
-																								}
-
-																							current_node_p = node_p;
-																						}
+																					status = ProcessMetadataHit (COLL_OBJ_T, id_s, NULL, collection_s, stat_p, process_hit_fn, data_p, pool_p);
 
 
 																					freeRodsObjStat (stat_p);
@@ -1035,7 +1158,7 @@ IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char *
 
 											where_columns_p [0] = COL_D_DATA_ID;
 
-											for (j = 0; j < id_results_p -> rowCnt; ++ j, id_s += inc)
+											for (j = 0; (j < id_results_p -> rowCnt) && (status == APR_SUCCESS); ++ j, id_s += inc)
 												{
 													genQueryOut_t *data_id_results_p = NULL;
 
@@ -1092,21 +1215,7 @@ IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char *
 
 																											if (stat_p)
 																												{
-																													IRodsObjectNode *node_p = AllocateIRodsObjectNode (DATA_OBJ_T, id_s, data_name_s, collection_s, stat_p -> ownerName, stat_p -> rescHier, stat_p -> modifyTime, stat_p -> objSize, stat_p -> chksum, pool_p);
-
-																													if (node_p)
-																														{
-																															if (current_node_p)
-																																{
-																																	current_node_p -> ion_next_p = node_p;
-																																}
-																															else
-																																{
-																																	root_node_p = node_p;
-																																}
-
-																															current_node_p = node_p;
-																														}
+																													status = ProcessMetadataHit (DATA_OBJ_T, id_s, data_name_s, collection_s, stat_p, process_hit_fn, data_p, pool_p);
 
 
 																													freeRodsObjStat (stat_p);
@@ -1147,7 +1256,88 @@ IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char *
 			freeGenQueryOut (&meta_id_results_p);
 		}		/* if (meta_id_results_p) */
 
-	return root_node_p;
+	return status;
+}
+
+
+IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char * const value_s, SearchOperator op, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	HitsList hits;
+
+	hits.hl_root_node_p = NULL;
+	hits.hl_current_node_p = NULL;
+	hits.hl_pool_p = pool_p;
+
+	if (ProcessMatchingMetadataHits (key_s, value_s, op, rods_connection_p, AddHitToList, &hits, pool_p) != APR_SUCCESS)
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get all of the metadata search hits for \"%s\"", key_s);
+		}
+
+	return hits.hl_root_node_p;
+}
+
+
+
+static apr_status_t ProcessMetadataHit (const objType_t obj_type, const char *id_s, const char *data_name_s, const char *collection_s, const rodsObjStat_t *stat_p, apr_status_t (*process_hit_fn) (const IRodsObject *hit_p, void *data_p), void *data_p, apr_pool_t *pool_p)
+{
+	/*
+	 * Use a pool for each hit so that the memory used by searches
+	 * with many hits does not keep growing.
+	 */
+	apr_pool_t *hit_pool_p = NULL;
+	apr_status_t status = apr_pool_create (&hit_pool_p, pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			IRodsObject hit;
+			const char *resource_s = (obj_type == DATA_OBJ_T) ? stat_p -> rescHier : NULL;
+
+			InitIRodsObject (&hit);
+
+			status = SetIRodsObject (&hit, obj_type, id_s, data_name_s, collection_s, stat_p -> ownerName, resource_s, stat_p -> modifyTime, stat_p -> objSize, stat_p -> chksum, hit_pool_p);
+
+			if (status == APR_SUCCESS)
+				{
+					status = process_hit_fn (&hit, data_p);
+				}
+			else
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to set metadata search hit for \"%s\"", id_s);
+				}
+
+			apr_pool_destroy (hit_pool_p);
+		}
+	else
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to create pool for metadata search hit \"%s\"", id_s);
+		}
+
+	return status;
+}
+
+
+static apr_status_t AddHitToList (const IRodsObject *hit_p, void *data_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	HitsList *hits_p = (HitsList *) data_p;
+	IRodsObjectNode *node_p = AllocateIRodsObjectNode (hit_p -> io_obj_type, hit_p -> io_id_s, hit_p -> io_data_s, hit_p -> io_collection_s, hit_p -> io_owner_name_s, hit_p -> io_resource_s, hit_p -> io_last_modified_time_s, hit_p -> io_size, hit_p -> io_checksum_s, hits_p -> hl_pool_p);
+
+	if (node_p)
+		{
+			if (hits_p -> hl_current_node_p)
+				{
+					hits_p -> hl_current_node_p -> ion_next_p = node_p;
+				}
+			else
+				{
+					hits_p -> hl_root_node_p = node_p;
+				}
+
+			hits_p -> hl_current_node_p = node_p;
+			status = APR_SUCCESS;
+		}
+
+	return status;
 }
 
 
@@ -1164,10 +1354,15 @@ apr_status_t GetMetadataTableForId (char *id_s, davrods_dir_conf_t *config_p, rc
 			switch (format)
 			{
 				case OF_JSON:
-					status = GetMetadataArrayAsJSON (metadata_array_p, bucket_brigade_p);
+					status = GetMetadataArrayAsJSON (metadata_array_p, bucket_brigade_p, false);
 					content_type_s = CONTENT_TYPE_JSON_S;
 					break;
 
+				case OF_NDJSON:
+					status = GetMetadataArrayAsJSON (metadata_array_p, bucket_brigade_p, true);
+					content_type_s = CONTENT_TYPE_NDJSON_S;
+					break;
+
 				case OF_TSV:
 					status = GetMetadataArrayAsColumnData (metadata_array_p, bucket_brigade_p, "\t");
 					break;
@@ -1237,62 +1432,38 @@ apr_array_header_t *GetMetadataArrayForId (char *id_s, rcComm_t *connection_p, r
 
 
 
-static apr_status_t GetMetadataArrayAsJSON (apr_array_header_t *metadata_array_p, apr_bucket_brigade *bucket_brigade_p)
+static apr_status_t GetMetadataArrayAsJSON (apr_array_header_t *metadata_array_p, apr_bucket_brigade *bucket_brigade_p, const bool ndjson_flag)
 {
-	apr_status_t status = APR_SUCCESS;
-	const int last_index = metadata_array_p -> nelts - 1;
-
-	if (last_index >= 0)
-		{
-			status = apr_brigade_puts (bucket_brigade_p, NULL, NULL, "[\n");
-
-			if (status == APR_SUCCESS)
-				{
-					int i;
-
-					for (i = 0; i <= last_index; ++ i)
-						{
-							const IrodsMetadata *metadata_p = APR_ARRAY_IDX (metadata_array_p, i, IrodsMetadata *);
-
-							status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "\t{\n\t\t\"attribute\": \"%s\",\n\t\t\"value\": \"%s\"", metadata_p -> im_key_s, metadata_p -> im_value_s);
+	JSONWriter writer;
+	int i;
 
-							if (status == APR_SUCCESS)
-								{
-									if ((metadata_p -> im_units_s) && (strlen (metadata_p -> im_units_s) > 0))
-										{
-											status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, ",\n\t\t\"units\": \"%s\"", metadata_p -> im_units_s);
-										}
+	/*
+	 * The caller flattens the brigade afterwards so we don't
+	 * give the writer an output filter to pass it on to.
+	 */
+	InitJSONWriter (&writer, bucket_brigade_p, NULL, ndjson_flag);
 
+	BeginJSONArray (&writer);
 
-									if (status == APR_SUCCESS)
-										{
-											if (i == last_index)
-												{
-													status = apr_brigade_puts (bucket_brigade_p, NULL, NULL, "\n\t}\n");
-												}
-											else
-												{
-													status = apr_brigade_puts (bucket_brigade_p, NULL, NULL, "\n\t},\n");
-												}
-										}
-								}
-
-							if (status != APR_SUCCESS)
-								{
-									i = last_index;
-								}
+	for (i = 0; (i < metadata_array_p -> nelts) && (writer.jw_status == APR_SUCCESS); ++ i)
+		{
+			const IrodsMetadata *metadata_p = APR_ARRAY_IDX (metadata_array_p, i, IrodsMetadata *);
 
-						}		/* for (i = 0; i < last_index; ++ i */
+			BeginJSONObject (&writer);
+			WriteJSONStringMember (&writer, "attribute", metadata_p -> im_key_s);
+			WriteJSONStringMember (&writer, "value", metadata_p -> im_value_s);
 
-					if (status == APR_SUCCESS)
-						{
-							apr_brigade_puts (bucket_brigade_p, NULL, NULL, "]\n");
-						}
+			if ((metadata_p -> im_units_s) && (strlen (metadata_p -> im_units_s) > 0))
+				{
+					WriteJSONStringMember (&writer, "units", metadata_p -> im_units_s);
 				}
 
-		}		/* if (size > 0) */
+			EndJSONObject (&writer);
+		}		/* for (i = 0; i < metadata_array_p -> nelts; ++ i) */
 
-	return status;
+	EndJSONArray (&writer);
+
+	return FinishJSONWriter (&writer);
 }
 
 
@@ -1587,6 +1758,8 @@ static genQueryOut_t *ExecuteGenQuery (rcComm_t *connection_p, genQueryInp_t * c
 		{
 			const char *error_s = rodsErrorName (status, NULL);
 
+			CheckIRodsConnectionStatus (connection_p, status, pool_p);
+
 			if (error_s)
 				{
 					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "RunQuery failed, error: %s", error_s);
@@ -2151,3 +2324,156 @@ static int CopyTableKeysToArray (void *data_p, const char *key_s, const char *va
 
 	return res;
 }
+
+
+/*
+ * Split an id such as "1.10021" into its object type and minor id. The
+ * minor id is only set if it is a valid number so that it is safe to use
+ * within a query.
+ */
+static objType_t GetIdParts (const char *id_s, const char **minor_id_ss)
+{
+	objType_t obj_type = UNKNOWN_OBJ_T;
+	const char *minor_id_s = GetMinorId (id_s);
+
+	if (minor_id_s)
+		{
+			obj_type = GetObjTypeForIdString (id_s);
+		}
+	else
+		{
+			minor_id_s = id_s;
+		}
+
+	if (minor_id_s && (*minor_id_s != '\0') && (strspn (minor_id_s, "0123456789") == strlen (minor_id_s)))
+		{
+			*minor_id_ss = minor_id_s;
+		}
+	else
+		{
+			*minor_id_ss = NULL;
+		}
+
+	return obj_type;
+}
+
+
+/*
+ * Get the details of the data objects or collections with the given
+ * minor ids in a single query and add them to objects_p keyed by
+ * their minor ids.
+ */
+static int AddObjectsForIds (const objType_t obj_type, apr_array_header_t *ids_p, apr_hash_t *objects_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	int status = 0;
+	genQueryInp_t query;
+	genQueryOut_t *results_p = NULL;
+	const int *columns_p = (obj_type == DATA_OBJ_T) ? S_ID_DATA_OBJECT_COLUMNS_P : S_ID_COLLECTION_COLUMNS_P;
+	const int id_column = (obj_type == DATA_OBJ_T) ? COL_D_DATA_ID : COL_COLL_ID;
+	char *ids_condition_s = GetGenQueryInCondition ((char **) ids_p -> elts, (size_t) ids_p -> nelts, pool_p);
+
+	memset (&query, 0, sizeof (genQueryInp_t));
+	query.maxRows = MAX_SQL_ROWS;
+
+	while ((*columns_p != -1) && (status == 0))
+		{
+			status = addInxIval (& (query.selectInp), *columns_p, 1);
+			++ columns_p;
+		}
+
+	if (status == 0)
+		{
+			if (ids_condition_s)
+				{
+					status = addInxVal (& (query.sqlCondInp), id_column, ids_condition_s);
+				}
+			else
+				{
+					status = SYS_MALLOC_ERR;
+				}
+		}
+
+	if (status == 0)
+		{
+			do
+				{
+					status = rcGenQuery (rods_connection_p, &query, &results_p);
+					CheckIRodsConnectionStatus (rods_connection_p, status, pool_p);
+
+					if (status == 0)
+						{
+							int i;
+
+							for (i = 0; i < results_p -> rowCnt; ++ i)
+								{
+									const char *id_s = GetGenQueryResultValue (results_p, id_column, i);
+
+									/* A data object has a row for each of its replicas so just use the first */
+									if (id_s && (!apr_hash_get (objects_p, id_s, APR_HASH_KEY_STRING)))
+										{
+											IRodsObject *obj_p = (IRodsObject *) apr_palloc (pool_p, sizeof (IRodsObject));
+
+											if (obj_p)
+												{
+													apr_status_t apr_status;
+
+													InitIRodsObject (obj_p);
+
+													if (obj_type == DATA_OBJ_T)
+														{
+															const char *size_s = GetGenQueryResultValue (results_p, COL_DATA_SIZE, i);
+															const char *collection_s = GetGenQueryResultValue (results_p, COL_COLL_NAME, i);
+															const size_t collection_length = strlen (collection_s);
+
+															/* Match the collection paths that GetIRodsObjectNodeForId () uses */
+															if ((collection_length == 0) || (* (collection_s + collection_length - 1) != '/'))
+																{
+																	collection_s = apr_pstrcat (pool_p, collection_s, "/", NULL);
+																}
+
+															apr_status = SetIRodsObject (obj_p, DATA_OBJ_T, id_s, GetGenQueryResultValue (results_p, COL_DATA_NAME, i), collection_s,
+																GetGenQueryResultValue (results_p, COL_D_OWNER_NAME, i), GetGenQueryResultValue (results_p, COL_D_RESC_HIER, i),
+																GetGenQueryResultValue (results_p, COL_D_MODIFY_TIME, i), size_s ? apr_atoi64 (size_s) : 0,
+																GetGenQueryResultValue (results_p, COL_D_DATA_CHECKSUM, i), pool_p);
+														}
+													else
+														{
+															apr_status = SetIRodsObject (obj_p, COLL_OBJ_T, id_s, NULL, GetGenQueryResultValue (results_p, COL_COLL_NAME, i),
+																GetGenQueryResultValue (results_p, COL_COLL_OWNER_NAME, i), NULL,
+																GetGenQueryResultValue (results_p, COL_COLL_MODIFY_TIME, i), 0, NULL, pool_p);
+														}
+
+													if (apr_status == APR_SUCCESS)
+														{
+															apr_hash_set (objects_p, obj_p -> io_id_s, APR_HASH_KEY_STRING, obj_p);
+														}
+													else
+														{
+															ap_log_perror (APLOG_MARK, APLOG_ERR, apr_status, pool_p, "Failed to set object for id \"%s\"", id_s);
+														}
+												}
+										}
+
+								}		/* for (i = 0; i < results_p -> rowCnt; ++ i) */
+
+							query.continueInx = results_p -> continueInx;
+							freeGenQueryOut (&results_p);
+						}
+				}
+			while ((status == 0) && (query.continueInx > 0));
+		}
+
+	if (status == CAT_NO_ROWS_FOUND)
+		{
+			status = 0;
+		}
+	else if (status != 0)
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get the objects for ids %s, %s", ids_condition_s ? ids_condition_s : "", get_rods_error_msg (status));
+		}
+
+	freeGenQueryOut (&results_p);
+	clearGenQueryInp (&query);
+
+	return status;
+}
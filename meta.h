@@ -87,9 +87,44 @@ apr_status_t GetSearchOperatorFromString (const char *op_s, SearchOperator *op_p
 
 IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char * const value_s, SearchOperator op, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
 
+/**
+ * Call a function for each data object and collection that has a given metadata
+ * key and value. Each hit is only valid for the duration of the call so, unlike
+ * GetMatchingMetadataHits (), the memory used does not grow with the number of hits.
+ *
+ * @param key_s The metadata key to search for.
+ * @param value_s The metadata value to search for.
+ * @param op The SearchOperator to use to compare the values.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param process_hit_fn The function to call for each hit. If this returns anything
+ * other than APR_SUCCESS, the search is stopped.
+ * @param data_p The custom data to pass to process_hit_fn.
+ * @param pool_p The pool to use for any allocations.
+ * @return APR_SUCCESS upon success, the error from process_hit_fn otherwise.
+ */
+apr_status_t ProcessMatchingMetadataHits (const char * const key_s, const char * const value_s, SearchOperator op, rcComm_t *rods_connection_p, apr_status_t (*process_hit_fn) (const IRodsObject *hit_p, void *data_p), void *data_p, apr_pool_t *pool_p);
+
 IRodsObjectNode *GetIRodsObjectNodeForId (const char *id_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
 
 
+/**
+ * Get the IRodsObjectNodes for a list of ids such as "1.10021" or "2.10002".
+ * Rather than querying each id in turn, the ids are looked up a page at a
+ * time with at most one query for data objects and one for collections
+ * for each page.
+ *
+ * @param ids_ss The ids to look up.
+ * @param num_ids The number of ids.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param unknown_ids_p If this is not <code>NULL</code>, any ids that
+ * could not be found will be appended to it.
+ * @param pool_p The pool to use for any allocations.
+ * @return The list of IRodsObjectNodes in the same order as the ids
+ * or <code>NULL</code> if none of them were found.
+ */
+IRodsObjectNode *GetIRodsObjectNodesForIds (const char **ids_ss, const int num_ids, rcComm_t *rods_connection_p, apr_array_header_t *unknown_ids_p, apr_pool_t *pool_p);
+
+
 apr_table_t *GetAllDataObjectMetadataValuesForKey (apr_pool_t *pool_p, rcComm_t *connection_p, const char *key_s);
 
 char *GetParentCollectionId (const char *child_id_s, const objType_t object_type, const char *zone_s, rcComm_t *irods_connection_p, apr_pool_t *pool_p);
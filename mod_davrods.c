@@ -26,6 +26,15 @@
 #include "auth.h"
 #include "common.h"
 #include "rest.h"
+#include "negative_cache.h"
+#include "replica_selector.h"
+#include "write_placement.h"
+#include "session_token.h"
+#include "auth_cache.h"
+#include "env_cache.h"
+#include "curl_util.h"
+#include "public_pool.h"
+#include "mod_status.h"
 #include "http_request.h"
 
 #include <curl/curl.h>
@@ -35,6 +44,10 @@ APLOG_USE_MODULE(davrods);
 
 
 
+static int EIRodsDavPreConfig (apr_pool_t *config_pool_p, apr_pool_t *log_pool_p, apr_pool_t *temp_pool_p);
+
+static int EIRodsDavPostConfig (apr_pool_t *config_pool_p, apr_pool_t *log_pool_p, apr_pool_t *temp_pool_p, server_rec *server_p);
+
 static void EIRodsDavChildInit (apr_pool_t *pool_p, server_rec *server_p);
 
 static apr_status_t EIRodsDavChildFinalize (void *data_p);
@@ -45,10 +58,16 @@ static void register_davrods_hooks(apr_pool_t *p) {
     davrods_auth_register(p);
     davrods_dav_register(p);
 
+    ap_hook_pre_config (EIRodsDavPreConfig, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_config (EIRodsDavPostConfig, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_child_init (EIRodsDavChildInit, NULL, NULL, APR_HOOK_FIRST);
     ap_hook_fixups (EIRodsDavFixUps, NULL, NULL, APR_HOOK_FIRST);
+    ap_hook_check_authn (CheckSessionToken, NULL, NULL, APR_HOOK_FIRST, AP_AUTH_INTERNAL_PER_CONF);
 
     ap_hook_handler (EIRodsDavAPIHandler, NULL, NULL, APR_HOOK_FIRST);
+
+    APR_OPTIONAL_HOOK (ap, status_hook, PrintReplicaStats, NULL, NULL, APR_HOOK_MIDDLE);
+    APR_OPTIONAL_HOOK (ap, status_hook, PrintAuthCacheStats, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 module AP_MODULE_DECLARE_DATA davrods_module = {
@@ -63,6 +82,48 @@ module AP_MODULE_DECLARE_DATA davrods_module = {
 
 
 
+static int EIRodsDavPreConfig (apr_pool_t *config_pool_p, apr_pool_t *log_pool_p, apr_pool_t *temp_pool_p)
+{
+	int res = OK;
+
+	ResetEnvFile ();
+	ResetPublicConnectionPools ();
+
+	if (RegisterAuthCacheMutex (config_pool_p) != APR_SUCCESS)
+		{
+			ap_log_perror (APLOG_MARK, APLOG_CRIT, APR_EGENERAL, log_pool_p, "Failed to register the authentication cache mutex");
+			res = HTTP_INTERNAL_SERVER_ERROR;
+		}
+
+	return res;
+}
+
+
+static int EIRodsDavPostConfig (apr_pool_t *config_pool_p, apr_pool_t *log_pool_p, apr_pool_t *temp_pool_p, server_rec *server_p)
+{
+	/*
+	 * These values are in shared memory so they need to be set up
+	 * before the child processes are forked.
+	 */
+	InitReplicaStats (config_pool_p, server_p);
+	InitNegativeCacheGenerations (config_pool_p, server_p);
+	InitWritePlacement (config_pool_p, server_p);
+
+	/*
+	 * The iRODS client library reads its environment file from
+	 * IRODS_ENVIRONMENT_FILE, so set it while there is only one thread.
+	 */
+	ExportEnvFile (server_p);
+
+	if (InitAuthCache (config_pool_p, server_p) != APR_SUCCESS)
+		{
+			return HTTP_INTERNAL_SERVER_ERROR;
+		}
+
+	return OK;
+}
+
+
 static void EIRodsDavChildInit (apr_pool_t *pool_p, server_rec *server_p)
 {
 	CURLcode res = curl_global_init (CURL_GLOBAL_DEFAULT);
@@ -70,11 +131,17 @@ static void EIRodsDavChildInit (apr_pool_t *pool_p, server_rec *server_p)
 	if (res == CURLE_OK)
 		{
 			apr_pool_cleanup_register (pool_p, NULL, EIRodsDavChildFinalize, apr_pool_cleanup_null);
+			InitCurlUtil (pool_p);
 		}
 	else
 		{
 			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to initialise CURL library");
 		}
+
+	InitNegativeCache (pool_p);
+	InitEnvCache (pool_p);
+	InitPublicConnectionPools (pool_p, server_p);
+	InitAuthCacheChild (pool_p, server_p);
 }
 
 
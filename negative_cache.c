@@ -0,0 +1,493 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * negative_cache.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "negative_cache.h"
+
+#include "apr_strings.h"
+#include "apr_hash.h"
+#include "apr_fnmatch.h"
+#include "apr_time.h"
+#include "apr_shm.h"
+#include "apr_atomic.h"
+
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
+
+#include "http_log.h"
+
+#include "irods/rcConnect.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/**
+ * The names that clients such as Finder, Windows Explorer and Office
+ * constantly probe for and which are very unlikely to ever exist.
+ * Office's "~$*" lock files are left out since they are created as a
+ * matter of course and other Apache servers can't see that happen.
+ */
+static char *S_DEFAULT_PROBE_NAMES_SS [] =
+{
+	".DS_Store",
+	"._*",
+	"desktop.ini",
+	"Thumbs.db",
+	NULL
+};
+
+
+/**
+ * The number of entries to store before the cache is emptied. This keeps
+ * the memory used by each child process bounded.
+ */
+static const unsigned int S_MAX_ENTRIES = 16384;
+
+
+/**
+ * The number of shared generation counters that collections are hashed
+ * into.
+ */
+static const unsigned int S_NUM_GENERATIONS = 4096;
+
+
+/**
+ * An entry in the cache.
+ */
+typedef struct KnownAbsent
+{
+	/** When the entry expires. */
+	apr_time_t ka_expiry;
+
+	/** The generation of the entry's collection when it was added. */
+	apr_uint32_t ka_generation;
+} KnownAbsent;
+
+
+/*
+ * The cache is per child process. It maps each collection path to a
+ * hash of "<user>/<name>" keys for the names that are known not to
+ * exist within it, with a KnownAbsent as the value.
+ */
+static apr_pool_t *s_cache_pool_p = NULL;
+
+static apr_hash_t *s_collections_p = NULL;
+
+static unsigned int s_num_entries = 0;
+
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *s_mutex_p = NULL;
+#endif
+
+
+/*
+ * Creating a name in a collection bumps the collection's generation
+ * counter in shared memory, which makes every child process's entries for
+ * it stale. Collections that share a counter just lose their entries
+ * sooner.
+ */
+static apr_shm_t *s_shm_p = NULL;
+
+static apr_uint32_t *s_generations_p = NULL;
+
+
+static apr_uint32_t *GetGenerationCounter (const char *rods_path_s, apr_ssize_t collection_length);
+
+static apr_uint32_t GetGeneration (const char *rods_path_s, apr_ssize_t collection_length);
+
+static bool SplitPath (const char *rods_path_s, apr_ssize_t *collection_length_p, const char **name_ss);
+
+static bool MatchesPatterns (char * const *patterns_ss, const char *name_s);
+
+static bool IsProbeName (const davrods_dir_conf_t *conf_p, const char *name_s);
+
+static bool GetEntryKey (char *key_s, const size_t key_size, const char *username_s, const char *name_s);
+
+static void LockNegativeCache (void);
+
+static void UnlockNegativeCache (void);
+
+
+apr_status_t InitNegativeCacheGenerations (apr_pool_t *pool_p, server_rec *server_p)
+{
+	const apr_size_t size = S_NUM_GENERATIONS * sizeof (apr_uint32_t);
+	apr_status_t status = apr_shm_create (&s_shm_p, size, NULL, pool_p);
+
+	if (status == APR_ENOTIMPL)
+		{
+			/* Anonymous shared memory isn't available so use a named segment instead */
+			const char *filename_s = ap_runtime_dir_relative (pool_p, "davrods-negative-cache");
+
+			apr_shm_remove (filename_s, pool_p);
+			status = apr_shm_create (&s_shm_p, size, filename_s, pool_p);
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			s_generations_p = (apr_uint32_t *) apr_shm_baseaddr_get (s_shm_p);
+			memset (s_generations_p, 0, size);
+		}
+	else
+		{
+			ap_log_error (APLOG_MARK, APLOG_ERR, status, server_p, "Failed to create the shared memory for the negative cache");
+			s_generations_p = NULL;
+		}
+
+	return status;
+}
+
+
+apr_status_t InitNegativeCache (apr_pool_t *pool_p)
+{
+	apr_status_t status = apr_pool_create (&s_cache_pool_p, pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			s_collections_p = apr_hash_make (s_cache_pool_p);
+			s_num_entries = 0;
+
+			#if APR_HAS_THREADS
+			status = apr_thread_mutex_create (&s_mutex_p, APR_THREAD_MUTEX_DEFAULT, pool_p);
+
+			if (status != APR_SUCCESS)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to create the negative cache mutex");
+					s_collections_p = NULL;
+				}
+			#endif
+		}
+	else
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, status, pool_p, "Failed to create the negative cache pool");
+		}
+
+	return status;
+}
+
+
+bool IsDeniedName (const davrods_dir_conf_t *conf_p, const char *rods_path_s)
+{
+	bool denied_flag = false;
+
+	if (conf_p -> denied_names_ss)
+		{
+			apr_ssize_t collection_length;
+			const char *name_s;
+
+			if (SplitPath (rods_path_s, &collection_length, &name_s))
+				{
+					denied_flag = MatchesPatterns (conf_p -> denied_names_ss, name_s);
+				}
+		}
+
+	return denied_flag;
+}
+
+
+bool IsKnownAbsent (const davrods_dir_conf_t *conf_p, const char *username_s, const char *rods_path_s)
+{
+	bool absent_flag = false;
+
+	if ((conf_p -> negative_cache_timeout > 0) && s_collections_p)
+		{
+			apr_ssize_t collection_length;
+			const char *name_s;
+
+			if (SplitPath (rods_path_s, &collection_length, &name_s) && IsProbeName (conf_p, name_s))
+				{
+					char key_s [MAX_NAME_LEN + NAME_LEN];
+
+					if (GetEntryKey (key_s, sizeof (key_s), username_s, name_s))
+						{
+							const apr_uint32_t generation = GetGeneration (rods_path_s, collection_length);
+							apr_hash_t *names_p;
+
+							LockNegativeCache ();
+
+							names_p = (apr_hash_t *) apr_hash_get (s_collections_p, rods_path_s, collection_length);
+
+							if (names_p)
+								{
+									KnownAbsent *entry_p = (KnownAbsent *) apr_hash_get (names_p, key_s, APR_HASH_KEY_STRING);
+
+									if (entry_p)
+										{
+											if ((entry_p -> ka_expiry > apr_time_now ()) && (entry_p -> ka_generation == generation))
+												{
+													absent_flag = true;
+												}
+											else
+												{
+													apr_hash_set (names_p, key_s, APR_HASH_KEY_STRING, NULL);
+												}
+										}
+
+								}		/* if (names_p) */
+
+							UnlockNegativeCache ();
+						}
+				}
+		}
+
+	return absent_flag;
+}
+
+
+void AddKnownAbsent (const davrods_dir_conf_t *conf_p, const char *username_s, const char *rods_path_s)
+{
+	if ((conf_p -> negative_cache_timeout > 0) && s_collections_p)
+		{
+			apr_ssize_t collection_length;
+			const char *name_s;
+
+			if (SplitPath (rods_path_s, &collection_length, &name_s) && IsProbeName (conf_p, name_s))
+				{
+					char key_s [MAX_NAME_LEN + NAME_LEN];
+
+					if (GetEntryKey (key_s, sizeof (key_s), username_s, name_s))
+						{
+							const apr_time_t expiry = apr_time_now () + apr_time_from_sec (conf_p -> negative_cache_timeout);
+							const apr_uint32_t generation = GetGeneration (rods_path_s, collection_length);
+							apr_hash_t *names_p;
+
+							LockNegativeCache ();
+
+							if (s_num_entries >= S_MAX_ENTRIES)
+								{
+									apr_pool_clear (s_cache_pool_p);
+									s_collections_p = apr_hash_make (s_cache_pool_p);
+									s_num_entries = 0;
+								}
+
+							names_p = (apr_hash_t *) apr_hash_get (s_collections_p, rods_path_s, collection_length);
+
+							if (!names_p)
+								{
+									names_p = apr_hash_make (s_cache_pool_p);
+									apr_hash_set (s_collections_p, apr_pstrndup (s_cache_pool_p, rods_path_s, collection_length), collection_length, names_p);
+								}
+
+							KnownAbsent *entry_p = (KnownAbsent *) apr_hash_get (names_p, key_s, APR_HASH_KEY_STRING);
+
+							if (!entry_p)
+								{
+									entry_p = (KnownAbsent *) apr_palloc (s_cache_pool_p, sizeof (KnownAbsent));
+									apr_hash_set (names_p, apr_pstrdup (s_cache_pool_p, key_s), APR_HASH_KEY_STRING, entry_p);
+									++ s_num_entries;
+								}
+
+							entry_p -> ka_expiry = expiry;
+							entry_p -> ka_generation = generation;
+
+							UnlockNegativeCache ();
+						}
+				}
+		}
+}
+
+
+void ForgetKnownAbsent (const davrods_dir_conf_t *conf_p, const char *rods_path_s)
+{
+	if ((conf_p -> negative_cache_timeout > 0) && s_collections_p)
+		{
+			apr_ssize_t collection_length;
+			const char *name_s;
+
+			if (SplitPath (rods_path_s, &collection_length, &name_s) && IsProbeName (conf_p, name_s))
+				{
+					/*
+					 * The entries for every user are dropped since the new
+					 * name may now be visible to all of them. Bumping the
+					 * generation does the same in the other child processes.
+					 */
+					apr_uint32_t *counter_p = GetGenerationCounter (rods_path_s, collection_length);
+
+					if (counter_p)
+						{
+							apr_atomic_inc32 (counter_p);
+						}
+
+					LockNegativeCache ();
+					apr_hash_set (s_collections_p, rods_path_s, collection_length, NULL);
+					UnlockNegativeCache ();
+				}
+		}
+}
+
+
+const char *SetNegativeCacheTimeout (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+	apr_int64_t timeout = apr_atoi64 (arg_p);
+
+	if ((timeout >= 0) && (timeout <= INT_MAX))
+		{
+			conf_p -> negative_cache_timeout = (int) timeout;
+		}
+	else
+		{
+			res_s = apr_psprintf (cmd_p -> pool, "Invalid negative cache timeout \"%s\"", arg_p);
+		}
+
+	return res_s;
+}
+
+
+const char *SetNegativeCacheNames (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+	char **args_ss = NULL;
+	apr_status_t status = apr_tokenize_to_argv (arg_p, &args_ss, cmd_p -> pool);
+
+	if (status == APR_SUCCESS)
+		{
+			conf_p -> negative_cache_names_ss = args_ss;
+		}
+	else
+		{
+			res_s = apr_psprintf (cmd_p -> pool, "Failed to tokenize \"%s\" error %d", arg_p, status);
+		}
+
+	return res_s;
+}
+
+
+const char *SetDeniedNames (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+	char **args_ss = NULL;
+	apr_status_t status = apr_tokenize_to_argv (arg_p, &args_ss, cmd_p -> pool);
+
+	if (status == APR_SUCCESS)
+		{
+			conf_p -> denied_names_ss = args_ss;
+		}
+	else
+		{
+			res_s = apr_psprintf (cmd_p -> pool, "Failed to tokenize \"%s\" error %d", arg_p, status);
+		}
+
+	return res_s;
+}
+
+
+static apr_uint32_t *GetGenerationCounter (const char *rods_path_s, apr_ssize_t collection_length)
+{
+	apr_uint32_t *counter_p = NULL;
+
+	if (s_generations_p)
+		{
+			const unsigned int hash = apr_hashfunc_default (rods_path_s, &collection_length);
+
+			counter_p = s_generations_p + (hash % S_NUM_GENERATIONS);
+		}
+
+	return counter_p;
+}
+
+
+static apr_uint32_t GetGeneration (const char *rods_path_s, apr_ssize_t collection_length)
+{
+	apr_uint32_t *counter_p = GetGenerationCounter (rods_path_s, collection_length);
+
+	return counter_p ? apr_atomic_read32 (counter_p) : 0;
+}
+
+
+/*
+ * Get the length of the collection part of an iRODS path, which is used
+ * as the hash key without making a copy, and the name within it.
+ */
+static bool SplitPath (const char *rods_path_s, apr_ssize_t *collection_length_p, const char **name_ss)
+{
+	bool success_flag = false;
+	const char *slash_s = strrchr (rods_path_s, '/');
+
+	if (slash_s && (* (slash_s + 1) != '\0'))
+		{
+			*collection_length_p = slash_s - rods_path_s;
+			*name_ss = slash_s + 1;
+			success_flag = true;
+		}
+
+	return success_flag;
+}
+
+
+static bool MatchesPatterns (char * const *patterns_ss, const char *name_s)
+{
+	bool match_flag = false;
+
+	while (*patterns_ss && !match_flag)
+		{
+			if (apr_fnmatch (*patterns_ss, name_s, APR_FNM_CASE_BLIND) == APR_SUCCESS)
+				{
+					match_flag = true;
+				}
+			else
+				{
+					++ patterns_ss;
+				}
+		}
+
+	return match_flag;
+}
+
+
+static bool IsProbeName (const davrods_dir_conf_t *conf_p, const char *name_s)
+{
+	char * const *patterns_ss = conf_p -> negative_cache_names_ss ? conf_p -> negative_cache_names_ss : S_DEFAULT_PROBE_NAMES_SS;
+
+	return MatchesPatterns (patterns_ss, name_s);
+}
+
+
+static bool GetEntryKey (char *key_s, const size_t key_size, const char *username_s, const char *name_s)
+{
+	const int res = snprintf (key_s, key_size, "%s/%s", username_s ? username_s : "", name_s);
+
+	return ((res >= 0) && ((size_t) res < key_size));
+}
+
+
+static void LockNegativeCache (void)
+{
+	#if APR_HAS_THREADS
+	apr_thread_mutex_lock (s_mutex_p);
+	#endif
+}
+
+
+static void UnlockNegativeCache (void)
+{
+	#if APR_HAS_THREADS
+	apr_thread_mutex_unlock (s_mutex_p);
+	#endif
+}
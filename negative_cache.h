@@ -0,0 +1,125 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * negative_cache.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef NEGATIVE_CACHE_H_
+#define NEGATIVE_CACHE_H_
+
+#include <stdbool.h>
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "apr_pools.h"
+
+#include "config.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create the shared memory that lets ForgetKnownAbsent reach the caches
+ * of every child process. This is called from the post_config hook so
+ * that every child process shares it.
+ *
+ * @param pool_p The configuration pool.
+ * @param server_p The server.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t InitNegativeCacheGenerations (apr_pool_t *pool_p, server_rec *server_p);
+
+
+/**
+ * Set up the cache of data objects and collections that are known not
+ * to exist. This is called once for each child process.
+ *
+ * @param pool_p The pool of the child process.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t InitNegativeCache (apr_pool_t *pool_p);
+
+
+/**
+ * Check whether the name of an iRODS path matches any of the patterns
+ * set with DavRodsDeniedNames. Such paths are treated as not existing
+ * without asking the iRODS server.
+ *
+ * @param conf_p The module configuration.
+ * @param rods_path_s The iRODS path to check.
+ * @return <code>true</code> if the path is denied, <code>false</code>
+ * otherwise.
+ */
+bool IsDeniedName (const davrods_dir_conf_t *conf_p, const char *rods_path_s);
+
+
+/**
+ * Check whether an iRODS path has recently been found not to exist for
+ * the given user.
+ *
+ * @param conf_p The module configuration.
+ * @param username_s The iRODS user.
+ * @param rods_path_s The iRODS path to check.
+ * @return <code>true</code> if the path is known not to exist,
+ * <code>false</code> otherwise.
+ */
+bool IsKnownAbsent (const davrods_dir_conf_t *conf_p, const char *username_s, const char *rods_path_s);
+
+
+/**
+ * Remember that an iRODS path does not exist for the given user. This
+ * does nothing unless the negative cache is enabled and the name of the
+ * path matches one of the probe patterns.
+ *
+ * @param conf_p The module configuration.
+ * @param username_s The iRODS user.
+ * @param rods_path_s The iRODS path that does not exist.
+ */
+void AddKnownAbsent (const davrods_dir_conf_t *conf_p, const char *username_s, const char *rods_path_s);
+
+
+/**
+ * Forget the absent entries for the collection containing an
+ * iRODS path that is about to be created, e.g. by a PUT or MKCOL.
+ * This reaches every child process of this server but not other
+ * Apache servers.
+ *
+ * @param conf_p The module configuration.
+ * @param rods_path_s The iRODS path being created.
+ */
+void ForgetKnownAbsent (const davrods_dir_conf_t *conf_p, const char *rods_path_s);
+
+
+const char *SetNegativeCacheTimeout (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetNegativeCacheNames (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetDeniedNames (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NEGATIVE_CACHE_H_ */
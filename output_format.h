@@ -29,6 +29,7 @@ typedef enum OutputFormat
 	OF_JSON,
 	OF_TSV,
 	OF_CSV,
+	OF_NDJSON,
 	OF_NUM_FORMATS
 } OutputFormat;
 
@@ -0,0 +1,647 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * public_pool.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "public_pool.h"
+#include "auth.h"
+#include "common.h"
+#include "env_cache.h"
+
+#include "apr_strings.h"
+#include "apr_hash.h"
+#include "apr_tables.h"
+#include "apr_time.h"
+
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
+
+#include "http_log.h"
+
+#include "irods/rodsClient.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/**
+ * How long, in seconds, an idle connection can sit in the pool before
+ * it is probed prior to reuse, if DavRodsConnectionProbeIdle is not set.
+ */
+static const int S_DEFAULT_PROBE_IDLE = 60;
+
+
+typedef struct PublicConnection
+{
+	rcComm_t *pc_connection_p;
+
+	/** When the connection was last put back in the pool. */
+	apr_time_t pc_last_used;
+} PublicConnection;
+
+
+/**
+ * The idle connections for one public user on one iRODS server.
+ */
+typedef struct PublicConnectionPool
+{
+	const char *pcp_host_s;
+
+	int pcp_port;
+
+	const char *pcp_zone_s;
+
+	const char *pcp_username_s;
+
+	const char *pcp_password_s;
+
+	/** The most connections to keep idle, this is also the number logged in when the child starts. */
+	int pcp_max_idle;
+
+	/** The idle connections with the most recently used last. */
+	PublicConnection *pcp_idle_p;
+
+	int pcp_num_idle;
+} PublicConnectionPool;
+
+
+/**
+ * A connection that has been taken out of a pool for a request.
+ */
+typedef struct PublicCheckout
+{
+	PublicConnectionPool *pco_pool_p;
+
+	rcComm_t *pco_connection_p;
+
+	apr_pool_t *pco_davrods_pool_p;
+} PublicCheckout;
+
+
+/*
+ * A configuration section that sets DavRodsPublicConnections along with
+ * the server that it is in.
+ */
+typedef struct NotedConfig
+{
+	davrods_dir_conf_t *nc_conf_p;
+
+	server_rec *nc_server_p;
+} NotedConfig;
+
+
+/*
+ * The NotedConfigs for the sections that set DavRodsPublicConnections.
+ * These are in the configuration pool so this is reset before the
+ * configuration is read again on a restart.
+ */
+static apr_array_header_t *s_noted_confs_p = NULL;
+
+
+/*
+ * The pools are per child process, keyed by "<user>#<zone>@<host>:<port>".
+ */
+static apr_pool_t *s_pools_pool_p = NULL;
+
+static apr_hash_t *s_pools_p = NULL;
+
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *s_mutex_p = NULL;
+#endif
+
+
+static davrods_dir_conf_t *GetMergedConfig (const NotedConfig *noted_p, apr_pool_t *pool_p);
+
+static bool CanPoolConfig (const davrods_dir_conf_t *conf_p);
+
+static char *GetPoolKey (apr_pool_t *pool_p, const davrods_dir_conf_t *conf_p);
+
+static PublicConnectionPool *GetConnectionPool (const davrods_dir_conf_t *conf_p, apr_pool_t *tmp_pool_p);
+
+static rcComm_t *OpenPublicConnection (const PublicConnectionPool *pool_p, apr_pool_t *log_pool_p);
+
+static rcComm_t *TakeIdleConnection (PublicConnectionPool *pool_p, const int probe_idle, apr_pool_t *log_pool_p);
+
+static bool InstallConnection (request_rec *req_p, apr_pool_t *davrods_pool_p, davrods_dir_conf_t *conf_p, rcComm_t *connection_p);
+
+static apr_status_t ReturnPublicConnection (void *data_p);
+
+static apr_status_t ClosePublicConnections (void *data_p);
+
+static void LockPublicPools (void);
+
+static void UnlockPublicPools (void);
+
+
+void ResetPublicConnectionPools (void)
+{
+	s_noted_confs_p = NULL;
+}
+
+
+apr_status_t InitPublicConnectionPools (apr_pool_t *pool_p, server_rec *server_p)
+{
+	apr_status_t status = apr_pool_create (&s_pools_pool_p, pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			s_pools_p = apr_hash_make (s_pools_pool_p);
+
+			#if APR_HAS_THREADS
+			status = apr_thread_mutex_create (&s_mutex_p, APR_THREAD_MUTEX_DEFAULT, pool_p);
+
+			if (status != APR_SUCCESS)
+				{
+					ap_log_error (APLOG_MARK, APLOG_ERR, status, server_p, "Failed to create the public connection pool mutex");
+					s_pools_p = NULL;
+				}
+			#endif
+
+			if (s_pools_p)
+				{
+					/* This runs before the pools' memory is freed */
+					apr_pool_cleanup_register (s_pools_pool_p, NULL, ClosePublicConnections, apr_pool_cleanup_null);
+
+					/*
+					 * Log in the connections now, while the child has only one thread
+					 * and before it is serving any requests.
+					 */
+					if (s_noted_confs_p)
+						{
+							int i;
+
+							for (i = 0; i < s_noted_confs_p -> nelts; ++ i)
+								{
+									const NotedConfig *noted_p = APR_ARRAY_IDX (s_noted_confs_p, i, const NotedConfig *);
+									const davrods_dir_conf_t *conf_p = GetMergedConfig (noted_p, pool_p);
+									PublicConnectionPool *public_pool_p = GetConnectionPool (conf_p, pool_p);
+
+									if (public_pool_p)
+										{
+											bool loop_flag = true;
+
+											while (loop_flag && (public_pool_p -> pcp_num_idle < public_pool_p -> pcp_max_idle))
+												{
+													rcComm_t *connection_p = OpenPublicConnection (public_pool_p, pool_p);
+
+													if (connection_p)
+														{
+															PublicConnection *idle_p = public_pool_p -> pcp_idle_p + public_pool_p -> pcp_num_idle;
+
+															idle_p -> pc_connection_p = connection_p;
+															idle_p -> pc_last_used = apr_time_now ();
+															++ (public_pool_p -> pcp_num_idle);
+														}
+													else
+														{
+															/* Don't keep trying if the server is down, requests will log in as needed */
+															loop_flag = false;
+														}
+												}
+
+											ap_log_error (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, server_p, "Logged in %d connections for public user \"%s\" on %s:%d",
+												public_pool_p -> pcp_num_idle, public_pool_p -> pcp_username_s, public_pool_p -> pcp_host_s, public_pool_p -> pcp_port);
+										}
+								}
+						}
+				}
+		}
+	else
+		{
+			ap_log_error (APLOG_MARK, APLOG_ERR, status, server_p, "Failed to create the public connection pool memory pool");
+		}
+
+	return status;
+}
+
+
+rcComm_t *GetPooledPublicConnection (request_rec *req_p, apr_pool_t *davrods_pool_p, davrods_dir_conf_t *conf_p)
+{
+	rcComm_t *connection_p = NULL;
+	void *ptr = NULL;
+
+	/* Is there already a connection for the public user from earlier in this request? */
+	if ((apr_pool_userdata_get (&ptr, GetConnectionKey (), davrods_pool_p) == APR_SUCCESS) && ptr)
+		{
+			const char *username_s = GetUsernameFromPool (davrods_pool_p);
+
+			if (username_s && (strcmp (username_s, conf_p -> davrods_public_username_s) == 0))
+				{
+					connection_p = (rcComm_t *) ptr;
+				}
+			else
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, req_p, "Closing existing iRODS connection for user '%s' (need public user connection)", username_s ? username_s : "");
+
+					/* This runs rods_conn_cleanup for the existing connection */
+					apr_pool_clear (davrods_pool_p);
+				}
+		}
+
+	if (!connection_p)
+		{
+			PublicConnectionPool *public_pool_p = GetConnectionPool (conf_p, req_p -> pool);
+
+			if (public_pool_p)
+				{
+					const int probe_idle = (conf_p -> connection_probe_idle > 0) ? conf_p -> connection_probe_idle : S_DEFAULT_PROBE_IDLE;
+
+					connection_p = TakeIdleConnection (public_pool_p, probe_idle, req_p -> pool);
+
+					if (!connection_p)
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, req_p, "No idle public user connections, logging in a new one");
+							connection_p = OpenPublicConnection (public_pool_p, req_p -> pool);
+						}
+
+					if (connection_p)
+						{
+							if (InstallConnection (req_p, davrods_pool_p, conf_p, connection_p))
+								{
+									PublicCheckout *checkout_p = (PublicCheckout *) apr_palloc (req_p -> pool, sizeof (PublicCheckout));
+									request_rec *main_req_p = req_p;
+
+									checkout_p -> pco_pool_p = public_pool_p;
+									checkout_p -> pco_connection_p = connection_p;
+									checkout_p -> pco_davrods_pool_p = davrods_pool_p;
+
+									/*
+									 * Subrequests share the connection with their main request so only
+									 * give it back when that finishes.
+									 */
+									while (main_req_p -> main)
+										{
+											main_req_p = main_req_p -> main;
+										}
+
+									apr_pool_cleanup_register (main_req_p -> pool, checkout_p, ReturnPublicConnection, apr_pool_cleanup_null);
+								}
+							else
+								{
+									rcDisconnect (connection_p);
+									connection_p = NULL;
+								}
+						}
+				}
+		}
+
+	return connection_p;
+}
+
+
+const char *SetPublicConnections (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+	apr_int64_t num_connections = apr_atoi64 (arg_p);
+
+	if ((num_connections >= 0) && (num_connections <= INT_MAX))
+		{
+			conf_p -> public_connections = (int) num_connections;
+
+			if (num_connections > 0)
+				{
+					NotedConfig *noted_p = (NotedConfig *) apr_palloc (cmd_p -> pool, sizeof (NotedConfig));
+
+					noted_p -> nc_conf_p = conf_p;
+					noted_p -> nc_server_p = cmd_p -> server;
+
+					if (!s_noted_confs_p)
+						{
+							s_noted_confs_p = apr_array_make (cmd_p -> pool, 1, sizeof (NotedConfig *));
+						}
+
+					APR_ARRAY_PUSH (s_noted_confs_p, NotedConfig *) = noted_p;
+				}
+		}
+	else
+		{
+			res_s = apr_psprintf (cmd_p -> pool, "Invalid number of public connections \"%s\"", arg_p);
+		}
+
+	return res_s;
+}
+
+
+/*
+ * The section that set DavRodsPublicConnections only has the directives
+ * that were in it, so merge it on top of its server's configuration to
+ * pick up the host, zone, user and authentication scheme set there, the
+ * same as a request would. Directives in enclosing <Location> or
+ * <Directory> sections are not seen as there is no request to walk them.
+ */
+static davrods_dir_conf_t *GetMergedConfig (const NotedConfig *noted_p, apr_pool_t *pool_p)
+{
+	davrods_dir_conf_t *conf_p = noted_p -> nc_conf_p;
+	davrods_dir_conf_t *server_conf_p = ap_get_module_config (noted_p -> nc_server_p -> lookup_defaults, &davrods_module);
+
+	if (server_conf_p && (server_conf_p != conf_p))
+		{
+			conf_p = (davrods_dir_conf_t *) davrods_merge_dir_config (pool_p, server_conf_p, conf_p);
+		}
+
+	return conf_p;
+}
+
+
+/*
+ * The pooled connections are logged in without a request, so only
+ * native authentication is supported.
+ */
+static bool CanPoolConfig (const davrods_dir_conf_t *conf_p)
+{
+	return ((conf_p -> public_connections > 0) && (conf_p -> davrods_public_username_s) && (conf_p -> rods_auth_scheme == DAVRODS_AUTH_NATIVE));
+}
+
+
+static char *GetPoolKey (apr_pool_t *pool_p, const davrods_dir_conf_t *conf_p)
+{
+	return apr_psprintf (pool_p, "%s#%s@%s:%d", conf_p -> davrods_public_username_s, conf_p -> rods_zone, conf_p -> rods_host, conf_p -> rods_port);
+}
+
+
+static PublicConnectionPool *GetConnectionPool (const davrods_dir_conf_t *conf_p, apr_pool_t *tmp_pool_p)
+{
+	PublicConnectionPool *public_pool_p = NULL;
+
+	if (s_pools_p && CanPoolConfig (conf_p))
+		{
+			char *key_s = GetPoolKey (tmp_pool_p, conf_p);
+
+			LockPublicPools ();
+
+			public_pool_p = (PublicConnectionPool *) apr_hash_get (s_pools_p, key_s, APR_HASH_KEY_STRING);
+
+			if (!public_pool_p)
+				{
+					public_pool_p = (PublicConnectionPool *) apr_palloc (s_pools_pool_p, sizeof (PublicConnectionPool));
+
+					public_pool_p -> pcp_host_s = apr_pstrdup (s_pools_pool_p, conf_p -> rods_host);
+					public_pool_p -> pcp_port = conf_p -> rods_port;
+					public_pool_p -> pcp_zone_s = apr_pstrdup (s_pools_pool_p, conf_p -> rods_zone);
+					public_pool_p -> pcp_username_s = apr_pstrdup (s_pools_pool_p, conf_p -> davrods_public_username_s);
+					public_pool_p -> pcp_password_s = apr_pstrdup (s_pools_pool_p, conf_p -> davrods_public_password_s ? conf_p -> davrods_public_password_s : "");
+					public_pool_p -> pcp_max_idle = conf_p -> public_connections;
+					public_pool_p -> pcp_idle_p = (PublicConnection *) apr_pcalloc (s_pools_pool_p, conf_p -> public_connections * sizeof (PublicConnection));
+					public_pool_p -> pcp_num_idle = 0;
+
+					apr_hash_set (s_pools_p, apr_pstrdup (s_pools_pool_p, key_s), APR_HASH_KEY_STRING, public_pool_p);
+				}
+
+			UnlockPublicPools ();
+		}
+
+	return public_pool_p;
+}
+
+
+static rcComm_t *OpenPublicConnection (const PublicConnectionPool *pool_p, apr_pool_t *log_pool_p)
+{
+	rErrMsg_t error;
+	rcComm_t *connection_p = rcConnect (pool_p -> pcp_host_s, pool_p -> pcp_port, pool_p -> pcp_username_s, pool_p -> pcp_zone_s, 0, &error);
+
+	if (connection_p)
+		{
+			// clientLoginWithPassword () takes a writable password.
+			char *password_s = apr_pstrdup (log_pool_p, pool_p -> pcp_password_s);
+			int status = clientLoginWithPassword (connection_p, password_s);
+
+			if (status != 0)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, log_pool_p, "Failed to log in public user \"%s\": %d = %s",
+						pool_p -> pcp_username_s, status, get_rods_error_msg (status));
+
+					rcDisconnect (connection_p);
+					connection_p = NULL;
+				}
+		}
+	else
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, log_pool_p, "Could not connect to iRODS at %s:%d for public user \"%s\": %s",
+				pool_p -> pcp_host_s, pool_p -> pcp_port, pool_p -> pcp_username_s, error.msg);
+		}
+
+	return connection_p;
+}
+
+
+static rcComm_t *TakeIdleConnection (PublicConnectionPool *pool_p, const int probe_idle, apr_pool_t *log_pool_p)
+{
+	rcComm_t *connection_p = NULL;
+	bool loop_flag = true;
+
+	while (loop_flag)
+		{
+			PublicConnection idle;
+
+			LockPublicPools ();
+
+			if (pool_p -> pcp_num_idle > 0)
+				{
+					-- (pool_p -> pcp_num_idle);
+					idle = * (pool_p -> pcp_idle_p + pool_p -> pcp_num_idle);
+				}
+			else
+				{
+					idle.pc_connection_p = NULL;
+				}
+
+			UnlockPublicPools ();
+
+			if (idle.pc_connection_p)
+				{
+					if (apr_time_now () - idle.pc_last_used > apr_time_from_sec (probe_idle))
+						{
+							miscSvrInfo_t *server_info_p = NULL;
+							int status = rcGetMiscSvrInfo (idle.pc_connection_p, &server_info_p);
+
+							if (server_info_p)
+								{
+									free (server_info_p);
+								}
+
+							if (status >= 0)
+								{
+									connection_p = idle.pc_connection_p;
+									loop_flag = false;
+								}
+							else
+								{
+									ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, log_pool_p, "Dropping idle public user connection that failed its probe: %d = %s",
+										status, get_rods_error_msg (status));
+
+									rcDisconnect (idle.pc_connection_p);
+								}
+						}
+					else
+						{
+							connection_p = idle.pc_connection_p;
+							loop_flag = false;
+						}
+				}
+			else
+				{
+					loop_flag = false;
+				}
+		}
+
+	return connection_p;
+}
+
+
+/*
+ * Store the connection in the davrods pool where the rest of the module
+ * expects to find it. The cleanup is a no-op since the connection belongs
+ * to the public pool rather than to the davrods pool.
+ */
+static bool InstallConnection (request_rec *req_p, apr_pool_t *davrods_pool_p, davrods_dir_conf_t *conf_p, rcComm_t *connection_p)
+{
+	bool success_flag = false;
+	rodsEnv *env_p = GetRodsEnvFromPool (davrods_pool_p);
+
+	if (!env_p)
+		{
+			env_p = (rodsEnv *) apr_palloc (davrods_pool_p, sizeof (rodsEnv));
+		}
+
+	if (GetCachedRodsEnv (req_p, conf_p -> rods_env_file, env_p))
+		{
+			const char *username_s = GetUsernameFromPool (davrods_pool_p);
+
+			if (! (username_s && (strcmp (username_s, conf_p -> davrods_public_username_s) == 0)))
+				{
+					apr_pool_userdata_set (apr_pstrdup (davrods_pool_p, conf_p -> davrods_public_username_s), GetUsernameKey (), apr_pool_cleanup_null, davrods_pool_p);
+				}
+
+			apr_pool_userdata_set (env_p, GetRodsEnvKey (), apr_pool_cleanup_null, davrods_pool_p);
+			apr_pool_userdata_set (connection_p, GetConnectionKey (), apr_pool_cleanup_null, davrods_pool_p);
+			apr_pool_userdata_set (connection_p, GetPublicConnectionKey (), apr_pool_cleanup_null, davrods_pool_p);
+
+			success_flag = true;
+		}
+
+	return success_flag;
+}
+
+
+static apr_status_t ReturnPublicConnection (void *data_p)
+{
+	PublicCheckout *checkout_p = (PublicCheckout *) data_p;
+	void *ptr = NULL;
+	bool keep_flag = false;
+
+	/*
+	 * If the davrods pool no longer holds this connection, it has been
+	 * replaced, e.g. after being lost, so it can't be trusted.
+	 */
+	if ((apr_pool_userdata_get (&ptr, GetConnectionKey (), checkout_p -> pco_davrods_pool_p) == APR_SUCCESS) && (ptr == checkout_p -> pco_connection_p))
+		{
+			ptr = NULL;
+			apr_pool_userdata_get (&ptr, GetBrokenKey (), checkout_p -> pco_davrods_pool_p);
+
+			keep_flag = (ptr == NULL);
+
+			apr_pool_userdata_setn (NULL, GetConnectionKey (), apr_pool_cleanup_null, checkout_p -> pco_davrods_pool_p);
+			apr_pool_userdata_setn (NULL, GetBrokenKey (), apr_pool_cleanup_null, checkout_p -> pco_davrods_pool_p);
+		}
+
+	ptr = NULL;
+
+	if ((apr_pool_userdata_get (&ptr, GetPublicConnectionKey (), checkout_p -> pco_davrods_pool_p) == APR_SUCCESS) && (ptr == checkout_p -> pco_connection_p))
+		{
+			apr_pool_userdata_setn (NULL, GetPublicConnectionKey (), apr_pool_cleanup_null, checkout_p -> pco_davrods_pool_p);
+		}
+
+	if (keep_flag)
+		{
+			PublicConnectionPool *pool_p = checkout_p -> pco_pool_p;
+
+			LockPublicPools ();
+
+			if (pool_p -> pcp_num_idle < pool_p -> pcp_max_idle)
+				{
+					PublicConnection *idle_p = pool_p -> pcp_idle_p + pool_p -> pcp_num_idle;
+
+					idle_p -> pc_connection_p = checkout_p -> pco_connection_p;
+					idle_p -> pc_last_used = apr_time_now ();
+					++ (pool_p -> pcp_num_idle);
+				}
+			else
+				{
+					keep_flag = false;
+				}
+
+			UnlockPublicPools ();
+		}
+
+	if (!keep_flag)
+		{
+			rcDisconnect (checkout_p -> pco_connection_p);
+		}
+
+	return APR_SUCCESS;
+}
+
+
+static apr_status_t ClosePublicConnections (void *data_p)
+{
+	if (s_pools_p)
+		{
+			apr_hash_index_t *index_p;
+
+			for (index_p = apr_hash_first (NULL, s_pools_p); index_p; index_p = apr_hash_next (index_p))
+				{
+					PublicConnectionPool *pool_p = NULL;
+
+					apr_hash_this (index_p, NULL, NULL, (void **) &pool_p);
+
+					while (pool_p -> pcp_num_idle > 0)
+						{
+							-- (pool_p -> pcp_num_idle);
+							rcDisconnect ((pool_p -> pcp_idle_p + pool_p -> pcp_num_idle) -> pc_connection_p);
+						}
+				}
+
+			s_pools_p = NULL;
+		}
+
+	return APR_SUCCESS;
+}
+
+
+static void LockPublicPools (void)
+{
+	#if APR_HAS_THREADS
+	apr_thread_mutex_lock (s_mutex_p);
+	#endif
+}
+
+
+static void UnlockPublicPools (void)
+{
+	#if APR_HAS_THREADS
+	apr_thread_mutex_unlock (s_mutex_p);
+	#endif
+}
@@ -0,0 +1,82 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * public_pool.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef PUBLIC_POOL_H_
+#define PUBLIC_POOL_H_
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "apr_pools.h"
+
+#include "irods/rcConnect.h"
+
+#include "config.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Forget the configurations that were noted by SetPublicConnections
+ * during the previous reading of the configuration. This is called from
+ * the pre_config hook.
+ */
+void ResetPublicConnectionPools (void);
+
+
+/**
+ * Set up the pools of logged in public user connections and log in
+ * the configured number of connections for each of them. This is called
+ * once for each child process.
+ *
+ * @param pool_p The pool of the child process.
+ * @param server_p The server.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t InitPublicConnectionPools (apr_pool_t *pool_p, server_rec *server_p);
+
+
+/**
+ * Get a logged in connection for the public user from the pool and
+ * store it in the davrods pool for the rest of the request. The
+ * connection is put back in the pool when the request finishes.
+ *
+ * @param req_p The anonymous request.
+ * @param davrods_pool_p The davrods pool for the request's connection.
+ * @param conf_p The module configuration.
+ * @return The connection or <code>NULL</code> upon error.
+ */
+rcComm_t *GetPooledPublicConnection (request_rec *req_p, apr_pool_t *davrods_pool_p, davrods_dir_conf_t *conf_p);
+
+
+const char *SetPublicConnections (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PUBLIC_POOL_H_ */
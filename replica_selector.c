@@ -0,0 +1,455 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * replica_selector.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdlib.h>
+
+#include "replica_selector.h"
+#include "common.h"
+
+#include "apr_strings.h"
+#include "apr_tables.h"
+#include "apr_shm.h"
+#include "apr_atomic.h"
+
+#include "http_log.h"
+#include "http_protocol.h"
+#include "mod_status.h"
+
+#include "irods/rodsGenQuery.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/**
+ * The read statistics for a resource. These live in shared memory and
+ * are updated without locking. The averages are only used to rank replicas
+ * so the odd lost update between child processes doesn't matter, but the
+ * counters are updated atomically so that they stay accurate.
+ */
+typedef struct ResourceStats
+{
+	/** 0 if the slot is free, 1 while it is being claimed and 2 once rs_name_s is set. */
+	volatile apr_uint32_t rs_state;
+
+	char rs_name_s [NAME_LEN];
+
+	/** The moving average of the time to the first block of data, in seconds. */
+	double rs_latency;
+
+	/** The moving average of the read throughput, in bytes per second. */
+	double rs_throughput;
+
+	volatile apr_uint32_t rs_num_reads;
+
+	volatile apr_uint32_t rs_num_failures;
+
+	apr_time_t rs_last_failure;
+} ResourceStats;
+
+
+/**
+ * A good replica of a data object that could be read from.
+ */
+typedef struct ReplicaCandidate
+{
+	const char *rc_replica_number_s;
+
+	const char *rc_resource_s;
+
+	double rc_expected_time;
+} ReplicaCandidate;
+
+
+/** The maximum number of resources that statistics are kept for. */
+#define S_MAX_RESOURCES (64)
+
+/** The weight given to each new measurement in the moving averages. */
+static const double S_EWMA_WEIGHT = 0.2;
+
+/**
+ * The minimum number of bytes for a read to be used to measure
+ * throughput. Smaller reads are dominated by their latency.
+ */
+static const apr_off_t S_MIN_THROUGHPUT_SAMPLE = 1024 * 1024;
+
+/** How long, in seconds, a resource is avoided for after a failure. */
+static const int S_FAILURE_BACKOFF = 60;
+
+/** The penalty, in seconds, added to the expected read time of a recently failed resource. */
+static const double S_FAILURE_PENALTY = 3600.0;
+
+
+static apr_shm_t *s_shm_p = NULL;
+
+static ResourceStats *s_stats_p = NULL;
+
+
+static ResourceStats *GetResourceStats (const char *resource_s, const bool create_flag);
+
+static apr_array_header_t *GetReplicaCandidates (rcComm_t *connection_p, const char *rods_path_s, const rodsLong_t size, apr_pool_t *pool_p);
+
+static double GetExpectedReadTime (const char *resource_s, const rodsLong_t size, const apr_time_t now);
+
+static int CompareReplicaCandidates (const void *v0_p, const void *v1_p);
+
+
+
+apr_status_t InitReplicaStats (apr_pool_t *pool_p, server_rec *server_p)
+{
+	const apr_size_t size = S_MAX_RESOURCES * sizeof (ResourceStats);
+	apr_status_t status = apr_shm_create (&s_shm_p, size, NULL, pool_p);
+
+	if (status == APR_ENOTIMPL)
+		{
+			/* Anonymous shared memory isn't available so use a named segment instead */
+			const char *filename_s = ap_runtime_dir_relative (pool_p, "davrods-replica-stats");
+
+			apr_shm_remove (filename_s, pool_p);
+			status = apr_shm_create (&s_shm_p, size, filename_s, pool_p);
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			s_stats_p = (ResourceStats *) apr_shm_baseaddr_get (s_shm_p);
+			memset (s_stats_p, 0, size);
+		}
+	else
+		{
+			ap_log_error (APLOG_MARK, APLOG_ERR, status, server_p, "Failed to create the shared memory for the replica statistics");
+			s_stats_p = NULL;
+		}
+
+	return status;
+}
+
+
+int OpenBestReplica (rcComm_t *connection_p, dataObjInp_t *open_params_p, const rodsLong_t size, const char **resource_ss, const char **replica_number_ss, apr_pool_t *pool_p)
+{
+	int status = SYS_INVALID_INPUT_PARAM;
+	bool opened_flag = false;
+	apr_array_header_t *candidates_p = GetReplicaCandidates (connection_p, open_params_p -> objPath, size, pool_p);
+
+	*resource_ss = NULL;
+	*replica_number_ss = NULL;
+
+	if (candidates_p)
+		{
+			int i;
+
+			for (i = 0; (i < candidates_p -> nelts) && (!opened_flag); ++ i)
+				{
+					ReplicaCandidate *candidate_p = & (APR_ARRAY_IDX (candidates_p, i, ReplicaCandidate));
+
+					addKeyVal (& (open_params_p -> condInput), REPL_NUM_KW, candidate_p -> rc_replica_number_s);
+					status = rcDataObjOpen (connection_p, open_params_p);
+					rmKeyVal (& (open_params_p -> condInput), REPL_NUM_KW);
+
+					if (status >= 0)
+						{
+							*resource_ss = candidate_p -> rc_resource_s;
+							*replica_number_ss = candidate_p -> rc_replica_number_s;
+							opened_flag = true;
+						}
+					else
+						{
+							ap_log_perror (APLOG_MARK, APLOG_WARNING, APR_EGENERAL, pool_p, "Failed to open replica %s of %s on %s, %s", candidate_p -> rc_replica_number_s, open_params_p -> objPath, candidate_p -> rc_resource_s, get_rods_error_msg (status));
+							RecordReplicaFailure (candidate_p -> rc_resource_s);
+						}
+				}
+		}
+
+	/* Let the server choose if none of the replicas could be opened */
+	if (!opened_flag)
+		{
+			status = rcDataObjOpen (connection_p, open_params_p);
+		}
+
+	return status;
+}
+
+
+void RecordReplicaRead (const char *resource_s, const apr_interval_time_t latency, const apr_off_t num_bytes, const apr_interval_time_t duration)
+{
+	ResourceStats *stats_p = GetResourceStats (resource_s, true);
+
+	if (stats_p)
+		{
+			const double latency_secs = ((double) latency) / APR_USEC_PER_SEC;
+
+			if (stats_p -> rs_num_reads == 0)
+				{
+					stats_p -> rs_latency = latency_secs;
+				}
+			else
+				{
+					stats_p -> rs_latency += S_EWMA_WEIGHT * (latency_secs - stats_p -> rs_latency);
+				}
+
+			if ((num_bytes >= S_MIN_THROUGHPUT_SAMPLE) && (duration > 0))
+				{
+					const double throughput = ((double) num_bytes) * APR_USEC_PER_SEC / duration;
+
+					if (stats_p -> rs_throughput == 0.0)
+						{
+							stats_p -> rs_throughput = throughput;
+						}
+					else
+						{
+							stats_p -> rs_throughput += S_EWMA_WEIGHT * (throughput - stats_p -> rs_throughput);
+						}
+				}
+
+			apr_atomic_inc32 (& (stats_p -> rs_num_reads));
+		}
+}
+
+
+void RecordReplicaFailure (const char *resource_s)
+{
+	ResourceStats *stats_p = GetResourceStats (resource_s, true);
+
+	if (stats_p)
+		{
+			apr_atomic_inc32 (& (stats_p -> rs_num_failures));
+			stats_p -> rs_last_failure = apr_time_now ();
+		}
+}
+
+
+int PrintReplicaStats (request_rec *req_p, int flags)
+{
+	if (s_stats_p)
+		{
+			const bool short_flag = (flags & AP_STATUS_SHORT) != 0;
+			int i;
+
+			if (!short_flag)
+				{
+					ap_rputs ("<hr />\n<h2>Davrods replica statistics</h2>\n", req_p);
+					ap_rputs ("<table border=\"0\">\n<tr><th>Resource</th><th>Reads</th><th>Failures</th><th>Latency (ms)</th><th>Throughput (MB/s)</th></tr>\n", req_p);
+				}
+
+			for (i = 0; i < S_MAX_RESOURCES; ++ i)
+				{
+					ResourceStats *stats_p = s_stats_p + i;
+
+					if (apr_atomic_read32 (&stats_p -> rs_state) == 2)
+						{
+							if (short_flag)
+								{
+									ap_rprintf (req_p, "DavrodsReplica%s: reads=%u failures=%u latency_ms=%.1f throughput_mbs=%.1f\n",
+										stats_p -> rs_name_s, stats_p -> rs_num_reads, stats_p -> rs_num_failures,
+										stats_p -> rs_latency * 1000.0, stats_p -> rs_throughput / (1024.0 * 1024.0));
+								}
+							else
+								{
+									ap_rprintf (req_p, "<tr><td>%s</td><td>%u</td><td>%u</td><td>%.1f</td><td>%.1f</td></tr>\n",
+										ap_escape_html (req_p -> pool, stats_p -> rs_name_s), stats_p -> rs_num_reads, stats_p -> rs_num_failures,
+										stats_p -> rs_latency * 1000.0, stats_p -> rs_throughput / (1024.0 * 1024.0));
+								}
+						}
+				}
+
+			if (!short_flag)
+				{
+					ap_rputs ("</table>\n", req_p);
+				}
+		}
+
+	return OK;
+}
+
+
+const char *SetReplicaRouting (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	if (strcasecmp (arg_p, "true") == 0)
+		{
+			conf_p -> replica_routing = 1;
+		}
+	else if (strcasecmp (arg_p, "false") == 0)
+		{
+			conf_p -> replica_routing = -1;
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Find the statistics for a resource, optionally claiming a free slot
+ * for it if it doesn't have one yet.
+ */
+static ResourceStats *GetResourceStats (const char *resource_s, const bool create_flag)
+{
+	ResourceStats *stats_p = NULL;
+
+	if (s_stats_p && resource_s && (strlen (resource_s) < NAME_LEN))
+		{
+			int i;
+
+			for (i = 0; (i < S_MAX_RESOURCES) && (!stats_p); ++ i)
+				{
+					ResourceStats *slot_p = s_stats_p + i;
+
+					if ((apr_atomic_read32 (&slot_p -> rs_state) == 2) && (strcmp (slot_p -> rs_name_s, resource_s) == 0))
+						{
+							stats_p = slot_p;
+						}
+				}
+
+			if (!stats_p && create_flag)
+				{
+					for (i = 0; (i < S_MAX_RESOURCES) && (!stats_p); ++ i)
+						{
+							ResourceStats *slot_p = s_stats_p + i;
+
+							if (apr_atomic_cas32 (&slot_p -> rs_state, 1, 0) == 0)
+								{
+									strcpy (slot_p -> rs_name_s, resource_s);
+									apr_atomic_set32 (&slot_p -> rs_state, 2);
+									stats_p = slot_p;
+								}
+						}
+				}
+		}
+
+	return stats_p;
+}
+
+
+/*
+ * Get the good replicas of a data object sorted so that the one which
+ * should be quickest to read comes first.
+ */
+static apr_array_header_t *GetReplicaCandidates (rcComm_t *connection_p, const char *rods_path_s, const rodsLong_t size, apr_pool_t *pool_p)
+{
+	apr_array_header_t *candidates_p = NULL;
+	const char *slash_s = strrchr (rods_path_s, '/');
+
+	if (slash_s && (strchr (rods_path_s, '\'') == NULL))
+		{
+			const char *collection_s = (slash_s == rods_path_s) ? "/" : apr_pstrndup (pool_p, rods_path_s, slash_s - rods_path_s);
+			genQueryInp_t query;
+			genQueryOut_t *results_p = NULL;
+			int status;
+
+			memset (&query, 0, sizeof (genQueryInp_t));
+			query.maxRows = MAX_SQL_ROWS;
+
+			if (((status = addInxIval (& (query.selectInp), COL_DATA_REPL_NUM, 1)) == 0) &&
+					((status = addInxIval (& (query.selectInp), COL_D_RESC_NAME, 1)) == 0) &&
+					((status = addInxVal (& (query.sqlCondInp), COL_COLL_NAME, apr_pstrcat (pool_p, "= '", collection_s, "'", NULL))) == 0) &&
+					((status = addInxVal (& (query.sqlCondInp), COL_DATA_NAME, apr_pstrcat (pool_p, "= '", slash_s + 1, "'", NULL))) == 0) &&
+					((status = addInxVal (& (query.sqlCondInp), COL_D_REPL_STATUS, "= '1'")) == 0))
+				{
+					status = rcGenQuery (connection_p, &query, &results_p);
+
+					if (status == 0)
+						{
+							const apr_time_t now = apr_time_now ();
+							int i;
+
+							candidates_p = apr_array_make (pool_p, results_p -> rowCnt, sizeof (ReplicaCandidate));
+
+							for (i = 0; i < results_p -> rowCnt; ++ i)
+								{
+									const char *replica_number_s = GetGenQueryResultValue (results_p, COL_DATA_REPL_NUM, i);
+									const char *resource_s = GetGenQueryResultValue (results_p, COL_D_RESC_NAME, i);
+
+									if (replica_number_s && resource_s)
+										{
+											ReplicaCandidate *candidate_p = (ReplicaCandidate *) apr_array_push (candidates_p);
+
+											candidate_p -> rc_replica_number_s = apr_pstrdup (pool_p, replica_number_s);
+											candidate_p -> rc_resource_s = apr_pstrdup (pool_p, resource_s);
+											candidate_p -> rc_expected_time = GetExpectedReadTime (resource_s, size, now);
+										}
+								}
+
+							qsort (candidates_p -> elts, candidates_p -> nelts, sizeof (ReplicaCandidate), CompareReplicaCandidates);
+						}
+					else if (status != CAT_NO_ROWS_FOUND)
+						{
+							ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get the replicas of %s, %s", rods_path_s, get_rods_error_msg (status));
+						}
+
+					freeGenQueryOut (&results_p);
+				}
+
+			clearGenQueryInp (&query);
+		}
+
+	return candidates_p;
+}
+
+
+/*
+ * Resources that haven't been read from yet are given an expected time
+ * of 0 so that they get tried and measured.
+ */
+static double GetExpectedReadTime (const char *resource_s, const rodsLong_t size, const apr_time_t now)
+{
+	double expected_time = 0.0;
+	const ResourceStats *stats_p = GetResourceStats (resource_s, false);
+
+	if (stats_p)
+		{
+			if (stats_p -> rs_num_reads > 0)
+				{
+					expected_time = stats_p -> rs_latency;
+
+					if (stats_p -> rs_throughput > 0.0)
+						{
+							expected_time += ((double) size) / stats_p -> rs_throughput;
+						}
+				}
+
+			if ((stats_p -> rs_num_failures > 0) && (now - stats_p -> rs_last_failure < apr_time_from_sec (S_FAILURE_BACKOFF)))
+				{
+					expected_time += S_FAILURE_PENALTY;
+				}
+		}
+
+	return expected_time;
+}
+
+
+static int CompareReplicaCandidates (const void *v0_p, const void *v1_p)
+{
+	const ReplicaCandidate *c0_p = (const ReplicaCandidate *) v0_p;
+	const ReplicaCandidate *c1_p = (const ReplicaCandidate *) v1_p;
+	int res = 0;
+
+	if (c0_p -> rc_expected_time < c1_p -> rc_expected_time)
+		{
+			res = -1;
+		}
+	else if (c0_p -> rc_expected_time > c1_p -> rc_expected_time)
+		{
+			res = 1;
+		}
+
+	return res;
+}
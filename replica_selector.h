@@ -0,0 +1,113 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * replica_selector.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef REPLICA_SELECTOR_H_
+#define REPLICA_SELECTOR_H_
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "apr_pools.h"
+#include "apr_time.h"
+
+#include <irods/rodsClient.h>
+
+#include "config.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create the shared memory that holds the read statistics for each
+ * resource. This is called from the post_config hook so that every child
+ * process shares the same statistics.
+ *
+ * @param pool_p The configuration pool.
+ * @param server_p The server.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t InitReplicaStats (apr_pool_t *pool_p, server_rec *server_p);
+
+
+/**
+ * Open a data object for reading from the replica that is expected to
+ * be the quickest to read from this host. If opening the chosen replica
+ * fails, the next best one is tried and finally the iRODS server is left
+ * to choose one.
+ *
+ * @param connection_p The connection to the iRODS server.
+ * @param open_params_p The parameters to open the data object with.
+ * @param size The size of the data object in bytes.
+ * @param resource_ss If a particular replica was opened, this will be set
+ * to the name of its resource.
+ * @param replica_number_ss If a particular replica was opened, this will be
+ * set to its replica number so that the same one can be opened again.
+ * @param pool_p The pool to use for any allocations.
+ * @return The iRODS file descriptor upon success or a negative iRODS error
+ * code upon failure.
+ */
+int OpenBestReplica (rcComm_t *connection_p, dataObjInp_t *open_params_p, const rodsLong_t size, const char **resource_ss, const char **replica_number_ss, apr_pool_t *pool_p);
+
+
+/**
+ * Record how long a read from a resource took.
+ *
+ * @param resource_s The name of the resource.
+ * @param latency The time taken to open the data object and get its
+ * first block of data.
+ * @param num_bytes The number of bytes that were read.
+ * @param duration The total time taken by the read.
+ */
+void RecordReplicaRead (const char *resource_s, const apr_interval_time_t latency, const apr_off_t num_bytes, const apr_interval_time_t duration);
+
+
+/**
+ * Record that opening or reading a replica on a resource failed.
+ *
+ * @param resource_s The name of the resource.
+ */
+void RecordReplicaFailure (const char *resource_s);
+
+
+/**
+ * Print the read statistics for each resource as part of the mod_status
+ * server-status page.
+ *
+ * @param req_p The request for the status page.
+ * @param flags The mod_status flags.
+ * @return OK.
+ */
+int PrintReplicaStats (request_rec *req_p, int flags);
+
+
+const char *SetReplicaRouting (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REPLICA_SELECTOR_H_ */
@@ -30,6 +30,13 @@
 #include "debug.h"
 
 #include "frictionless_data_package.h"
+#include "negative_cache.h"
+#include "vault_read.h"
+#include "replica_selector.h"
+#include "write_placement.h"
+#include "upload_checksum.h"
+#include "resumable_upload.h"
+#include "archive_download.h"
 
 /************************************/
 
@@ -54,6 +61,9 @@ static dav_error *SetRodsPathFromResourceAndURI (dav_resource *resource, const c
 
 
 static dav_error *DeliverFile (const dav_resource *resource_p, ap_filter_t *output_p);
+
+static dav_error *DeliverFileFromIRods (const dav_resource *resource_p, ap_filter_t *output_p);
+static int ReopenDataObject (const dav_resource *resource_p, rcComm_t **connection_pp, const char *filename_s, const char *replica_number_s, const rodsLong_t offset);
 static void LogFilters (const ap_filter_t *filter_p, request_rec *req_p);
 static void LogConnection (const rcComm_t * const connection_p, request_rec *req_p);
 
@@ -155,6 +165,21 @@ struct dav_stream
 	char *container;
 	size_t container_size;
 	size_t container_off;
+
+	// The checksums calculated over the body as it is written, or NULL.
+	UploadChecksum *checksum;
+
+	// The session if this is a chunk of a resumable upload, or NULL.
+	ResumableUpload *upload;
+
+	// The number of bytes that have been written to iRODS.
+	apr_off_t written;
+
+	// Whether the body is being kept in small_buffer to send in a single put.
+	bool small_put;
+	char *small_buffer;
+	size_t small_size;
+	size_t small_off;
 };
 
 
@@ -308,6 +333,21 @@ static dav_error *get_dav_resource_rods_info (dav_resource *resource)
 	if (err)
 		return err;
 
+	const char *username_s = res_private->rods_conn->clientUser.userName;
+
+	// Client probes for names such as .DS_Store can be answered without asking iRODS.
+	if (IsDeniedName (res_private->conf, res_private->rods_path)
+			|| IsKnownAbsent (res_private->conf, username_s, res_private->rods_path))
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
+					"Object <%s> is denied or known not to exist", res_private->rods_path);
+
+			resource->exists = 0;
+
+			return dav_new_error (resource->pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+					0, "File does not exist");
+		}
+
 	dataObjInp_t obj_in = { { 0 } };
 	rodsObjStat_t *stat_out = NULL;
 
@@ -316,6 +356,8 @@ static dav_error *get_dav_resource_rods_info (dav_resource *resource)
 
 	if (status < 0)
 		{
+			CheckIRodsStatus (r, status);
+
 			ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_EEXIST, r,
 					"Could not stat object <%s>: %s", res_private->rods_path,
 					get_rods_error_msg (status));
@@ -324,6 +366,8 @@ static dav_error *get_dav_resource_rods_info (dav_resource *resource)
 				{
 					resource->exists = 0;
 
+					AddKnownAbsent (res_private->conf, username_s, res_private->rods_path);
+
 					return dav_new_error (resource->pool, HTTP_INTERNAL_SERVER_ERROR, 0,
 							0, "File does not exist");
 				}
@@ -481,6 +525,29 @@ static dav_error *dav_repo_get_resource (request_rec *r, const char *root_dir,
 		{
 			err_p = get_dav_resource_rods_info (resource_p);
 
+			/*
+			 * A stat is safe to repeat, so if the cached connection has been
+			 * lost, e.g. by a server restart, log in again and try once more.
+			 */
+			if (err_p && IsIRodsConnectionBroken (r))
+				{
+					rcComm_t *connection_p = ReconnectIRodsConnection (r);
+
+					if (connection_p)
+						{
+							struct dav_resource_private *priv_p = resource_p -> info;
+
+							priv_p -> rods_conn = connection_p;
+							priv_p -> rods_env = GetRodsEnvFromPool (priv_p -> davrods_pool);
+							priv_p -> rods_root = GetRodsExposedPath (r);
+
+							if (priv_p -> rods_env && priv_p -> rods_root)
+								{
+									err_p = get_dav_resource_rods_info (resource_p);
+								}
+						}
+				}
+
 			/*
 			 * If it is a fd request and the file does not exist
 			 * we would get an error, so let's check for that
@@ -640,6 +707,186 @@ static int dav_repo_is_parent_resource (const dav_resource *parent,
 			&& path_child [pathlen_parent] == '/';
 }
 
+/**
+ * \brief Create the data object for a write stream on the resource set in its open_params.
+ *
+ * For small puts the whole body is sent along with the request, so that
+ * iRODS creates, writes and closes the data object in one round trip.
+ */
+static int stream_rods_create (dav_stream *stream)
+{
+	rcComm_t *rods_conn = stream->resource->info->rods_conn;
+
+	if (stream->small_put)
+		{
+			bytesBuf_t put_buffer = { (int) stream->small_off, stream->small_buffer };
+			portalOprOut_t *portal_out = NULL;
+
+			stream->open_params.dataSize = stream->small_off;
+			addKeyVal (&stream->open_params.condInput, DATA_INCLUDED_KW, "");
+
+			int status = _rcDataObjPut (rods_conn, &stream->open_params, &put_buffer,
+					&portal_out);
+
+			if (portal_out)
+				free (portal_out);
+
+			return status;
+		}
+	else
+		{
+			return rcDataObjCreate (rods_conn, &stream->open_params);
+		}
+}
+
+/**
+ * \brief Create the data object that a write stream writes to.
+ *
+ * If DavRodsWriteResources is set, its resources are tried in the order
+ * chosen by the write placement policy until the data object is created
+ * on one of them or the error isn't down to the resource.
+ */
+static int stream_create_data_object (dav_stream *stream)
+{
+	const dav_resource *resource = stream->resource;
+	dataObjInp_t *open_params = &stream->open_params;
+	apr_array_header_t *write_resources = GetWriteResources (
+			resource->info->conf, resource->info->rods_conn, stream->pool);
+
+	if (!write_resources)
+		return stream_rods_create (stream);
+
+	// The expected size of the upload, if known, for the least-in-flight policy.
+	const char *length_s = apr_table_get (resource->info->r->headers_in,
+			"Content-Length");
+	apr_off_t length = length_s ? apr_atoi64 (length_s) : 0;
+	int status = SYS_INVALID_INPUT_PARAM;
+
+	bool try_next = true;
+
+	for (int i = 0; i < write_resources->nelts && try_next; i ++)
+		{
+			const char *resc_name = APR_ARRAY_IDX (write_resources, i, const char *);
+
+			rmKeyVal (&open_params->condInput, DEST_RESC_NAME_KW);
+			addKeyVal (&open_params->condInput, DEST_RESC_NAME_KW, resc_name);
+
+			if ((status = stream_rods_create (stream)) >= 0)
+				{
+					AddInFlightUpload (resc_name, length, stream->pool);
+					try_next = false;
+				}
+			else
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, resource->info->r,
+							"Creating <%s> failed on resource %s: %d = %s",
+							open_params->objPath, resc_name, status, get_rods_error_msg (status));
+
+					// Only another resource can help if this one was the problem.
+					try_next = IsWriteResourceError (status);
+				}
+		}
+
+	return status;
+}
+
+/**
+ * \brief Open the temporary data object of a resumable upload, creating it for the first chunk.
+ */
+static dav_error *stream_open_upload_object (dav_stream *stream)
+{
+	const dav_resource *resource = stream->resource;
+	dataObjInp_t *open_params = &stream->open_params;
+	dav_error *err = NULL;
+	int status;
+
+	// Chunks of the same upload can arrive at the same time, so only the
+	// one that gets the session lock first creates the object and the
+	// others wait for it before opening it.
+	if (LockResumableUpload (stream->upload, resource->info->rods_conn)
+			!= APR_SUCCESS)
+		{
+			return dav_new_error (resource->pool, HTTP_INTERNAL_SERVER_ERROR, 0, 0,
+					"Could not lock the upload session");
+		}
+
+	if (HasResumableUploadStarted (stream->upload))
+		{
+			open_params->openFlags = O_WRONLY | O_CREAT;
+
+			if ((status = rcDataObjOpen (resource->info->rods_conn, open_params)) >= 0)
+				{
+					stream->data_obj.l1descInx = status;
+				}
+			else
+				{
+					// The temporary object has gone, so the client has to start again.
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, resource->info->r,
+							"rcDataObjOpen failed for resumable upload <%s>: %d = %s",
+							open_params->objPath, status, get_rods_error_msg (status));
+					DeleteResumableUpload (stream->upload);
+					err = dav_new_error (resource->pool, HTTP_CONFLICT, 0, 0,
+							"The upload session has expired, please start the upload again");
+				}
+		}
+	else
+		{
+			// Replace anything left over from a session that was lost.
+			addKeyVal (&open_params->condInput, FORCE_FLAG_KW, "");
+
+			if ((status = stream_create_data_object (stream)) >= 0)
+				{
+					stream->data_obj.l1descInx = status;
+
+					if (MarkResumableUploadStarted (stream->upload) != APR_SUCCESS)
+						{
+							// Without the mark, the next chunk would create the object again.
+							openedDataObjInp_t close_params = { 0 };
+							close_params.l1descInx = status;
+							rcDataObjClose (resource->info->rods_conn, &close_params);
+							err = dav_new_error (resource->pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+									0, "Could not record the start of the upload");
+						}
+				}
+			else
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, resource->info->r,
+							"rcDataObjCreate failed for <%s>: %d = %s", open_params->objPath,
+							status, get_rods_error_msg (status));
+					err = dav_new_error (resource->pool, HTTP_INTERNAL_SERVER_ERROR, 0, 0,
+							"Could not create destination resource");
+				}
+		}
+
+	UnlockResumableUpload (stream->upload);
+
+	return err;
+}
+
+/**
+ * \brief Check whether an upload is small enough to keep in memory and send in a single put.
+ */
+static void stream_check_small_put (dav_stream *stream)
+{
+	const dav_resource *resource = stream->resource;
+	size_t max_size = resource->info->conf->rods_small_put_size;
+	const char *length_s = apr_table_get (resource->info->r->headers_in,
+			"Content-Length");
+
+	if (max_size > 0 && length_s)
+		{
+			apr_off_t length = apr_atoi64 (length_s);
+
+			if (length >= 0 && (apr_uint64_t) length <= max_size)
+				{
+					stream->small_size = (size_t) length;
+					stream->small_off = 0;
+					stream->small_buffer = apr_palloc (stream->pool, stream->small_size + 1);
+					stream->small_put = (stream->small_buffer != NULL);
+				}
+		}
+}
+
 static dav_error *dav_repo_open_stream (const dav_resource *resource,
 		dav_stream_mode mode, dav_stream **result_stream)
 {
@@ -651,11 +898,36 @@ static dav_error *dav_repo_open_stream (const dav_resource *resource,
 			stream->pool = resource->pool;
 			stream->resource = resource;
 
-			if (mode == DAV_MODE_WRITE_SEEKABLE
+			if (mode == DAV_MODE_WRITE_SEEKABLE)
+				stream->upload = GetResumableUpload (resource, stream->pool);
+			else if (mode == DAV_MODE_WRITE_TRUNC)
+				stream_check_small_put (stream);
+
+			if (stream->upload)
+				{
+					// Chunks of a resumable upload are written into a temporary object
+					// that is kept between requests until all of them have arrived.
+					stream->write_path = apr_pstrdup (stream->pool,
+							GetResumableUploadObjectPath (stream->upload));
+				}
+			else if (stream->small_put && !resource->exists)
+				{
+					// The single put either creates the whole data object or nothing
+					// at all, so there's no need for a temporary file.
+					stream->write_path = apr_pstrdup (stream->pool,
+							resource->info->rods_path);
+				}
+			else if (mode == DAV_MODE_WRITE_SEEKABLE
 					|| (mode == DAV_MODE_WRITE_TRUNC
 							&& resource->info->conf->tmpfile_rollback
-									== DAVRODS_TMPFILE_ROLLBACK_NO))
+									== DAVRODS_TMPFILE_ROLLBACK_NO
+							&& !(resource->exists && !stream->small_put
+									&& HasUploadChecksumHeader (resource->info->r))))
 				{
+					// An existing data object that is overwritten with a checksum to
+					// verify goes through a tmpfile, so that a mismatch doesn't leave
+					// a corrupt copy in its place. Small puts are verified before
+					// anything is sent.
 					// Either way, do not use tmpfiles for rollback support.
 					stream->write_path = apr_pstrdup (stream->pool,
 							resource->info->rods_path);
@@ -667,7 +939,7 @@ static dav_error *dav_repo_open_stream (const dav_resource *resource,
 
 					// Think up a semi-random filename that's unlikely to exist in this directory.
 					int cheapsum = 0;
-					for (const char *c = resource->uri; c; c ++)
+					for (const char *c = resource->uri; *c; c ++)
 						cheapsum += 1 << *c;
 
 					// Get the path to the parent directory.
@@ -725,7 +997,25 @@ static dav_error *dav_repo_open_stream (const dav_resource *resource,
 					WHISPER("Opening write stream to <%s> for resource <%s>\n", stream->write_path, resource->uri);
 					open_params->oprType = PUT_OPR;
 
-					if (strcmp (stream->write_path, resource->info->rods_path) == 0
+					if (stream->upload)
+						{
+							dav_error *upload_err = stream_open_upload_object (stream);
+
+							if (upload_err)
+								return upload_err;
+						}
+					else if (stream->small_put)
+						{
+							// The data object is created when the stream is closed.
+							WHISPER("Will send <%s> in a single put\n", stream->write_path);
+
+							if (strcmp (stream->write_path, resource->info->rods_path) == 0
+									&& resource->exists)
+								{
+									addKeyVal (&open_params->condInput, FORCE_FLAG_KW, "");
+								}
+						}
+					else if (strcmp (stream->write_path, resource->info->rods_path) == 0
 							&& resource->exists)
 						{
 
@@ -765,11 +1055,12 @@ static dav_error *dav_repo_open_stream (const dav_resource *resource,
 
 							int status;
 
-							if ((status = rcDataObjCreate (resource->info->rods_conn, open_params))
-									>= 0)
+							if ((status = stream_create_data_object (stream)) >= 0)
 								{
 									openedDataObjInp_t *data_obj = &stream->data_obj;
 									data_obj->l1descInx = status;
+
+									ForgetKnownAbsent (resource->info->conf, resource->info->rods_path);
 								}
 							else
 								{
@@ -785,6 +1076,9 @@ static dav_error *dav_repo_open_stream (const dav_resource *resource,
 							"Will write using %luK chunks",
 							resource->info->conf->rods_tx_buffer_size / 1024);
 
+					stream->checksum = StartUploadChecksum (resource->info->r,
+							resource->info->conf, stream->pool);
+
 					*result_stream = stream;
 
 				}		/* if (stream -> write_path) */
@@ -835,7 +1129,11 @@ static dav_error *stream_send_buffer (dav_stream *stream, const char *buffer,
 					&stream->data_obj, &stream->output_buffer);
 			free (stream->output_buffer.buf);
 
-			if (written < 0)
+			if (written >= 0)
+				{
+					stream->written += written;
+				}
+			else
 				{
 					ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS,
 							stream->resource->info->r, "rcDataObjWrite failed: %d = %s", written,
@@ -873,6 +1171,25 @@ static dav_error *dav_repo_write_stream (dav_stream *stream,
 {
 	dav_error *err;
 
+	if (stream->checksum)
+		UpdateUploadChecksum (stream->checksum, input_buffer, input_buffer_size);
+
+	if (stream->small_put)
+		{
+			// Small bodies are kept in memory until they are sent in a single put.
+			if (input_buffer_size > stream->small_size - stream->small_off)
+				{
+					return dav_new_error (stream->pool, HTTP_BAD_REQUEST, 0, 0,
+							"The request body is longer than its Content-Length");
+				}
+
+			memcpy (stream->small_buffer + stream->small_off, input_buffer,
+					input_buffer_size);
+			stream->small_off += input_buffer_size;
+
+			return NULL;
+		}
+
 	// Initial testing shows that on average input buffers are around 2K in
 	// size. Transferring them each to iRODS as is is incredibly inefficient.
 	// That's why we collect input buffers into "containers". This way, we can
@@ -940,20 +1257,87 @@ static dav_error *dav_repo_close_stream (dav_stream *stream, int commit)
 
 	WHISPER("Closing stream for resource <%s> / object <%s>.\n", resource->uri, stream->write_path);
 
-	openedDataObjInp_t close_params = { 0 };
-	close_params.l1descInx = stream->data_obj.l1descInx;
+	dav_error *checksum_err = NULL;
+	int status;
 
-	int status = rcDataObjClose (resource->info->rods_conn, &close_params);
-	if (status < 0)
+	if (stream->small_put)
 		{
-			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, resource->info->r,
-					"rcDataObjClose failed: %d = %s", status,
-					get_rods_error_msg (status));
-			// (in the case where temp file rollback is enabled)
-			// XXX: This may leave a temporary file '.davrods-*', is this okay?
-			// XXX: Should we attempt to unlink the uploaded file here?
-			return dav_new_error (resource->pool, HTTP_INTERNAL_SERVER_ERROR, 0, 0,
-					"Could not close the uploaded resource");
+			// Nothing has been sent to iRODS yet, so there is nothing to roll back.
+			if (!commit)
+				return NULL;
+
+			// Check the body before sending it so that a corrupt upload never
+			// reaches iRODS.
+			if (stream->checksum)
+				{
+					checksum_err = VerifyUploadChecksum (stream->checksum, resource->pool);
+
+					if (checksum_err)
+						return checksum_err;
+				}
+
+			if ((status = stream_create_data_object (stream)) < 0)
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, resource->info->r,
+							"Single put failed for <%s>: %d = %s", stream->write_path,
+							status, get_rods_error_msg (status));
+					return dav_new_error (resource->pool, HTTP_INTERNAL_SERVER_ERROR, 0, 0,
+							"Could not store the uploaded resource");
+				}
+
+			ForgetKnownAbsent (resource->info->conf, resource->info->rods_path);
+		}
+	else
+		{
+			openedDataObjInp_t close_params = { 0 };
+			close_params.l1descInx = stream->data_obj.l1descInx;
+
+			status = rcDataObjClose (resource->info->rods_conn, &close_params);
+			if (status < 0)
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, resource->info->r,
+							"rcDataObjClose failed: %d = %s", status,
+							get_rods_error_msg (status));
+					// (in the case where temp file rollback is enabled)
+					// XXX: This may leave a temporary file '.davrods-*', is this okay?
+					// XXX: Should we attempt to unlink the uploaded file here?
+					return dav_new_error (resource->pool, HTTP_INTERNAL_SERVER_ERROR, 0, 0,
+							"Could not close the uploaded resource");
+				}
+
+			// If the body doesn't match the checksums that the client sent, throw
+			// the upload away rather than committing it.
+			if (commit && stream->checksum)
+				{
+					checksum_err = VerifyUploadChecksum (stream->checksum, resource->pool);
+
+					if (checksum_err)
+						commit = 0;
+				}
+		}
+
+	if (stream->upload)
+		{
+			// Keep whatever reached iRODS, even if the request was interrupted, so
+			// that the client can carry on from there. A chunk that failed its
+			// checksum has to be sent again.
+			bool complete_flag = false;
+
+			if (!checksum_err)
+				{
+					if (EndResumableUploadChunk (stream->upload, stream->written,
+							&complete_flag) != APR_SUCCESS)
+						{
+							return dav_new_error (resource->pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+									0, "Could not record the progress of the upload");
+						}
+				}
+
+			if (!complete_flag)
+				return checksum_err;
+
+			// All of the data object has arrived, so move it into place.
+			commit = 1;
 		}
 
 	if (commit)
@@ -1022,11 +1406,33 @@ static dav_error *dav_repo_close_stream (dav_stream *stream, int commit)
 											"Something went wrong while renaming the uploaded resource");
 								}
 						}
+
+					if (stream->upload)
+						DeleteResumableUpload (stream->upload);
 				}
 			else
 				{
 					// We were already writing to the destination object, so we're done here.
 				}
+
+			// Register the checksum calculated during the upload, as long as we
+			// created the data object and so know that we wrote its only replica.
+			if (stream->checksum
+					&& (strcmp (stream->write_path, resource->info->rods_path)
+							|| !resource->exists))
+				{
+					status = RegisterUploadChecksum (stream->checksum,
+							resource->info->rods_conn, resource->info->rods_path);
+
+					if (status < 0)
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS,
+									resource->info->r,
+									"Registering the checksum of <%s> failed: %d = %s",
+									resource->info->rods_path, status,
+									get_rods_error_msg (status));
+						}
+				}
 		}
 	else
 		{
@@ -1089,7 +1495,7 @@ static dav_error *dav_repo_close_stream (dav_stream *stream, int commit)
 				}
 		}
 
-	return NULL;
+	return checksum_err;
 }
 
 static dav_error *dav_repo_seek_stream (dav_stream *stream, apr_off_t abs_pos)
@@ -1099,6 +1505,11 @@ static dav_error *dav_repo_seek_stream (dav_stream *stream, apr_off_t abs_pos)
 	seek_inp.offset = abs_pos;
 	seek_inp.whence = SEEK_SET;
 
+	// The body no longer covers the whole data object, so its checksum
+	// is only good for checking against the client's one.
+	if (stream->checksum)
+		SkipUploadChecksumRegistration (stream->checksum);
+
 	fileLseekOut_t *seek_out = NULL;
 	int status = rcDataObjLseek (stream->resource->info->rods_conn, &seek_inp,
 			&seek_out);
@@ -1127,6 +1538,12 @@ static dav_error *dav_repo_set_headers (request_rec *r, const dav_resource *reso
 
 	if (resource->collection)
 		{
+			if (IsArchiveDownloadRequest (r, resource->info->conf))
+				{
+					SetArchiveDownloadHeaders (resource);
+					return 0;
+				}
+
 			// A GET on a collection => client must be a web browser / standard HTTP client.
 			// We will output an HTML directory listing.
 			ap_set_content_type (r, "text/html; charset=utf-8");
@@ -1166,120 +1583,6 @@ static dav_error *dav_repo_set_headers (request_rec *r, const dav_resource *reso
 	return 0;
 }
 
-static dav_error *deliver_file (const dav_resource *resource,
-		ap_filter_t *output)
-{
-	// Download a file from iRODS to the WebDAV client.
-
-	apr_pool_t *pool = resource->pool;
-	apr_bucket_brigade *bb;
-	apr_bucket *bkt;
-
-	bb = apr_brigade_create (pool, output->c->bucket_alloc);
-
-	dataObjInp_t open_params = { { 0 } };
-
-	open_params.openFlags = O_RDONLY;
-	strcpy (open_params.objPath, resource->info->rods_path);
-
-	int status;
-
-	if ((status = rcDataObjOpen (resource->info->rods_conn, &open_params)) < 0)
-		{
-			apr_brigade_destroy (bb);
-
-			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, resource->info->r,
-					"rcDataObjOpen failed: %d = %s", status, get_rods_error_msg (status));
-
-			// Note: This might be a CONFLICT situation where the file was deleted
-			//       in a separate concurrent request.
-
-			return dav_new_error (pool, HTTP_INTERNAL_SERVER_ERROR, 0, 0,
-					"Could not open requested resource for reading");
-		}
-	else
-		{
-			// `status` contains some sort of file descriptor.
-			openedDataObjInp_t data_obj = { .l1descInx = status };
-
-			bytesBuf_t read_buffer = { 0 };
-
-			size_t buffer_size = resource->info->conf->rods_rx_buffer_size;
-			data_obj.len = buffer_size;
-
-			int bytes_read = 0;
-
-			ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, resource->info->r,
-					"Reading data object in %luK chunks", buffer_size / 1024);
-
-			// Read from iRODS, write to the client.
-			do
-				{
-					bytes_read = rcDataObjRead (resource->info->rods_conn, &data_obj,
-							&read_buffer);
-
-					if (bytes_read < 0)
-						{
-							if (read_buffer.buf)
-								free (read_buffer.buf);
-							apr_brigade_destroy (bb);
-
-							ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS,
-									resource->info->r, "rcDataObjRead failed: %d = %s",
-									bytes_read, get_rods_error_msg (bytes_read));
-							return dav_new_error (pool, HTTP_INTERNAL_SERVER_ERROR, 0, 0,
-									"Could not read from requested resource");
-						}
-					apr_brigade_write (bb, NULL, NULL, read_buffer.buf, bytes_read);
-
-					free (read_buffer.buf);
-					read_buffer.buf = NULL;
-
-					if ((status = ap_pass_brigade (output, bb)) != APR_SUCCESS)
-						{
-							apr_brigade_destroy (bb);
-							return dav_new_error (pool, HTTP_INTERNAL_SERVER_ERROR, 0, status,
-									"Could not write contents to filter.");
-						}
-				}
-			while ((size_t) bytes_read == buffer_size);
-
-			openedDataObjInp_t close_params = { 0 };
-			close_params.l1descInx = data_obj.l1descInx;
-
-			status = rcDataObjClose (resource->info->rods_conn, &close_params);
-			if (status < 0)
-				{
-					ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS,
-							resource->info->r,
-							"rcDataObjClose failed: %d = %s (proceeding as if nothing happened)",
-							status, get_rods_error_msg (status));
-					// We already gave the entire file to the client, it makes no sense to send them an error here.
-
-					//return dav_new_error(
-					//    pool, HTTP_INTERNAL_SERVER_ERROR, 0, status,
-					//    "Could not close requested data object"
-					//);
-				}
-
-		}
-
-	bkt = apr_bucket_eos_create (output->c->bucket_alloc);
-
-	APR_BRIGADE_INSERT_TAIL(bb, bkt);
-
-	if ((status = ap_pass_brigade (output, bb)) != APR_SUCCESS)
-		{
-			apr_brigade_destroy (bb);
-			return dav_new_error (pool, HTTP_INTERNAL_SERVER_ERROR, 0, status,
-					"Could not write contents to filter.");
-		}
-	apr_brigade_destroy (bb);
-
-	return NULL;
-}
-
-
 static void LogFilters (const ap_filter_t *filter_p, request_rec *req_p)
 {
 	size_t index = 0;
@@ -1301,6 +1604,20 @@ static void LogConnection (const rcComm_t * const connection_p, request_rec *req
 
 
 static dav_error *DeliverFile (const dav_resource *resource_p, ap_filter_t *output_p)
+{
+	dav_error *error_p = NULL;
+
+	/* A replica in a vault on this host can be sent without going through the iRODS agent */
+	if (! ((resource_p -> info -> conf -> direct_vault_reads > 0) && DeliverFileFromVault (resource_p, output_p, &error_p)))
+		{
+			error_p = DeliverFileFromIRods (resource_p, output_p);
+		}
+
+	return error_p;
+}
+
+
+static dav_error *DeliverFileFromIRods (const dav_resource *resource_p, ap_filter_t *output_p)
 {
 	dav_error *error_p = NULL;
 	apr_pool_t *pool_p = resource_p -> pool;
@@ -1313,12 +1630,36 @@ static dav_error *DeliverFile (const dav_resource *resource_p, ap_filter_t *outp
 	apr_status_t error_status = APR_EGENERAL;
 	const char * const filename_s = resource_p -> info -> rods_path;
 
+	/* If replica routing is on, these are for the replica that is being read from. */
+	const char *replica_resource_s = NULL;
+	const char *replica_number_s = NULL;
+	const apr_time_t start_time = apr_time_now ();
+
+	bool reconnected_flag = false;
+
 	memset (&open_params, 0, sizeof (dataObjInp_t));
 
 	open_params.openFlags = O_RDONLY;
 	strcpy (open_params.objPath, filename_s);
 
-	if ((irods_status = rcDataObjOpen (connection_p, &open_params)) >= 0)
+	if (resource_p -> info -> conf -> replica_routing > 0)
+		{
+			irods_status = OpenBestReplica (connection_p, &open_params, resource_p -> info -> stat -> objSize, &replica_resource_s, &replica_number_s, pool_p);
+		}
+	else
+		{
+			irods_status = rcDataObjOpen (connection_p, &open_params);
+		}
+
+	if (IsIRodsConnectionError (irods_status))
+		{
+			CheckIRodsStatus (req_p, irods_status);
+
+			irods_status = ReopenDataObject (resource_p, &connection_p, filename_s, replica_number_s, 0);
+			reconnected_flag = true;
+		}
+
+	if (irods_status >= 0)
 		{
 			openedDataObjInp_t close_params;
 			openedDataObjInp_t data_obj;
@@ -1337,6 +1678,10 @@ static dav_error *DeliverFile (const dav_resource *resource_p, ap_filter_t *outp
 					const size_t buffer_size = resource_p -> info -> conf -> rods_rx_buffer_size;
 					int current_bytes_read = 0;
 					size_t total_bytes_read = 0;
+					apr_interval_time_t latency = -1;
+
+					/* Only time the reads from iRODS, not the writes to a possibly slow client. */
+					apr_interval_time_t read_time = apr_time_now () - start_time;
 
 					memset (&read_buffer, 0, sizeof (bytesBuf_t));
 
@@ -1349,8 +1694,17 @@ static dav_error *DeliverFile (const dav_resource *resource_p, ap_filter_t *outp
 					// Read from iRODS, write to the client.
 					do
 						{
+							apr_time_t read_start_time = apr_time_now ();
+
 							current_bytes_read = rcDataObjRead (connection_p, &data_obj, &read_buffer);
 
+							read_time += apr_time_now () - read_start_time;
+
+							if (latency < 0)
+								{
+									latency = read_time;
+								}
+
 							if (current_bytes_read > 0)
 								{
 									if ((apr_status = apr_brigade_write (bb_p, NULL, NULL, read_buffer.buf, current_bytes_read)) == APR_SUCCESS)
@@ -1381,10 +1735,50 @@ static dav_error *DeliverFile (const dav_resource *resource_p, ap_filter_t *outp
 											error_status = apr_status;
 										}
 								}
+							else if ((current_bytes_read < 0) && IsIRodsConnectionError (current_bytes_read) && !reconnected_flag)
+								{
+									/*
+									 * The data before total_bytes_read has already been sent, so pick
+									 * up from there on a new connection, from the same replica so that
+									 * the rest of the data and its timings come from the same resource.
+									 */
+									int fd;
+
+									CheckIRodsStatus (req_p, current_bytes_read);
+									reconnected_flag = true;
+
+									fd = ReopenDataObject (resource_p, &connection_p, filename_s, replica_number_s, (rodsLong_t) total_bytes_read);
+
+									if (fd >= 0)
+										{
+											data_obj.l1descInx = fd;
+
+											/* Go round the loop again */
+											current_bytes_read = (int) buffer_size;
+										}
+									else
+										{
+											if (replica_resource_s)
+												{
+													RecordReplicaFailure (replica_resource_s);
+												}
+
+											ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, req_p, "Failed to resume reading %s after %lu total bytes: %d = %s", filename_s, total_bytes_read, fd, get_rods_error_msg (fd));
+
+											error_s = "Could not read from requested resource";
+										}
+								}
 							else if (current_bytes_read < 0)
 								{
 									ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, req_p, "rcDataObjRead failed for %s: %d = %s after %lu total bytes", filename_s, current_bytes_read, get_rods_error_msg (current_bytes_read), total_bytes_read);
 
+									CheckIRodsStatus (req_p, current_bytes_read);
+
+									if (replica_resource_s)
+										{
+											RecordReplicaFailure (replica_resource_s);
+										}
+
 									error_s = "Could not read from requested resource";
 								}
 
@@ -1399,6 +1793,11 @@ static dav_error *DeliverFile (const dav_resource *resource_p, ap_filter_t *outp
 						}
 					while (((size_t) current_bytes_read == buffer_size) && (!error_s));
 
+					if (replica_resource_s && (!error_s))
+						{
+							RecordReplicaRead (replica_resource_s, latency, (apr_off_t) total_bytes_read, read_time);
+						}
+
 					/* Add the end-of-stream bucket */
 					if ((bkt_p = apr_bucket_eos_create (output_p -> c -> bucket_alloc)) != NULL)
 						{
@@ -1462,7 +1861,7 @@ static dav_error *DeliverFile (const dav_resource *resource_p, ap_filter_t *outp
 					//);
 				}
 
-		}		/* if ((irods_status = rcDataObjOpen (connection_p, &open_params)) >= 0) */
+		}		/* if (irods_status >= 0) */
 	else
 		{
 			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, req_p, "rcDataObjOpen failed for %s: %d = %s", filename_s, irods_status, get_rods_error_msg (irods_status));
@@ -1487,6 +1886,77 @@ static dav_error *DeliverFile (const dav_resource *resource_p, ap_filter_t *outp
 }
 
 
+/*
+ * Log in again after the connection was lost while delivering a data
+ * object and open it again at the offset that had been reached. If
+ * replica_number_s is set, that replica is opened again.
+ */
+static int ReopenDataObject (const dav_resource *resource_p, rcComm_t **connection_pp, const char *filename_s, const char *replica_number_s, const rodsLong_t offset)
+{
+	request_rec *req_p = resource_p -> info -> r;
+	rcComm_t *connection_p = ReconnectIRodsConnection (req_p);
+	int irods_status = SYS_SOCK_CONNECT_ERR;
+
+	if (connection_p)
+		{
+			dataObjInp_t open_params;
+
+			resource_p -> info -> rods_conn = connection_p;
+			*connection_pp = connection_p;
+
+			memset (&open_params, 0, sizeof (dataObjInp_t));
+
+			open_params.openFlags = O_RDONLY;
+			strcpy (open_params.objPath, filename_s);
+
+			if (replica_number_s)
+				{
+					addKeyVal (& (open_params.condInput), REPL_NUM_KW, replica_number_s);
+				}
+
+			irods_status = rcDataObjOpen (connection_p, &open_params);
+			clearKeyVal (& (open_params.condInput));
+
+			if ((irods_status >= 0) && (offset > 0))
+				{
+					openedDataObjInp_t seek_params;
+					fileLseekOut_t *seek_out_p = NULL;
+					int seek_status;
+
+					memset (&seek_params, 0, sizeof (openedDataObjInp_t));
+					seek_params.l1descInx = irods_status;
+					seek_params.offset = offset;
+					seek_params.whence = SEEK_SET;
+
+					seek_status = rcDataObjLseek (connection_p, &seek_params, &seek_out_p);
+
+					if (seek_out_p)
+						{
+							free (seek_out_p);
+						}
+
+					if (seek_status < 0)
+						{
+							openedDataObjInp_t close_params;
+
+							memset (&close_params, 0, sizeof (openedDataObjInp_t));
+							close_params.l1descInx = irods_status;
+							rcDataObjClose (connection_p, &close_params);
+
+							irods_status = seek_status;
+						}
+				}
+
+			if (irods_status >= 0)
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_INFO, APR_SUCCESS, req_p, "Reopened %s at offset %lld on a new iRODS connection", filename_s, (long long) offset);
+				}
+		}
+
+	return irods_status;
+}
+
+
 static dav_error *deliver_directory (const dav_resource *resource,
 		ap_filter_t *output)
 {
@@ -1503,6 +1973,8 @@ static dav_error *deliver_directory (const dav_resource *resource,
 
 	if (status < 0)
 		{
+			CheckIRodsStatus (resource->info->r, status);
+
 			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, resource->info->r,
 					"rcOpenCollection failed: %d = %s", status,
 					get_rods_error_msg (status));
@@ -1553,6 +2025,8 @@ static dav_error *deliver_directory (const dav_resource *resource,
 						}
 					else
 						{
+							CheckIRodsStatus (resource->info->r, status);
+
 							ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS,
 									resource->info->r,
 									"rcReadCollection failed for collection <%s> with error <%s>",
@@ -1685,7 +2159,11 @@ static dav_error *dav_repo_deliver (const dav_resource *resource, ap_filter_t *o
 		{
 			davrods_dir_conf_t *conf_p = resource->info->conf;
 
-			if (conf_p -> themed_listings)
+			if (IsArchiveDownloadRequest (resource->info->r, conf_p))
+				{
+					return DeliverCollectionArchive (resource, output);
+				}
+			else if (conf_p -> themed_listings)
 				{
 					return DeliverThemedDirectory (resource, output);
 				}
@@ -1753,6 +2231,8 @@ static dav_error *dav_repo_create_collection (dav_resource *resource)
 					status, "Could not create a collection at the given path");
 		}
 
+	ForgetKnownAbsent (resource->info->conf, resource->info->rods_path);
+
 	// Update resource stat info.
 	return get_dav_resource_rods_info (resource);;
 }
@@ -1852,6 +2332,8 @@ static dav_error *walker (struct dav_repo_walker_private *ctx, int depth)
 			ctx->resource.info->rods_path, 0, &coll_handle);
 	if (status < 0)
 		{
+			CheckIRodsStatus (ctx->resource.info->r, status);
+
 			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, ctx->resource.info->r,
 					"rcOpenCollection failed: %d = %s", status,
 					get_rods_error_msg (status));
@@ -1882,6 +2364,8 @@ static dav_error *walker (struct dav_repo_walker_private *ctx, int depth)
 						}
 					else
 						{
+							CheckIRodsStatus (ctx->resource.info->r, status);
+
 							ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS,
 									ctx->resource.info->r,
 									"rcReadCollection failed for collection <%s> with error <%s>",
@@ -2205,6 +2689,8 @@ static dav_error *dav_copy_walk_callback (dav_walk_resource *wres, int calltype)
 
 			WHISPER("COPY: current dest <%s>\n", dst_path);
 
+			ForgetKnownAbsent (resource->info->conf, dst_path);
+
 			if (resource->collection)
 				{
 					// Create collection.
@@ -2344,6 +2830,8 @@ static dav_error *dav_repo_move_resource (dav_resource *src, dav_resource *dst,
 				}
 		}
 
+	ForgetKnownAbsent (dst->info->conf, dst->info->rods_path);
+
 	src->exists = 0;
 	dst->exists = 1;
 	dst->collection = src->collection;
@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #define ALLOCATE_REST_CONSTANTS (1)
 #include "rest.h"
@@ -41,6 +42,8 @@
 #include "listing.h"
 #include "repo.h"
 #include "theme.h"
+#include "resumable_upload.h"
+#include "archive_ingest.h"
 
 #include "debug.h"
 
@@ -55,6 +58,17 @@ typedef struct APICall
 } APICall;
 
 
+/*
+ * The state used to stream the hits of a metadata search.
+ */
+typedef struct SearchHitsOutput
+{
+	JSONWriter *sho_writer_p;
+	const IRodsConfig *sho_config_p;
+	apr_pool_t *sho_pool_p;
+} SearchHitsOutput;
+
+
 /*
  * STATIC DECLARATIONS
  */
@@ -85,6 +99,10 @@ static int GetInformationForEntry (const APICall *call_p, request_rec *req_p, ap
 
 static int ListInformationForEntries (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
 
+static int GetUploadStatus (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
+
+static int IngestArchive (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
+
 
 static const char *GetIdParameter (apr_table_t *params_p, request_rec *req_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
 
@@ -119,6 +137,24 @@ static const char *GetFullPath (const char *path_s, request_rec *req_p, apr_pool
 
 static void SetMimeTypeForOutputFormat (request_rec *req_p, const OutputFormat fmt);
 
+static apr_status_t WriteSearchHit (const IRodsObject *hit_p, void *data_p);
+
+static int RunModAVUMetadata (rcComm_t *rods_connection_p, const char *command_s, const IRodsObject *irods_obj_p, const char *key_s, const char *value_s, const char *units_s, const char *arg_0_s, const char *arg_1_s, const char *arg_2_s, apr_pool_t *pool_p);
+
+static int ModifyMetadataInBatch (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
+
+static json_t *GetBatchOperations (request_rec *req_p, apr_table_t *params_p, int *res_p, apr_pool_t *pool_p);
+
+static char *ReadRequestBody (request_rec *req_p, const apr_off_t max_size, int *res_p, apr_pool_t *pool_p);
+
+static int RunBatchOperation (const json_t *op_p, const IRodsObject *irods_obj_p, rcComm_t *rods_connection_p, const char **error_ss, apr_pool_t *pool_p);
+
+static const char *GetBatchOperationValue (const json_t *op_p, const char *key_s);
+
+static bool IsJSONRequest (const request_rec *req_p);
+
+static bool IsArchiveRequest (const request_rec *req_p);
+
 /*
  * STATIC VARIABLES
  */
@@ -132,10 +168,14 @@ static APICall S_REST_API_ACTIONS_P [] =
 	{ REST_METADATA_EDIT_S, EditMetadataForEntry },
 	{ REST_METADATA_MATCHING_KEYS_S, GetMatchingMetadataKeys },
 	{ REST_METADATA_MATCHING_VALUES_S, GetMatchingMetadataValues },
+	{ REST_METADATA_BATCH_S, ModifyMetadataInBatch },
 
 	{ REST_GET_INFO_S, GetInformationForEntry },
 	{ REST_LIST_S, ListInformationForEntries },
 
+	{ REST_UPLOAD_STATUS_S, GetUploadStatus },
+	{ REST_UPLOAD_ARCHIVE_S, IngestArchive },
+
 	{ NULL, NULL }
 };
 
@@ -152,6 +192,12 @@ static APICall S_VIEW_ACTIONS_P [] =
 static const char * const S_HANDLER_NAME_S = "davrods-rest-handler";
 static const char * const S_HANDLER_SET_VALUE_S = "true";
 
+/*
+ * The largest JSON request body, in bytes, that
+ * the metadata/batch call will accept.
+ */
+static const apr_off_t S_MAX_BATCH_BODY_SIZE = 16 * 1024 * 1024;
+
 /*
  * API DEFINITIONS
  */
@@ -257,6 +303,24 @@ int EIRodsDavAPIHandler (request_rec *req_p)
 							ap_args_to_table (req_p, &params_p);
 							processed_flag = true;
 						}
+					else if ((req_p -> method_number == M_POST) && (IsJSONRequest (req_p)))
+						{
+							/*
+							 * Leave the JSON body for the API call to read and
+							 * just use any parameters from the query string.
+							 */
+							ap_args_to_table (req_p, &params_p);
+							processed_flag = true;
+						}
+					else if ((req_p -> method_number == M_POST) && (IsArchiveRequest (req_p)))
+						{
+							/*
+							 * Archives are unpacked as they are read, so again
+							 * leave the body and use the query string.
+							 */
+							ap_args_to_table (req_p, &params_p);
+							processed_flag = true;
+						}
 					else if (req_p -> method_number == M_POST)
 						{
 							apr_array_header_t *key_value_pairs_p = NULL;
@@ -353,12 +417,15 @@ int EIRodsDavAPIHandler (request_rec *req_p)
 
 															if (strncmp (path_s, call_p -> ac_action_s, l) == 0)
 																{
-																	res = call_p -> ac_callback_fn (call_p, req_p, params_p, config_p, davrods_path_s);
+																	/*
+																	 * Set the default content type before calling the
+																	 * action as any streamed output will send the headers
+																	 * straight away. Actions that return other types of
+																	 * data will override this.
+																	 */
+																	ap_set_content_type (req_p, CONTENT_TYPE_JSON_S);
 
-																	if (res == OK)
-																		{
-																			ap_set_content_type (req_p, CONTENT_TYPE_JSON_S);
-																		}
+																	res = call_p -> ac_callback_fn (call_p, req_p, params_p, config_p, davrods_path_s);
 
 																	/* force exit from loop */
 																	call_p = NULL;
@@ -468,7 +535,7 @@ const char *GetMinorId (const char *id_s)
 }
 
 
-IRodsObjectNode *GetMatchingIds (request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p)
+IRodsObjectNode *GetMatchingIds (request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, apr_array_header_t *unknown_ids_p)
 {
 	apr_pool_t *pool_p = req_p -> pool;
 	IRodsObjectNode *root_node_p = NULL;
@@ -486,29 +553,18 @@ IRodsObjectNode *GetMatchingIds (request_rec *req_p, apr_table_t *params_p, davr
 						{
 							const char *sep_s = " ,";
 							char *id_s = apr_strtok (copied_ids_s, sep_s, &copied_ids_s);
-							IRodsObjectNode *current_node_p = NULL;
+							apr_array_header_t *ids_p = apr_array_make (pool_p, 16, sizeof (char *));
 
 							while (id_s)
 								{
-									IRodsObjectNode *node_p = GetIRodsObjectNodeForId (id_s, rods_connection_p, pool_p);
-
-									if (node_p)
-										{
-											if (current_node_p)
-												{
-													current_node_p -> ion_next_p = node_p;
-												}
-											else
-												{
-													root_node_p = node_p;
-												}
-
-											current_node_p = node_p;
-										}
-
+									APR_ARRAY_PUSH (ids_p, char *) = id_s;
 									id_s = apr_strtok (NULL, sep_s, &copied_ids_s);
 								}		/* while (id_s) */
 
+							if (ids_p -> nelts > 0)
+								{
+									root_node_p = GetIRodsObjectNodesForIds ((const char **) ids_p -> elts, ids_p -> nelts, rods_connection_p, unknown_ids_p, pool_p);
+								}
 
 						}		/* if (copied_ids_s) */
 
@@ -517,12 +573,6 @@ IRodsObjectNode *GetMatchingIds (request_rec *req_p, apr_table_t *params_p, davr
 		}		/* if (rods_connection_p) */
 
 
-	if (root_node_p)
-		{
-			SortIRodsObjectNodeListIntoDirectoryOrder (root_node_p);
-		}
-
-
 	return root_node_p;
 }
 
@@ -535,7 +585,7 @@ static int GetVirtualListingAsHTML (const APICall *call_p, request_rec *req_p, a
 
 	if (rods_connection_p)
 		{
-			IRodsObjectNode *root_node_p = GetMatchingIds (req_p, params_p, config_p);
+			IRodsObjectNode *root_node_p = GetMatchingIds (req_p, params_p, config_p, NULL);
 			apr_pool_t *pool_p = req_p -> pool;
 			char *result_s = NULL;
 			apr_size_t result_length = 0;
@@ -560,9 +610,12 @@ static int GetVirtualListingAsHTML (const APICall *call_p, request_rec *req_p, a
 
 			if (root_node_p)
 				{
-					IRodsObjectNode *node_p = root_node_p;
+					IRodsObjectNode *node_p;
 					unsigned int i;
 
+					SortIRodsObjectNodeListIntoDirectoryOrder (root_node_p);
+					node_p = root_node_p;
+
 					while (node_p && (apr_status == APR_SUCCESS))
 						{
 							apr_status = PrintItem (config_p -> theme_p, node_p -> ion_object_p, &irods_config, i, bucket_brigade_p, pool_p, rods_connection_p, req_p);
@@ -701,11 +754,15 @@ static int SearchMetadata (const APICall *call_p, request_rec *req_p, apr_table_
 
 			if (rods_connection_p)
 				{
-					IRodsObjectNode *node_p = GetMatchingMetadataHits (key_s, value_s, op, rods_connection_p, pool_p);
+					apr_bucket_brigade *bb_p = apr_brigade_create (pool_p, req_p -> connection -> bucket_alloc);
 
-					if (node_p)
+					if (bb_p)
 						{
 							IRodsConfig irods_config;
+							JSONWriter writer;
+							SearchHitsOutput output;
+							apr_status_t status;
+							const OutputFormat format = (GetRequestedOutputFormat (params_p, pool_p, OF_JSON) == OF_NDJSON) ? OF_NDJSON : OF_JSON;
 
 							char *metadata_root_link_s = apr_pstrcat (pool_p, davrods_path_s, config_p -> eirods_dav_views_path_s, NULL);
 
@@ -714,15 +771,50 @@ static int SearchMetadata (const APICall *call_p, request_rec *req_p, apr_table_
 
 							SetIRodsConfig (&irods_config, exposed_root_s, davrods_path_s, metadata_root_link_s);
 
-							PrintIRodsObjectNodesToJSON (node_p, &irods_config, req_p);
-							FreeIRodsObjectNodeList (node_p);
-						}
-					else
-						{
-							ap_rputs ("[]", req_p);
-						}
+							/*
+							 * The hits are sent to the client as they are found so
+							 * the headers need to be set before we start.
+							 */
+							SetMimeTypeForOutputFormat (req_p, format);
+
+							InitJSONWriter (&writer, bb_p, req_p -> output_filters, (format == OF_NDJSON));
+
+							output.sho_writer_p = &writer;
+							output.sho_config_p = &irods_config;
+							output.sho_pool_p = pool_p;
+
+							BeginJSONArray (&writer);
+
+							status = ProcessMatchingMetadataHits (key_s, value_s, op, rods_connection_p, WriteSearchHit, &output, pool_p);
+
+							if (status == APR_SUCCESS)
+								{
+									EndJSONArray (&writer);
+
+									status = FinishJSONWriter (&writer);
+
+									if (status != APR_SUCCESS)
+										{
+											ap_log_rerror (APLOG_MARK, APLOG_ERR, status, req_p, "Failed to send search hits for \"%s\"", key_s);
+										}
+
+									res = OK;
+								}
+							else
+								{
+									ap_log_rerror (APLOG_MARK, APLOG_ERR, status, req_p, "Failed to get all of the hits when searching for \"%s\"", key_s);
+
+									/*
+									 * If none of the hits have gone to the client yet, we
+									 * can still send an error rather than a partial result.
+									 */
+									res = HasJSONWriterSentData (&writer) ? OK : HTTP_INTERNAL_SERVER_ERROR;
+									AbortJSONWriter (&writer);
+								}
+
+							apr_brigade_destroy (bb_p);
+						}		/* if (bb_p) */
 
-					res = OK;
 				}		/* if (rods_connection_p) */
 
 		}
@@ -731,6 +823,22 @@ static int SearchMetadata (const APICall *call_p, request_rec *req_p, apr_table_
 }
 
 
+static apr_status_t WriteSearchHit (const IRodsObject *hit_p, void *data_p)
+{
+	SearchHitsOutput *output_p = (SearchHitsOutput *) data_p;
+	apr_pool_t *hit_pool_p = NULL;
+	apr_status_t status = apr_pool_create (&hit_pool_p, output_p -> sho_pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			status = WriteIRodsObjectAsJSON (output_p -> sho_writer_p, hit_p, output_p -> sho_config_p, hit_pool_p);
+			apr_pool_destroy (hit_pool_p);
+		}
+
+	return status;
+}
+
+
 
 
 static OutputFormat GetRequestedOutputFormat (apr_table_t *params_p, apr_pool_t *pool_p, OutputFormat default_format)
@@ -756,6 +864,10 @@ static OutputFormat GetRequestedOutputFormat (apr_table_t *params_p, apr_pool_t
 				{
 					format = OF_CSV;
 				}
+			else if (strcmp (format_s, "ndjson") == 0)
+				{
+					format = OF_NDJSON;
+				}
 		}
 
 	return format;
@@ -766,7 +878,25 @@ static int ListInformationForEntries (const APICall *call_p, request_rec *req_p,
 {
 	int res = DECLINED;
 	apr_pool_t *pool_p = req_p -> pool;
-	IRodsObjectNode *root_node_p = GetMatchingIds (req_p, params_p, config_p);
+	apr_array_header_t *unknown_ids_p = apr_array_make (pool_p, 4, sizeof (char *));
+	IRodsObjectNode *root_node_p = GetMatchingIds (req_p, params_p, config_p, unknown_ids_p);
+
+	/*
+	 * Report any ids that could not be found in a header so
+	 * that the body stays as a plain array of the matches.
+	 */
+	if (unknown_ids_p -> nelts > 0)
+		{
+			int i;
+
+			/* The ids came from the client so make sure that they are safe to use in a header */
+			for (i = 0; i < unknown_ids_p -> nelts; ++ i)
+				{
+					APR_ARRAY_IDX (unknown_ids_p, i, const char *) = apr_pescape_urlencoded (pool_p, APR_ARRAY_IDX (unknown_ids_p, i, const char *));
+				}
+
+			apr_table_setn (req_p -> headers_out, "X-Eirods-Dav-Unknown-Ids", apr_array_pstrcat (pool_p, unknown_ids_p, ','));
+		}
 
 	if (root_node_p)
 		{
@@ -774,9 +904,12 @@ static int ListInformationForEntries (const APICall *call_p, request_rec *req_p,
 			char *metadata_root_link_s = apr_pstrcat (pool_p, davrods_path_s, config_p -> eirods_dav_views_path_s, NULL);
 			const char *exposed_root_s = GetRodsExposedPath (req_p);
 
+			const OutputFormat format = (GetRequestedOutputFormat (params_p, pool_p, OF_JSON) == OF_NDJSON) ? OF_NDJSON : OF_JSON;
+
 			SetIRodsConfig (&irods_config, exposed_root_s, davrods_path_s, metadata_root_link_s);
 
-			PrintIRodsObjectNodesToJSON (root_node_p, &irods_config, req_p);
+			SetMimeTypeForOutputFormat (req_p, format);
+			PrintIRodsObjectNodesToJSON (root_node_p, &irods_config, req_p, (format == OF_NDJSON));
 			FreeIRodsObjectNodeList (root_node_p);
 
 			res = OK;
@@ -1112,7 +1245,11 @@ static void SetMimeTypeForOutputFormat (request_rec *req_p, const OutputFormat f
 				break;
 
 			case OF_JSON:
-				content_type_s = "application/json";
+				content_type_s = CONTENT_TYPE_JSON_S;
+				break;
+
+			case OF_NDJSON:
+				content_type_s = CONTENT_TYPE_NDJSON_S;
 				break;
 
 			case OF_TSV:
@@ -1127,6 +1264,89 @@ static void SetMimeTypeForOutputFormat (request_rec *req_p, const OutputFormat f
 }
 
 
+/*
+ * Call rcModAVUMetadata () for an iRODS object. The command_s is one of the imeta
+ * commands such as "add", "set", "rm" or "mod" and the arg_x_s values are any
+ * extra arguments that the command needs, e.g. the "n:", "v:" and "u:" values
+ * for "mod".
+ */
+static int RunModAVUMetadata (rcComm_t *rods_connection_p, const char *command_s, const IRodsObject *irods_obj_p, const char *key_s, const char *value_s, const char *units_s, const char *arg_0_s, const char *arg_1_s, const char *arg_2_s, apr_pool_t *pool_p)
+{
+	int status = SYS_INVALID_INPUT_PARAM;
+	const char *type_s = NULL;
+
+	switch (irods_obj_p -> io_obj_type)
+	{
+		case DATA_OBJ_T:
+			type_s = "-d";
+			break;
+
+		case COLL_OBJ_T:
+			type_s = "-C";
+			break;
+
+		default:
+			break;
+	}
+
+	if (type_s)
+		{
+			modAVUMetadataInp_t mod;
+			char *full_name_s = GetIRodsObjectFullPath (irods_obj_p, pool_p);
+
+			memset (&mod, 0, sizeof (modAVUMetadataInp_t));
+
+			mod.arg0 = (char *) command_s;
+			mod.arg1 = (char *) type_s;
+			mod.arg2 = full_name_s;
+			mod.arg3 = (char *) key_s;
+			mod.arg4 = (char *) value_s;
+
+			if (units_s && (strlen (units_s) > 0))
+				{
+					mod.arg5 = (char *) units_s;
+					mod.arg6 = (char *) arg_0_s;
+					mod.arg7 = (char *) arg_1_s;
+					mod.arg8 = (char *) arg_2_s;
+				}
+			else
+				{
+					mod.arg5 = (char *) arg_0_s;
+					mod.arg6 = (char *) arg_1_s;
+					mod.arg7 = (char *) arg_2_s;
+					mod.arg8 = (char *) "";
+				}
+
+			mod.arg9 = "";
+
+			status = rcModAVUMetadata (rods_connection_p, &mod);
+
+			if (status != 0)
+				{
+					const char *error_s = rodsErrorName (status, NULL);
+
+					CheckIRodsConnectionStatus (rods_connection_p, status, pool_p);
+
+					if (error_s)
+						{
+							ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p,
+														 "rcModAVUMetadata failed, error: %s for args \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"",
+														 error_s, mod.arg1, mod.arg2, mod.arg3, mod.arg4, mod.arg5, mod.arg6, mod.arg7, mod.arg8, mod.arg9);
+						}
+					else
+						{
+							ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p,
+														 "rcModAVUMetadata failed, error: %d for args \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"",
+														 status, mod.arg1, mod.arg2, mod.arg3, mod.arg4, mod.arg5, mod.arg6, mod.arg7, mod.arg8, mod.arg9);
+						}
+				}
+
+		}		/* if (type_s) */
+
+	return status;
+}
+
+
 static apr_status_t ModifyMetadataForEntry (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s, const char *command_s, const char *arg_0_s, const char *arg_1_s, const char *arg_2_s)
 {
 	apr_status_t res = APR_EGENERAL;
@@ -1160,84 +1380,18 @@ static apr_status_t ModifyMetadataForEntry (const APICall *call_p, request_rec *
 
 											if (apr_res == APR_SUCCESS)
 												{
-													const char *type_s = NULL;
-													modAVUMetadataInp_t mod;
-
-													mod.arg0 = (char *) command_s;
-
-													switch (irods_obj.io_obj_type)
-													{
-														case DATA_OBJ_T:
-															type_s = "-d";
-															break;
-
-														case COLL_OBJ_T:
-															type_s = "-C";
-															break;
+													const char *units_s = GetParameterValue (params_p, "units", pool_p);
+													int status = RunModAVUMetadata (rods_connection_p, command_s, &irods_obj, key_s, value_s, units_s, arg_0_s, arg_1_s, arg_2_s, pool_p);
 
-														default:
-															break;
-													}
-
-
-													if (type_s)
+													if (status != SYS_INVALID_INPUT_PARAM)
 														{
-															int status;
-															const char *units_s = GetParameterValue (params_p, "units", pool_p);
-															char *full_name_s = apr_pstrcat (req_p -> pool, irods_obj.io_collection_s, "/", irods_obj.io_data_s, NULL);
-
-															mod.arg1 = (char *) type_s;
-															mod.arg2 = full_name_s;
-															mod.arg3 = (char *) key_s;
-															mod.arg4 = (char *) value_s;
-
-
-															if (units_s && (strlen (units_s) > 0))
-																{
-																	mod.arg5 = (char *) units_s;
-																	mod.arg6 = (char *) arg_0_s;
-																	mod.arg7 = (char *) arg_1_s;
-																	mod.arg8 = (char *) arg_2_s;
-																}
-															else
-																{
-																	mod.arg5 = (char *) arg_0_s;
-																	mod.arg6 = (char *) arg_1_s;
-																	mod.arg7 = (char *) arg_2_s;
-																	mod.arg8 = (char *) "";
-																}
-
-															mod.arg9 = "";
-
-															status = rcModAVUMetadata (rods_connection_p, &mod);
-
 															if (status == 0)
 																{
 																	res = APR_SUCCESS;
 																}
-															else
-																{
-																	const char *error_s = rodsErrorName (status, NULL);
-
-																	if (error_s)
-																		{
-																			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p,
-																										 "rcModAVUMetadata failed, error: %s for args \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"",
-																										 error_s, mod.arg1, mod.arg2, mod.arg3, mod.arg4, mod.arg5, mod.arg6, mod.arg7, mod.arg8, mod.arg9);
-																		}
-																	else
-																		{
-																			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p,
-																										 "rcModAVUMetadata failed, error: %d for args \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"",
-																										 status, mod.arg1, mod.arg2, mod.arg3, mod.arg4, mod.arg5, mod.arg6, mod.arg7, mod.arg8, mod.arg9);
-																		}
-
-																	res = APR_EGENERAL;
-																}
 
 															AddDecodedJSONResponse (call_p, res, id_s, req_p);
-
-														}		/* if (type_s) */
+														}
 													else
 														{
 															ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "Failed to get object type for id \"%s\"", id_s);
@@ -1601,3 +1755,511 @@ static apr_status_t RunMetadataQuery (const int *where_columns_p, const char **w
 	return status;
 }
 
+
+static bool IsJSONRequest (const request_rec *req_p)
+{
+	const char *content_type_s = apr_table_get (req_p -> headers_in, "Content-Type");
+
+	return ((content_type_s != NULL) && (strncasecmp (content_type_s, CONTENT_TYPE_JSON_S, strlen (CONTENT_TYPE_JSON_S)) == 0));
+}
+
+
+static bool IsArchiveRequest (const request_rec *req_p)
+{
+	const char *content_type_s = apr_table_get (req_p -> headers_in, "Content-Type");
+
+	return ((content_type_s != NULL) && ((strncasecmp (content_type_s, "application/x-tar", 17) == 0) || (strncasecmp (content_type_s, "application/tar", 15) == 0)));
+}
+
+
+static int ModifyMetadataInBatch (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+{
+	int res = HTTP_BAD_REQUEST;
+	apr_pool_t *pool_p = req_p -> pool;
+	json_t *ops_p = GetBatchOperations (req_p, params_p, &res, pool_p);
+
+	if (ops_p)
+		{
+			rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+
+			if (rods_connection_p)
+				{
+					const size_t num_ops = json_array_size (ops_p);
+					const char **ids_ss = (const char **) apr_pcalloc (pool_p, (num_ops + 1) * sizeof (const char *));
+					apr_array_header_t *unknown_ids_p = apr_array_make (pool_p, 4, sizeof (char *));
+					apr_bucket_brigade *bb_p = apr_brigade_create (pool_p, req_p -> connection -> bucket_alloc);
+					const char *stop_on_error_s = GetParameterValue (params_p, "stop_on_error", pool_p);
+					const bool stop_on_error_flag = (stop_on_error_s && (strcmp (stop_on_error_s, "true") == 0));
+
+					if (ids_ss && unknown_ids_p && bb_p)
+						{
+							IRodsObjectNode *root_node_p = NULL;
+							IRodsObjectNode *node_p;
+							JSONWriter writer;
+							size_t i;
+							int num_succeeded = 0;
+							int num_failed = 0;
+							int next_unknown_index = 0;
+							bool stopped_flag = false;
+
+							for (i = 0; i < num_ops; ++ i)
+								{
+									const char *id_s = GetBatchOperationValue (json_array_get (ops_p, i), "id");
+
+									* (ids_ss + i) = id_s ? id_s : "";
+								}
+
+							/* Look up all of the objects at once rather than for each operation */
+							if (num_ops > 0)
+								{
+									root_node_p = GetIRodsObjectNodesForIds (ids_ss, (int) num_ops, rods_connection_p, unknown_ids_p, pool_p);
+								}
+
+							node_p = root_node_p;
+
+							InitJSONWriter (&writer, bb_p, req_p -> output_filters, false);
+
+							BeginJSONObject (&writer);
+							WriteJSONKey (&writer, "results");
+							BeginJSONArray (&writer);
+
+							for (i = 0; (i < num_ops) && (writer.jw_status == APR_SUCCESS); ++ i)
+								{
+									const json_t *op_p = json_array_get (ops_p, i);
+									const IRodsObject *irods_obj_p = NULL;
+									const char *error_s = NULL;
+									int status = -1;
+
+									/*
+									 * The found objects are in the same order as the ids and
+									 * unknown_ids_p holds the pointers from ids_ss that could
+									 * not be found, so we can match them up as we go.
+									 */
+									if ((next_unknown_index < unknown_ids_p -> nelts) && (APR_ARRAY_IDX (unknown_ids_p, next_unknown_index, const char *) == * (ids_ss + i)))
+										{
+											++ next_unknown_index;
+										}
+									else if (node_p)
+										{
+											irods_obj_p = node_p -> ion_object_p;
+											node_p = node_p -> ion_next_p;
+										}
+
+									if (stopped_flag)
+										{
+											error_s = "Skipped after an earlier error";
+										}
+									else if (irods_obj_p)
+										{
+											apr_pool_t *op_pool_p = NULL;
+
+											if (apr_pool_create (&op_pool_p, pool_p) == APR_SUCCESS)
+												{
+													status = RunBatchOperation (op_p, irods_obj_p, rods_connection_p, &error_s, op_pool_p);
+													apr_pool_destroy (op_pool_p);
+												}
+											else
+												{
+													error_s = "Out of memory";
+												}
+										}
+									else
+										{
+											error_s = "Unknown id";
+										}
+
+									BeginJSONObject (&writer);
+									WriteJSONKey (&writer, "index");
+									WriteJSONInteger (&writer, (apr_int64_t) i);
+									WriteJSONStringMember (&writer, "op", GetBatchOperationValue (op_p, "op"));
+									WriteJSONStringMember (&writer, "id", * (ids_ss + i));
+									WriteJSONKey (&writer, "status");
+									WriteJSONBoolean (&writer, (status == 0));
+
+									if (status == 0)
+										{
+											++ num_succeeded;
+										}
+									else
+										{
+											WriteJSONStringMember (&writer, "error", error_s);
+											++ num_failed;
+
+											if (stop_on_error_flag)
+												{
+													stopped_flag = true;
+												}
+										}
+
+									EndJSONObject (&writer);
+								}		/* for (i = 0; i < num_ops; ++ i) */
+
+							EndJSONArray (&writer);
+
+							WriteJSONKey (&writer, "succeeded");
+							WriteJSONInteger (&writer, num_succeeded);
+							WriteJSONKey (&writer, "failed");
+							WriteJSONInteger (&writer, num_failed);
+
+							EndJSONObject (&writer);
+
+							if (FinishJSONWriter (&writer) != APR_SUCCESS)
+								{
+									ap_log_rerror (APLOG_MARK, APLOG_ERR, writer.jw_status, req_p, "Failed to send metadata batch results");
+								}
+
+							if (root_node_p)
+								{
+									FreeIRodsObjectNodeList (root_node_p);
+								}
+
+							apr_brigade_destroy (bb_p);
+
+							res = OK;
+						}		/* if (ids_ss && unknown_ids_p && bb_p) */
+					else
+						{
+							res = HTTP_INTERNAL_SERVER_ERROR;
+						}
+
+				}		/* if (rods_connection_p) */
+			else
+				{
+					res = HTTP_INTERNAL_SERVER_ERROR;
+				}
+
+			json_decref (ops_p);
+		}		/* if (ops_p) */
+
+	return res;
+}
+
+
+/*
+ * The operations can either be the JSON body of a POST request or
+ * be passed in as the "operations" parameter. If the body is too large,
+ * res_p is set to HTTP_REQUEST_ENTITY_TOO_LARGE.
+ */
+static json_t *GetBatchOperations (request_rec *req_p, apr_table_t *params_p, int *res_p, apr_pool_t *pool_p)
+{
+	json_t *ops_p = NULL;
+	const char *ops_s = NULL;
+
+	if ((req_p -> method_number == M_POST) && (IsJSONRequest (req_p)))
+		{
+			ops_s = ReadRequestBody (req_p, S_MAX_BATCH_BODY_SIZE, res_p, pool_p);
+		}
+	else
+		{
+			ops_s = GetParameterValue (params_p, "operations", pool_p);
+		}
+
+	if (ops_s)
+		{
+			json_error_t error;
+
+			ops_p = json_loads (ops_s, 0, &error);
+
+			if (ops_p)
+				{
+					if (!json_is_array (ops_p))
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_BADARG, req_p, "The metadata batch operations must be a JSON array");
+
+							json_decref (ops_p);
+							ops_p = NULL;
+						}
+				}
+			else
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_BADARG, req_p, "Failed to parse metadata batch operations, \"%s\" at line %d, column %d", error.text, error.line, error.column);
+				}
+		}
+	else
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_BADARG, req_p, "No metadata batch operations were given");
+		}
+
+	return ops_p;
+}
+
+
+static char *ReadRequestBody (request_rec *req_p, const apr_off_t max_size, int *res_p, apr_pool_t *pool_p)
+{
+	char *body_s = NULL;
+
+	if (ap_setup_client_block (req_p, REQUEST_CHUNKED_DECHUNK) == OK)
+		{
+			if (ap_should_client_block (req_p))
+				{
+					apr_bucket_brigade *bb_p = apr_brigade_create (pool_p, req_p -> connection -> bucket_alloc);
+
+					if (bb_p)
+						{
+							char buffer_s [HUGE_STRING_LEN];
+							apr_off_t total = 0;
+							long length = 0;
+							apr_status_t status = APR_SUCCESS;
+
+							while ((status == APR_SUCCESS) && ((length = ap_get_client_block (req_p, buffer_s, sizeof (buffer_s))) > 0))
+								{
+									total += length;
+
+									if (total <= max_size)
+										{
+											status = apr_brigade_write (bb_p, NULL, NULL, buffer_s, (apr_size_t) length);
+										}
+									else
+										{
+											ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_BADARG, req_p, "Request body is larger than the maximum of %" APR_OFF_T_FMT " bytes", max_size);
+											*res_p = HTTP_REQUEST_ENTITY_TOO_LARGE;
+											status = APR_BADARG;
+										}
+								}
+
+							if ((status == APR_SUCCESS) && (length == 0))
+								{
+									apr_size_t body_length = 0;
+
+									if (apr_brigade_pflatten (bb_p, &body_s, &body_length, pool_p) == APR_SUCCESS)
+										{
+											body_s = apr_pstrmemdup (pool_p, body_s, body_length);
+										}
+									else
+										{
+											body_s = NULL;
+										}
+								}
+
+							apr_brigade_destroy (bb_p);
+						}
+				}
+		}
+
+	return body_s;
+}
+
+
+static const char *GetBatchOperationValue (const json_t *op_p, const char *key_s)
+{
+	const char *value_s = NULL;
+
+	if (json_is_object (op_p))
+		{
+			value_s = json_string_value (json_object_get (op_p, key_s));
+		}
+
+	return value_s;
+}
+
+
+static int RunBatchOperation (const json_t *op_p, const IRodsObject *irods_obj_p, rcComm_t *rods_connection_p, const char **error_ss, apr_pool_t *pool_p)
+{
+	int status = SYS_INVALID_INPUT_PARAM;
+	const char *command_s = GetBatchOperationValue (op_p, "op");
+	const char *key_s = GetBatchOperationValue (op_p, "key");
+	const char *value_s = GetBatchOperationValue (op_p, "value");
+	const char *units_s = GetBatchOperationValue (op_p, "units");
+
+	if (command_s && key_s && value_s)
+		{
+			if ((strcmp (command_s, "add") == 0) || (strcmp (command_s, "set") == 0))
+				{
+					status = RunModAVUMetadata (rods_connection_p, command_s, irods_obj_p, key_s, value_s, units_s, "", "", "", pool_p);
+				}
+			else if (strcmp (command_s, "remove") == 0)
+				{
+					status = RunModAVUMetadata (rods_connection_p, "rm", irods_obj_p, key_s, value_s, units_s, "", "", "", pool_p);
+				}
+			else if (strcmp (command_s, "rename") == 0)
+				{
+					const char *new_values_ss [3] = { GetBatchOperationValue (op_p, "new_key"), GetBatchOperationValue (op_p, "new_value"), GetBatchOperationValue (op_p, "new_units") };
+					const char *prefixes_ss [3] = { "n:", "v:", "u:" };
+					const char *args_ss [3] = { "", "", "" };
+					int num_args = 0;
+					int i;
+
+					for (i = 0; i < 3; ++ i)
+						{
+							if (new_values_ss [i] && (strlen (new_values_ss [i]) > 0))
+								{
+									args_ss [num_args] = apr_pstrcat (pool_p, prefixes_ss [i], new_values_ss [i], NULL);
+									++ num_args;
+								}
+						}
+
+					if (num_args > 0)
+						{
+							status = RunModAVUMetadata (rods_connection_p, "mod", irods_obj_p, key_s, value_s, units_s, args_ss [0], args_ss [1], args_ss [2], pool_p);
+						}
+					else
+						{
+							*error_ss = "A rename needs at least one of new_key, new_value or new_units";
+						}
+				}
+			else
+				{
+					*error_ss = "Unknown op, it must be one of add, set, remove or rename";
+				}
+
+			if ((status != 0) && (*error_ss == NULL))
+				{
+					const char *error_s = rodsErrorName (status, NULL);
+
+					*error_ss = error_s ? error_s : "Failed to modify metadata";
+				}
+		}
+	else
+		{
+			*error_ss = "Each operation needs op, id, key and value";
+		}
+
+	return status;
+}
+
+
+static int GetUploadStatus (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+{
+	int res = DECLINED;
+	apr_pool_t *pool_p = req_p -> pool;
+	rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+
+	if (rods_connection_p)
+		{
+			const char * const path_s = GetParameterValue (params_p, "path", pool_p);
+			const char * const size_s = GetParameterValue (params_p, "size", pool_p);
+
+			if (path_s && size_s)
+				{
+					const char *full_path_s = GetFullPath (path_s, req_p, pool_p);
+
+					if (full_path_s)
+						{
+							json_t *status_p = GetResumableUploadStatus (config_p, rods_connection_p -> clientUser.userName, full_path_s, apr_atoi64 (size_s), pool_p);
+
+							if (status_p)
+								{
+									char *result_s = json_dumps (status_p, JSON_INDENT (2));
+
+									if (result_s)
+										{
+											ap_rputs (result_s, req_p);
+											res = OK;
+											free (result_s);
+										}
+									else
+										{
+											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "json_dumps failed");
+										}
+
+									json_decref (status_p);
+								}
+							else
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get upload status for \"%s\"", full_path_s);
+								}
+						}
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to get full path for \"%s\"", path_s);
+						}
+
+				}		/* if (path_s && size_s) */
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Missing path or size variable for %s", req_p -> uri);
+				}
+		}
+
+	return res;
+}
+
+
+static int IngestArchive (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+{
+	int res = HTTP_BAD_REQUEST;
+	apr_pool_t *pool_p = req_p -> pool;
+
+	if ((req_p -> method_number == M_POST) && (IsArchiveRequest (req_p)))
+		{
+			const char * const path_s = GetParameterValue (params_p, "path", pool_p);
+
+			if (path_s)
+				{
+					const char *full_path_s = GetFullPath (path_s, req_p, pool_p);
+					rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+
+					if (full_path_s && rods_connection_p)
+						{
+							apr_bucket_brigade *bb_p = apr_brigade_create (pool_p, req_p -> connection -> bucket_alloc);
+
+							if (bb_p)
+								{
+									JSONWriter writer;
+									apr_status_t status;
+									const char *overwrite_s = GetParameterValue (params_p, "overwrite", pool_p);
+									const bool overwrite_flag = (overwrite_s && (strcmp (overwrite_s, "true") == 0));
+									const OutputFormat format = (GetRequestedOutputFormat (params_p, pool_p, OF_JSON) == OF_NDJSON) ? OF_NDJSON : OF_JSON;
+
+									/*
+									 * The result for each member is sent as soon as it
+									 * has been stored.
+									 */
+									SetMimeTypeForOutputFormat (req_p, format);
+
+									InitJSONWriter (&writer, bb_p, req_p -> output_filters, (format == OF_NDJSON));
+
+									BeginJSONArray (&writer);
+
+									status = IngestTarArchive (req_p, rods_connection_p, full_path_s, config_p, overwrite_flag, &writer);
+
+									if (status != APR_SUCCESS)
+										{
+											ap_log_rerror (APLOG_MARK, APLOG_ERR, status, req_p, "Failed to unpack all of the archive into \"%s\"", full_path_s);
+										}
+
+									if ((status == APR_EINVAL) && (!HasJSONWriterSentData (&writer)))
+										{
+											/*
+											 * The archive is malformed and none of the results have
+											 * gone to the client yet, so we can still reject it.
+											 */
+											AbortJSONWriter (&writer);
+											res = HTTP_BAD_REQUEST;
+										}
+									else
+										{
+											EndJSONArray (&writer);
+
+											status = FinishJSONWriter (&writer);
+
+											if (status != APR_SUCCESS)
+												{
+													ap_log_rerror (APLOG_MARK, APLOG_ERR, status, req_p, "Failed to send the results of unpacking into \"%s\"", full_path_s);
+												}
+
+											res = OK;
+										}
+
+									apr_brigade_destroy (bb_p);
+								}		/* if (bb_p) */
+							else
+								{
+									res = HTTP_INTERNAL_SERVER_ERROR;
+								}
+						}
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get full path or connection for \"%s\"", path_s);
+							res = HTTP_INTERNAL_SERVER_ERROR;
+						}
+
+				}		/* if (path_s) */
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Missing path variable for %s", req_p -> uri);
+				}
+		}
+
+	return res;
+}
@@ -49,10 +49,14 @@ REST_PREFIX const char REST_METADATA_ADD_S [] REST_VAL ("metadata/add");
 REST_PREFIX const char REST_METADATA_DELETE_S [] REST_VAL ("metadata/delete");
 REST_PREFIX const char REST_METADATA_MATCHING_KEYS_S [] REST_VAL ("metadata/keys");
 REST_PREFIX const char REST_METADATA_MATCHING_VALUES_S [] REST_VAL ("metadata/values");
+REST_PREFIX const char REST_METADATA_BATCH_S [] REST_VAL ("metadata/batch");
 
 REST_PREFIX const char REST_GET_INFO_S [] REST_VAL ("general/info");
 REST_PREFIX const char REST_LIST_S [] REST_VAL ("general/list");
 
+REST_PREFIX const char REST_UPLOAD_STATUS_S [] REST_VAL ("upload/status");
+REST_PREFIX const char REST_UPLOAD_ARCHIVE_S [] REST_VAL ("upload/archive");
+
 
 REST_PREFIX const char VIEW_SEARCH_S [] REST_VAL ("search");
 REST_PREFIX const char VIEW_LIST_S [] REST_VAL ("list");
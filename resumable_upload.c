@@ -0,0 +1,639 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * resumable_upload.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "resumable_upload.h"
+#include "repo.h"
+
+#include "apr_strings.h"
+#include "apr_file_io.h"
+#include "apr_file_info.h"
+#include "apr_md5.h"
+
+#include "http_log.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/** How long an upload session is kept after its last chunk was written. */
+static const apr_interval_time_t S_SESSION_TIMEOUT = APR_TIME_C (86400) * APR_USEC_PER_SEC;
+
+static const char * const S_OBJECT_PREFIX_S = ".davrods-upload-";
+
+/**
+ * The first line of a session file once its temporary data object
+ * has been created.
+ */
+static const char * const S_STARTED_MARKER_S = "started\n";
+
+
+/** A range of bytes that has been written, the end is exclusive. */
+typedef struct UploadRange
+{
+	apr_off_t ur_start;
+	apr_off_t ur_end;
+} UploadRange;
+
+
+struct ResumableUpload
+{
+	request_rec *ru_req_p;
+
+	apr_pool_t *ru_pool_p;
+
+	/** The local file that holds the written ranges. */
+	const char *ru_session_file_s;
+
+	/** The temporary data object that the chunks are written to. */
+	const char *ru_object_path_s;
+
+	/** The range sent in this request, the end is exclusive. */
+	apr_off_t ru_start;
+	apr_off_t ru_end;
+
+	/** The size of the complete data object. */
+	apr_off_t ru_total;
+
+	bool ru_started_flag;
+
+	/** The session file while it is locked by LockResumableUpload. */
+	apr_file_t *ru_lock_file_p;
+};
+
+
+static bool ParseContentRange (const char *header_s, apr_off_t *start_p, apr_off_t *end_p, apr_off_t *total_p);
+
+static apr_status_t OpenSessionFile (ResumableUpload *upload_p, apr_file_t **file_pp);
+
+static void DeleteUploadObject (ResumableUpload *upload_p, rcComm_t *connection_p);
+
+static char *GetSessionId (const char *username_s, const char *rods_path_s, const apr_off_t total, apr_pool_t *pool_p);
+
+static apr_array_header_t *ReadRanges (apr_file_t *file_p, apr_pool_t *pool_p);
+
+static apr_status_t WriteRanges (apr_file_t *file_p, const apr_array_header_t *ranges_p);
+
+static void AddRange (apr_array_header_t *ranges_p, const apr_off_t start, const apr_off_t end);
+
+static int CompareRanges (const void *v0_p, const void *v1_p);
+
+static apr_off_t GetContiguousOffset (const apr_array_header_t *ranges_p);
+
+
+ResumableUpload *GetResumableUpload (const dav_resource *resource_p, apr_pool_t *pool_p)
+{
+	const davrods_dir_conf_t *conf_p = resource_p -> info -> conf;
+	request_rec *req_p = resource_p -> info -> r;
+
+	if ((conf_p -> resumable_uploads_dir_s) && (req_p -> method_number == M_PUT))
+		{
+			const char *header_s = apr_table_get (req_p -> headers_in, "Content-Range");
+			apr_off_t start;
+			apr_off_t end;
+			apr_off_t total;
+
+			if (header_s && ParseContentRange (header_s, &start, &end, &total))
+				{
+					const char *rods_path_s = resource_p -> info -> rods_path;
+					const char *last_slash_s = strrchr (rods_path_s, '/');
+
+					if (last_slash_s)
+						{
+							const char *username_s = resource_p -> info -> rods_conn -> clientUser.userName;
+							char *id_s = GetSessionId (username_s, rods_path_s, total, pool_p);
+
+							if (id_s)
+								{
+									ResumableUpload *upload_p = apr_pcalloc (pool_p, sizeof (ResumableUpload));
+
+									if (upload_p)
+										{
+											const char *collection_s = apr_pstrmemdup (pool_p, rods_path_s, last_slash_s - rods_path_s);
+
+											upload_p -> ru_req_p = req_p;
+											upload_p -> ru_pool_p = pool_p;
+											upload_p -> ru_session_file_s = apr_pstrcat (pool_p, conf_p -> resumable_uploads_dir_s, "/", id_s, NULL);
+											upload_p -> ru_object_path_s = apr_pstrcat (pool_p, collection_s, "/", S_OBJECT_PREFIX_S, id_s, NULL);
+											upload_p -> ru_start = start;
+											upload_p -> ru_end = end + 1;
+											upload_p -> ru_total = total;
+
+											return upload_p;
+										}
+								}
+						}
+
+				}		/* if (header_s && ParseContentRange (header_s, &start, &end, &total)) */
+
+		}		/* if ((conf_p -> resumable_uploads_dir_s) && (req_p -> method_number == M_PUT)) */
+
+	return NULL;
+}
+
+
+const char *GetResumableUploadObjectPath (const ResumableUpload *upload_p)
+{
+	return upload_p -> ru_object_path_s;
+}
+
+
+apr_status_t LockResumableUpload (ResumableUpload *upload_p, rcComm_t *connection_p)
+{
+	apr_file_t *file_p = NULL;
+	apr_status_t status = OpenSessionFile (upload_p, &file_p);
+
+	if (status == APR_SUCCESS)
+		{
+			if ((status = apr_file_lock (file_p, APR_FLOCK_EXCLUSIVE)) == APR_SUCCESS)
+				{
+					apr_finfo_t finfo;
+
+					if ((status = apr_file_info_get (&finfo, APR_FINFO_MTIME | APR_FINFO_SIZE, file_p)) == APR_SUCCESS)
+						{
+							upload_p -> ru_started_flag = (finfo.size > 0);
+
+							/*
+							 * This is checked while the session is locked so that a chunk
+							 * can't remove a temporary data object that another chunk has
+							 * just created for a new session.
+							 */
+							if ((upload_p -> ru_started_flag) && (apr_time_now () - finfo.mtime > S_SESSION_TIMEOUT))
+								{
+									ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, upload_p -> ru_req_p, "Upload session \"%s\" for \"%s\" has expired", upload_p -> ru_session_file_s, upload_p -> ru_req_p -> uri);
+
+									DeleteUploadObject (upload_p, connection_p);
+									status = apr_file_trunc (file_p, 0);
+									upload_p -> ru_started_flag = false;
+								}
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							upload_p -> ru_lock_file_p = file_p;
+						}
+					else
+						{
+							apr_file_unlock (file_p);
+						}
+				}
+
+			if (status != APR_SUCCESS)
+				{
+					apr_file_close (file_p);
+				}
+		}
+
+	if (status != APR_SUCCESS)
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_ERR, status, upload_p -> ru_req_p, "Failed to lock upload session \"%s\" for \"%s\"", upload_p -> ru_session_file_s, upload_p -> ru_req_p -> uri);
+		}
+
+	return status;
+}
+
+
+apr_status_t MarkResumableUploadStarted (ResumableUpload *upload_p)
+{
+	apr_status_t status = apr_file_puts (S_STARTED_MARKER_S, upload_p -> ru_lock_file_p);
+
+	if (status == APR_SUCCESS)
+		{
+			status = apr_file_flush (upload_p -> ru_lock_file_p);
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			upload_p -> ru_started_flag = true;
+		}
+	else
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_ERR, status, upload_p -> ru_req_p, "Failed to update upload session \"%s\" for \"%s\"", upload_p -> ru_session_file_s, upload_p -> ru_req_p -> uri);
+		}
+
+	return status;
+}
+
+
+void UnlockResumableUpload (ResumableUpload *upload_p)
+{
+	if (upload_p -> ru_lock_file_p)
+		{
+			apr_file_unlock (upload_p -> ru_lock_file_p);
+			apr_file_close (upload_p -> ru_lock_file_p);
+			upload_p -> ru_lock_file_p = NULL;
+		}
+}
+
+
+bool HasResumableUploadStarted (const ResumableUpload *upload_p)
+{
+	return upload_p -> ru_started_flag;
+}
+
+
+apr_status_t EndResumableUploadChunk (ResumableUpload *upload_p, const apr_off_t num_bytes, bool *complete_flag_p)
+{
+	apr_pool_t *pool_p = upload_p -> ru_pool_p;
+	apr_file_t *file_p = NULL;
+	apr_status_t status = OpenSessionFile (upload_p, &file_p);
+
+	if (status == APR_SUCCESS)
+		{
+			/*
+			 * Chunks of the same upload can arrive at the same time on
+			 * different connections, so the ranges are read again while
+			 * the session file is locked.
+			 */
+			if ((status = apr_file_lock (file_p, APR_FLOCK_EXCLUSIVE)) == APR_SUCCESS)
+				{
+					apr_array_header_t *ranges_p = ReadRanges (file_p, pool_p);
+
+					if (ranges_p)
+						{
+							apr_off_t end = upload_p -> ru_start + num_bytes;
+							apr_off_t offset;
+
+							if (end > upload_p -> ru_end)
+								{
+									end = upload_p -> ru_end;
+								}
+
+							AddRange (ranges_p, upload_p -> ru_start, end);
+
+							if ((status = WriteRanges (file_p, ranges_p)) == APR_SUCCESS)
+								{
+									offset = GetContiguousOffset (ranges_p);
+
+									apr_table_setn (upload_p -> ru_req_p -> headers_out, "Upload-Offset", apr_off_t_toa (upload_p -> ru_req_p -> pool, offset));
+									*complete_flag_p = (offset >= upload_p -> ru_total);
+								}
+						}
+					else
+						{
+							status = APR_ENOMEM;
+						}
+
+					apr_file_unlock (file_p);
+				}
+
+			apr_file_close (file_p);
+		}
+
+	if (status != APR_SUCCESS)
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_ERR, status, upload_p -> ru_req_p, "Failed to update upload session \"%s\" for \"%s\"", upload_p -> ru_session_file_s, upload_p -> ru_req_p -> uri);
+		}
+
+	return status;
+}
+
+
+void DeleteResumableUpload (ResumableUpload *upload_p)
+{
+	apr_status_t status = apr_file_remove (upload_p -> ru_session_file_s, upload_p -> ru_pool_p);
+
+	if ((status != APR_SUCCESS) && (!APR_STATUS_IS_ENOENT (status)))
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_WARNING, status, upload_p -> ru_req_p, "Failed to remove upload session \"%s\"", upload_p -> ru_session_file_s);
+		}
+}
+
+
+json_t *GetResumableUploadStatus (const davrods_dir_conf_t *conf_p, const char *username_s, const char *rods_path_s, const apr_off_t total, apr_pool_t *pool_p)
+{
+	json_t *status_p = NULL;
+
+	if (conf_p -> resumable_uploads_dir_s)
+		{
+			char *id_s = GetSessionId (username_s, rods_path_s, total, pool_p);
+
+			if (id_s)
+				{
+					const char *session_file_s = apr_pstrcat (pool_p, conf_p -> resumable_uploads_dir_s, "/", id_s, NULL);
+					apr_array_header_t *ranges_p = NULL;
+					apr_file_t *file_p = NULL;
+					apr_status_t status = apr_file_open (&file_p, session_file_s, APR_FOPEN_READ, APR_FPROT_OS_DEFAULT, pool_p);
+
+					if (status == APR_SUCCESS)
+						{
+							if (apr_file_lock (file_p, APR_FLOCK_SHARED) == APR_SUCCESS)
+								{
+									ranges_p = ReadRanges (file_p, pool_p);
+									apr_file_unlock (file_p);
+								}
+
+							apr_file_close (file_p);
+						}
+					else if (APR_STATUS_IS_ENOENT (status))
+						{
+							ranges_p = apr_array_make (pool_p, 1, sizeof (UploadRange));
+						}
+
+					if (ranges_p)
+						{
+							json_t *ranges_json_p = json_array ();
+
+							if (ranges_json_p)
+								{
+									int i;
+									bool success_flag = true;
+
+									for (i = 0; (i < ranges_p -> nelts) && success_flag; ++ i)
+										{
+											const UploadRange *range_p = & APR_ARRAY_IDX (ranges_p, i, UploadRange);
+											json_t *range_json_p = json_pack ("[II]", (json_int_t) (range_p -> ur_start), (json_int_t) (range_p -> ur_end));
+
+											if (!((range_json_p) && (json_array_append_new (ranges_json_p, range_json_p) == 0)))
+												{
+													success_flag = false;
+												}
+										}
+
+									if (success_flag)
+										{
+											status_p = json_pack ("{s:s,s:I,s:I,s:o}", "path", rods_path_s, "total", (json_int_t) total,
+												"offset", (json_int_t) GetContiguousOffset (ranges_p), "ranges", ranges_json_p);
+										}
+									else
+										{
+											json_decref (ranges_json_p);
+										}
+								}
+						}
+
+				}		/* if (id_s) */
+		}
+
+	return status_p;
+}
+
+
+const char *SetResumableUploadsDirectory (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	conf_p -> resumable_uploads_dir_s = arg_p;
+
+	return NULL;
+}
+
+
+static apr_status_t OpenSessionFile (ResumableUpload *upload_p, apr_file_t **file_pp)
+{
+	apr_pool_t *pool_p = upload_p -> ru_pool_p;
+	const apr_int32_t flags = APR_FOPEN_CREATE | APR_FOPEN_READ | APR_FOPEN_WRITE;
+	const apr_fileperms_t perms = APR_FPROT_UREAD | APR_FPROT_UWRITE;
+	apr_status_t status = apr_file_open (file_pp, upload_p -> ru_session_file_s, flags, perms, pool_p);
+
+	if (APR_STATUS_IS_ENOENT (status))
+		{
+			const char *dir_s = ap_make_dirstr_parent (pool_p, upload_p -> ru_session_file_s);
+
+			if ((status = apr_dir_make_recursive (dir_s, APR_FPROT_OS_DEFAULT, pool_p)) == APR_SUCCESS)
+				{
+					status = apr_file_open (file_pp, upload_p -> ru_session_file_s, flags, perms, pool_p);
+				}
+		}
+
+	return status;
+}
+
+
+static void DeleteUploadObject (ResumableUpload *upload_p, rcComm_t *connection_p)
+{
+	dataObjInp_t unlink_params;
+	int status;
+
+	memset (&unlink_params, 0, sizeof (dataObjInp_t));
+	apr_cpystrn (unlink_params.objPath, upload_p -> ru_object_path_s, MAX_NAME_LEN);
+
+	/* There's no need to keep a partial upload in the trash */
+	addKeyVal (& (unlink_params.condInput), FORCE_FLAG_KW, "");
+
+	status = rcDataObjUnlink (connection_p, &unlink_params);
+	clearKeyVal (& (unlink_params.condInput));
+
+	if ((status < 0) && (status != CAT_NO_ROWS_FOUND))
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, upload_p -> ru_req_p, "Failed to remove \"%s\" for expired upload session: %d = %s", upload_p -> ru_object_path_s, status, get_rods_error_msg (status));
+		}
+}
+
+
+/*
+ * Parse a header such as "Content-Range: bytes 0-1048575/209715200". Ranges
+ * without a total length can't be tracked as part of an upload session.
+ */
+static bool ParseContentRange (const char *header_s, apr_off_t *start_p, apr_off_t *end_p, apr_off_t *total_p)
+{
+	bool success_flag = false;
+
+	if (strncasecmp (header_s, "bytes ", 6) == 0)
+		{
+			char *end_s = NULL;
+
+			header_s += 6;
+
+			if ((apr_strtoff (start_p, header_s, &end_s, 10) == APR_SUCCESS) && (*end_s == '-'))
+				{
+					header_s = end_s + 1;
+
+					if ((apr_strtoff (end_p, header_s, &end_s, 10) == APR_SUCCESS) && (*end_s == '/'))
+						{
+							header_s = end_s + 1;
+
+							if ((apr_strtoff (total_p, header_s, &end_s, 10) == APR_SUCCESS) && (*end_s == '\0'))
+								{
+									success_flag = (*start_p >= 0) && (*start_p <= *end_p) && (*end_p < *total_p);
+								}
+						}
+				}
+		}
+
+	return success_flag;
+}
+
+
+static char *GetSessionId (const char *username_s, const char *rods_path_s, const apr_off_t total, apr_pool_t *pool_p)
+{
+	char *id_s = NULL;
+	char *key_s = apr_psprintf (pool_p, "%s\n%s\n%" APR_OFF_T_FMT, username_s, rods_path_s, total);
+
+	if (key_s)
+		{
+			unsigned char digest [APR_MD5_DIGESTSIZE];
+
+			if (apr_md5 (digest, key_s, strlen (key_s)) == APR_SUCCESS)
+				{
+					id_s = apr_palloc (pool_p, (2 * APR_MD5_DIGESTSIZE) + 1);
+
+					if (id_s)
+						{
+							int i;
+
+							for (i = 0; i < APR_MD5_DIGESTSIZE; ++ i)
+								{
+									apr_snprintf (id_s + (2 * i), 3, "%02x", digest [i]);
+								}
+						}
+				}
+		}
+
+	return id_s;
+}
+
+
+static apr_array_header_t *ReadRanges (apr_file_t *file_p, apr_pool_t *pool_p)
+{
+	apr_array_header_t *ranges_p = apr_array_make (pool_p, 8, sizeof (UploadRange));
+
+	if (ranges_p)
+		{
+			char line_s [128];
+
+			while (apr_file_gets (line_s, sizeof (line_s), file_p) == APR_SUCCESS)
+				{
+					UploadRange range;
+
+					if (sscanf (line_s, "%" APR_OFF_T_FMT " %" APR_OFF_T_FMT, & (range.ur_start), & (range.ur_end)) == 2)
+						{
+							APR_ARRAY_PUSH (ranges_p, UploadRange) = range;
+						}
+				}
+		}
+
+	return ranges_p;
+}
+
+
+static apr_status_t WriteRanges (apr_file_t *file_p, const apr_array_header_t *ranges_p)
+{
+	apr_off_t offset = 0;
+	apr_status_t status = apr_file_trunc (file_p, 0);
+
+	if (status == APR_SUCCESS)
+		{
+			status = apr_file_seek (file_p, APR_SET, &offset);
+		}
+
+	/* Keep the session marked as started */
+	if (status == APR_SUCCESS)
+		{
+			status = apr_file_puts (S_STARTED_MARKER_S, file_p);
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			int i;
+
+			for (i = 0; (i < ranges_p -> nelts) && (status == APR_SUCCESS); ++ i)
+				{
+					const UploadRange *range_p = & APR_ARRAY_IDX (ranges_p, i, UploadRange);
+
+					if (apr_file_printf (file_p, "%" APR_OFF_T_FMT " %" APR_OFF_T_FMT "\n", range_p -> ur_start, range_p -> ur_end) < 0)
+						{
+							status = APR_EGENERAL;
+						}
+				}
+		}
+
+	return status;
+}
+
+
+/*
+ * Add a range and merge any ranges that now overlap or touch each other.
+ */
+static void AddRange (apr_array_header_t *ranges_p, const apr_off_t start, const apr_off_t end)
+{
+	if (end > start)
+		{
+			UploadRange *range_p = (UploadRange *) apr_array_push (ranges_p);
+			int i;
+			int j = 0;
+
+			range_p -> ur_start = start;
+			range_p -> ur_end = end;
+
+			qsort (ranges_p -> elts, ranges_p -> nelts, sizeof (UploadRange), CompareRanges);
+
+			for (i = 1; i < ranges_p -> nelts; ++ i)
+				{
+					UploadRange *last_p = & APR_ARRAY_IDX (ranges_p, j, UploadRange);
+					const UploadRange *current_p = & APR_ARRAY_IDX (ranges_p, i, UploadRange);
+
+					if (current_p -> ur_start <= last_p -> ur_end)
+						{
+							if (current_p -> ur_end > last_p -> ur_end)
+								{
+									last_p -> ur_end = current_p -> ur_end;
+								}
+						}
+					else
+						{
+							++ j;
+							APR_ARRAY_IDX (ranges_p, j, UploadRange) = *current_p;
+						}
+				}
+
+			ranges_p -> nelts = j + 1;
+		}
+}
+
+
+static int CompareRanges (const void *v0_p, const void *v1_p)
+{
+	const UploadRange *range0_p = (const UploadRange *) v0_p;
+	const UploadRange *range1_p = (const UploadRange *) v1_p;
+
+	if (range0_p -> ur_start < range1_p -> ur_start)
+		{
+			return -1;
+		}
+	else if (range0_p -> ur_start > range1_p -> ur_start)
+		{
+			return 1;
+		}
+
+	return 0;
+}
+
+
+static apr_off_t GetContiguousOffset (const apr_array_header_t *ranges_p)
+{
+	apr_off_t offset = 0;
+
+	if (ranges_p -> nelts > 0)
+		{
+			const UploadRange *range_p = & APR_ARRAY_IDX (ranges_p, 0, UploadRange);
+
+			if (range_p -> ur_start == 0)
+				{
+					offset = range_p -> ur_end;
+				}
+		}
+
+	return offset;
+}
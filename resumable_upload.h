@@ -0,0 +1,168 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * resumable_upload.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef RESUMABLE_UPLOAD_H_
+#define RESUMABLE_UPLOAD_H_
+
+#include <stdbool.h>
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "mod_dav.h"
+
+#include "jansson.h"
+
+#include <irods/rodsClient.h>
+
+#include "config.h"
+
+
+/**
+ * An upload that is sent as a series of Content-Range PUT requests.
+ * The chunks are written into a temporary data object and the ranges
+ * that have been written are stored in a session file on this host
+ * until the whole of the data object has been received.
+ */
+typedef struct ResumableUpload ResumableUpload;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Get the upload session for a Content-Range PUT request.
+ *
+ * @param resource_p The resource being uploaded to.
+ * @param pool_p The pool to allocate the ResumableUpload from.
+ * @return The ResumableUpload or <code>NULL</code> if resumable uploads
+ * are not enabled or the request is not a Content-Range PUT with a known
+ * total length.
+ */
+ResumableUpload *GetResumableUpload (const dav_resource *resource_p, apr_pool_t *pool_p);
+
+
+/**
+ * Get the path of the temporary data object that the chunks are
+ * written to.
+ *
+ * @param upload_p The ResumableUpload.
+ * @return The path.
+ */
+const char *GetResumableUploadObjectPath (const ResumableUpload *upload_p);
+
+
+/**
+ * Lock the session file for an upload, so that only one of any chunks
+ * that arrive at the same time creates the temporary data object. If the
+ * session has expired, its temporary data object is removed and the
+ * session is started again.
+ *
+ * @param upload_p The ResumableUpload.
+ * @param connection_p The connection to use to remove the temporary
+ * data object of an expired session.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t LockResumableUpload (ResumableUpload *upload_p, rcComm_t *connection_p);
+
+
+/**
+ * Record that the temporary data object has been created. The session
+ * must be locked by LockResumableUpload.
+ *
+ * @param upload_p The ResumableUpload.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t MarkResumableUploadStarted (ResumableUpload *upload_p);
+
+
+/**
+ * Release the lock taken by LockResumableUpload.
+ *
+ * @param upload_p The ResumableUpload.
+ */
+void UnlockResumableUpload (ResumableUpload *upload_p);
+
+
+/**
+ * Check whether the temporary data object has already been created for
+ * this upload. This is only known once the session has been locked.
+ *
+ * @param upload_p The ResumableUpload.
+ * @return <code>true</code> if the temporary data object should already
+ * exist, <code>false</code> if it needs creating.
+ */
+bool HasResumableUploadStarted (const ResumableUpload *upload_p);
+
+
+/**
+ * Record the chunk written by this request in the session file. The
+ * number of contiguous bytes from the start of the data object that
+ * have been written is returned to the client in an Upload-Offset
+ * header.
+ *
+ * @param upload_p The ResumableUpload.
+ * @param num_bytes The number of bytes of the chunk that were written.
+ * This can be less than the size of the range if the request was
+ * interrupted.
+ * @param complete_flag_p This will be set to <code>true</code> if the
+ * whole of the data object has now been written.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t EndResumableUploadChunk (ResumableUpload *upload_p, const apr_off_t num_bytes, bool *complete_flag_p);
+
+
+/**
+ * Remove the session file for an upload once it has finished or has
+ * to be started again.
+ *
+ * @param upload_p The ResumableUpload.
+ */
+void DeleteResumableUpload (ResumableUpload *upload_p);
+
+
+/**
+ * Get the ranges that have been written so far for an upload.
+ *
+ * @param conf_p The configuration.
+ * @param username_s The user that is uploading the data object.
+ * @param rods_path_s The path of the data object.
+ * @param total The total size of the data object.
+ * @param pool_p The pool to use for any temporary allocations.
+ * @return A JSON object with the contiguous offset and the written
+ * ranges or <code>NULL</code> upon error. This should be freed with
+ * json_decref.
+ */
+json_t *GetResumableUploadStatus (const davrods_dir_conf_t *conf_p, const char *username_s, const char *rods_path_s, const apr_off_t total, apr_pool_t *pool_p);
+
+
+const char *SetResumableUploadsDirectory (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESUMABLE_UPLOAD_H_ */
@@ -0,0 +1,438 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * session_token.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <limits.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "session_token.h"
+#include "mod_davrods.h"
+
+#include "apr_base64.h"
+#include "apr_file_io.h"
+#include "apr_strings.h"
+
+#include "http_log.h"
+#include "util_cookies.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+static const char * const S_COOKIE_NAME_S = "davrods_session_token";
+
+static const char * const S_COOKIE_ATTRIBUTES_S = "path=/;HttpOnly;Secure;SameSite=Lax";
+
+/** The request note that holds the user authenticated by a session token. */
+static const char * const S_TOKEN_USER_NOTE_S = "davrods-session-token-user";
+
+/** The characters that can appear in a url-safe base64 value. */
+static const char * const S_BASE64_URL_CHARS_S = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/** The shortest key that tokens can be signed with. */
+static const apr_off_t S_MIN_KEY_LENGTH = 32;
+
+
+static const char *GetTokenFromRequest (request_rec *req_p, bool *cookie_flag_p);
+
+static bool ParseToken (const davrods_dir_conf_t *conf_p, const char *token_s, char **username_ss, apr_int64_t *expiry_p, apr_pool_t *pool_p);
+
+static char *CreateToken (const davrods_dir_conf_t *conf_p, const char *username_s, const apr_int64_t expiry, apr_pool_t *pool_p);
+
+static char *GetSignature (const davrods_dir_conf_t *conf_p, const char *payload_s, apr_pool_t *pool_p);
+
+static void WriteTokenCookie (request_rec *req_p, const davrods_dir_conf_t *conf_p, const char *username_s);
+
+static char *EncodeBase64Url (const unsigned char *data_p, const int length, apr_pool_t *pool_p);
+
+static char *DecodeBase64Url (const char *value_s, apr_pool_t *pool_p);
+
+
+
+int CheckSessionToken (request_rec *req_p)
+{
+	int res = DECLINED;
+	davrods_dir_conf_t *conf_p = ap_get_module_config (req_p -> per_dir_config, &davrods_module);
+
+	if ((conf_p) && (conf_p -> session_token_key_p) && (conf_p -> session_token_proxy_username_s))
+		{
+			bool cookie_flag = false;
+			const char *token_s = GetTokenFromRequest (req_p, &cookie_flag);
+
+			if (token_s)
+				{
+					char *username_s = NULL;
+					apr_int64_t expiry = 0;
+
+					if (ParseToken (conf_p, token_s, &username_s, &expiry, req_p -> pool))
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, req_p, "Authenticated \"%s\" using a session token", username_s);
+
+							req_p -> user = username_s;
+							req_p -> ap_auth_type = cookie_flag ? (char *) "Cookie" : (char *) "Bearer";
+							apr_table_setn (req_p -> notes, S_TOKEN_USER_NOTE_S, username_s);
+
+							/* Refresh cookies once they are half way through their lifetime */
+							if ((cookie_flag) && (expiry - apr_time_sec (apr_time_now ()) < (conf_p -> session_token_lifetime / 2)))
+								{
+									WriteTokenCookie (req_p, conf_p, username_s);
+								}
+
+							res = OK;
+						}
+					else
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, req_p, "Ignoring invalid or expired session token");
+						}
+				}
+		}
+
+	return res;
+}
+
+
+bool IsSessionTokenRequest (const request_rec *req_p)
+{
+	bool token_flag = false;
+
+	while ((req_p) && (!token_flag))
+		{
+			if (apr_table_get (req_p -> notes, S_TOKEN_USER_NOTE_S))
+				{
+					token_flag = true;
+				}
+			else
+				{
+					req_p = req_p -> main;
+				}
+		}
+
+	return token_flag;
+}
+
+
+void IssueSessionToken (request_rec *req_p, const char *username_s)
+{
+	davrods_dir_conf_t *conf_p = ap_get_module_config (req_p -> per_dir_config, &davrods_module);
+
+	if ((conf_p) && (conf_p -> session_token_key_p) && (conf_p -> session_token_proxy_username_s))
+		{
+			if (!IsSessionTokenRequest (req_p))
+				{
+					WriteTokenCookie (req_p, conf_p, username_s);
+				}
+		}
+}
+
+
+const char *SetSessionTokenKeyFile (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+	const char *path_s = ap_server_root_relative (cmd_p -> pool, arg_p);
+	apr_file_t *file_p = NULL;
+	apr_status_t status = apr_file_open (&file_p, path_s, APR_FOPEN_READ | APR_FOPEN_BINARY, APR_OS_DEFAULT, cmd_p -> pool);
+
+	if (status == APR_SUCCESS)
+		{
+			apr_finfo_t info;
+
+			status = apr_file_info_get (&info, APR_FINFO_SIZE, file_p);
+
+			if (status == APR_SUCCESS)
+				{
+					if (info.size >= S_MIN_KEY_LENGTH)
+						{
+							unsigned char *key_p = apr_palloc (cmd_p -> pool, (apr_size_t) info.size);
+							apr_size_t num_read = 0;
+
+							status = apr_file_read_full (file_p, key_p, (apr_size_t) info.size, &num_read);
+
+							if (status == APR_SUCCESS)
+								{
+									conf_p -> session_token_key_p = key_p;
+									conf_p -> session_token_key_length = num_read;
+								}
+							else
+								{
+									res_s = apr_psprintf (cmd_p -> pool, "Failed to read session token key from \"%s\"", path_s);
+								}
+						}
+					else
+						{
+							res_s = apr_psprintf (cmd_p -> pool, "The session token key in \"%s\" must be at least %" APR_OFF_T_FMT " bytes long", path_s, S_MIN_KEY_LENGTH);
+						}
+				}
+			else
+				{
+					res_s = apr_psprintf (cmd_p -> pool, "Failed to get the size of session token key file \"%s\"", path_s);
+				}
+
+			apr_file_close (file_p);
+		}
+	else
+		{
+			res_s = apr_psprintf (cmd_p -> pool, "Failed to open session token key file \"%s\"", path_s);
+		}
+
+	return res_s;
+}
+
+
+const char *SetSessionTokenLifetime (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+	apr_int64_t lifetime = apr_atoi64 (arg_p);
+
+	if ((lifetime > 0) && (lifetime <= INT_MAX))
+		{
+			conf_p -> session_token_lifetime = (int) lifetime;
+		}
+	else
+		{
+			res_s = apr_psprintf (cmd_p -> pool, "Invalid session token lifetime \"%s\"", arg_p);
+		}
+
+	return res_s;
+}
+
+
+const char *SetSessionTokenProxyUser (cmd_parms *cmd_p, void *config_p, const char *username_s, const char *password_s)
+{
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	conf_p -> session_token_proxy_username_s = username_s;
+	conf_p -> session_token_proxy_password_s = password_s;
+
+	return NULL;
+}
+
+
+/*
+ * Tokens are accepted from "Authorization: Bearer <token>" headers
+ * and from the cookie that IssueSessionToken sets.
+ */
+static const char *GetTokenFromRequest (request_rec *req_p, bool *cookie_flag_p)
+{
+	const char *token_s = NULL;
+	const char *auth_s = apr_table_get (req_p -> headers_in, "Authorization");
+
+	if ((auth_s) && (strncasecmp (auth_s, "Bearer ", 7) == 0))
+		{
+			token_s = auth_s + 7;
+
+			while (apr_isspace (*token_s))
+				{
+					++ token_s;
+				}
+
+			*cookie_flag_p = false;
+		}
+	else
+		{
+			const char *value_s = NULL;
+
+			if ((ap_cookie_read (req_p, S_COOKIE_NAME_S, &value_s, 0) == APR_SUCCESS) && (value_s) && (*value_s != '\0'))
+				{
+					token_s = value_s;
+					*cookie_flag_p = true;
+				}
+		}
+
+	return token_s;
+}
+
+
+/*
+ * A token is "<payload>.<signature>" where the payload is
+ * "<username>\n<zone>\n<expiry time in seconds>" and the signature
+ * is its HMAC-SHA256, both encoded as url-safe base64.
+ */
+static bool ParseToken (const davrods_dir_conf_t *conf_p, const char *token_s, char **username_ss, apr_int64_t *expiry_p, apr_pool_t *pool_p)
+{
+	bool valid_flag = false;
+	const char *separator_s = strchr (token_s, '.');
+
+	if (separator_s)
+		{
+			char *payload_s = DecodeBase64Url (apr_pstrmemdup (pool_p, token_s, separator_s - token_s), pool_p);
+
+			if (payload_s)
+				{
+					const char *signature_s = separator_s + 1;
+					const char *expected_signature_s = GetSignature (conf_p, payload_s, pool_p);
+
+					if (expected_signature_s)
+						{
+							const size_t length = strlen (expected_signature_s);
+
+							if ((strlen (signature_s) == length) && (CRYPTO_memcmp (signature_s, expected_signature_s, length) == 0))
+								{
+									char *state_p = NULL;
+									char *username_s = apr_strtok (payload_s, "\n", &state_p);
+									char *zone_s = apr_strtok (NULL, "\n", &state_p);
+									char *expiry_s = apr_strtok (NULL, "\n", &state_p);
+
+									if ((username_s) && (zone_s) && (expiry_s) && (strcmp (zone_s, conf_p -> rods_zone) == 0))
+										{
+											const apr_int64_t expiry = apr_atoi64 (expiry_s);
+
+											if (expiry > apr_time_sec (apr_time_now ()))
+												{
+													*username_ss = username_s;
+													*expiry_p = expiry;
+													valid_flag = true;
+												}
+										}
+								}
+						}
+				}
+		}
+
+	return valid_flag;
+}
+
+
+static char *CreateToken (const davrods_dir_conf_t *conf_p, const char *username_s, const apr_int64_t expiry, apr_pool_t *pool_p)
+{
+	char *token_s = NULL;
+	char *payload_s = apr_psprintf (pool_p, "%s\n%s\n%" APR_INT64_T_FMT, username_s, conf_p -> rods_zone, expiry);
+	char *signature_s = GetSignature (conf_p, payload_s, pool_p);
+
+	if (signature_s)
+		{
+			char *encoded_payload_s = EncodeBase64Url ((const unsigned char *) payload_s, (int) strlen (payload_s), pool_p);
+
+			if (encoded_payload_s)
+				{
+					token_s = apr_pstrcat (pool_p, encoded_payload_s, ".", signature_s, NULL);
+				}
+		}
+
+	return token_s;
+}
+
+
+static char *GetSignature (const davrods_dir_conf_t *conf_p, const char *payload_s, apr_pool_t *pool_p)
+{
+	char *signature_s = NULL;
+	unsigned char digest [EVP_MAX_MD_SIZE];
+	unsigned int digest_length = 0;
+
+	if (HMAC (EVP_sha256 (), conf_p -> session_token_key_p, (int) conf_p -> session_token_key_length, (const unsigned char *) payload_s, strlen (payload_s), digest, &digest_length))
+		{
+			signature_s = EncodeBase64Url (digest, (int) digest_length, pool_p);
+		}
+
+	return signature_s;
+}
+
+
+static void WriteTokenCookie (request_rec *req_p, const davrods_dir_conf_t *conf_p, const char *username_s)
+{
+	const apr_int64_t expiry = apr_time_sec (apr_time_now ()) + conf_p -> session_token_lifetime;
+	char *token_s = CreateToken (conf_p, username_s, expiry, req_p -> pool);
+
+	if (token_s)
+		{
+			ap_cookie_write (req_p, S_COOKIE_NAME_S, token_s, S_COOKIE_ATTRIBUTES_S, conf_p -> session_token_lifetime, req_p -> err_headers_out, NULL);
+		}
+	else
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, req_p, "Failed to create session token for \"%s\"", username_s);
+		}
+}
+
+
+static char *EncodeBase64Url (const unsigned char *data_p, const int length, apr_pool_t *pool_p)
+{
+	char *encoded_s = apr_palloc (pool_p, apr_base64_encode_len (length));
+
+	if (encoded_s)
+		{
+			char *c_p = encoded_s;
+
+			apr_base64_encode_binary (encoded_s, data_p, length);
+
+			/* Swap to the url-safe alphabet and remove the padding */
+			while (*c_p != '\0')
+				{
+					if (*c_p == '+')
+						{
+							*c_p = '-';
+						}
+					else if (*c_p == '/')
+						{
+							*c_p = '_';
+						}
+					else if (*c_p == '=')
+						{
+							*c_p = '\0';
+						}
+
+					if (*c_p != '\0')
+						{
+							++ c_p;
+						}
+				}
+		}
+
+	return encoded_s;
+}
+
+
+static char *DecodeBase64Url (const char *value_s, apr_pool_t *pool_p)
+{
+	char *decoded_s = NULL;
+	const size_t length = strlen (value_s);
+
+	/* apr_base64_decode stops quietly at invalid characters, so check for them first */
+	if ((length > 0) && (strspn (value_s, S_BASE64_URL_CHARS_S) == length))
+		{
+			char *standard_s = apr_pstrdup (pool_p, value_s);
+			char *c_p;
+
+			for (c_p = standard_s; *c_p != '\0'; ++ c_p)
+				{
+					if (*c_p == '-')
+						{
+							*c_p = '+';
+						}
+					else if (*c_p == '_')
+						{
+							*c_p = '/';
+						}
+				}
+
+			decoded_s = apr_palloc (pool_p, apr_base64_decode_len (standard_s));
+
+			if (decoded_s)
+				{
+					apr_base64_decode (decoded_s, standard_s);
+				}
+		}
+
+	return decoded_s;
+}
@@ -0,0 +1,87 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * session_token.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SESSION_TOKEN_H_
+#define SESSION_TOKEN_H_
+
+#include <stdbool.h>
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "config.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * The check_authn hook that authenticates a request using a signed
+ * session token, sent either as a cookie or as an
+ * "Authorization: Bearer" header. Only the signature and expiry time
+ * of the token are checked, so no credentials are sent to iRODS.
+ *
+ * @param req_p The request.
+ * @return OK if the request has a valid session token, DECLINED
+ * otherwise so that the other authentication providers are used.
+ */
+int CheckSessionToken (request_rec *req_p);
+
+
+/**
+ * Check whether a request was authenticated by CheckSessionToken.
+ *
+ * @param req_p The request.
+ * @return <code>true</code> if the request has a valid session token,
+ * <code>false</code> otherwise.
+ */
+bool IsSessionTokenRequest (const request_rec *req_p);
+
+
+/**
+ * Send a new session token as a cookie after a user has logged in
+ * with their password. This does nothing if session tokens are not
+ * enabled.
+ *
+ * @param req_p The request that the user logged in on.
+ * @param username_s The user that logged in.
+ */
+void IssueSessionToken (request_rec *req_p, const char *username_s);
+
+
+const char *SetSessionTokenKeyFile (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+const char *SetSessionTokenLifetime (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+const char *SetSessionTokenProxyUser (cmd_parms *cmd_p, void *config_p, const char *username_s, const char *password_s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SESSION_TOKEN_H_ */
@@ -30,8 +30,12 @@
 #include "rest.h"
 
 #include "listing.h"
+#include "collection_listing.h"
 
 #include "frictionless_data_package.h"
+#include "listing_prefetch.h"
+
+#include "util_script.h"
 
 
 static const char *S_FILE_PREFIX_S = "file:";
@@ -72,6 +76,12 @@ static apr_status_t PrintTableHeader (const char *heading_s, const char *default
 
 static int IsColumnDisplayed (const char *heading_s);
 
+static apr_status_t PrintDataPackageRow (const struct HtmlTheme *theme_p, unsigned int row_index, apr_bucket_brigade *bucket_brigade_p);
+
+static apr_status_t PrintItemWithMetadata (struct HtmlTheme *theme_p, const IRodsObject *irods_obj_p, const apr_array_header_t *metadata_array_p, const IRodsConfig *config_p, unsigned int row_index, apr_bucket_brigade *bb_p, apr_pool_t *pool_p, rcComm_t *connection_p, request_rec *req_p);
+
+static apr_status_t PrintPrefetchedItems (ListingPrefetch *prefetch_p, struct HtmlTheme *theme_p, const IRodsConfig *config_p, unsigned int row_index, apr_bucket_brigade *bb_p, apr_pool_t *pool_p, rcComm_t *connection_p, request_rec *req_p);
+
 
 /*************************************/
 
@@ -158,6 +168,10 @@ struct HtmlTheme *AllocateHtmlTheme (apr_pool_t *pool_p)
 
 			theme_p -> ht_fd_save_datapackages_flag = 0;
 
+			theme_p -> ht_fd_cache_dir_s = NULL;
+
+			theme_p -> ht_fd_sniff_headers_flag = 0;
+
 		}
 
 	return theme_p;
@@ -171,7 +185,9 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 	request_rec *req_p = davrods_resource_p -> r;
 	apr_pool_t *pool_p = resource_p -> pool;
 	int status;
-	collHandle_t  collection_handle;
+	CollectionListing collection_listing;
+	ListingOptions listing_options;
+	apr_table_t *params_p = NULL;
 	davrods_dir_conf_t *conf_p = davrods_resource_p->conf;
 	struct HtmlTheme *theme_p = conf_p -> theme_p;
 
@@ -194,10 +210,38 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 		}
 
 
-	memset (&collection_handle, 0, sizeof (collHandle_t));
+	/*
+	 * Get any sorting, filtering and paging options so that they can be
+	 * compiled into the listing query.
+	 */
+	InitListingOptions (&listing_options);
+	ap_args_to_table (req_p, &params_p);
+
+	if (SetListingOptionsFromParameters (&listing_options, params_p, pool_p) != APR_SUCCESS)
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_BADARG, req_p, "Invalid listing parameters \"%s\", ignoring them", req_p -> args ? req_p -> args : "");
+			InitListingOptions (&listing_options);
+		}
+
+	/*
+	 * Only list the replicas on the selected resources, picking the
+	 * first of these that holds each data object.
+	 */
+	listing_options.lo_resources_ss = theme_p -> ht_resources_ss;
+
+	/*
+	 * If the listing includes every data object, it can tell us whether
+	 * there is a real datapackage.json without us having to stat it. This
+	 * isn't the case when only some resources are shown, as the real file
+	 * could be on one of the hidden ones.
+	 */
+	if ((theme_p -> ht_show_fd_data_packages_flag > 0) && (IsFullListing (&listing_options)) && (!listing_options.lo_resources_ss))
+		{
+			listing_options.lo_watched_name_s = GetDataPackageFilename ();
+		}
 
 	// Open the collection
-	status = rclOpenCollection (davrods_resource_p -> rods_conn, davrods_resource_p -> rods_path, DATA_QUERY_FIRST_FG | LONG_METADATA_FG | NO_TRIM_REPL_FG, &collection_handle);
+	status = OpenCollectionListing (&collection_listing, davrods_resource_p -> rods_path, &listing_options, davrods_resource_p -> rods_conn, pool_p);
 
 	if (status >= 0)
 		{
@@ -214,64 +258,50 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 						{
 							int row_index = 0;
 							collEnt_t coll_entry;
+							ListingPrefetch *prefetch_p = NULL;
+							int prefetch_row_index = 0;
+
+							apr_bucket_brigade *rows_bb_p = bucket_brigade_p;
 
 							/*
 							 * Add the datapackage.json entry to the listing?
 							 */
 							if (theme_p -> ht_show_fd_data_packages_flag > 0)
 								{
-									/*
-									 * Don't add it if it already exists
-									 */
-									if (!DoesFDDataPackageExist (resource_p))
+									if (listing_options.lo_watched_name_s)
 										{
-											status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<tr class=\"odd\">");
-											const char *icon_s = theme_p -> ht_fd_resource_data_package_icon_s;
-
-											if (!icon_s)
-												{
-													icon_s = GetIRodsObjectIconForExtension ("json", theme_p);
-												}
-
-											if (icon_s)
-												{
-													status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"icon\"><img src=\"%s\" alt=\"Frictionless Data Data Package\" /></td>", icon_s);
-												}
-											else
-												{
-													status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"icon\"></td>");
-												}
-
-											if (IsColumnDisplayed (theme_p -> ht_name_heading_s))
-												{
-													status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"name\"><a href=\"./datapackage.json\">datapackage.json</a></td>");
-												}
-
-											if (IsColumnDisplayed (theme_p -> ht_size_heading_s))
-												{
-													status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"size\"></td>");
-												}
-
-
-											if (IsColumnDisplayed (theme_p -> ht_date_heading_s))
-												{
-													status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"time\"></td>");
-												}
-
-											if (IsColumnDisplayed (theme_p -> ht_checksum_heading_s))
-												{
-													status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"checksum\"></td>");
-												}
-
-											if (theme_p -> ht_show_metadata_flag != MD_NONE)
-												{
-													status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"metatable empty\"></td>");
-												}
-
+											/*
+											 * We won't know whether the datapackage.json already exists until
+											 * the listing is finished, so print the rows separately and add the
+											 * entry before them afterwards if it is needed. Since it might not
+											 * be printed, it isn't counted in row_index.
+											 */
+											rows_bb_p = apr_brigade_create (pool_p, output_p -> c -> bucket_alloc);
+										}
+									else if (!DoesFDDataPackageExist (resource_p))
+										{
+											/*
+											 * Don't add it if it already exists
+											 */
+											status = PrintDataPackageRow (theme_p, row_index, bucket_brigade_p);
 											++ row_index;
-
 										}
+								}
 
+							/*
+							 * With a separate catalog connection, the metadata and missing
+							 * checksums can be looked up on it by another thread while this
+							 * one pages through the listing on the data connection.
+							 */
+							if ((theme_p -> ht_show_metadata_flag == MD_FULL) || (theme_p -> ht_show_checksums_flag > 0))
+								{
+									rcComm_t *catalog_connection_p = GetIRodsCatalogConnection (req_p, davrods_resource_p -> rods_conn);
+
+									if (catalog_connection_p)
+										{
+											prefetch_p = StartListingPrefetch (catalog_connection_p, (theme_p -> ht_show_metadata_flag == MD_FULL), (theme_p -> ht_show_checksums_flag > 0), pool_p);
+											prefetch_row_index = row_index;
+										}
 								}
 
 							memset (&coll_entry, 0, sizeof (collEnt_t));
@@ -279,13 +309,13 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 							// Actually print the directory listing, one table row at a time.
 							do
 								{
-									status = rclReadCollection (davrods_resource_p -> rods_conn, &collection_handle, &coll_entry);
+									status = ReadCollectionListing (&collection_listing, &coll_entry);
 
 									if (status >= 0)
 										{
 											IRodsObject irods_obj;
 
-											if ((coll_entry.objType == DATA_OBJ_T) && (theme_p -> ht_show_checksums_flag > 0))
+											if ((coll_entry.objType == DATA_OBJ_T) && (theme_p -> ht_show_checksums_flag > 0) && (!prefetch_p))
 												{
 													size_t l = coll_entry.chksum ? strlen (coll_entry.chksum) : 0;
 
@@ -300,46 +330,36 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 
 											if (apr_status == APR_SUCCESS)
 												{
-													int show_item_flag = 1;
-
-													if (irods_obj.io_obj_type == DATA_OBJ_T)
+													if (prefetch_p)
 														{
-															if (theme_p -> ht_resources_ss)
+															/*
+															 * The row is printed once its lookups are done. If it
+															 * can't be queued, PrintPrefetchedItems does them on the
+															 * data connection when it is printed.
+															 */
+															apr_status = AddToListingPrefetch (prefetch_p, &irods_obj);
+															++ row_index;
+
+															if (apr_status != APR_SUCCESS)
 																{
-																	char **resources_ss = theme_p -> ht_resources_ss;
-																	int loop_flag = 1;
-
-																	show_item_flag = 0;
-
-																	while (loop_flag)
-																		{
-																			if (strcmp (irods_obj.io_resource_s, *resources_ss) == 0)
-																				{
-																					show_item_flag = 1;
-																					loop_flag = 0;
-																				}
-																			else
-																				{
-																					++ resources_ss;
-																					loop_flag = (*resources_ss != NULL) ? 1 : 0;
-																				}
-																		}
-																}
+																	const char *collection_s = coll_entry.collName ? coll_entry.collName : "";
+																	const char *data_object_s = coll_entry.dataName ? coll_entry.dataName : "";
 
+																	ap_log_rerror (APLOG_MARK, APLOG_WARNING, apr_status, req_p, "Failed to AddToListingPrefetch for \"%s\":\"%s\"", collection_s, data_object_s);
+																}
 														}
-
-													if (show_item_flag)
+													else
 														{
-															apr_status = PrintItem (conf_p -> theme_p, &irods_obj, &irods_config, row_index, bucket_brigade_p, pool_p, resource_p -> info -> rods_conn, req_p);
+															apr_status = PrintItem (conf_p -> theme_p, &irods_obj, &irods_config, row_index, rows_bb_p, pool_p, resource_p -> info -> rods_conn, req_p);
 															++ row_index;
-														}
 
-													if (apr_status != APR_SUCCESS)
-														{
-															const char *collection_s = coll_entry.collName ? coll_entry.collName : "";
-															const char *data_object_s = coll_entry.dataName ? coll_entry.dataName : "";
+															if (apr_status != APR_SUCCESS)
+																{
+																	const char *collection_s = coll_entry.collName ? coll_entry.collName : "";
+																	const char *data_object_s = coll_entry.dataName ? coll_entry.dataName : "";
 
-															ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "Failed to PrintItem for \"%s\":\"%s\"", collection_s, data_object_s);
+																	ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "Failed to PrintItem for \"%s\":\"%s\"", collection_s, data_object_s);
+																}
 														}
 												}
 											else
@@ -361,7 +381,7 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 												{
 													ap_log_rerror(APLOG_MARK, APLOG_ERR, APR_SUCCESS,
 																				req_p,
-																				"rcReadCollection failed for collection <%s> with error <%s>",
+																				"ReadCollectionListing failed for collection <%s> with error <%s>",
 																				davrods_resource_p->rods_path, get_rods_error_msg(status));
 
 													apr_brigade_destroy(bucket_brigade_p);
@@ -373,6 +393,36 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 								}
 							while (status >= 0);
 
+							if (prefetch_p)
+								{
+									apr_status = FinishListingPrefetch (prefetch_p, req_p);
+
+									if (apr_status != APR_SUCCESS)
+										{
+											ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "FinishListingPrefetch failed");
+										}
+
+									if (!res_p)
+										{
+											apr_status = PrintPrefetchedItems (prefetch_p, conf_p -> theme_p, &irods_config, prefetch_row_index, rows_bb_p, pool_p, davrods_resource_p -> rods_conn, req_p);
+										}
+								}
+
+							if (rows_bb_p != bucket_brigade_p)
+								{
+									/*
+									 * The rows after it were counted from 0, so give it the
+									 * other row class to keep them alternating.
+									 */
+									if (!collection_listing.cl_watched_name_found_flag)
+										{
+											PrintDataPackageRow (theme_p, 1, bucket_brigade_p);
+										}
+
+									APR_BRIGADE_CONCAT (bucket_brigade_p, rows_bb_p);
+									apr_brigade_destroy (rows_bb_p);
+								}
+
 						}		/* if (InitIRodsConfig (&irods_config, davrods_resource_p) == APR_SUCCESS) */
 					else
 						{
@@ -402,11 +452,11 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 
 			apr_brigade_destroy(bucket_brigade_p);
 
-			rclCloseCollection (&collection_handle);
-		}		/* if (collection_handle >= 0) */
+			CloseCollectionListing (&collection_listing);
+		}		/* if (status >= 0) */
 	else
 		{
-			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, req_p, "rcOpenCollection failed: %d = %s", status, get_rods_error_msg (status));
+			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, req_p, "OpenCollectionListing failed: %d = %s", status, get_rods_error_msg (status));
 
 			res_p = dav_new_error (pool_p, HTTP_INTERNAL_SERVER_ERROR, 0, status, "Could not open a collection");
 		}
@@ -911,6 +961,59 @@ apr_status_t PrintAllHTMLBeforeListing (struct dav_resource_private *davrods_res
 }
 
 
+/*
+ * Print the table row for a virtual datapackage.json
+ */
+static apr_status_t PrintDataPackageRow (const struct HtmlTheme *theme_p, unsigned int row_index, apr_bucket_brigade *bucket_brigade_p)
+{
+	apr_status_t status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<tr class=\"%s\">", (row_index % 2 == 0) ? "odd" : "even");
+	const char *icon_s = theme_p -> ht_fd_resource_data_package_icon_s;
+
+	if (!icon_s)
+		{
+			icon_s = GetIRodsObjectIconForExtension ("json", theme_p);
+		}
+
+	if (icon_s)
+		{
+			status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"icon\"><img src=\"%s\" alt=\"Frictionless Data Data Package\" /></td>", icon_s);
+		}
+	else
+		{
+			status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"icon\"></td>");
+		}
+
+	if (IsColumnDisplayed (theme_p -> ht_name_heading_s))
+		{
+			status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"name\"><a href=\"./datapackage.json\">datapackage.json</a></td>");
+		}
+
+	if (IsColumnDisplayed (theme_p -> ht_size_heading_s))
+		{
+			status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"size\"></td>");
+		}
+
+	if (IsColumnDisplayed (theme_p -> ht_date_heading_s))
+		{
+			status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"time\"></td>");
+		}
+
+	if (IsColumnDisplayed (theme_p -> ht_checksum_heading_s))
+		{
+			status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"checksum\"></td>");
+		}
+
+	if (theme_p -> ht_show_metadata_flag != MD_NONE)
+		{
+			status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"metatable empty\"></td>");
+		}
+
+	status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "</tr>\n");
+
+	return status;
+}
+
+
 static int IsColumnDisplayed (const char *heading_s)
 {
 	int res = (!heading_s || (strcmp (heading_s, THEME_HIDE_COLUMN_S) != 0)) ? 1 :0;
@@ -1018,6 +1121,16 @@ static apr_status_t PrintBreadcrumbs (struct dav_resource_private *davrods_resou
 }
 
 apr_status_t PrintItem (struct HtmlTheme *theme_p, const IRodsObject *irods_obj_p, const IRodsConfig *config_p, unsigned int row_index, apr_bucket_brigade *bb_p, apr_pool_t *pool_p, rcComm_t *connection_p, request_rec *req_p)
+{
+	return PrintItemWithMetadata (theme_p, irods_obj_p, NULL, config_p, row_index, bb_p, pool_p, connection_p, req_p);
+}
+
+
+/*
+ * Print a row of a listing. If metadata_array_p is NULL and the theme shows
+ * the metadata in full, it is looked up using connection_p.
+ */
+static apr_status_t PrintItemWithMetadata (struct HtmlTheme *theme_p, const IRodsObject *irods_obj_p, const apr_array_header_t *metadata_array_p, const IRodsConfig *config_p, unsigned int row_index, apr_bucket_brigade *bb_p, apr_pool_t *pool_p, rcComm_t *connection_p, request_rec *req_p)
 {
 	apr_status_t status = APR_SUCCESS;
 	const char *link_suffix_s = irods_obj_p -> io_obj_type == COLL_OBJ_T ? "/" : NULL;
@@ -1154,7 +1267,14 @@ apr_status_t PrintItem (struct HtmlTheme *theme_p, const IRodsObject *irods_obj_
 				{
 					const char *zone_s = NULL;
 
-					status = GetAndPrintMetadataForIRodsObject (irods_obj_p, config_p -> ic_metadata_root_link_s, zone_s, theme_p, bb_p, connection_p, req_p, pool_p);
+					if (metadata_array_p)
+						{
+							status = PrintMetadataForIRodsObject (irods_obj_p, metadata_array_p, config_p -> ic_metadata_root_link_s, theme_p, bb_p, req_p, pool_p);
+						}
+					else
+						{
+							status = GetAndPrintMetadataForIRodsObject (irods_obj_p, config_p -> ic_metadata_root_link_s, zone_s, theme_p, bb_p, connection_p, req_p, pool_p);
+						}
 
 					if (status == APR_SUCCESS)
 						{
@@ -1195,6 +1315,58 @@ apr_status_t PrintItem (struct HtmlTheme *theme_p, const IRodsObject *irods_obj_
 }
 
 
+static apr_status_t PrintPrefetchedItems (ListingPrefetch *prefetch_p, struct HtmlTheme *theme_p, const IRodsConfig *config_p, unsigned int row_index, apr_bucket_brigade *bb_p, apr_pool_t *pool_p, rcComm_t *connection_p, request_rec *req_p)
+{
+	apr_status_t status = APR_SUCCESS;
+	const size_t num_items = GetListingPrefetchSize (prefetch_p);
+	size_t i;
+
+	for (i = 0; i < num_items; ++ i, ++ row_index)
+		{
+			const IRodsObject *irods_obj_p = GetListingPrefetchObject (prefetch_p, i);
+			const apr_array_header_t *metadata_array_p = GetListingPrefetchMetadata (prefetch_p, i);
+			IRodsObject unqueued_obj;
+
+			/*
+			 * PrintItemWithMetadata gets the metadata itself if it is NULL, but
+			 * the checksum of an entry that couldn't be queued still needs doing.
+			 */
+			if ((theme_p -> ht_show_checksums_flag > 0) && (irods_obj_p -> io_obj_type == DATA_OBJ_T)
+					&& ((! (irods_obj_p -> io_checksum_s)) || (* (irods_obj_p -> io_checksum_s) == '\0'))
+					&& (!WasListingPrefetchQueued (prefetch_p, i)))
+				{
+					collEnt_t coll_entry;
+					char *checksum_s;
+
+					memset (&coll_entry, 0, sizeof (collEnt_t));
+					coll_entry.collName = irods_obj_p -> io_collection_s;
+					coll_entry.dataName = irods_obj_p -> io_data_s;
+
+					checksum_s = GetChecksum (&coll_entry, connection_p, pool_p);
+
+					if (checksum_s)
+						{
+							memcpy (&unqueued_obj, irods_obj_p, sizeof (IRodsObject));
+							unqueued_obj.io_checksum_s = checksum_s;
+							irods_obj_p = &unqueued_obj;
+						}
+				}
+
+			status = PrintItemWithMetadata (theme_p, irods_obj_p, metadata_array_p, config_p, row_index, bb_p, pool_p, connection_p, req_p);
+
+			if (status != APR_SUCCESS)
+				{
+					const char *collection_s = irods_obj_p -> io_collection_s ? irods_obj_p -> io_collection_s : "";
+					const char *data_object_s = irods_obj_p -> io_data_s ? irods_obj_p -> io_data_s : "";
+
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, status, req_p, "Failed to PrintItem for \"%s\":\"%s\"", collection_s, data_object_s);
+				}
+		}
+
+	return status;
+}
+
+
 int GetEditableFlag (const struct HtmlTheme  * const theme_p, apr_table_t *params_p, apr_pool_t *pool_p)
 {
 	int editable_flag = theme_p -> ht_metadata_editable_flag;
@@ -1813,6 +1985,10 @@ void MergeThemeConfigs (davrods_dir_conf_t *conf_p, davrods_dir_conf_t *parent_p
 
 	DAVRODS_PROP_MERGE (theme_p -> ht_fd_save_datapackages_flag);
 
+	DAVRODS_PROP_MERGE (theme_p -> ht_fd_cache_dir_s);
+
+	DAVRODS_PROP_MERGE (theme_p -> ht_fd_sniff_headers_flag);
+
 	conf_p -> theme_p -> ht_icons_map_p = MergeAPRTables (parent_p -> theme_p -> ht_icons_map_p, child_p -> theme_p -> ht_icons_map_p, pool_p);
 
 
@@ -2143,3 +2319,30 @@ const char *SetFDDataPackageImage (cmd_parms *cmd_p, void *config_p, const char
 
 	return NULL;
 }
+
+
+const char *SetFDCacheDirectory (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	conf_p -> theme_p -> ht_fd_cache_dir_s = arg_p;
+
+	return NULL;
+}
+
+
+const char *SetFDSniffTabularHeaders (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t *) config_p;
+
+	if (strcasecmp (arg_p, "true") == 0)
+		{
+			conf_p -> theme_p -> ht_fd_sniff_headers_flag = 1;
+		}
+	else if (strcasecmp (arg_p, "false") == 0)
+		{
+			conf_p -> theme_p -> ht_fd_sniff_headers_flag = -1;
+		}
+
+	return NULL;
+}
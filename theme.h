@@ -160,6 +160,10 @@ struct HtmlTheme
 	const char *ht_fd_resource_data_package_icon_s;
 
 	int ht_fd_save_datapackages_flag;
+
+	const char *ht_fd_cache_dir_s;
+
+	int ht_fd_sniff_headers_flag;
 };
 
 
@@ -179,6 +183,9 @@ THEME_PREFIX const char THEME_HIDE_COLUMN_S [] THEME_VAL ("!");
 THEME_PREFIX const char * const CONTENT_TYPE_JSON_S THEME_VAL ("application/json");
 
 
+THEME_PREFIX const char * const CONTENT_TYPE_NDJSON_S THEME_VAL ("application/x-ndjson");
+
+
 /* forward declaration */
 struct davrods_dir_conf;
 
@@ -314,6 +321,10 @@ const char *SetFDDataPackageImage (cmd_parms *cmd_p, void *config_p, const char
 
 const char *SetSaveFDDataPackages (cmd_parms *cmd_p, void *config_p, const char *arg_p);
 
+const char *SetFDCacheDirectory (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetFDSniffTabularHeaders (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
 
 #ifdef __cplusplus
 }
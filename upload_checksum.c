@@ -0,0 +1,425 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * upload_checksum.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdbool.h>
+
+#include <openssl/evp.h>
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+
+#include "upload_checksum.h"
+
+#include "apr_strings.h"
+#include "apr_base64.h"
+
+#include "http_log.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/**
+ * iRODS stores SHA-256 checksums as this prefix followed by the
+ * base64-encoded digest and MD5 checksums as plain hex.
+ */
+static const char * const S_IRODS_SHA256_PREFIX_S = "sha2:";
+
+
+struct UploadChecksum
+{
+	request_rec *uc_req_p;
+
+	/** The digest contexts, each is NULL if it is not needed. */
+	EVP_MD_CTX *uc_md5_p;
+	EVP_MD_CTX *uc_sha256_p;
+
+	/** The base64-encoded digests that the client sent, if any. */
+	const char *uc_expected_md5_s;
+	const char *uc_expected_sha256_s;
+
+	/** The algorithm of the checksum to register with iRODS. */
+	UploadChecksumAlgorithm uc_register;
+
+	unsigned char uc_md5 [MD5_DIGEST_LENGTH];
+	unsigned char uc_sha256 [SHA256_DIGEST_LENGTH];
+
+	bool uc_finished_flag;
+};
+
+
+static EVP_MD_CTX *CreateDigest (const EVP_MD *md_p, apr_pool_t *pool_p);
+
+static apr_status_t DestroyDigest (void *data_p);
+
+static bool ParseDigestHeader (UploadChecksum *checksum_p, const char *header_s, apr_pool_t *pool_p);
+
+static void FinishUploadChecksum (UploadChecksum *checksum_p);
+
+static bool DoesDigestMatch (const unsigned char *digest_p, const int digest_length, const char *expected_s, apr_pool_t *pool_p);
+
+static char *GetIRodsChecksum (const UploadChecksum *checksum_p, apr_pool_t *pool_p);
+
+
+UploadChecksum *StartUploadChecksum (request_rec *req_p, const davrods_dir_conf_t *conf_p, apr_pool_t *pool_p)
+{
+	UploadChecksum *checksum_p = apr_pcalloc (pool_p, sizeof (UploadChecksum));
+
+	if (checksum_p)
+		{
+			const char *header_s = apr_table_get (req_p -> headers_in, "Content-MD5");
+			bool md5_flag = false;
+			bool sha256_flag = false;
+
+			checksum_p -> uc_req_p = req_p;
+			checksum_p -> uc_register = conf_p -> upload_checksum;
+
+			if (header_s)
+				{
+					checksum_p -> uc_expected_md5_s = header_s;
+				}
+
+			header_s = apr_table_get (req_p -> headers_in, "Digest");
+
+			if (header_s)
+				{
+					if (!ParseDigestHeader (checksum_p, header_s, pool_p))
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, req_p, "No supported algorithms in Digest header \"%s\"", header_s);
+						}
+				}
+
+			md5_flag = (checksum_p -> uc_expected_md5_s != NULL) || (checksum_p -> uc_register == DAVRODS_CHECKSUM_MD5);
+			sha256_flag = (checksum_p -> uc_expected_sha256_s != NULL) || (checksum_p -> uc_register == DAVRODS_CHECKSUM_SHA256);
+
+			if (md5_flag || sha256_flag)
+				{
+					if (md5_flag)
+						{
+							checksum_p -> uc_md5_p = CreateDigest (EVP_md5 (), pool_p);
+						}
+
+					if (sha256_flag)
+						{
+							checksum_p -> uc_sha256_p = CreateDigest (EVP_sha256 (), pool_p);
+						}
+
+					if (((!md5_flag) || (checksum_p -> uc_md5_p)) && ((!sha256_flag) || (checksum_p -> uc_sha256_p)))
+						{
+							return checksum_p;
+						}
+					else
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_ENOMEM, req_p, "Failed to create the checksum digests for upload to \"%s\"", req_p -> uri);
+						}
+				}
+
+		}		/* if (checksum_p) */
+
+	return NULL;
+}
+
+
+bool HasUploadChecksumHeader (request_rec *req_p)
+{
+	bool found_flag = (apr_table_get (req_p -> headers_in, "Content-MD5") != NULL);
+
+	if (!found_flag)
+		{
+			const char *header_s = apr_table_get (req_p -> headers_in, "Digest");
+
+			if (header_s)
+				{
+					UploadChecksum checksum;
+
+					memset (&checksum, 0, sizeof (UploadChecksum));
+					found_flag = ParseDigestHeader (&checksum, header_s, req_p -> pool);
+				}
+		}
+
+	return found_flag;
+}
+
+
+void UpdateUploadChecksum (UploadChecksum *checksum_p, const void *data_p, const apr_size_t length)
+{
+	if (checksum_p -> uc_md5_p)
+		{
+			EVP_DigestUpdate (checksum_p -> uc_md5_p, data_p, length);
+		}
+
+	if (checksum_p -> uc_sha256_p)
+		{
+			EVP_DigestUpdate (checksum_p -> uc_sha256_p, data_p, length);
+		}
+}
+
+
+void SkipUploadChecksumRegistration (UploadChecksum *checksum_p)
+{
+	checksum_p -> uc_register = DAVRODS_CHECKSUM_NONE;
+}
+
+
+dav_error *VerifyUploadChecksum (UploadChecksum *checksum_p, apr_pool_t *pool_p)
+{
+	dav_error *err_p = NULL;
+
+	FinishUploadChecksum (checksum_p);
+
+	if (checksum_p -> uc_expected_md5_s)
+		{
+			if (!DoesDigestMatch (checksum_p -> uc_md5, MD5_DIGEST_LENGTH, checksum_p -> uc_expected_md5_s, pool_p))
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, checksum_p -> uc_req_p, "MD5 checksum of upload to \"%s\" does not match \"%s\"",
+						checksum_p -> uc_req_p -> uri, checksum_p -> uc_expected_md5_s);
+
+					err_p = dav_new_error (pool_p, HTTP_BAD_REQUEST, 0, 0, "The uploaded data does not match the MD5 checksum sent with it");
+				}
+		}
+
+	if ((!err_p) && (checksum_p -> uc_expected_sha256_s))
+		{
+			if (!DoesDigestMatch (checksum_p -> uc_sha256, SHA256_DIGEST_LENGTH, checksum_p -> uc_expected_sha256_s, pool_p))
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, checksum_p -> uc_req_p, "SHA-256 checksum of upload to \"%s\" does not match \"%s\"",
+						checksum_p -> uc_req_p -> uri, checksum_p -> uc_expected_sha256_s);
+
+					err_p = dav_new_error (pool_p, HTTP_BAD_REQUEST, 0, 0, "The uploaded data does not match the SHA-256 checksum sent with it");
+				}
+		}
+
+	return err_p;
+}
+
+
+int RegisterUploadChecksum (UploadChecksum *checksum_p, rcComm_t *connection_p, const char *rods_path_s)
+{
+	int status = 0;
+	char *irods_checksum_s;
+
+	FinishUploadChecksum (checksum_p);
+
+	irods_checksum_s = GetIRodsChecksum (checksum_p, checksum_p -> uc_req_p -> pool);
+
+	if (irods_checksum_s)
+		{
+			dataObjInfo_t data_obj_info;
+			keyValPair_t reg_params;
+			modDataObjMeta_t mod_params;
+
+			memset (&data_obj_info, 0, sizeof (dataObjInfo_t));
+			memset (&reg_params, 0, sizeof (keyValPair_t));
+			memset (&mod_params, 0, sizeof (modDataObjMeta_t));
+
+			/*
+			 * The data object has just been created, so the replica that
+			 * we wrote is the first one.
+			 */
+			rstrcpy (data_obj_info.objPath, rods_path_s, MAX_NAME_LEN);
+			data_obj_info.replNum = 0;
+
+			addKeyVal (&reg_params, CHKSUM_KW, irods_checksum_s);
+
+			mod_params.dataObjInfo = &data_obj_info;
+			mod_params.regParam = &reg_params;
+
+			status = rcModDataObjMeta (connection_p, &mod_params);
+
+			clearKeyVal (&reg_params);
+		}
+
+	return status;
+}
+
+
+const char *SetUploadChecksum (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	if (strcasecmp (arg_p, "none") == 0)
+		{
+			conf_p -> upload_checksum = DAVRODS_CHECKSUM_NONE;
+		}
+	else if (strcasecmp (arg_p, "md5") == 0)
+		{
+			conf_p -> upload_checksum = DAVRODS_CHECKSUM_MD5;
+		}
+	else if (strcasecmp (arg_p, "sha256") == 0)
+		{
+			conf_p -> upload_checksum = DAVRODS_CHECKSUM_SHA256;
+		}
+	else
+		{
+			res_s = "The upload checksum must be one of 'none', 'md5' or 'sha256'";
+		}
+
+	return res_s;
+}
+
+
+static EVP_MD_CTX *CreateDigest (const EVP_MD *md_p, apr_pool_t *pool_p)
+{
+	EVP_MD_CTX *context_p = EVP_MD_CTX_create ();
+
+	if (context_p)
+		{
+			if (EVP_DigestInit_ex (context_p, md_p, NULL) == 1)
+				{
+					apr_pool_cleanup_register (pool_p, context_p, DestroyDigest, apr_pool_cleanup_null);
+				}
+			else
+				{
+					EVP_MD_CTX_destroy (context_p);
+					context_p = NULL;
+				}
+		}
+
+	return context_p;
+}
+
+
+static apr_status_t DestroyDigest (void *data_p)
+{
+	EVP_MD_CTX_destroy ((EVP_MD_CTX *) data_p);
+
+	return APR_SUCCESS;
+}
+
+
+/*
+ * Get the MD5 and SHA-256 values from a header such as
+ * "Digest: SHA-256=X48E9qOokqqrvdts8nOJRJN3OWDUoyWxBf7kbu9DBPE=,md5=..."
+ */
+static bool ParseDigestHeader (UploadChecksum *checksum_p, const char *header_s, apr_pool_t *pool_p)
+{
+	bool found_flag = false;
+	char *copied_header_s = apr_pstrdup (pool_p, header_s);
+
+	if (copied_header_s)
+		{
+			char *state_s = NULL;
+			char *entry_s = apr_strtok (copied_header_s, ",", &state_s);
+
+			while (entry_s)
+				{
+					char *value_s = strchr (entry_s, '=');
+
+					if (value_s)
+						{
+							char *algorithm_s = entry_s;
+
+							*value_s = '\0';
+							++ value_s;
+
+							apr_collapse_spaces (algorithm_s, algorithm_s);
+							apr_collapse_spaces (value_s, value_s);
+
+							if (strcasecmp (algorithm_s, "MD5") == 0)
+								{
+									checksum_p -> uc_expected_md5_s = value_s;
+									found_flag = true;
+								}
+							else if (strcasecmp (algorithm_s, "SHA-256") == 0)
+								{
+									checksum_p -> uc_expected_sha256_s = value_s;
+									found_flag = true;
+								}
+						}
+
+					entry_s = apr_strtok (NULL, ",", &state_s);
+				}		/* while (entry_s) */
+		}
+
+	return found_flag;
+}
+
+
+static void FinishUploadChecksum (UploadChecksum *checksum_p)
+{
+	if (!checksum_p -> uc_finished_flag)
+		{
+			if (checksum_p -> uc_md5_p)
+				{
+					EVP_DigestFinal_ex (checksum_p -> uc_md5_p, checksum_p -> uc_md5, NULL);
+				}
+
+			if (checksum_p -> uc_sha256_p)
+				{
+					EVP_DigestFinal_ex (checksum_p -> uc_sha256_p, checksum_p -> uc_sha256, NULL);
+				}
+
+			checksum_p -> uc_finished_flag = true;
+		}
+}
+
+
+static bool DoesDigestMatch (const unsigned char *digest_p, const int digest_length, const char *expected_s, apr_pool_t *pool_p)
+{
+	bool match_flag = false;
+	char *decoded_p = apr_palloc (pool_p, apr_base64_decode_len (expected_s));
+
+	if (decoded_p)
+		{
+			int decoded_length = apr_base64_decode (decoded_p, expected_s);
+
+			if ((decoded_length == digest_length) && (memcmp (decoded_p, digest_p, digest_length) == 0))
+				{
+					match_flag = true;
+				}
+		}
+
+	return match_flag;
+}
+
+
+static char *GetIRodsChecksum (const UploadChecksum *checksum_p, apr_pool_t *pool_p)
+{
+	char *irods_checksum_s = NULL;
+
+	if (checksum_p -> uc_register == DAVRODS_CHECKSUM_MD5)
+		{
+			irods_checksum_s = apr_palloc (pool_p, (2 * MD5_DIGEST_LENGTH) + 1);
+
+			if (irods_checksum_s)
+				{
+					int i;
+
+					for (i = 0; i < MD5_DIGEST_LENGTH; ++ i)
+						{
+							apr_snprintf (irods_checksum_s + (2 * i), 3, "%02x", checksum_p -> uc_md5 [i]);
+						}
+				}
+		}
+	else if (checksum_p -> uc_register == DAVRODS_CHECKSUM_SHA256)
+		{
+			char *encoded_s = apr_palloc (pool_p, apr_base64_encode_len (SHA256_DIGEST_LENGTH));
+
+			if (encoded_s)
+				{
+					apr_base64_encode (encoded_s, (const char *) checksum_p -> uc_sha256, SHA256_DIGEST_LENGTH);
+					irods_checksum_s = apr_pstrcat (pool_p, S_IRODS_SHA256_PREFIX_S, encoded_s, NULL);
+				}
+		}
+
+	return irods_checksum_s;
+}
@@ -0,0 +1,126 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * upload_checksum.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef UPLOAD_CHECKSUM_H_
+#define UPLOAD_CHECKSUM_H_
+
+#include <stdbool.h>
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "mod_dav.h"
+
+#include <irods/rodsClient.h>
+
+#include "config.h"
+
+
+/**
+ * The checksums of an upload that are calculated as its body is
+ * streamed to iRODS.
+ */
+typedef struct UploadChecksum UploadChecksum;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Start calculating the checksums for an upload.
+ *
+ * @param req_p The upload request. Any Content-MD5 or Digest headers
+ * that it has will be checked once the upload has finished.
+ * @param conf_p The configuration for the upload.
+ * @param pool_p The pool to allocate the UploadChecksum from.
+ * @return The UploadChecksum or <code>NULL</code> if there are no
+ * checksums to calculate for this upload.
+ */
+UploadChecksum *StartUploadChecksum (request_rec *req_p, const davrods_dir_conf_t *conf_p, apr_pool_t *pool_p);
+
+
+/**
+ * Check whether an upload has any checksums for its body that will be
+ * verified once it has finished.
+ *
+ * @param req_p The upload request.
+ * @return <code>true</code> if the request has a Content-MD5 header or
+ * a Digest header with a supported algorithm, <code>false</code> otherwise.
+ */
+bool HasUploadChecksumHeader (request_rec *req_p);
+
+
+/**
+ * Add the next block of the upload body to the checksums.
+ *
+ * @param checksum_p The UploadChecksum.
+ * @param data_p The data to add.
+ * @param length The length of the data in bytes.
+ */
+void UpdateUploadChecksum (UploadChecksum *checksum_p, const void *data_p, const apr_size_t length);
+
+
+/**
+ * Stop the checksum from being registered with iRODS. This is used when
+ * the body is not the complete data object, e.g. for partial updates.
+ *
+ * @param checksum_p The UploadChecksum.
+ */
+void SkipUploadChecksumRegistration (UploadChecksum *checksum_p);
+
+
+/**
+ * Check the calculated checksums against those that the client sent
+ * in the Content-MD5 and Digest request headers.
+ *
+ * @param checksum_p The UploadChecksum.
+ * @param pool_p The pool to allocate any error from.
+ * @return <code>NULL</code> if all of the checksums match, an error
+ * otherwise.
+ */
+dav_error *VerifyUploadChecksum (UploadChecksum *checksum_p, apr_pool_t *pool_p);
+
+
+/**
+ * Register the calculated checksum for a data object in the iCAT, so
+ * that iRODS doesn't need to read the data object again to calculate it.
+ *
+ * @param checksum_p The UploadChecksum.
+ * @param connection_p The connection to the iRODS server.
+ * @param rods_path_s The path of the data object.
+ * @return 0 upon success or if there was no checksum to register, a
+ * negative iRODS error code upon failure.
+ */
+int RegisterUploadChecksum (UploadChecksum *checksum_p, rcComm_t *connection_p, const char *rods_path_s);
+
+
+const char *SetUploadChecksum (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UPLOAD_CHECKSUM_H_ */
@@ -0,0 +1,439 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * vault_read.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include "vault_read.h"
+#include "repo.h"
+#include "common.h"
+
+#include "apr_strings.h"
+#include "apr_file_io.h"
+#include "apr_file_info.h"
+#include "apr_network_io.h"
+#include "apr_buckets.h"
+
+#include "http_log.h"
+
+#include "irods/rodsGenQuery.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/**
+ * The access levels that allow a user to read a data object. Both the
+ * older spaced and the newer underscored forms are used by different
+ * iRODS versions.
+ */
+static const char * const S_READ_ACCESS_NAMES_SS [] =
+{
+	"read object",
+	"read_object",
+	"read",
+	"modify object",
+	"modify_object",
+	"write",
+	"own",
+	NULL
+};
+
+
+static bool HasReadAccess (rcComm_t *connection_p, const char *collection_s, const char *name_s, apr_pool_t *pool_p);
+
+static char *GetUserAndGroupIdsCondition (rcComm_t *connection_p, apr_pool_t *pool_p);
+
+static char *GetLocalReplicaPath (rcComm_t *connection_p, const char *collection_s, const char *name_s, const rodsLong_t size, char **hosts_ss, apr_pool_t *pool_p);
+
+static bool IsLocalHost (const char *host_s, char **hosts_ss, apr_pool_t *pool_p);
+
+static bool IsReadAccessName (const char *access_s);
+
+
+
+bool DeliverFileFromVault (const dav_resource *resource_p, ap_filter_t *output_p, dav_error **err_pp)
+{
+	bool delivered_flag = false;
+	struct dav_resource_private *davrods_resource_p = (struct dav_resource_private *) resource_p -> info;
+	apr_pool_t *pool_p = resource_p -> pool;
+	const char *rods_path_s = davrods_resource_p -> rods_path;
+	const char *slash_s = strrchr (rods_path_s, '/');
+
+	/*
+	 * Paths with quotes can't be used in GenQuery conditions so let
+	 * these go through the iRODS protocol.
+	 */
+	if (slash_s && (strchr (rods_path_s, '\'') == NULL) && (davrods_resource_p -> stat))
+		{
+			rcComm_t *connection_p = davrods_resource_p -> rods_conn;
+			const char *collection_s = (slash_s == rods_path_s) ? "/" : apr_pstrndup (pool_p, rods_path_s, slash_s - rods_path_s);
+			const char *name_s = slash_s + 1;
+
+			if (HasReadAccess (connection_p, collection_s, name_s, pool_p))
+				{
+					const rodsLong_t size = davrods_resource_p -> stat -> objSize;
+					char *vault_path_s = GetLocalReplicaPath (connection_p, collection_s, name_s, size, davrods_resource_p -> conf -> local_vault_hosts_ss, pool_p);
+
+					if (vault_path_s)
+						{
+							apr_file_t *file_p = NULL;
+							apr_status_t status = apr_file_open (&file_p, vault_path_s, APR_FOPEN_READ | APR_FOPEN_BINARY | APR_FOPEN_SENDFILE_ENABLED, APR_OS_DEFAULT, pool_p);
+
+							if (status == APR_SUCCESS)
+								{
+									apr_finfo_t info;
+
+									status = apr_file_info_get (&info, APR_FINFO_SIZE, file_p);
+
+									/*
+									 * Make sure that what is on disk is what the catalog says should
+									 * be there before handing it over.
+									 */
+									if ((status == APR_SUCCESS) && (info.size == (apr_off_t) size))
+										{
+											apr_bucket_brigade *bb_p = apr_brigade_create (pool_p, output_p -> c -> bucket_alloc);
+
+											ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, davrods_resource_p -> r, "Reading <%s> directly from \"%s\"", rods_path_s, vault_path_s);
+
+											apr_brigade_insert_file (bb_p, file_p, 0, info.size, pool_p);
+											APR_BRIGADE_INSERT_TAIL (bb_p, apr_bucket_eos_create (output_p -> c -> bucket_alloc));
+
+											status = ap_pass_brigade (output_p, bb_p);
+
+											if (status != APR_SUCCESS)
+												{
+													*err_pp = dav_new_error (pool_p, HTTP_INTERNAL_SERVER_ERROR, 0, status, "Could not write contents to filter.");
+												}
+
+											delivered_flag = true;
+										}
+									else
+										{
+											ap_log_rerror (APLOG_MARK, APLOG_DEBUG, status, davrods_resource_p -> r, "Vault file \"%s\" for <%s> doesn't match the catalog, reading through iRODS", vault_path_s, rods_path_s);
+											apr_file_close (file_p);
+										}
+								}
+							else
+								{
+									ap_log_rerror (APLOG_MARK, APLOG_DEBUG, status, davrods_resource_p -> r, "Could not open vault file \"%s\" for <%s>, reading through iRODS", vault_path_s, rods_path_s);
+								}
+
+						}		/* if (vault_path_s) */
+
+				}		/* if (HasReadAccess (connection_p, collection_s, name_s, pool_p)) */
+
+		}
+
+	return delivered_flag;
+}
+
+
+const char *SetDirectVaultReads (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	if (strcasecmp (arg_p, "true") == 0)
+		{
+			conf_p -> direct_vault_reads = 1;
+		}
+	else if (strcasecmp (arg_p, "false") == 0)
+		{
+			conf_p -> direct_vault_reads = -1;
+		}
+
+	return NULL;
+}
+
+
+const char *SetLocalVaultHosts (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+	char **args_ss = NULL;
+	apr_status_t status = apr_tokenize_to_argv (arg_p, &args_ss, cmd_p -> pool);
+
+	if (status == APR_SUCCESS)
+		{
+			conf_p -> local_vault_hosts_ss = args_ss;
+		}
+	else
+		{
+			res_s = apr_psprintf (cmd_p -> pool, "Failed to tokenize \"%s\" error %d", arg_p, status);
+		}
+
+	return res_s;
+}
+
+
+/*
+ * Since the file is read by Apache rather than by the iRODS server, we
+ * have to check the data object's access list for the user and any of
+ * their groups ourselves.
+ */
+static bool HasReadAccess (rcComm_t *connection_p, const char *collection_s, const char *name_s, apr_pool_t *pool_p)
+{
+	bool access_flag = false;
+	char *ids_condition_s = GetUserAndGroupIdsCondition (connection_p, pool_p);
+
+	if (ids_condition_s)
+		{
+			genQueryInp_t query;
+			genQueryOut_t *results_p = NULL;
+			int status;
+
+			memset (&query, 0, sizeof (genQueryInp_t));
+			query.maxRows = MAX_SQL_ROWS;
+
+			if (((status = addInxIval (& (query.selectInp), COL_DATA_ACCESS_NAME, 1)) == 0) &&
+					((status = addInxVal (& (query.sqlCondInp), COL_COLL_NAME, apr_pstrcat (pool_p, "= '", collection_s, "'", NULL))) == 0) &&
+					((status = addInxVal (& (query.sqlCondInp), COL_DATA_NAME, apr_pstrcat (pool_p, "= '", name_s, "'", NULL))) == 0) &&
+					((status = addInxVal (& (query.sqlCondInp), COL_DATA_ACCESS_USER_ID, ids_condition_s)) == 0))
+				{
+					status = rcGenQuery (connection_p, &query, &results_p);
+
+					if (status == 0)
+						{
+							int i;
+
+							for (i = 0; (i < results_p -> rowCnt) && (!access_flag); ++ i)
+								{
+									access_flag = IsReadAccessName (GetGenQueryResultValue (results_p, COL_DATA_ACCESS_NAME, i));
+								}
+						}
+					else if (status != CAT_NO_ROWS_FOUND)
+						{
+							ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get the access list for %s/%s, %s", collection_s, name_s, get_rods_error_msg (status));
+						}
+
+					freeGenQueryOut (&results_p);
+				}
+
+			clearGenQueryInp (&query);
+		}
+
+	return access_flag;
+}
+
+
+/*
+ * Build an "in (...)" condition for the ids of the connected user and of
+ * all of the groups that they belong to.
+ */
+static char *GetUserAndGroupIdsCondition (rcComm_t *connection_p, apr_pool_t *pool_p)
+{
+	char *condition_s = NULL;
+	const char *username_s = connection_p -> clientUser.userName;
+	const char *zone_s = connection_p -> clientUser.rodsZone;
+
+	if ((strchr (username_s, '\'') == NULL) && (strchr (zone_s, '\'') == NULL))
+		{
+			genQueryInp_t query;
+			genQueryOut_t *results_p = NULL;
+			int status;
+
+			memset (&query, 0, sizeof (genQueryInp_t));
+			query.maxRows = MAX_SQL_ROWS;
+
+			if (((status = addInxIval (& (query.selectInp), COL_USER_ID, 1)) == 0) &&
+					((status = addInxIval (& (query.selectInp), COL_USER_GROUP_ID, 1)) == 0) &&
+					((status = addInxVal (& (query.sqlCondInp), COL_USER_NAME, apr_pstrcat (pool_p, "= '", username_s, "'", NULL))) == 0) &&
+					((status = addInxVal (& (query.sqlCondInp), COL_USER_ZONE, apr_pstrcat (pool_p, "= '", zone_s, "'", NULL))) == 0))
+				{
+					status = rcGenQuery (connection_p, &query, &results_p);
+
+					if (status == 0)
+						{
+							char **ids_ss = (char **) apr_palloc (pool_p, (1 + results_p -> rowCnt) * sizeof (char *));
+
+							if (ids_ss)
+								{
+									size_t num_ids = 0;
+									int i;
+
+									for (i = 0; i < results_p -> rowCnt; ++ i)
+										{
+											const char *value_s = GetGenQueryResultValue (results_p, COL_USER_GROUP_ID, i);
+
+											if (value_s && (*value_s != '\0'))
+												{
+													* (ids_ss + num_ids) = apr_pstrdup (pool_p, value_s);
+													++ num_ids;
+												}
+										}
+
+									/* The user's own id is a group id too */
+									* (ids_ss + num_ids) = apr_pstrdup (pool_p, GetGenQueryResultValue (results_p, COL_USER_ID, 0));
+									++ num_ids;
+
+									condition_s = GetGenQueryInCondition (ids_ss, num_ids, pool_p);
+								}
+						}
+					else if (status != CAT_NO_ROWS_FOUND)
+						{
+							ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get the group ids for %s#%s, %s", username_s, zone_s, get_rods_error_msg (status));
+						}
+
+					freeGenQueryOut (&results_p);
+				}
+
+			clearGenQueryInp (&query);
+		}
+
+	return condition_s;
+}
+
+
+/*
+ * Find the vault path of a good replica of the given size that is held
+ * on a resource on this host.
+ */
+static char *GetLocalReplicaPath (rcComm_t *connection_p, const char *collection_s, const char *name_s, const rodsLong_t size, char **hosts_ss, apr_pool_t *pool_p)
+{
+	char *path_s = NULL;
+	genQueryInp_t query;
+	genQueryOut_t *results_p = NULL;
+	int status;
+
+	memset (&query, 0, sizeof (genQueryInp_t));
+	query.maxRows = MAX_SQL_ROWS;
+
+	if (((status = addInxIval (& (query.selectInp), COL_D_DATA_PATH, 1)) == 0) &&
+			((status = addInxIval (& (query.selectInp), COL_R_LOC, 1)) == 0) &&
+			((status = addInxIval (& (query.selectInp), COL_DATA_SIZE, 1)) == 0) &&
+			((status = addInxVal (& (query.sqlCondInp), COL_COLL_NAME, apr_pstrcat (pool_p, "= '", collection_s, "'", NULL))) == 0) &&
+			((status = addInxVal (& (query.sqlCondInp), COL_DATA_NAME, apr_pstrcat (pool_p, "= '", name_s, "'", NULL))) == 0) &&
+			((status = addInxVal (& (query.sqlCondInp), COL_D_REPL_STATUS, "= '1'")) == 0))
+		{
+			status = rcGenQuery (connection_p, &query, &results_p);
+
+			if (status == 0)
+				{
+					int i;
+
+					for (i = 0; (i < results_p -> rowCnt) && (!path_s); ++ i)
+						{
+							const char *host_s = GetGenQueryResultValue (results_p, COL_R_LOC, i);
+							const char *size_s = GetGenQueryResultValue (results_p, COL_DATA_SIZE, i);
+
+							if (host_s && size_s && (apr_atoi64 (size_s) == size) && IsLocalHost (host_s, hosts_ss, pool_p))
+								{
+									const char *value_s = GetGenQueryResultValue (results_p, COL_D_DATA_PATH, i);
+
+									if (value_s && (*value_s == '/'))
+										{
+											path_s = apr_pstrdup (pool_p, value_s);
+										}
+								}
+						}
+				}
+			else if (status != CAT_NO_ROWS_FOUND)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get the replicas of %s/%s, %s", collection_s, name_s, get_rods_error_msg (status));
+				}
+
+			freeGenQueryOut (&results_p);
+		}
+
+	clearGenQueryInp (&query);
+
+	return path_s;
+}
+
+
+/*
+ * If DavRodsLocalVaultHosts is set, the resource host must be one of
+ * those. Otherwise it must match the name of this machine, allowing for
+ * one of them to be given without its domain.
+ */
+static bool IsLocalHost (const char *host_s, char **hosts_ss, apr_pool_t *pool_p)
+{
+	bool local_flag = false;
+
+	if (hosts_ss)
+		{
+			while (*hosts_ss && !local_flag)
+				{
+					if (strcasecmp (*hosts_ss, host_s) == 0)
+						{
+							local_flag = true;
+						}
+					else
+						{
+							++ hosts_ss;
+						}
+				}
+		}
+	else
+		{
+			char hostname_s [APRMAXHOSTLEN + 1];
+
+			if (strcasecmp (host_s, "localhost") == 0)
+				{
+					local_flag = true;
+				}
+			else if (apr_gethostname (hostname_s, sizeof (hostname_s), pool_p) == APR_SUCCESS)
+				{
+					if (strcasecmp (hostname_s, host_s) == 0)
+						{
+							local_flag = true;
+						}
+					else
+						{
+							const char *dot_s = strchr (hostname_s, '.');
+							const size_t short_length = dot_s ? (size_t) (dot_s - hostname_s) : strlen (hostname_s);
+							const char *host_dot_s = strchr (host_s, '.');
+							const size_t host_short_length = host_dot_s ? (size_t) (host_dot_s - host_s) : strlen (host_s);
+
+							/* Only one of the names may be missing its domain */
+							if ((!dot_s || !host_dot_s) && (short_length == host_short_length) && (strncasecmp (hostname_s, host_s, short_length) == 0))
+								{
+									local_flag = true;
+								}
+						}
+				}
+		}
+
+	return local_flag;
+}
+
+
+static bool IsReadAccessName (const char *access_s)
+{
+	bool match_flag = false;
+
+	if (access_s)
+		{
+			const char * const *name_ss = S_READ_ACCESS_NAMES_SS;
+
+			while (*name_ss && !match_flag)
+				{
+					if (strcmp (*name_ss, access_s) == 0)
+						{
+							match_flag = true;
+						}
+					else
+						{
+							++ name_ss;
+						}
+				}
+		}
+
+	return match_flag;
+}
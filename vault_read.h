@@ -0,0 +1,67 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * vault_read.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef VAULT_READ_H_
+#define VAULT_READ_H_
+
+#include <stdbool.h>
+
+#include "httpd.h"
+#include "http_config.h"
+#include "util_filter.h"
+
+#include "mod_dav.h"
+
+#include "config.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Try to send a data object to the client by reading a good replica
+ * directly from a resource vault on this host rather than through the
+ * iRODS protocol. The user's read access is checked in the catalog first.
+ *
+ * @param resource_p The resource for the data object.
+ * @param output_p The filter to send the data object to.
+ * @param err_pp If the data object was delivered but sending it to the
+ * client failed, this will be set to the error.
+ * @return <code>true</code> if the data object was delivered, <code>false</code>
+ * if it was not and should be read through the iRODS protocol instead.
+ */
+bool DeliverFileFromVault (const dav_resource *resource_p, ap_filter_t *output_p, dav_error **err_pp);
+
+
+const char *SetDirectVaultReads (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetLocalVaultHosts (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VAULT_READ_H_ */
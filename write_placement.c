@@ -0,0 +1,491 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * write_placement.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdlib.h>
+
+#include "write_placement.h"
+#include "common.h"
+
+#include "apr_strings.h"
+#include "apr_shm.h"
+#include "apr_atomic.h"
+
+#include "http_log.h"
+
+#include "irods/rodsGenQuery.h"
+#include "irods/rodsErrorTable.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/**
+ * The values shared by all of the child processes. As with the replica
+ * statistics, the free space values are updated without locking since
+ * they are only used to rank the resources.
+ */
+typedef struct WritePlacementHeader
+{
+	/** The counter used to take turns between the resources. */
+	volatile apr_uint32_t wph_next;
+
+	/** When the free space values were last refreshed. */
+	apr_time_t wph_free_space_time;
+} WritePlacementHeader;
+
+
+typedef struct WriteResourceStats
+{
+	/** 0 if the slot is free, 1 while it is being claimed and 2 once wrs_name_s is set. */
+	volatile apr_uint32_t wrs_state;
+
+	char wrs_name_s [NAME_LEN];
+
+	/** The size of the uploads currently being written from this host, in KB. */
+	volatile apr_uint32_t wrs_in_flight_kb;
+
+	/** The free space reported by the iCAT in bytes, or -1 if it is unknown. */
+	apr_int64_t wrs_free_space;
+} WriteResourceStats;
+
+
+/**
+ * An upload that is counted against a resource until its pool is
+ * cleared.
+ */
+typedef struct InFlightUpload
+{
+	WriteResourceStats *ifu_stats_p;
+
+	apr_uint32_t ifu_size_kb;
+} InFlightUpload;
+
+
+/**
+ * A write resource along with its rank for the current upload.
+ */
+typedef struct RankedResource
+{
+	const WriteResource *rr_resource_p;
+
+	double rr_score;
+} RankedResource;
+
+
+/** The maximum number of resources that values are kept for. */
+#define S_MAX_WRITE_RESOURCES (64)
+
+/** How long, in seconds, the free space values are used for before they are refreshed. */
+static const int S_FREE_SPACE_REFRESH_INTERVAL = 60;
+
+
+static apr_shm_t *s_shm_p = NULL;
+
+static WritePlacementHeader *s_header_p = NULL;
+
+static WriteResourceStats *s_stats_p = NULL;
+
+
+static WriteResourceStats *GetWriteResourceStats (const char *resource_s, const bool create_flag);
+
+static void RefreshFreeSpace (const apr_array_header_t *resources_p, rcComm_t *connection_p, apr_pool_t *pool_p);
+
+static double GetResourceScore (const WriteResource *resource_p, const WritePlacementPolicy policy);
+
+static apr_status_t RemoveInFlightUpload (void *data_p);
+
+
+
+apr_status_t InitWritePlacement (apr_pool_t *pool_p, server_rec *server_p)
+{
+	const apr_size_t size = sizeof (WritePlacementHeader) + S_MAX_WRITE_RESOURCES * sizeof (WriteResourceStats);
+	apr_status_t status = apr_shm_create (&s_shm_p, size, NULL, pool_p);
+
+	if (status == APR_ENOTIMPL)
+		{
+			/* Anonymous shared memory isn't available so use a named segment instead */
+			const char *filename_s = ap_runtime_dir_relative (pool_p, "davrods-write-placement");
+
+			apr_shm_remove (filename_s, pool_p);
+			status = apr_shm_create (&s_shm_p, size, filename_s, pool_p);
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			char *base_p = (char *) apr_shm_baseaddr_get (s_shm_p);
+
+			memset (base_p, 0, size);
+			s_header_p = (WritePlacementHeader *) base_p;
+			s_stats_p = (WriteResourceStats *) (base_p + sizeof (WritePlacementHeader));
+		}
+	else
+		{
+			ap_log_error (APLOG_MARK, APLOG_ERR, status, server_p, "Failed to create the shared memory for the write placement");
+			s_header_p = NULL;
+			s_stats_p = NULL;
+		}
+
+	return status;
+}
+
+
+apr_array_header_t *GetWriteResources (const davrods_dir_conf_t *conf_p, rcComm_t *connection_p, apr_pool_t *pool_p)
+{
+	apr_array_header_t *names_p = NULL;
+	const apr_array_header_t *resources_p = conf_p -> write_resources_p;
+
+	if (resources_p && (resources_p -> nelts > 0))
+		{
+			RankedResource *ranked_p = (RankedResource *) apr_palloc (pool_p, resources_p -> nelts * sizeof (RankedResource));
+
+			names_p = apr_array_make (pool_p, resources_p -> nelts, sizeof (const char *));
+
+			if (ranked_p && names_p)
+				{
+					const WritePlacementPolicy policy = conf_p -> write_placement_policy;
+					int total_weight = 0;
+					int start = 0;
+					int i;
+
+					for (i = 0; i < resources_p -> nelts; ++ i)
+						{
+							total_weight += APR_ARRAY_IDX (resources_p, i, WriteResource).wr_weight;
+						}
+
+					/*
+					 * Take turns between the resources in proportion to their weights. This
+					 * is the order for round-robin and is used to break ties for the other
+					 * policies so that idle resources still share the uploads.
+					 */
+					if (s_header_p && (total_weight > 0))
+						{
+							int turn = (int) (apr_atomic_inc32 (& (s_header_p -> wph_next)) % (apr_uint32_t) total_weight);
+
+							while (turn >= APR_ARRAY_IDX (resources_p, start, WriteResource).wr_weight)
+								{
+									turn -= APR_ARRAY_IDX (resources_p, start, WriteResource).wr_weight;
+									++ start;
+								}
+						}
+
+					if (policy == DAVRODS_WRITE_FREE_SPACE)
+						{
+							RefreshFreeSpace (resources_p, connection_p, pool_p);
+						}
+
+					/* A stable insertion sort keeps the round-robin order for equal scores */
+					for (i = 0; i < resources_p -> nelts; ++ i)
+						{
+							const WriteResource *resource_p = & (APR_ARRAY_IDX (resources_p, (start + i) % resources_p -> nelts, WriteResource));
+							const double score = (policy == DAVRODS_WRITE_ROUND_ROBIN) ? 0.0 : GetResourceScore (resource_p, policy);
+							int j = i;
+
+							while ((j > 0) && (ranked_p [j - 1].rr_score > score))
+								{
+									ranked_p [j] = ranked_p [j - 1];
+									-- j;
+								}
+
+							ranked_p [j].rr_resource_p = resource_p;
+							ranked_p [j].rr_score = score;
+						}
+
+					for (i = 0; i < resources_p -> nelts; ++ i)
+						{
+							APR_ARRAY_PUSH (names_p, const char *) = ranked_p [i].rr_resource_p -> wr_name_s;
+						}
+				}
+		}
+
+	return names_p;
+}
+
+
+void AddInFlightUpload (const char *resource_s, const apr_off_t num_bytes, apr_pool_t *pool_p)
+{
+	WriteResourceStats *stats_p = GetWriteResourceStats (resource_s, true);
+
+	if (stats_p)
+		{
+			InFlightUpload *upload_p = (InFlightUpload *) apr_palloc (pool_p, sizeof (InFlightUpload));
+
+			if (upload_p)
+				{
+					/* Count every upload as at least 1KB so that those of unknown size still register */
+					upload_p -> ifu_stats_p = stats_p;
+					upload_p -> ifu_size_kb = (num_bytes > 0) ? (apr_uint32_t) ((num_bytes + 1023) / 1024) : 1;
+
+					apr_atomic_add32 (& (stats_p -> wrs_in_flight_kb), upload_p -> ifu_size_kb);
+					apr_pool_cleanup_register (pool_p, upload_p, RemoveInFlightUpload, apr_pool_cleanup_null);
+				}
+		}
+}
+
+
+bool IsWriteResourceError (const int status)
+{
+	bool resource_error_flag = false;
+
+	if (status < 0)
+		{
+			/* Any errno from the resource server is added to the iRODS error code */
+			const int code = (status / 1000) * 1000;
+
+			switch (code)
+				{
+					case SYS_RESC_DOES_NOT_EXIST:
+					case SYS_RESC_IS_DOWN:
+					case SYS_INVALID_RESC_INPUT:
+					case SYS_SOCK_CONNECT_ERR:
+					case UNIX_FILE_OPEN_ERR:
+					case UNIX_FILE_CREATE_ERR:
+					case UNIX_FILE_WRITE_ERR:
+					case UNIX_FILE_MKDIR_ERR:
+						resource_error_flag = true;
+						break;
+
+					default:
+						break;
+				}
+		}
+
+	return resource_error_flag;
+}
+
+
+const char *SetWriteResources (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+	char **args_ss = NULL;
+	apr_status_t status = apr_tokenize_to_argv (arg_p, &args_ss, cmd_p -> pool);
+
+	if (status == APR_SUCCESS)
+		{
+			apr_array_header_t *resources_p = apr_array_make (cmd_p -> pool, 4, sizeof (WriteResource));
+			char **arg_ss = args_ss;
+
+			while (*arg_ss && !res_s)
+				{
+					WriteResource *resource_p = (WriteResource *) apr_array_push (resources_p);
+					char *colon_s = strrchr (*arg_ss, ':');
+
+					resource_p -> wr_name_s = *arg_ss;
+					resource_p -> wr_weight = 1;
+
+					if (colon_s)
+						{
+							*colon_s = '\0';
+							resource_p -> wr_weight = atoi (colon_s + 1);
+						}
+
+					if ((resource_p -> wr_weight <= 0) || (* (resource_p -> wr_name_s) == '\0') || (strlen (resource_p -> wr_name_s) >= NAME_LEN))
+						{
+							res_s = apr_psprintf (cmd_p -> pool, "Invalid write resource \"%s\", it must be a name with an optional positive weight e.g. resc1:2", *arg_ss);
+						}
+
+					++ arg_ss;
+				}
+
+			if (!res_s)
+				{
+					conf_p -> write_resources_p = resources_p;
+				}
+		}
+	else
+		{
+			res_s = apr_psprintf (cmd_p -> pool, "Failed to tokenize \"%s\" error %d", arg_p, status);
+		}
+
+	return res_s;
+}
+
+
+const char *SetWritePlacementPolicy (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *res_s = NULL;
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	if (strcasecmp (arg_p, "round-robin") == 0)
+		{
+			conf_p -> write_placement_policy = DAVRODS_WRITE_ROUND_ROBIN;
+		}
+	else if (strcasecmp (arg_p, "least-in-flight") == 0)
+		{
+			conf_p -> write_placement_policy = DAVRODS_WRITE_LEAST_IN_FLIGHT;
+		}
+	else if (strcasecmp (arg_p, "free-space") == 0)
+		{
+			conf_p -> write_placement_policy = DAVRODS_WRITE_FREE_SPACE;
+		}
+	else
+		{
+			res_s = "The write placement policy must be one of 'round-robin', 'least-in-flight' or 'free-space'";
+		}
+
+	return res_s;
+}
+
+
+static WriteResourceStats *GetWriteResourceStats (const char *resource_s, const bool create_flag)
+{
+	WriteResourceStats *stats_p = NULL;
+
+	if (s_stats_p && resource_s && (strlen (resource_s) < NAME_LEN))
+		{
+			int i;
+
+			for (i = 0; (i < S_MAX_WRITE_RESOURCES) && (!stats_p); ++ i)
+				{
+					WriteResourceStats *slot_p = s_stats_p + i;
+
+					if ((apr_atomic_read32 (&slot_p -> wrs_state) == 2) && (strcmp (slot_p -> wrs_name_s, resource_s) == 0))
+						{
+							stats_p = slot_p;
+						}
+				}
+
+			if (!stats_p && create_flag)
+				{
+					for (i = 0; (i < S_MAX_WRITE_RESOURCES) && (!stats_p); ++ i)
+						{
+							WriteResourceStats *slot_p = s_stats_p + i;
+
+							if (apr_atomic_cas32 (&slot_p -> wrs_state, 1, 0) == 0)
+								{
+									strcpy (slot_p -> wrs_name_s, resource_s);
+									slot_p -> wrs_free_space = -1;
+									apr_atomic_set32 (&slot_p -> wrs_state, 2);
+									stats_p = slot_p;
+								}
+						}
+				}
+		}
+
+	return stats_p;
+}
+
+
+/*
+ * Get the free space of the write resources from the iCAT if the stored
+ * values are out of date.
+ */
+static void RefreshFreeSpace (const apr_array_header_t *resources_p, rcComm_t *connection_p, apr_pool_t *pool_p)
+{
+	const apr_time_t now = apr_time_now ();
+
+	if (s_header_p && (now - s_header_p -> wph_free_space_time >= apr_time_from_sec (S_FREE_SPACE_REFRESH_INTERVAL)))
+		{
+			char **names_ss = (char **) apr_palloc (pool_p, resources_p -> nelts * sizeof (char *));
+
+			/* Stop other requests from refreshing at the same time */
+			s_header_p -> wph_free_space_time = now;
+
+			if (names_ss)
+				{
+					genQueryInp_t query;
+					genQueryOut_t *results_p = NULL;
+					int status;
+					int i;
+
+					for (i = 0; i < resources_p -> nelts; ++ i)
+						{
+							names_ss [i] = (char *) APR_ARRAY_IDX (resources_p, i, WriteResource).wr_name_s;
+						}
+
+					memset (&query, 0, sizeof (genQueryInp_t));
+					query.maxRows = MAX_SQL_ROWS;
+
+					if (((status = addInxIval (& (query.selectInp), COL_R_RESC_NAME, 1)) == 0) &&
+							((status = addInxIval (& (query.selectInp), COL_R_FREE_SPACE, 1)) == 0) &&
+							((status = addInxVal (& (query.sqlCondInp), COL_R_RESC_NAME, GetGenQueryInCondition (names_ss, resources_p -> nelts, pool_p))) == 0))
+						{
+							status = rcGenQuery (connection_p, &query, &results_p);
+
+							if (status == 0)
+								{
+									for (i = 0; i < results_p -> rowCnt; ++ i)
+										{
+											WriteResourceStats *stats_p = GetWriteResourceStats (GetGenQueryResultValue (results_p, COL_R_RESC_NAME, i), true);
+
+											if (stats_p)
+												{
+													const char *free_space_s = GetGenQueryResultValue (results_p, COL_R_FREE_SPACE, i);
+
+													stats_p -> wrs_free_space = (free_space_s && (*free_space_s != '\0')) ? apr_atoi64 (free_space_s) : -1;
+												}
+										}
+								}
+							else if (status != CAT_NO_ROWS_FOUND)
+								{
+									ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get the free space of the write resources, %s", get_rods_error_msg (status));
+								}
+
+							freeGenQueryOut (&results_p);
+						}
+
+					clearGenQueryInp (&query);
+				}
+		}
+}
+
+
+/*
+ * Lower scores are better. Resources whose free space is unknown are put
+ * after all of those whose free space is known.
+ */
+static double GetResourceScore (const WriteResource *resource_p, const WritePlacementPolicy policy)
+{
+	double score = 0.0;
+	WriteResourceStats *stats_p = GetWriteResourceStats (resource_p -> wr_name_s, false);
+
+	if (policy == DAVRODS_WRITE_LEAST_IN_FLIGHT)
+		{
+			if (stats_p)
+				{
+					score = ((double) apr_atomic_read32 (& (stats_p -> wrs_in_flight_kb))) / resource_p -> wr_weight;
+				}
+		}
+	else if (policy == DAVRODS_WRITE_FREE_SPACE)
+		{
+			if (stats_p && (stats_p -> wrs_free_space >= 0))
+				{
+					score = - ((double) stats_p -> wrs_free_space) * resource_p -> wr_weight;
+				}
+			else
+				{
+					score = 1.0;
+				}
+		}
+
+	return score;
+}
+
+
+static apr_status_t RemoveInFlightUpload (void *data_p)
+{
+	InFlightUpload *upload_p = (InFlightUpload *) data_p;
+
+	apr_atomic_sub32 (& (upload_p -> ifu_stats_p -> wrs_in_flight_kb), upload_p -> ifu_size_kb);
+
+	return APR_SUCCESS;
+}
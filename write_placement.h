@@ -0,0 +1,116 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * write_placement.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef WRITE_PLACEMENT_H_
+#define WRITE_PLACEMENT_H_
+
+#include <stdbool.h>
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "apr_pools.h"
+#include "apr_tables.h"
+
+#include "irods/rcConnect.h"
+
+#include "config.h"
+
+
+/**
+ * A resource that new data objects can be written to.
+ */
+typedef struct WriteResource
+{
+	const char *wr_name_s;
+
+	/** The relative share of the uploads that this resource should get. */
+	int wr_weight;
+} WriteResource;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create the shared memory that holds the upload counts and free space
+ * for each write resource. This is called from the post_config hook so
+ * that every child process shares the same values.
+ *
+ * @param pool_p The configuration pool.
+ * @param server_p The server.
+ * @return APR_SUCCESS upon success, an error code otherwise.
+ */
+apr_status_t InitWritePlacement (apr_pool_t *pool_p, server_rec *server_p);
+
+
+/**
+ * Get the resources set with DavRodsWriteResources in the order that
+ * they should be tried for a new data object.
+ *
+ * @param conf_p The module configuration.
+ * @param connection_p The connection to the iRODS server, used to
+ * refresh the free space of the resources if needed.
+ * @param pool_p The pool to use for any allocations.
+ * @return An array of the resource names or <code>NULL</code> if no
+ * write resources are configured.
+ */
+apr_array_header_t *GetWriteResources (const davrods_dir_conf_t *conf_p, rcComm_t *connection_p, apr_pool_t *pool_p);
+
+
+/**
+ * Count an upload as being in flight to a resource until the given pool
+ * is cleared.
+ *
+ * @param resource_s The name of the resource.
+ * @param num_bytes The expected size of the upload in bytes.
+ * @param pool_p The pool whose lifetime matches the upload.
+ */
+void AddInFlightUpload (const char *resource_s, const apr_off_t num_bytes, apr_pool_t *pool_p);
+
+
+/**
+ * Check whether an error from creating a data object was caused by the
+ * resource that it was created on, so that the next write resource is
+ * worth trying. Errors such as permissions, the data object already
+ * existing or quotas would be the same on any resource.
+ *
+ * @param status The iRODS error code.
+ * @return <code>true</code> if the error was down to the resource,
+ * <code>false</code> otherwise.
+ */
+bool IsWriteResourceError (const int status);
+
+
+const char *SetWriteResources (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetWritePlacementPolicy (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WRITE_PLACEMENT_H_ */